@@ -0,0 +1,151 @@
+#include "compression.h"
+
+#include <memory>
+
+#include <numeric>
+
+#include <lz4.h>
+#include <zdict.h>
+#include <zstd.h>
+
+namespace {
+    /// Fast enough to not show up next to the socket writes, and still does well on text
+    constexpr auto zstd_level = 1;
+
+    /// Creating a zstd context isn't free, so every thread keeps one around
+    ZSTD_CCtx *compression_context() {
+        thread_local auto context = std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)>(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        return context.get();
+    }
+
+    ZSTD_DCtx *decompression_context() {
+        thread_local auto context = std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)>(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        return context.get();
+    }
+}
+
+ca::codec ca::negotiate_codec(std::uint8_t ours, std::uint8_t theirs) noexcept {
+    const auto common = ours & theirs;
+
+    // zstd gets a better ratio on chat text, lz4 is there for whoever only has that
+    if (common & codec_bit(codec::zstd))
+        return ca::codec::zstd;
+    if (common & codec_bit(codec::lz4))
+        return ca::codec::lz4;
+    return ca::codec::none;
+}
+
+std::vector<std::byte> ca::compress(ca::codec codec, std::span<const std::byte> data) {
+    auto compressed = std::vector<std::byte>();
+
+    switch (codec) {
+        case codec::none:
+        case codec::zstd_dictionary: // Needs the dictionary, see ca::dictionary::compress
+            break;
+        case codec::lz4: {
+            if (data.size() > LZ4_MAX_INPUT_SIZE)
+                break;
+
+            compressed.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(data.size()))));
+            const auto size = LZ4_compress_default(reinterpret_cast<const char *>(data.data()),
+                                                   reinterpret_cast<char *>(compressed.data()),
+                                                   static_cast<int>(data.size()), static_cast<int>(compressed.size()));
+            compressed.resize(size > 0 ? static_cast<size_t>(size) : 0);
+            break;
+        }
+        case codec::zstd: {
+            compressed.resize(ZSTD_compressBound(data.size()));
+            const auto size = ZSTD_compressCCtx(compression_context(), compressed.data(), compressed.size(),
+                                                data.data(), data.size(), zstd_level);
+            compressed.resize(ZSTD_isError(size) ? 0 : size);
+            break;
+        }
+    }
+    return compressed;
+}
+
+bool ca::decompress(ca::codec codec, std::span<const std::byte> data, std::span<char> content) {
+    if (content.size() > max_decompressed_size)
+        return false;
+
+    switch (codec) {
+        case codec::none:
+        case codec::zstd_dictionary: // Needs the dictionary, see ca::dictionary::decompress
+            return false;
+        case codec::lz4: {
+            const auto size = LZ4_decompress_safe(reinterpret_cast<const char *>(data.data()), content.data(),
+                                                  static_cast<int>(data.size()), static_cast<int>(content.size()));
+            return size >= 0 && static_cast<size_t>(size) == content.size();
+        }
+        case codec::zstd: {
+            const auto size = ZSTD_decompressDCtx(decompression_context(), content.data(), content.size(),
+                                                  data.data(), data.size());
+            return !ZSTD_isError(size) && size == content.size();
+        }
+    }
+    return false;
+}
+
+ca::dictionary::dictionary(std::uint32_t version, std::vector<std::byte> content) : _version(version),
+                                                                                  _content(std::move(content)) {
+    _compress = ZSTD_createCDict(_content.data(), _content.size(), zstd_level);
+    _decompress = ZSTD_createDDict(_content.data(), _content.size());
+}
+
+ca::dictionary::~dictionary() {
+    ZSTD_freeCDict(_compress);
+    ZSTD_freeDDict(_decompress);
+}
+
+std::vector<std::byte> ca::dictionary::compress(std::span<const std::byte> data) const {
+    const auto context = compression_context();
+    ZSTD_CCtx_reset(context, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_refCDict(context, _compress);
+
+    // Every byte counts on short messages, the size and the dictionary are already known on the other side
+    ZSTD_CCtx_setParameter(context, ZSTD_c_contentSizeFlag, 0);
+    ZSTD_CCtx_setParameter(context, ZSTD_c_dictIDFlag, 0);
+
+    auto compressed = std::vector<std::byte>(ZSTD_compressBound(data.size()));
+    const auto size = ZSTD_compress2(context, compressed.data(), compressed.size(), data.data(), data.size());
+
+    // Leave the context the way the plain zstd compression expects it
+    ZSTD_CCtx_reset(context, ZSTD_reset_session_and_parameters);
+
+    compressed.resize(ZSTD_isError(size) ? 0 : size);
+    return compressed;
+}
+
+bool ca::dictionary::decompress(std::span<const std::byte> data, std::span<char> content) const {
+    if (content.size() > max_decompressed_size)
+        return false;
+
+    const auto size = ZSTD_decompress_usingDDict(decompression_context(), content.data(), content.size(),
+                                                 data.data(), data.size(), _decompress);
+    return !ZSTD_isError(size) && size == content.size();
+}
+
+std::shared_ptr<const ca::dictionary> ca::train_dictionary(std::uint32_t version,
+                                                           const std::vector<std::string_view> &samples, size_t size) {
+    // zdict wants every sample back to back, with a separate list of their sizes
+    auto buffer = std::string();
+    buffer.reserve(std::accumulate(samples.begin(), samples.end(), size_t(0),
+                                   [](size_t total, std::string_view sample) { return total + sample.size(); }));
+
+    auto sizes = std::vector<size_t>();
+    sizes.reserve(samples.size());
+    for (const auto &sample : samples) {
+        buffer += sample;
+        sizes.push_back(sample.size());
+    }
+
+    auto content = std::vector<std::byte>(size);
+    const auto trained = ZDICT_trainFromBuffer(content.data(), content.size(), buffer.data(), sizes.data(),
+                                               static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(trained))
+        return nullptr;
+
+    content.resize(trained);
+    auto dictionary = std::make_shared<const ca::dictionary>(version, std::move(content));
+    return dictionary->valid() ? dictionary : nullptr;
+}
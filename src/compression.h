@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace ca {
+    /// Compression algorithms for message content, picked per connection when connecting
+    enum class codec : std::uint8_t {
+        none = 0,
+        lz4 = 1,
+        zstd = 2,
+        zstd_dictionary = 3 // zstd with a dictionary the relay trained, only used for small messages
+    };
+
+    /// \return The bit for a codec in a codec mask, as sent in the hello packet
+    [[nodiscard]] constexpr std::uint8_t codec_bit(ca::codec codec) noexcept {
+        return std::uint8_t(1u << std::uint8_t(codec));
+    }
+
+    /// Every codec this build can compress and decompress
+    constexpr auto supported_codecs = std::uint8_t(codec_bit(codec::lz4) | codec_bit(codec::zstd) |
+                                                   codec_bit(codec::zstd_dictionary));
+
+    /// Content smaller than this is too small for the general purpose codecs, it's only compressed with a dictionary
+    constexpr auto compression_threshold = size_t(256);
+
+    /// Content smaller than this isn't compressed at all, not even with a dictionary
+    constexpr auto dictionary_threshold = size_t(16);
+
+    /// Dictionaries bigger than this are refused, what gets trained is a lot smaller
+    constexpr auto max_dictionary_size = size_t(1024 * 1024);
+
+    /// Refuse to decompress anything bigger than this, so a tiny packet can't make us allocate gigabytes
+    constexpr auto max_decompressed_size = size_t(64 * 1024 * 1024);
+
+    /// Picks the codec to use for sending, the best one that both sides support
+    /// \param ours The codecs we support
+    /// \param theirs The codecs the other side announced
+    /// \return The codec, none if there's nothing in common
+    [[nodiscard]] ca::codec negotiate_codec(std::uint8_t ours, std::uint8_t theirs) noexcept;
+
+    /// A zstd dictionary trained on recent chat messages. One message at a time is too little data for zstd to find
+    /// anything to reuse, with a dictionary of what chat messages usually look like short messages shrink a lot
+    class dictionary {
+    public:
+        /// \param version Identifies the dictionary, sent along with everything compressed with it
+        /// \param content The trained dictionary
+        dictionary(std::uint32_t version, std::vector<std::byte> content);
+
+        ~dictionary();
+
+        dictionary(const dictionary &) = delete;
+        dictionary &operator=(const dictionary &) = delete;
+
+        [[nodiscard]] std::uint32_t version() const noexcept { return _version; }
+
+        /// \return The dictionary as it's sent over the wire
+        [[nodiscard]] const std::vector<std::byte> &content() const noexcept { return _content; }
+
+        /// If the content was usable as a dictionary, check this after creating one
+        /// \return true if compressing / decompressing works
+        [[nodiscard]] bool valid() const noexcept { return _compress != nullptr && _decompress != nullptr; }
+
+        /// Compresses a block of data with the dictionary
+        /// \param data The data to compress
+        /// \return The compressed data, empty if it couldn't be compressed
+        [[nodiscard]] std::vector<std::byte> compress(std::span<const std::byte> data) const;
+
+        /// Decompresses a block created by #compress with the same dictionary
+        /// \param data The compressed data
+        /// \param content Where the original data goes, exactly as big as it was before it was compressed
+        /// \return false if it's corrupt
+        [[nodiscard]] bool decompress(std::span<const std::byte> data, std::span<char> content) const;
+
+    private:
+        std::uint32_t _version;
+        std::vector<std::byte> _content;
+
+        // Digested versions of the dictionary, so it isn't processed again for every message
+        ZSTD_CDict_s *_compress = nullptr;
+        ZSTD_DDict_s *_decompress = nullptr;
+    };
+
+    /// Trains a dictionary, this takes a while (tens of milliseconds for a few thousand messages)
+    /// \param version The version the new dictionary gets
+    /// \param samples Messages that are typical for what's going to be compressed
+    /// \param size How big the dictionary can get
+    /// \return The dictionary, nullptr if there weren't enough samples to train one
+    [[nodiscard]] std::shared_ptr<const ca::dictionary> train_dictionary(std::uint32_t version,
+                                                                         const std::vector<std::string_view> &samples,
+                                                                         size_t size);
+
+    /// Compresses a block of data
+    /// \param codec The algorithm to use (lz4 or zstd)
+    /// \param data The data to compress
+    /// \return The compressed data, empty if it couldn't be compressed
+    [[nodiscard]] std::vector<std::byte> compress(ca::codec codec, std::span<const std::byte> data);
+
+    /// Decompresses a block created by #compress, straight into memory the caller provides
+    /// \param codec The algorithm it was compressed with
+    /// \param data The compressed data
+    /// \param content Where the original data goes, exactly as big as it was before it was compressed
+    /// \return false if it's corrupt
+    [[nodiscard]] bool decompress(ca::codec codec, std::span<const std::byte> data, std::span<char> content);
+}
@@ -0,0 +1,98 @@
+#include "content_hash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace {
+    constexpr auto prime1 = std::uint64_t(0x9E3779B185EBCA87);
+    constexpr auto prime2 = std::uint64_t(0xC2B2AE3D27D4EB4F);
+    constexpr auto prime3 = std::uint64_t(0x165667B19E3779F9);
+    constexpr auto prime4 = std::uint64_t(0x85EBCA77C2B2AE63);
+    constexpr auto prime5 = std::uint64_t(0x27D4EB2F165667C5);
+
+    /// Little endian on every platform, compilers turn this into a single load where they can
+    template <typename T>
+    T read(const std::byte *data) noexcept {
+        auto value = T(0);
+        for (auto i = size_t(0); i < sizeof(T); i++)
+            value |= T(std::to_integer<std::uint8_t>(data[i])) << (8 * i);
+        return value;
+    }
+
+    std::uint64_t round(std::uint64_t accumulator, std::uint64_t input) noexcept {
+        accumulator += input * prime2;
+        return std::rotl(accumulator, 31) * prime1;
+    }
+
+    std::uint64_t merge(std::uint64_t hash, std::uint64_t accumulator) noexcept {
+        hash ^= round(0, accumulator);
+        return hash * prime1 + prime4;
+    }
+}
+
+ca::content_hash::content_hash() noexcept
+        : _accumulators({prime1 + prime2, prime2, 0, std::uint64_t(0) - prime1}) {}
+
+void ca::content_hash::update(std::span<const std::byte> data) noexcept {
+    _size += data.size();
+
+    // Top up a stripe left over from the last update first
+    if (_pending_size > 0) {
+        const auto taken = std::min(data.size(), _pending.size() - _pending_size);
+        std::memcpy(_pending.data() + _pending_size, data.data(), taken);
+        _pending_size += taken;
+        data = data.subspan(taken);
+
+        if (_pending_size < _pending.size())
+            return;
+        _stripe(_pending.data());
+        _pending_size = 0;
+    }
+
+    for (; data.size() >= _pending.size(); data = data.subspan(_pending.size()))
+        _stripe(data.data());
+
+    std::memcpy(_pending.data(), data.data(), data.size());
+    _pending_size = data.size();
+}
+
+std::uint64_t ca::content_hash::digest() const noexcept {
+    auto hash = std::uint64_t();
+    if (_size >= _pending.size()) {
+        const auto &[v1, v2, v3, v4] = _accumulators;
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        for (const auto accumulator : _accumulators)
+            hash = merge(hash, accumulator);
+    } else
+        hash = prime5;
+
+    hash += _size;
+
+    auto position = size_t(0);
+    for (; position + 8 <= _pending_size; position += 8) {
+        hash ^= round(0, read<std::uint64_t>(_pending.data() + position));
+        hash = std::rotl(hash, 27) * prime1 + prime4;
+    }
+    if (position + 4 <= _pending_size) {
+        hash ^= read<std::uint32_t>(_pending.data() + position) * prime1;
+        hash = std::rotl(hash, 23) * prime2 + prime3;
+        position += 4;
+    }
+    for (; position < _pending_size; position++) {
+        hash ^= std::to_integer<std::uint8_t>(_pending[position]) * prime5;
+        hash = std::rotl(hash, 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+void ca::content_hash::_stripe(const std::byte *data) noexcept {
+    for (auto i = size_t(0); i < _accumulators.size(); i++)
+        _accumulators[i] = round(_accumulators[i], read<std::uint64_t>(data + 8 * i));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace ca {
+    /// XXH64 of a stream of bytes, fed a piece at a time so a file never has to be in memory all at once. It's fast
+    /// enough to keep up with the network (several GB/s) and catches corruption, but it's no protection against
+    /// someone crafting content on purpose
+    class content_hash {
+    public:
+        content_hash() noexcept;
+
+        /// Hashes the next part of the stream
+        /// \param data The bytes following what's been hashed so far
+        void update(std::span<const std::byte> data) noexcept;
+
+        /// \return The hash of everything so far, more can still be added afterwards
+        [[nodiscard]] std::uint64_t digest() const noexcept;
+
+        /// \return How many bytes have been hashed
+        [[nodiscard]] std::uint64_t size() const noexcept { return _size; }
+
+    private:
+        /// Internal function: Mixes a full 32 byte stripe into the accumulators
+        void _stripe(const std::byte *data) noexcept;
+
+        std::array<std::uint64_t, 4> _accumulators;
+        std::array<std::byte, 32> _pending = {}; // The start of a stripe that hasn't been filled yet
+        size_t _pending_size = 0;
+        std::uint64_t _size = 0;
+    };
+}
@@ -0,0 +1,270 @@
+#include "content_store.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace {
+    /// How much is copied per update, the connection is still serviced in between
+    constexpr auto copy_slice_size = std::uint64_t(4 * 1024 * 1024);
+
+    /// Content copied in is named like this until it's been checked, leftovers are removed on startup
+    constexpr auto temporary_suffix = std::string_view(".tmp");
+
+    /// Reads and writes through a buffer, where the kernel can't copy by itself
+    std::int64_t copy_buffered(int source, int destination, std::uint64_t offset, std::uint64_t size,
+                               ca::content_hash *hash) {
+        auto buffer = std::vector<std::byte>(std::min<std::uint64_t>(size, 256 * 1024));
+        auto copied = std::uint64_t(0);
+        while (copied < size) {
+            const auto read = ::pread(source, buffer.data(), std::min<std::uint64_t>(buffer.size(), size - copied),
+                                      static_cast<off_t>(offset + copied));
+            if (read < 0 && errno == EINTR)
+                continue;
+            if (read < 0)
+                return -1;
+            if (read == 0)
+                break;
+
+            if (hash)
+                hash->update(std::span(buffer.data(), static_cast<size_t>(read)));
+            for (auto written = size_t(0); written < static_cast<size_t>(read);) {
+                const auto result = ::pwrite(destination, buffer.data() + written, static_cast<size_t>(read) - written,
+                                             static_cast<off_t>(offset + copied + written));
+                if (result < 0 && errno == EINTR)
+                    continue;
+                if (result <= 0)
+                    return -1;
+                written += static_cast<size_t>(result);
+            }
+            copied += static_cast<std::uint64_t>(read);
+        }
+        return static_cast<std::int64_t>(copied);
+    }
+}
+
+ca::content_store::content_store(ca::store_settings settings) : _settings(std::move(settings)) {
+    ::mkdir(_settings.directory.c_str(), 0755);
+
+    // Whatever is already there, most recently used first
+    auto found = std::vector<std::pair<std::int64_t, key>>();
+    if (auto directory = ::opendir(_settings.directory.c_str())) {
+        while (const auto item = ::readdir(directory)) {
+            const auto name = std::string_view(item->d_name);
+            const auto path = _settings.directory + "/" + item->d_name;
+            if (name.size() > temporary_suffix.size() && name.ends_with(temporary_suffix)) {
+                ::unlink(path.c_str());
+                continue;
+            }
+
+            auto content = key();
+            auto length = 0;
+            struct stat status = {};
+            const auto parsed = std::sscanf(item->d_name, "%16" SCNx64 "-%" SCNu64 "%n", &content.first,
+                                            &content.second, &length);
+            if (parsed != 2 || static_cast<size_t>(length) != name.size() || ::stat(path.c_str(), &status) != 0 ||
+                !S_ISREG(status.st_mode) || static_cast<std::uint64_t>(status.st_size) != content.second)
+                continue;
+            found.emplace_back(status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec, content);
+        }
+        ::closedir(directory);
+    }
+
+    std::sort(found.begin(), found.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+    for (const auto &[time, content] : found) {
+        _index.emplace(content, _entries.insert(_entries.end(), content));
+        _size += content.second;
+    }
+
+    // The limit could have been lowered since
+    _evict();
+}
+
+ca::content_store::~content_store() {
+    for (auto &job : _copies) {
+        ::close(job.destination);
+        if (!job.temporary.empty())
+            ::unlink(job.temporary.c_str());
+    }
+}
+
+bool ca::content_store::contains(std::uint64_t hash, std::uint64_t size) const {
+    return _index.contains(key(hash, size));
+}
+
+void ca::content_store::copy_out(std::uint64_t hash, std::uint64_t size, int fd, std::function<void(bool)> done) {
+    const auto content = key(hash, size);
+    auto source = _index.contains(content) ? ca::shared_file::open(_path(content)) : nullptr;
+
+    // Removed from under us, it isn't kept anymore
+    if (!source || source->size() != size) {
+        if (const auto it = _index.find(content); it != _index.end()) {
+            _entries.erase(it->second);
+            _index.erase(it);
+            _size -= size;
+        }
+        ::close(fd);
+        done(false);
+        return;
+    }
+
+    _touch(content);
+    _copies.push_back({.source = std::move(source), .destination = fd, .done = std::move(done), .content = content});
+}
+
+void ca::content_store::keep(std::uint64_t hash, std::shared_ptr<const ca::shared_file> file) {
+    const auto content = key(hash, file->size());
+    if (_index.contains(content)) {
+        _touch(content);
+        return;
+    }
+
+    const auto pending = std::any_of(_copies.begin(), _copies.end(), [&content](const auto &job) {
+        return !job.temporary.empty() && job.content == content;
+    });
+    if (pending || content.second > _settings.max_bytes)
+        return;
+
+    auto temporary = _path(content) + std::string(temporary_suffix);
+    const auto fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    _copies.push_back({.source = std::move(file), .destination = fd, .temporary = std::move(temporary),
+                       .content = content});
+}
+
+void ca::content_store::keep_verified(std::uint64_t hash, std::uint64_t size, const std::string &path) {
+    const auto content = key(hash, size);
+    if (_index.contains(content)) {
+        _touch(content);
+        return;
+    }
+
+    const auto pending = std::any_of(_copies.begin(), _copies.end(), [&content](const auto &job) {
+        return !job.temporary.empty() && job.content == content;
+    });
+    if (pending || content.second > _settings.max_bytes)
+        return;
+
+#ifdef __linux__
+    const auto destination = _path(content);
+    const auto temporary = destination + std::string(temporary_suffix);
+    const auto source = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    const auto clone = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    const auto cloned = source >= 0 && clone >= 0 && ::ioctl(clone, FICLONE, source) == 0;
+    if (source >= 0)
+        ::close(source);
+    if (clone >= 0)
+        ::close(clone);
+    if (cloned && ::rename(temporary.c_str(), destination.c_str()) == 0) {
+        _add(content);
+        return;
+    }
+    ::unlink(temporary.c_str());
+#endif
+
+    // Without a clone of its own it's copied and hashed again, the download could be changed before the copy is done
+    if (auto file = ca::shared_file::open(path))
+        keep(hash, std::move(file));
+}
+
+bool ca::content_store::update() {
+    auto budget = copy_slice_size;
+    while (!_copies.empty() && budget > 0) {
+        auto &job = _copies.front();
+        const auto copied = _copy_slice(job, budget);
+        if (copied < 0 || (copied == 0 && job.offset < job.source->size())) {
+            _finish(job, false);
+            _copies.pop_front();
+            continue;
+        }
+
+        job.offset += static_cast<std::uint64_t>(copied);
+        budget -= std::min(budget, static_cast<std::uint64_t>(copied));
+        if (job.offset == job.source->size()) {
+            _finish(job, true);
+            _copies.pop_front();
+        }
+    }
+    return !_copies.empty();
+}
+
+std::int64_t ca::content_store::_copy_slice(copy &job, std::uint64_t limit) {
+    const auto size = std::min(limit, job.source->size() - job.offset);
+
+    // Going in it's hashed, so it has to pass through here anyway
+    if (!job.temporary.empty())
+        return copy_buffered(job.source->fd(), job.destination, job.offset, size, &job.hash);
+
+#ifdef __linux__
+    auto in = static_cast<off_t>(job.offset);
+    auto out = static_cast<off_t>(job.offset);
+    const auto copied = ::copy_file_range(job.source->fd(), &in, job.destination, &out, size, 0);
+    if (copied >= 0 || (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP))
+        return copied;
+#endif
+    return copy_buffered(job.source->fd(), job.destination, job.offset, size, nullptr);
+}
+
+void ca::content_store::_finish(copy &job, bool copied) {
+    ::close(job.destination);
+
+    if (job.temporary.empty()) {
+        job.done(copied);
+        return;
+    }
+
+    // It changed since it was hashed, it's no use under this hash
+    if (!copied || job.hash.digest() != job.content.first ||
+        ::rename(job.temporary.c_str(), _path(job.content).c_str()) != 0) {
+        ::unlink(job.temporary.c_str());
+        return;
+    }
+    _add(job.content);
+}
+
+void ca::content_store::_add(key content) {
+    _index.emplace(content, _entries.insert(_entries.begin(), content));
+    _size += content.second;
+    _evict();
+}
+
+void ca::content_store::_evict() {
+    // A copy still going out of evicted content keeps reading it, it's only gone once that's closed
+    while (_size > _settings.max_bytes && _entries.size() > 1) {
+        const auto oldest = _entries.back();
+        ::unlink(_path(oldest).c_str());
+        _index.erase(oldest);
+        _entries.pop_back();
+        _size -= oldest.second;
+    }
+}
+
+void ca::content_store::_touch(key content) {
+    const auto it = _index.find(content);
+    if (it == _index.end())
+        return;
+
+    _entries.splice(_entries.begin(), _entries, it->second);
+    ::utimensat(AT_FDCWD, _path(content).c_str(), nullptr, 0);
+}
+
+std::string ca::content_store::_path(key content) const {
+    auto name = std::array<char, 64>();
+    std::snprintf(name.data(), name.size(), "%016" PRIx64 "-%" PRIu64, content.first, content.second);
+    return _settings.directory + "/" + name.data();
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <content_hash.h>
+#include <shared_file.h>
+
+namespace ca {
+    /// Where the content of sent and received files is kept, and how much of it
+    struct store_settings {
+        std::string directory = "attachments";
+        std::uint64_t max_bytes = std::uint64_t(1024) * 1024 * 1024; // The least recently used content goes past this
+    };
+
+    /// The content of every file sent or received, named after its content hash, so the same content offered again is
+    /// answered from here without any of it crossing the wire. Past the size limit the least recently used content is
+    /// evicted, when it was last used is the file's modification time so it survives restarts.
+    /// Copies are made a slice per #update so they don't hold up the connection, content going in is hashed on the
+    /// way and only kept if it still matches (the file could have changed since it was sent), content going out is
+    /// copied by the kernel (copy_file_range, which shares the blocks on filesystems that can). A download that was
+    /// only just verified is cloned in at once instead, where the filesystem can
+    class content_store {
+    public:
+        /// \param settings Where the content is kept (created if it doesn't exist), and how much of it
+        explicit content_store(ca::store_settings settings);
+
+        ~content_store();
+
+        content_store(const content_store &) = delete;
+        content_store &operator=(const content_store &) = delete;
+
+        /// \param hash The content hash
+        /// \param size The content size
+        /// \return If the content is kept here
+        [[nodiscard]] bool contains(std::uint64_t hash, std::uint64_t size) const;
+
+        /// Copies kept content to a file, it counts as used
+        /// \param hash The content hash
+        /// \param size The content size
+        /// \param fd The file to copy to, it's closed once the copy is done
+        /// \param done Called from #update with whether the content was copied
+        void copy_out(std::uint64_t hash, std::uint64_t size, int fd, std::function<void(bool)> done);
+
+        /// Keeps the content of a file, unless it's kept already (it counts as used then) or it's bigger than the
+        /// whole store
+        /// \param hash The file's content hash
+        /// \param file The file, it's read as it's copied
+        void keep(std::uint64_t hash, std::shared_ptr<const ca::shared_file> file);
+
+        /// Keeps the content of a file that's just been checked against its hash, without reading it again where the
+        /// filesystem can clone it (the blocks are shared until either side changes them), otherwise it's copied and
+        /// hashed like #keep does
+        /// \param hash The file's content hash
+        /// \param size The file's size
+        /// \param path The file
+        void keep_verified(std::uint64_t hash, std::uint64_t size, const std::string &path);
+
+        /// Copies the next slice of whatever is being copied
+        /// \return true if there's more to copy
+        bool update();
+
+        /// \return How much content is kept
+        [[nodiscard]] std::uint64_t size() const noexcept { return _size; }
+
+    private:
+        using key = std::pair<std::uint64_t, std::uint64_t>; // Hash and size
+
+        /// A copy that's still going, into the store or out of it
+        struct copy {
+            std::shared_ptr<const ca::shared_file> source;
+            int destination;
+            std::uint64_t offset = 0;
+            std::function<void(bool)> done = {}; // Out of the store
+            std::string temporary = {};          // Into the store, where it's copied to until it's been checked
+            key content;                         // What is being copied
+            ca::content_hash hash = {};          // Into the store, of what's been copied so far
+        };
+
+        /// Internal function: Copies the next part of a copy
+        /// \param job The copy
+        /// \param limit How much to copy at most
+        /// \return How much was copied, -1 if it failed
+        [[nodiscard]] static std::int64_t _copy_slice(copy &job, std::uint64_t limit);
+
+        /// Internal function: Ends a copy, whether it's done or failed
+        void _finish(copy &job, bool copied);
+
+        /// Internal function: Adds content that's been copied in, and evicts the least recently used content past the
+        /// size limit
+        void _add(key content);
+
+        /// Internal function: Evicts the least recently used content until the store is within its size limit
+        void _evict();
+
+        /// Internal function: Marks content as just used
+        void _touch(key content);
+
+        /// Internal function: Where content is kept
+        [[nodiscard]] std::string _path(key content) const;
+
+        ca::store_settings _settings;
+        std::list<key> _entries;                        // Most recently used first
+        std::map<key, std::list<key>::iterator> _index; // Into _entries
+        std::uint64_t _size = 0;
+        std::deque<copy> _copies;                       // One at a time, in order
+    };
+}
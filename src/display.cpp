@@ -32,28 +32,48 @@ bool ca::display::running() const noexcept {
 }
 
 void ca::display::render(ca::network_processor &processor) const noexcept {
+    const auto frame_span = ca::trace::scope("frame", "ui");
+
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     // Main rendering code here
-    ImGui_ImplOpenGL3_NewFrame();
-    ImGui_ImplGlfw_NewFrame();
-    ImGui::NewFrame();
+    {
+        const auto span = ca::trace::scope("new_frame", "ui");
+        ImGui_ImplOpenGL3_NewFrame();
+        ImGui_ImplGlfw_NewFrame();
+        ImGui::NewFrame();
+    }
+
+    // F9 writes out everything traced so far, without having to close the application
+    if (ImGui::IsKeyPressed(GLFW_KEY_F9, false))
+        ca::trace::dump();
+
+    {
+        const auto span = ca::trace::scope("build_ui", "ui");
+        auto ui_ctx = ui::init();
+        ui::root_node(ui_ctx);
 
-    auto ui_ctx = ui::init();
-    ui::root_node(ui_ctx);
+        // Start screen will reply with a bool if it's finished prompting the user for stuff
 
-    // Start screen will reply with a bool if it's finished prompting the user for stuff
+        if (const auto error = processor.error(); !error.empty()) {
+            if (ui::display_error(error))
+                std::terminate();
+        } else if (ui::display_start_screen(processor))
+            ui::handle_chat(processor, _focused);
+    }
 
-    if (const auto error = processor.error(); !error.empty()) {
-        if (ui::display_error(error))
-            std::terminate();
-    } else if (ui::display_start_screen(processor))
-        ui::handle_chat(processor, _focused);
+    {
+        const auto span = ca::trace::scope("render", "ui");
+        ImGui::Render();
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
 
+    {
+        const auto span = ca::trace::scope("swap_buffers", "ui");
+        glfwSwapBuffers(_window);
+    }
 
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-    glfwSwapBuffers(_window);
+    const auto span = ca::trace::scope("poll_events", "ui");
     glfwPollEvents();
 }
@@ -7,7 +7,9 @@
 #include <algorithm>
 
 #include <client_mode.h>
+#include <message_filter.h>
 #include <network_processor.h>
+#include <trace.h>
 
 #include <GLFW/glfw3.h>
 #include <glad/glad.h>
@@ -116,9 +118,10 @@ namespace ca {
         }
 
         /// Displays server information for when the server is created and waiting for a client connection
-        inline void display_server_information(std::uint16_t port) {
+        inline void display_server_information(const std::string &address, const char *io_backend) {
             ImGui::Begin("Server Information", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
-            ImGui::Text("Target port is %hu", port);
+            ImGui::Text("Listening on %s", address.c_str());
+            ImGui::Text("Sockets are handled with %s", io_backend);
             ImGui::End();
         }
 
@@ -146,7 +149,7 @@ namespace ca {
                         break;
                 }
             } else if (processor.waiting_on_connection()) {
-                display_server_information(processor.server_port());
+                display_server_information(processor.server_address(), processor.io_backend_name());
 
                 // We wait a frame before actually waiting for the client to connect
                 // This is because if we don't, the display wont rerender with the server information
@@ -199,7 +202,14 @@ namespace ca {
 
         struct user_chat {
             bool send = false;
+            bool edited = false; // The user changed the message this frame
             std::string current_message;
+            bool search = false;       // The user wants to search the history for search_query
+            bool clear_search = false; // The user is done with the search results
+            std::string search_query;
+            std::string filter_query;  // Only messages containing this are shown
+            bool attach = false;       // The user wants to send the file at attach_path
+            std::string attach_path;
         };
 
         /// Display a chat message sent from the other user
@@ -231,28 +241,133 @@ namespace ca {
                         time.am ? "AM" : "PM", msg.seen() ? " (Read)" : "");
         }
 
+        /// Display the search box, and the results of the last search below it
+        /// \param chat Where the search the user wants to make goes
+        /// \param results The messages found by the last search, empty if there isn't one
+        inline void search(user_chat &chat, const std::optional<std::vector<ca::message>> &results) {
+            static auto query = std::array<char, 257>(); // 257 to allow for null terminator
+
+            const auto entered = ImGui::InputTextWithHint("##SearchBox", "Search history", query.data(), 256,
+                                                          ImGuiInputTextFlags_EnterReturnsTrue);
+            ImGui::SameLine();
+            chat.search = ImGui::Button("Search") || entered;
+            chat.search_query = std::string(query.data());
+
+            if (!results)
+                return;
+
+            ImGui::SameLine();
+            chat.clear_search = ImGui::Button("Clear");
+            if (chat.clear_search)
+                query = std::array<char, 257>();
+
+            ImGui::BeginChild("search_results", ImVec2(0, 8 * ImGui::GetTextLineHeightWithSpacing()), true);
+            if (results->empty())
+                ImGui::Text("No messages found");
+            for (const auto &msg : *results)
+                if (msg.sent_by() == message::sender::other)
+                    display_other_chat(msg);
+                else
+                    display_your_chat(msg);
+            ImGui::EndChild();
+        }
+
+        /// Display the box to send a file with, and every file transfer below it
+        /// \param chat Where the file the user wants to send goes
+        /// \param transfers Every file sent and received so far
+        inline void files(user_chat &chat, const std::vector<ca::file_transfer> &transfers) {
+            static auto path = std::array<char, 4097>(); // 4097 to allow for null terminator
+
+            const auto entered = ImGui::InputTextWithHint("##AttachBox", "Path of a file to send", path.data(), 4096,
+                                                          ImGuiInputTextFlags_EnterReturnsTrue);
+            ImGui::SameLine();
+            chat.attach = ImGui::Button("Attach") || entered;
+            chat.attach_path = std::string(path.data());
+            if (chat.attach)
+                path = std::array<char, 4097>();
+
+            for (const auto &transfer : transfers) {
+                const auto fraction = transfer.size == 0 ? 1.0f : float(double(transfer.transferred) / transfer.size);
+                auto overlay = std::array<char, 64>();
+                switch (transfer.state) {
+                    case ca::transfer_state::hashing:
+                        snprintf(overlay.data(), overlay.size(), "Checking %.0f%%", fraction * 100);
+                        break;
+                    case ca::transfer_state::waiting:
+                        snprintf(overlay.data(), overlay.size(), "Waiting");
+                        break;
+                    case ca::transfer_state::transferring:
+                        snprintf(overlay.data(), overlay.size(), "%.1f / %.1f MB", transfer.transferred / 1e6,
+                                 transfer.size / 1e6);
+                        break;
+                    case ca::transfer_state::done:
+                        snprintf(overlay.data(), overlay.size(), "Done");
+                        break;
+                    case ca::transfer_state::failed:
+                        snprintf(overlay.data(), overlay.size(), "Failed");
+                        break;
+                }
+
+                ImGui::ProgressBar(fraction, ImVec2(ImGui::GetFontSize() * 12, 0), overlay.data());
+                ImGui::SameLine();
+                ImGui::Text("%s %s", transfer.incoming ? "From them:" : "To them:", transfer.name.c_str());
+            }
+        }
+
         /// Display the chat interaction between both clients
         /// \param messages a vector of the chat messages
+        /// \param reconnecting If the connection dropped, messages can still be sent and go out once it's back
+        /// \param search_results The messages found by the last search, empty if there isn't one
+        /// \param shown Which of the messages pass the filter, empty shows all of them
+        /// \param presence Who else is online, and typing
+        /// \param transfers Every file sent and received so far
         /// \return The message the user is currently typing, and if they want to send it or not
-        inline user_chat chat(const std::vector<ca::message> &messages = {}) {
+        inline user_chat chat(const std::vector<ca::message> &messages = {}, bool reconnecting = false,
+                              const std::optional<std::vector<ca::message>> &search_results = std::nullopt,
+                              const std::vector<bool> &shown = {}, const ca::presence &presence = {},
+                              const std::vector<ca::file_transfer> &transfers = {}) {
             auto chat = user_chat();
 
             ImGui::Begin("Chat");
-            ImGui::Text("Chat");
+            ImGui::Text(reconnecting ? "Chat (reconnecting...)" : "Chat");
+            if (!reconnecting && presence.online > 0) {
+                ImGui::SameLine();
+                if (presence.typing == 0)
+                    ImGui::TextDisabled("- %zu online", presence.online);
+                else if (presence.typing == 1)
+                    ImGui::TextDisabled("- %zu online, someone is typing...", presence.online);
+                else
+                    ImGui::TextDisabled("- %zu online, %zu people are typing...", presence.online, presence.typing);
+            }
+            ImGui::Separator();
+
+            ui::search(chat, search_results);
+            ui::files(chat, transfers);
+
+            static auto filter = std::array<char, 257>(); // 257 to allow for null terminator
+            ImGui::InputTextWithHint("##FilterBox", "Filter messages", filter.data(), 256);
+            chat.filter_query = std::string(filter.data());
             ImGui::Separator();
 
             // -5 is there to compensate for extra spacing between elements
             ImGui::BeginChild("messages_spacer", ImVec2(0, -ImGui::GetFrameHeightWithSpacing() - 5));
 
+            const auto shown_count = shown.empty() ? messages.size()
+                                                   : size_t(std::count(shown.begin(), shown.end(), true));
             const auto space = -ImGui::GetFrameHeightWithSpacing() -
-                               messages.size() * (ImGui::GetFontSize() + ImGui::GetStyle().ItemSpacing.y);
+                               shown_count * (ImGui::GetFontSize() + ImGui::GetStyle().ItemSpacing.y);
             ImGui::BeginChild("messages", ImVec2(0, space));
             ImGui::EndChild();
-            for (const auto &msg : messages)
+            for (auto i = size_t(0); i < messages.size(); i++) {
+                const auto &msg = messages[i];
+                if (!shown.empty() && !shown[i])
+                    continue;
+
                 if (msg.sent_by() == message::sender::other)
                     display_other_chat(msg);
                 else
                     display_your_chat(msg);
+            }
             if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
 
             ImGui::EndChild();
@@ -262,7 +377,7 @@ namespace ca {
             static auto message = std::array<char, 2049>(); // 2049 to allow for null terminator
             ImGui::Text("Message (2048 chars max)");
             ImGui::SameLine();
-            ImGui::InputText("##MessageBox", message.data(), 2048);
+            chat.edited = ImGui::InputText("##MessageBox", message.data(), 2048);
             ImGui::SameLine(ImGui::GetWindowContentRegionMax().x - 40);
             chat.send = ImGui::Button("Send");
             chat.current_message = std::string(message.data());
@@ -278,16 +393,40 @@ namespace ca {
         /// \param focused
         inline void handle_chat(ca::network_processor &processor, bool focused) {
             static auto messages = std::vector<ca::message>();
+            static auto search_results = std::optional<std::vector<ca::message>>();
+
+            // Filtering, every message's content is also kept in the filter, in the order it arrived
+            static auto filter = ca::message_filter();
+            static auto filter_ids = std::vector<std::uint32_t>(); // The filter's id of every message, in the same order
+            static auto filter_query = std::string();   // What's in the filter box
+            static auto filtered_query = std::string(); // What the matches are for
+            static auto filtered_count = size_t(0);     // How many of the filter's messages have been checked
+            static auto matched = std::vector<bool>();  // By filter id
+            static auto shown = std::vector<bool>();    // By position in messages
+
+            {
+                const auto span = ca::trace::scope("handle_chat_merge", "ui");
+
+                // If there are incoming messages, add them to the stored messages. Synced history is older than what's
+                // there already, so everything goes in by the time it was sent
+                for (auto &msg : processor.incoming_messages()) {
+                    const auto position = std::upper_bound(messages.begin(), messages.end(), msg.time_sent(),
+                                                           [](std::uint64_t time, const ca::message &other) {
+                                                               return time < other.time_sent();
+                                                           });
+                    filter_ids.insert(filter_ids.begin() + (position - messages.begin()), filter.add(msg.content()));
+                    messages.insert(position, std::move(msg));
+                }
 
-            // If there are incoming messages, add them to the stored messages
-            if (const auto &incoming = processor.incoming_messages(); !incoming.empty())
-                messages.insert(messages.end(), incoming.begin(), incoming.end());
+                if (auto results = processor.search_results())
+                    search_results = std::move(results);
 
-            // Update the messages that have been read by the other client
-            if (const auto &read_messages = processor.read_messages(); !read_messages.empty())
-                for (auto &msg : messages)
-                    for (auto hash : read_messages)
-                        if (msg == hash) msg.set_seen();
+                // Update the messages that have been read by the other client
+                if (const auto &read_messages = processor.read_messages(); !read_messages.empty())
+                    for (auto &msg : messages)
+                        for (auto hash : read_messages)
+                            if (msg == hash) msg.set_seen();
+            }
 
             // If the window is focused, update the other client that we read the messages
             if (focused && !messages.empty())
@@ -302,12 +441,52 @@ namespace ca {
                     }
                 }
 
-            const auto chat = ui::chat(messages);
+            // Only messages that arrived since the last frame are checked, unless the filter changed
+            if (filter_query != filtered_query || filtered_count != filter.size()) {
+                const auto span = ca::trace::scope("handle_chat_filter", "ui");
 
+                auto first = static_cast<std::uint32_t>(filtered_count);
+                if (filter_query != filtered_query) {
+                    matched.assign(filter.size(), false);
+                    first = 0;
+                }
+                matched.resize(filter.size());
+                if (!filter_query.empty())
+                    for (const auto id : filter.find(filter_query, first))
+                        matched[id] = true;
+
+                shown.clear();
+                if (!filter_query.empty())
+                    for (const auto id : filter_ids)
+                        shown.push_back(matched[id]);
+
+                filtered_query = filter_query;
+                filtered_count = filter.size();
+            }
+
+            const auto chat = ui::chat(messages, processor.reconnecting(), search_results, shown, processor.presence(),
+                                       processor.file_transfers());
+            filter_query = chat.filter_query;
+
+            // Clearing the message box counts as having stopped, the processor coalesces everything else
+            if (chat.send)
+                processor.typing(false);
+            else if (chat.edited)
+                processor.typing(!chat.current_message.empty());
+
+            if (chat.search && !chat.search_query.empty())
+                processor.search(chat.search_query);
+            if (chat.clear_search)
+                search_results.reset();
+            if (chat.attach && !chat.attach_path.empty())
+                processor.send_file(chat.attach_path);
+
+            // The chat and the send queue share the message's content
             if (chat.send && !chat.current_message.empty()) {
-                const auto message = ca::message(chat.current_message);
-                messages.emplace_back(message);
-                processor.queue_message(message);
+                auto message = ca::message(chat.current_message);
+                filter_ids.push_back(filter.add(message.content()));
+                processor.queue_message(message.share());
+                messages.push_back(std::move(message));
             }
         }
 
@@ -0,0 +1,198 @@
+#include "epoll_backend.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+std::unique_ptr<ca::epoll_backend> ca::epoll_backend::create() {
+    auto backend = std::unique_ptr<ca::epoll_backend>(new ca::epoll_backend());
+
+    backend->_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    backend->_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (backend->_epoll_fd < 0 || backend->_wake_fd < 0)
+        return nullptr;
+
+    auto event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.fd = backend->_wake_fd;
+    if (epoll_ctl(backend->_epoll_fd, EPOLL_CTL_ADD, backend->_wake_fd, &event) != 0)
+        return nullptr;
+
+    return backend;
+}
+
+ca::epoll_backend::~epoll_backend() {
+    if (_wake_fd >= 0) close(_wake_fd);
+    if (_epoll_fd >= 0) close(_epoll_fd);
+}
+
+bool ca::epoll_backend::add(int fd) {
+    auto event = epoll_event();
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        return false;
+
+    _limit_unsent(fd);
+    _connections[fd] = connection();
+    return true;
+}
+
+bool ca::epoll_backend::add_listener(int fd) {
+    auto event = epoll_event();
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        return false;
+
+    _listeners.insert(fd);
+    return true;
+}
+
+void ca::epoll_backend::remove(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    _connections.erase(fd);
+    _listeners.erase(fd);
+}
+
+void ca::epoll_backend::send(int fd, ca::shared_bytes bytes, ca::send_priority priority) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+
+    auto &connection = it->second;
+    if (connection.failed)
+        return;
+
+    connection.outgoing.push(std::move(bytes), priority);
+
+    // If we're already waiting on EPOLLOUT, the data goes out once the socket is writable again
+    if (!connection.want_write)
+        _flush(fd, connection);
+
+    // A slow reader is reported as closed on the next wait, same as a failed write
+    if (!connection.outgoing.enforce(_send_limit))
+        connection.failed = true;
+}
+
+void ca::epoll_backend::send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                                  size_t offset) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end() || it->second.failed)
+        return;
+
+    // Files don't count towards the send limit, there's nothing to enforce
+    auto &connection = it->second;
+    connection.outgoing.push_file(transfer, std::move(file), offset);
+    if (!connection.want_write)
+        _flush(fd, connection);
+}
+
+size_t ca::epoll_backend::queued_bytes(int fd) const {
+    const auto it = _connections.find(fd);
+    return it == _connections.end() ? 0 : it->second.outgoing.queued_bytes();
+}
+
+void ca::epoll_backend::wait(std::chrono::milliseconds timeout, const event_handler &handler) {
+    // Sockets that failed while sending are reported here, so every close goes through the handler
+    auto failed = std::vector<int>();
+    for (const auto &[fd, connection] : _connections)
+        if (connection.failed)
+            failed.push_back(fd);
+
+    for (const auto fd : failed) {
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+    }
+
+    auto events = std::array<epoll_event, 64>();
+    const auto count = epoll_wait(_epoll_fd, events.data(), static_cast<int>(events.size()),
+                                  static_cast<int>(timeout.count()));
+
+    for (auto i = 0; i < count; i++) {
+        const auto fd = events[i].data.fd;
+        const auto flags = events[i].events;
+
+        if (fd == _wake_fd) {
+            auto value = std::uint64_t();
+            [[maybe_unused]] const auto read = ::read(_wake_fd, &value, sizeof(value));
+            continue;
+        }
+
+        if (_listeners.contains(fd)) {
+            _accept(fd, handler);
+            continue;
+        }
+
+        if (flags & EPOLLOUT)
+            if (const auto it = _connections.find(fd); it != _connections.end())
+                _flush(fd, it->second);
+
+        // Read before handling a hang up, there can still be data in the socket that the other side sent
+        if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            _read(fd, handler);
+    }
+}
+
+void ca::epoll_backend::wake() {
+    const auto value = std::uint64_t(1);
+    [[maybe_unused]] const auto written = ::write(_wake_fd, &value, sizeof(value));
+}
+
+void ca::epoll_backend::_flush(int fd, connection &connection) {
+    const auto result = connection.outgoing.flush(fd);
+    if (result == write_queue::flush_result::failed) {
+        connection.failed = true;
+        return;
+    }
+
+    const auto want_write = result == write_queue::flush_result::blocked;
+    if (want_write == connection.want_write)
+        return;
+
+    connection.want_write = want_write;
+
+    auto event = epoll_event();
+    event.events = EPOLLIN | EPOLLRDHUP | (want_write ? std::uint32_t(EPOLLOUT) : 0);
+    event.data.fd = fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void ca::epoll_backend::_read(int fd, const event_handler &handler) {
+    while (_connections.contains(fd)) {
+        auto read = ssize_t();
+        {
+            const auto span = ca::trace::scope("socket_read", "net");
+            read = ::recv(fd, _read_buffer.data(), _read_buffer.size(), MSG_DONTWAIT);
+        }
+
+        if (read > 0) {
+            handler({.kind = io_event::type::received, .fd = fd,
+                     .data = std::span(_read_buffer.data(), static_cast<size_t>(read))});
+            continue;
+        }
+
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+
+        // Either the other side closed the connection (0), or the socket failed
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+        return;
+    }
+}
+
+void ca::epoll_backend::_accept(int fd, const event_handler &handler) {
+    while (_listeners.contains(fd)) {
+        const auto socket = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return; // EAGAIN once the backlog is empty, anything else we'll find out about on the next wait
+        }
+
+        handler({.kind = io_event::type::accepted, .fd = socket, .data = {}});
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <io_backend.h>
+#include <write_queue.h>
+
+namespace ca {
+    /// Readiness based backend, sockets are read from / written to with plain non-blocking syscalls
+    class epoll_backend : public io_backend {
+    public:
+        /// Creates the epoll instance
+        /// \return The backend, or nullptr if epoll couldn't be created
+        [[nodiscard]] static std::unique_ptr<ca::epoll_backend> create();
+
+        ~epoll_backend() override;
+
+        bool add(int fd) override;
+
+        bool add_listener(int fd) override;
+
+        void remove(int fd) override;
+
+        using io_backend::send;
+
+        void send(int fd, ca::shared_bytes bytes, ca::send_priority priority = ca::send_priority::normal) override;
+
+        void send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                       size_t offset) override;
+
+        void wait(std::chrono::milliseconds timeout, const event_handler &handler) override;
+
+        void wake() override;
+
+        [[nodiscard]] size_t queued_bytes(int fd) const override;
+
+        [[nodiscard]] const char *name() const noexcept override { return "epoll"; }
+
+    private:
+        epoll_backend() = default;
+
+        struct connection {
+            ca::write_queue outgoing;
+            bool want_write = false; // If we're waiting on EPOLLOUT
+            bool failed = false;
+        };
+
+        /// Internal function: Write out the queued data, and register / unregister for EPOLLOUT as needed
+        void _flush(int fd, connection &connection);
+
+        /// Internal function: Read everything available on the socket
+        void _read(int fd, const event_handler &handler);
+
+        /// Internal function: Accept every pending connection on a listener
+        void _accept(int fd, const event_handler &handler);
+
+        int _epoll_fd = -1;
+        int _wake_fd = -1;
+
+        std::unordered_map<int, connection> _connections;
+        std::unordered_set<int> _listeners;
+
+        std::vector<std::byte> _read_buffer = std::vector<std::byte>(64 * 1024);
+    };
+}
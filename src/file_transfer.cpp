@@ -0,0 +1,390 @@
+#include "file_transfer.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <packet.h>
+
+namespace {
+    /// How much of a file is hashed per tick, the connection is still serviced in between
+    constexpr auto hash_slice_size = std::uint64_t(4 * 1024 * 1024);
+
+    /// The receiver tells the sender how much it has whenever this much more has arrived
+    constexpr auto report_interval = std::uint64_t(1024 * 1024);
+
+    /// \return The part of a path after the last directory
+    std::string file_name(const std::string &path) {
+        const auto separator = path.find_last_of('/');
+        return separator == std::string::npos ? path : path.substr(separator + 1);
+    }
+
+    /// \return The name with a number in front of its extension, "notes (2).txt"
+    std::string numbered(const std::string &name, int number) {
+        const auto extension = name.find_last_of('.');
+        const auto split = extension == std::string::npos || extension == 0 ? name.size() : extension;
+        return name.substr(0, split) + " (" + std::to_string(number) + ")" + name.substr(split);
+    }
+
+}
+
+ca::file_transfers::file_transfers(ca::io_backend &backend, std::string downloads, ca::store_settings store)
+        : _backend(backend), _downloads(std::move(downloads)), _store(std::move(store)) {}
+
+ca::file_transfers::~file_transfers() {
+    for (const auto &[id, transfer] : _incoming)
+        if (transfer.fd >= 0)
+            ::close(transfer.fd);
+}
+
+void ca::file_transfers::send(const std::string &path) {
+    auto file = ca::shared_file::open(path);
+    auto name = file_name(path);
+    const auto id = _next_id++;
+
+    auto status = size_t(0);
+    {
+        auto guard = std::lock_guard(_status_mutex);
+        status = _status.size();
+        _status.push_back({.id = id, .incoming = false, .name = name, .size = file ? file->size() : 0,
+                           .transferred = 0, .state = file ? transfer_state::hashing : transfer_state::failed});
+    }
+
+    if (file)
+        _outgoing.emplace(id, outgoing{.file = std::move(file), .name = std::move(name), .status = status});
+}
+
+bool ca::file_transfers::update(int fd, bool connected, size_t max_frame_size) {
+    // A slice at a time over every file, whoever is first
+    auto sliced = false;
+
+    for (auto &[id, transfer] : _outgoing) {
+        if (transfer.finished)
+            continue;
+
+        if (!transfer.hashed) {
+            if (sliced)
+                continue;
+            sliced = true;
+
+            const auto size = transfer.file->size();
+            if (!_hash_slice(transfer.file->fd(), transfer.hash, size)) {
+                transfer.finished = true;
+                _report(transfer.status, transfer_state::failed, transfer.hash.size());
+                continue;
+            }
+
+            transfer.hashed = transfer.hash.size() == size;
+            _report(transfer.status, transfer.hashed ? transfer_state::waiting : transfer_state::hashing,
+                    transfer.hashed ? 0 : transfer.hash.size());
+        }
+
+        if (!transfer.hashed || !connected || transfer.offered)
+            continue;
+
+        // The other side would close the connection over a file_data packet bigger than its limit
+        if (max_frame_size < packet::max_file_data_size + packet::max_file_data_header_size) {
+            transfer.finished = true;
+            _report(transfer.status, transfer_state::failed, 0);
+            continue;
+        }
+
+        _backend.send(fd, ca::packet::file_offer(id, transfer.file->size(), transfer.hash.digest(), transfer.name));
+        transfer.offered = true;
+    }
+
+    for (auto &[id, transfer] : _incoming) {
+        if (transfer.finished || transfer.hash.size() >= transfer.existing || sliced)
+            continue;
+        sliced = true;
+
+        if (!_hash_slice(transfer.fd, transfer.hash, transfer.existing)) {
+            // Whatever is there can't be used, it's received again from the start
+            transfer.hash = ca::content_hash();
+            transfer.existing = 0;
+            (void) ::ftruncate(transfer.fd, 0);
+        }
+
+        _report(transfer.status, transfer_state::hashing, transfer.hash.size());
+        if (transfer.hash.size() >= transfer.existing && connected && transfer.offered)
+            _answer(fd, id, transfer);
+    }
+
+    const auto copying = _store.update();
+    const auto hashing = std::any_of(_outgoing.begin(), _outgoing.end(), [](const auto &entry) {
+        return !entry.second.finished && !entry.second.hashed;
+    }) || std::any_of(_incoming.begin(), _incoming.end(), [](const auto &entry) {
+        return !entry.second.finished && entry.second.hash.size() < entry.second.existing;
+    });
+    return hashing || copying;
+}
+
+void ca::file_transfers::handle(int fd, const ca::frame_decoder::frame &frame) {
+    switch (frame.type) {
+        case packet_type::file_offer: {
+            auto it = _incoming.find(frame.transfer);
+            if (it == _incoming.end()) {
+                auto transfer = incoming{.name = frame.name, .size = frame.file_size, .content_hash = frame.content_hash};
+                {
+                    auto guard = std::lock_guard(_status_mutex);
+                    transfer.status = _status.size();
+                    _status.push_back({.id = frame.transfer, .incoming = true, .name = frame.name,
+                                       .size = frame.file_size, .transferred = 0, .state = transfer_state::hashing});
+                }
+
+                ::mkdir(_downloads.c_str(), 0755);
+
+                // Kept from an earlier transfer (either way), none of it has to be sent
+                auto path = std::string();
+                const auto kept = _store.contains(frame.content_hash, frame.file_size) ? _create(frame.name, path) : -1;
+                if (kept >= 0) {
+                    transfer.finished = true;
+                    transfer.verified = true;
+                    _report(transfer.status, transfer_state::transferring, 0);
+                    _store.copy_out(frame.content_hash, frame.file_size, kept,
+                                    [this, entry = transfer.status, size = frame.file_size, path](bool copied) {
+                                        if (!copied)
+                                            ::unlink(path.c_str());
+                                        _report(entry, copied ? transfer_state::done : transfer_state::failed,
+                                                copied ? size : 0, copied ? &path : nullptr);
+                                    });
+                } else {
+                    // The same content being received twice at once would end up in the same partial file
+                    const auto duplicate = std::any_of(_incoming.begin(), _incoming.end(), [&frame](const auto &entry) {
+                        return !entry.second.finished && entry.second.content_hash == frame.content_hash &&
+                               entry.second.size == frame.file_size;
+                    });
+
+                    // Named after the content, so the same file continues from it whoever offers it
+                    auto partial_name = std::array<char, 64>();
+                    std::snprintf(partial_name.data(), partial_name.size(), "%016" PRIx64 "-%" PRIu64 ".part",
+                                  frame.content_hash, frame.file_size);
+                    transfer.partial = _downloads + "/" + partial_name.data();
+
+                    struct stat status = {};
+                    if (!duplicate)
+                        transfer.fd = ::open(transfer.partial.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+                    if (transfer.fd < 0 || fstat(transfer.fd, &status) != 0) {
+                        transfer.finished = true;
+                        _report(transfer.status, transfer_state::failed, 0);
+                    } else if (static_cast<std::uint64_t>(status.st_size) > transfer.size)
+                        (void) ::ftruncate(transfer.fd, 0);
+                    else
+                        transfer.existing = static_cast<std::uint64_t>(status.st_size);
+                }
+
+                it = _incoming.emplace(frame.transfer, std::move(transfer)).first;
+            }
+
+            it->second.offered = true;
+            _answer(fd, frame.transfer, it->second);
+            break;
+        }
+        case packet_type::file_accept: {
+            const auto it = _outgoing.find(frame.transfer);
+            if (it == _outgoing.end() || it->second.finished || !it->second.hashed)
+                break;
+
+            // Only the answer to the offer starts sending, after that it's the receiver reporting its progress
+            auto &transfer = it->second;
+            const auto offset = std::min<std::uint64_t>(frame.offset, transfer.file->size());
+            if (!transfer.streaming) {
+                transfer.streaming = true;
+                _backend.send_file(fd, frame.transfer, transfer.file, static_cast<size_t>(offset));
+            }
+            transfer.acknowledged = offset;
+            _report(transfer.status, transfer_state::transferring, offset);
+            break;
+        }
+        case packet_type::file_data: {
+            // Anything that isn't exactly what comes next wasn't asked for
+            const auto it = _incoming.find(frame.transfer);
+            if (it != _incoming.end() && !it->second.finished && it->second.hash.size() >= it->second.existing &&
+                frame.offset == it->second.hash.size())
+                _receive(fd, frame.transfer, it->second, frame);
+            break;
+        }
+        case packet_type::file_done: {
+            const auto it = _outgoing.find(frame.transfer);
+            if (it == _outgoing.end() || it->second.finished)
+                break;
+
+            auto &transfer = it->second;
+            const auto size = transfer.file->size();
+            transfer.finished = true;
+            if (frame.verified)
+                _store.keep(transfer.hash.digest(), transfer.file);
+            transfer.file = nullptr; // The send queue (and the store) hold on to it if they're still reading it
+            _report(transfer.status, frame.verified ? transfer_state::done : transfer_state::failed,
+                    frame.verified ? size : 0);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void ca::file_transfers::disconnected() {
+    for (auto &[id, transfer] : _outgoing) {
+        transfer.offered = false;
+        transfer.streaming = false;
+        if (transfer.hashed && !transfer.finished)
+            _report(transfer.status, transfer_state::waiting, transfer.acknowledged);
+    }
+
+    for (auto &[id, transfer] : _incoming) {
+        transfer.offered = false;
+        if (!transfer.finished && transfer.hash.size() >= transfer.existing)
+            _report(transfer.status, transfer_state::waiting, transfer.hash.size());
+    }
+}
+
+void ca::file_transfers::peer_changed() {
+    for (auto &[id, transfer] : _incoming) {
+        if (transfer.fd >= 0)
+            ::close(transfer.fd);
+        if (!transfer.finished)
+            _report(transfer.status, transfer_state::failed, transfer.hash.size());
+    }
+    _incoming.clear();
+}
+
+std::vector<ca::file_transfer> ca::file_transfers::progress() const {
+    auto guard = std::lock_guard(_status_mutex);
+    return _status;
+}
+
+bool ca::file_transfers::_hash_slice(int fd, ca::content_hash &hash, std::uint64_t size) {
+    auto buffer = std::vector<std::byte>(256 * 1024);
+    const auto end = std::min(size, hash.size() + hash_slice_size);
+    while (hash.size() < end) {
+        const auto read = ::pread(fd, buffer.data(), std::min<std::uint64_t>(buffer.size(), end - hash.size()),
+                                  static_cast<off_t>(hash.size()));
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read <= 0)
+            return false;
+        hash.update(std::span(buffer.data(), static_cast<size_t>(read)));
+    }
+    return true;
+}
+
+void ca::file_transfers::_answer(int fd, std::uint64_t id, incoming &transfer) {
+    if (transfer.finished) {
+        _backend.send(fd, ca::packet::file_done(id, transfer.verified), ca::send_priority::control);
+        return;
+    }
+
+    // Still hashing what was on disk, it's answered once that's done
+    if (transfer.hash.size() < transfer.existing)
+        return;
+
+    transfer.offered = false;
+    if (transfer.hash.size() == transfer.size) {
+        _finish(fd, id, transfer);
+        return;
+    }
+
+    transfer.reported = transfer.hash.size();
+    _report(transfer.status, transfer_state::transferring, transfer.hash.size());
+    _backend.send(fd, ca::packet::file_accept(id, transfer.hash.size()), ca::send_priority::control);
+}
+
+void ca::file_transfers::_receive(int fd, std::uint64_t id, incoming &transfer, const ca::frame_decoder::frame &frame) {
+    if (frame.data.size() > transfer.size - frame.offset) {
+        _finish(fd, id, transfer);
+        return;
+    }
+
+    // Straight from the receive buffer to the file, the data is never copied anywhere else
+    auto written = size_t(0);
+    while (written < frame.data.size()) {
+        const auto result = ::pwrite(transfer.fd, frame.data.data() + written, frame.data.size() - written,
+                                     static_cast<off_t>(frame.offset + written));
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0) {
+            // Out of space or similar, what did get written is kept for trying again later
+            ::close(std::exchange(transfer.fd, -1));
+            transfer.finished = true;
+            _report(transfer.status, transfer_state::failed, transfer.hash.size());
+            _backend.send(fd, ca::packet::file_done(id, false), ca::send_priority::control);
+            return;
+        }
+        written += static_cast<size_t>(result);
+    }
+
+    transfer.hash.update(frame.data);
+    const auto received = transfer.hash.size();
+    if (received == transfer.size) {
+        _finish(fd, id, transfer);
+        return;
+    }
+
+    _report(transfer.status, transfer_state::transferring, received);
+    if (received - transfer.reported >= report_interval) {
+        transfer.reported = received;
+        _backend.send(fd, ca::packet::file_accept(id, received), ca::send_priority::control);
+    }
+}
+
+void ca::file_transfers::_finish(int fd, std::uint64_t id, incoming &transfer) {
+    ::close(std::exchange(transfer.fd, -1));
+    transfer.finished = true;
+
+    // Something else arrived than was offered, it's no use for resuming either
+    const auto complete = transfer.hash.size() == transfer.size;
+    transfer.verified = complete && transfer.hash.digest() == transfer.content_hash;
+    if (!transfer.verified)
+        ::unlink(transfer.partial.c_str());
+
+    // Nothing already there is overwritten, the name gets a number instead. If it can't be moved it stays as a
+    // partial file, offered again it's moved then
+    auto path = std::string();
+    if (transfer.verified) {
+        const auto reserved = _create(transfer.name, path);
+        if (reserved >= 0)
+            ::close(reserved);
+        if (reserved < 0 || ::rename(transfer.partial.c_str(), path.c_str()) != 0) {
+            if (reserved >= 0)
+                ::unlink(path.c_str());
+            transfer.verified = false;
+        }
+    }
+
+    // Anyone sending the same content again is answered from the store
+    if (transfer.verified)
+        _store.keep_verified(transfer.content_hash, transfer.size, path);
+
+    _report(transfer.status, transfer.verified ? transfer_state::done : transfer_state::failed,
+            transfer.hash.size(), transfer.verified ? &path : nullptr);
+    _backend.send(fd, ca::packet::file_done(id, transfer.verified), ca::send_priority::control);
+}
+
+int ca::file_transfers::_create(const std::string &name, std::string &path) const {
+    path = _downloads + "/" + name;
+    for (auto copy = 2;; copy++) {
+        const auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0 || errno != EEXIST)
+            return fd;
+        path = _downloads + "/" + numbered(name, copy);
+    }
+}
+
+void ca::file_transfers::_report(size_t status, ca::transfer_state state, std::uint64_t transferred,
+                                 const std::string *name) {
+    auto guard = std::lock_guard(_status_mutex);
+    auto &entry = _status[status];
+    entry.state = state;
+    entry.transferred = transferred;
+    if (name)
+        entry.name = *name;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <content_hash.h>
+#include <content_store.h>
+#include <frame_decoder.h>
+#include <io_backend.h>
+#include <shared_file.h>
+
+namespace ca {
+    /// How far a file transfer has got
+    enum class transfer_state {
+        hashing,      // The file is read once to work out its content hash, before it's offered (or resumed)
+        waiting,      // Offered, the other side hasn't asked for it yet (or the connection is down)
+        transferring,
+        done,         // Arrived, and matched its content hash
+        failed        // Didn't match its content hash, or the file couldn't be read or written
+    };
+
+    /// A file being sent or received, as the user sees it
+    struct file_transfer {
+        std::uint64_t id;
+        bool incoming;
+        std::string name;          // Once an incoming file is done, the path it was saved to
+        std::uint64_t size;
+        std::uint64_t transferred; // How much the receiver has, or how much has been hashed while hashing
+        ca::transfer_state state;
+    };
+
+    /// Sends and receives files over a direct connection. A file is hashed and then offered, the receiver answers
+    /// with how much of it it already has and the sender streams the rest from the page cache (see
+    /// io_backend::send_file) while the receiver writes it straight to disk and hashes it as it arrives. Only one
+    /// packet's worth of a file is in memory at a time, whatever its size.
+    /// A partial file is kept (named after its content hash) until it's complete, so a transfer picks up where it
+    /// left off after a reconnect, and even after either side restarted when the same file is offered again.
+    /// Both sides keep the content of what went through in a content_store, an offer is also asking if the receiver
+    /// has the content already, it answers that it's done straight away then and copies it from there.
+    /// Everything other than #progress is only used from the processing thread
+    class file_transfers {
+    public:
+        /// \param backend Where the packets are sent, it has to outlive this
+        /// \param downloads The directory received files are saved in, it's created when the first one arrives
+        /// \param store Where the content of sent and received files is kept
+        file_transfers(ca::io_backend &backend, std::string downloads, ca::store_settings store);
+
+        ~file_transfers();
+
+        file_transfers(const file_transfers &) = delete;
+        file_transfers &operator=(const file_transfers &) = delete;
+
+        /// Starts sending a file, it's offered once it's been hashed
+        /// \param path The file to send
+        void send(const std::string &path);
+
+        /// Hashes the next slice of whatever is being hashed and offers the files that are ready, should be called on
+        /// every tick
+        /// \param fd The socket connected to the other side
+        /// \param connected If the other side can be sent to (it has resumed)
+        /// \param max_frame_size The biggest packet the other side accepts
+        /// \return true if there's more hashing (or copying) left, the next tick shouldn't wait for anything then
+        bool update(int fd, bool connected, size_t max_frame_size);
+
+        /// Handles a file_offer, file_accept, file_data or file_done packet
+        /// \param fd The socket connected to the other side
+        /// \param frame The packet
+        void handle(int fd, const ca::frame_decoder::frame &frame);
+
+        /// The connection dropped, everything is offered and asked for again once it's back
+        void disconnected();
+
+        /// The other side isn't who it was (see packet_type::resume), its transfer ids mean something else now.
+        /// Partial files stay on disk, the same file offered again continues from them
+        void peer_changed();
+
+        /// \return Every transfer so far, safe to call from any thread
+        [[nodiscard]] std::vector<ca::file_transfer> progress() const;
+
+    private:
+        /// A file we're sending
+        struct outgoing {
+            std::shared_ptr<const ca::shared_file> file;
+            std::string name;
+            ca::content_hash hash = {};     // Of what's been hashed so far, until it's all been
+            bool hashed = false;
+            bool offered = false;           // On the current connection
+            bool streaming = false;         // Being sent on the current connection
+            bool finished = false;          // The receiver has told us it's done, one way or another
+            std::uint64_t acknowledged = 0; // What the receiver last told us it has
+            size_t status = 0;              // Index in _status
+        };
+
+        /// A file we're receiving
+        struct incoming {
+            int fd = -1;                  // The partial file
+            std::string partial = {};     // Its path
+            std::string name;
+            std::uint64_t size = 0;
+            std::uint64_t content_hash = 0;
+            ca::content_hash hash = {};   // Of what's arrived so far
+            std::uint64_t existing = 0;   // What was on disk already, it's hashed before asking for the rest
+            std::uint64_t reported = 0;   // What the sender was last told we have
+            bool offered = false;         // On the current connection, it's waiting for our answer
+            bool finished = false;
+            bool verified = false;
+            size_t status = 0;            // Index in _status
+        };
+
+        /// Internal function: Hashes the next slice of a file
+        /// \param fd The file
+        /// \param hash Continues from how much it has hashed
+        /// \param size How much of the file to hash
+        /// \return false if the file couldn't be read
+        [[nodiscard]] static bool _hash_slice(int fd, ca::content_hash &hash, std::uint64_t size);
+
+        /// Internal function: Sends what an incoming file needs next, how much we have or that it's finished
+        void _answer(int fd, std::uint64_t id, incoming &transfer);
+
+        /// Internal function: Writes the data of a file_data packet to the partial file
+        void _receive(int fd, std::uint64_t id, incoming &transfer, const ca::frame_decoder::frame &frame);
+
+        /// Internal function: Checks an incoming file that's fully arrived, and moves it to where it's saved
+        void _finish(int fd, std::uint64_t id, incoming &transfer);
+
+        /// Internal function: Creates a file in the downloads directory, with a number added to the name if it's taken
+        /// \param name The name it's saved as
+        /// \param path Set to where it was created
+        /// \return The file, opened for writing, -1 if it couldn't be created
+        [[nodiscard]] int _create(const std::string &name, std::string &path) const;
+
+        /// Internal function: Updates what the user sees of a transfer
+        void _report(size_t status, ca::transfer_state state, std::uint64_t transferred, const std::string *name = nullptr);
+
+        ca::io_backend &_backend;
+        std::string _downloads;
+        ca::content_store _store;
+
+        std::uint64_t _next_id = 1;
+        std::map<std::uint64_t, outgoing> _outgoing;
+        std::map<std::uint64_t, incoming> _incoming; // By the other side's transfer id
+
+        mutable std::mutex _status_mutex;
+        std::vector<ca::file_transfer> _status;
+    };
+}
@@ -0,0 +1,524 @@
+#include "frame_decoder.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <utf8.h>
+
+namespace {
+    /// A buffer bigger than this is given back once everything in it is decoded, it only grew that much for a big
+    /// packet
+    constexpr auto shrink_threshold = size_t(64 * 1024);
+
+    /// File names are cut down to what every file system takes
+    constexpr auto max_file_name_size = size_t(255);
+}
+
+ca::frame_decoder::frame_decoder(ca::frame_limits limits, ca::receive_budget *budget)
+        : _limits(limits), _reservation(budget), _chunk_reservation(budget) {}
+
+void ca::frame_decoder::feed(std::span<const std::byte> data) {
+    if (_failed)
+        return;
+
+    // Drop the decoded bytes once they make up most of the buffer, so it doesn't keep growing
+    if (_offset > 0 && _offset * 2 >= _buffer.size()) {
+        _buffer.erase(_buffer.begin(), _buffer.begin() + static_cast<std::ptrdiff_t>(_offset));
+        _offset = 0;
+    }
+
+    if (_buffer.empty() && _buffer.capacity() > shrink_threshold) {
+        _buffer = std::vector<std::byte>();
+        (void) _reservation.resize(0);
+    }
+
+    // Grown the way a vector would grow it, or only as much as needed if the budget doesn't have that much left
+    const auto required = _buffer.size() + data.size();
+    if (required > _buffer.capacity()) {
+        auto capacity = std::max(required, _buffer.capacity() * 2);
+        if (!_reservation.resize(capacity) && !_reservation.resize(capacity = required)) {
+            _overflow();
+            return;
+        }
+        _buffer.reserve(capacity);
+    }
+
+    _buffer.insert(_buffer.end(), data.begin(), data.end());
+}
+
+void ca::frame_decoder::add_dictionary(std::shared_ptr<const ca::dictionary> dictionary) {
+    _dictionaries[1] = std::move(_dictionaries[0]);
+    _dictionaries[0] = std::move(dictionary);
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::next() {
+    // The pieces of a chunked packet are only collected, the packet comes out once the last one is here
+    while (!_failed && _available() > 0) {
+        auto reader = ca::wire::reader(std::span(_buffer).subspan(_offset));
+        auto frame = _decode(reader);
+        if (!frame) {
+            if (reader.malformed())
+                _failed = true;
+            // What's buffered is the start of a single packet, which can't get any bigger than the limit
+            else if (_available() > _limits.max_frame_size)
+                _overflow();
+            return std::nullopt;
+        }
+
+        // Nothing else can be trusted to decode right before we know that both sides use the same format
+        if (!_handshake_done) {
+            if (frame->type != packet_type::hello || frame->version != ca::wire::protocol_version) {
+                _failed = true;
+                _incompatible = true;
+                return std::nullopt;
+            }
+            _handshake_done = true;
+        }
+
+        _offset += reader.position();
+        if (frame->type != packet_type::chunk)
+            return frame;
+        if (!frame->more)
+            return _reassemble();
+    }
+    return std::nullopt;
+}
+
+bool ca::frame_decoder::failed() const noexcept {
+    return _failed;
+}
+
+bool ca::frame_decoder::incompatible() const noexcept {
+    return _incompatible;
+}
+
+bool ca::frame_decoder::oversized() const noexcept {
+    return _oversized;
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_decode(ca::wire::reader &reader, bool sequenced) {
+    const auto type_byte = reader.byte();
+    if (!type_byte)
+        return std::nullopt;
+
+    const auto type = static_cast<ca::packet_type>(*type_byte & ~compressed_flag);
+    const auto compressed = (*type_byte & compressed_flag) != 0;
+
+    // Only message packets can be compressed, and only chat messages can be sequenced
+    if ((compressed && type != packet_type::message) ||
+        (sequenced && type != packet_type::message && type != packet_type::room_message)) {
+        _failed = true;
+        return std::nullopt;
+    }
+
+    switch (type) {
+        case packet_type::message:
+            return _message(reader, compressed);
+        case packet_type::message_read: {
+            const auto message_hash = reader.varint();
+            if (!message_hash)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .message_hash = static_cast<size_t>(*message_hash)};
+        }
+        case packet_type::disconnect:
+            return frame{.type = type, .message = {}};
+        case packet_type::subscribe:
+        case packet_type::unsubscribe: {
+            const auto room = reader.varint();
+            if (!room)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .room = static_cast<ca::room_id>(*room)};
+        }
+        case packet_type::hello: {
+            const auto version = reader.varint();
+            const auto codecs = version ? reader.varint() : std::nullopt;
+            if (!codecs)
+                return std::nullopt;
+
+            // Other versions are only decoded far enough to be told apart, older ones end here
+            const auto current = *version == ca::wire::protocol_version;
+            const auto max_frame_size = current ? reader.varint() : std::optional(std::uint64_t(0));
+            if (!max_frame_size)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .codecs = static_cast<std::uint8_t>(*codecs),
+                         .version = static_cast<std::uint32_t>(*version),
+                         .max_frame_size = static_cast<size_t>(*max_frame_size)};
+        }
+        case packet_type::dictionary:
+            return _dictionary(reader);
+        case packet_type::sequenced: {
+            const auto sequence = reader.varint();
+            if (!sequence)
+                return std::nullopt;
+
+            auto frame = _decode(reader, true);
+            if (frame)
+                frame->sequence = *sequence;
+            return frame;
+        }
+        case packet_type::ack: {
+            const auto sequence = reader.varint();
+            if (!sequence)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .sequence = *sequence};
+        }
+        case packet_type::resume: {
+            const auto session = reader.varint();
+            const auto peer_session = session ? reader.varint() : std::nullopt;
+            const auto sequence = peer_session ? reader.varint() : std::nullopt;
+            if (!sequence)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .sequence = *sequence, .session = *session,
+                         .peer_session = *peer_session};
+        }
+        case packet_type::sync: {
+            const auto room = reader.varint();
+            const auto after = room ? reader.varint() : std::nullopt;
+            const auto since = after ? reader.varint() : std::nullopt;
+            const auto limit = since ? reader.varint() : std::nullopt;
+            if (!limit)
+                return std::nullopt;
+
+            const auto max_limit = std::uint64_t(std::numeric_limits<std::uint32_t>::max());
+            return frame{.type = type, .message = {}, .sequence = *after,
+                         .history_room = *room ? std::optional(static_cast<ca::room_id>(*room - 1)) : std::nullopt,
+                         .since = *since, .limit = static_cast<std::uint32_t>(std::min(*limit, max_limit))};
+        }
+        case packet_type::history:
+            return _history(reader);
+        case packet_type::search: {
+            const auto query_id = reader.varint();
+            const auto size = query_id ? reader.varint() : std::nullopt;
+            const auto query = size ? _bytes(reader, *size) : std::nullopt;
+            if (!query)
+                return std::nullopt;
+
+            return frame{.type = type, .message = {}, .query_id = *query_id,
+                         .query = std::string(reinterpret_cast<const char *>(query->data()), query->size())};
+        }
+        case packet_type::search_results: {
+            const auto query_id = reader.varint();
+            if (!query_id)
+                return std::nullopt;
+
+            auto results = frame{.type = type, .message = {}, .query_id = *query_id};
+            if (!_message_block(reader, results))
+                return std::nullopt;
+            return results;
+        }
+        case packet_type::presence: {
+            const auto room = reader.varint();
+            const auto typing = room ? reader.byte() : std::nullopt;
+            if (!typing)
+                return std::nullopt;
+            return frame{.type = type, .message = {},
+                         .history_room = *room ? std::optional(static_cast<ca::room_id>(*room - 1)) : std::nullopt,
+                         .presence = {.online = 0, .typing = *typing != 0 ? size_t(1) : size_t(0)}};
+        }
+        case packet_type::presence_summary: {
+            const auto room = reader.varint();
+            const auto online = room ? reader.varint() : std::nullopt;
+            const auto typing = online ? reader.varint() : std::nullopt;
+            if (!typing)
+                return std::nullopt;
+            return frame{.type = type, .message = {},
+                         .history_room = *room ? std::optional(static_cast<ca::room_id>(*room - 1)) : std::nullopt,
+                         .presence = {.online = static_cast<size_t>(*online), .typing = static_cast<size_t>(*typing)}};
+        }
+        case packet_type::ping:
+        case packet_type::pong: {
+            const auto time = reader.varint();
+            if (!time)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .ping_time = *time};
+        }
+        case packet_type::chunk:
+            return _chunk(reader);
+        case packet_type::file_offer:
+            return _file_offer(reader);
+        case packet_type::file_accept: {
+            const auto transfer = reader.varint();
+            const auto offset = transfer ? reader.varint() : std::nullopt;
+            if (!offset)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .transfer = *transfer, .offset = *offset};
+        }
+        case packet_type::file_data: {
+            const auto transfer = reader.varint();
+            const auto offset = transfer ? reader.varint() : std::nullopt;
+            const auto size = offset ? reader.varint() : std::nullopt;
+            const auto data = size ? _bytes(reader, *size) : std::nullopt;
+            if (!data)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .transfer = *transfer, .offset = *offset, .data = *data};
+        }
+        case packet_type::file_done: {
+            const auto transfer = reader.varint();
+            const auto verified = transfer ? reader.byte() : std::nullopt;
+            if (!verified)
+                return std::nullopt;
+            return frame{.type = type, .message = {}, .transfer = *transfer, .verified = *verified != 0};
+        }
+        case packet_type::room_message: {
+            const auto room = reader.varint();
+            const auto message_type = room ? reader.byte() : std::nullopt;
+            if (!message_type)
+                return std::nullopt;
+
+            if (static_cast<ca::packet_type>(*message_type & ~compressed_flag) != packet_type::message) {
+                _failed = true;
+                return std::nullopt;
+            }
+
+            auto frame = _message(reader, (*message_type & compressed_flag) != 0);
+            if (frame) {
+                frame->type = type;
+                frame->room = static_cast<ca::room_id>(*room);
+                frame->message.set_room(frame->room);
+            }
+            return frame;
+        }
+    }
+
+    _failed = true;
+    return std::nullopt;
+}
+
+std::optional<std::span<const std::byte>> ca::frame_decoder::_bytes(ca::wire::reader &reader, std::uint64_t size) {
+    if (size > _limits.max_frame_size) {
+        _overflow();
+        return std::nullopt;
+    }
+    return reader.bytes(size);
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_chunk(ca::wire::reader &reader) {
+    const auto more = reader.byte();
+    const auto size = more ? reader.varint() : std::nullopt;
+    const auto piece = size ? _bytes(reader, *size) : std::nullopt;
+    if (!piece)
+        return std::nullopt;
+
+    // The whole packet has to stay within the limit, not just every piece of it
+    const auto required = _chunks.size() + piece->size();
+    if (required > _limits.max_frame_size) {
+        _overflow();
+        return std::nullopt;
+    }
+
+    if (required > _chunks.capacity()) {
+        auto capacity = std::min(std::max(required, _chunks.capacity() * 2), _limits.max_frame_size);
+        if (!_chunk_reservation.resize(capacity) && !_chunk_reservation.resize(capacity = required)) {
+            _overflow();
+            return std::nullopt;
+        }
+        _chunks.reserve(capacity);
+    }
+
+    _chunks.insert(_chunks.end(), piece->begin(), piece->end());
+    return frame{.type = packet_type::chunk, .message = {}, .more = *more != 0};
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_reassemble() {
+    // Taken out first, a chunk packet inside of it would otherwise add to what's being decoded
+    const auto packet = std::exchange(_chunks, {});
+    auto reader = ca::wire::reader(packet);
+    auto frame = _decode(reader);
+
+    _chunks = std::vector<std::byte>();
+    (void) _chunk_reservation.resize(0);
+
+    // Every piece has arrived, so a packet that needs more than them (or leaves some over) is corrupt. File data is
+    // never chunked, it would point into the pieces
+    if (!frame || frame->type == packet_type::chunk || frame->type == packet_type::file_data ||
+        reader.position() != packet.size()) {
+        _failed = true;
+        return std::nullopt;
+    }
+    return frame;
+}
+
+void ca::frame_decoder::_overflow() noexcept {
+    _failed = true;
+    _oversized = true;
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_message(ca::wire::reader &reader, bool compressed) {
+    const auto time_sent = reader.timestamp();
+    const auto size = time_sent ? reader.varint() : std::nullopt;
+    const auto payload = size ? _bytes(reader, *size) : std::nullopt;
+    if (!payload)
+        return std::nullopt;
+
+    // The content goes straight from the receive buffer (or the decompressor) into a block of the slab pool
+    const auto text = std::string_view(reinterpret_cast<const char *>(payload->data()), payload->size());
+    auto content = compressed ? _decompress(*payload) : std::optional(ca::pooled_string(text));
+    if (!content) {
+        _failed = true;
+        return std::nullopt;
+    }
+
+    // Checked once here, everything after this (the UI, the relay's log and search index) can rely on valid UTF-8
+    // without null bytes. Only text that needs repairing is copied for it
+    if (!ca::utf8::valid(*content)) {
+        auto repaired = std::string(content->view());
+        ca::utf8::sanitize(repaired);
+        content = ca::pooled_string(repaired);
+    }
+    return frame{.type = packet_type::message, .message = ca::message(*time_sent, std::move(*content))};
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_dictionary(ca::wire::reader &reader) {
+    const auto version = reader.varint();
+    const auto size = version ? reader.varint() : std::nullopt;
+    if (!size)
+        return std::nullopt;
+
+    if (*size > ca::max_dictionary_size) {
+        _failed = true;
+        return std::nullopt;
+    }
+
+    const auto content = _bytes(reader, *size);
+    if (!content)
+        return std::nullopt;
+
+    auto dictionary = std::make_shared<const ca::dictionary>(static_cast<std::uint32_t>(*version),
+                                                             std::vector(content->begin(), content->end()));
+    if (!dictionary->valid()) {
+        _failed = true;
+        return std::nullopt;
+    }
+    return frame{.type = packet_type::dictionary, .message = {}, .dictionary = std::move(dictionary)};
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_file_offer(ca::wire::reader &reader) {
+    const auto transfer = reader.varint();
+    const auto size = transfer ? reader.varint() : std::nullopt;
+    const auto content_hash = size ? reader.varint() : std::nullopt;
+    const auto name_size = content_hash ? reader.varint() : std::nullopt;
+    const auto name_bytes = name_size ? _bytes(reader, *name_size) : std::nullopt;
+    if (!name_bytes)
+        return std::nullopt;
+
+    // Whatever the other side sends, it can only ever name a file in the directory it's saved to
+    auto name = std::string(reinterpret_cast<const char *>(name_bytes->data()), name_bytes->size());
+    if (const auto separator = name.find_last_of("/\\"); separator != std::string::npos)
+        name.erase(0, separator + 1);
+    ca::utf8::sanitize(name);
+    std::replace_if(name.begin(), name.end(), [](char c) { return c >= 0 && c < ' '; }, '_');
+    if (name.size() > max_file_name_size) {
+        // Cut before a character, not in the middle of one
+        auto end = max_file_name_size;
+        while (end > 0 && (static_cast<unsigned char>(name[end]) & 0xC0) == 0x80)
+            end--;
+        name.resize(end);
+    }
+    if (name.empty() || name == "." || name == "..")
+        name = "file";
+
+    return frame{.type = packet_type::file_offer, .message = {}, .transfer = *transfer, .file_size = *size,
+                 .content_hash = *content_hash, .name = std::move(name)};
+}
+
+std::optional<ca::frame_decoder::frame> ca::frame_decoder::_history(ca::wire::reader &reader) {
+    const auto room = reader.varint();
+    const auto last_sequence = room ? reader.varint() : std::nullopt;
+    const auto more = last_sequence ? reader.byte() : std::nullopt;
+    if (!more)
+        return std::nullopt;
+
+    auto history = frame{.type = packet_type::history, .message = {}, .sequence = *last_sequence,
+                         .history_room = *room ? std::optional(static_cast<ca::room_id>(*room - 1)) : std::nullopt,
+                         .more = *more != 0};
+    if (!_message_block(reader, history))
+        return std::nullopt;
+    return history;
+}
+
+bool ca::frame_decoder::_message_block(ca::wire::reader &reader, frame &frame) {
+    const auto size = reader.varint();
+    const auto payload = size ? _bytes(reader, *size) : std::nullopt;
+    if (!payload)
+        return false;
+
+    auto block_reader = ca::wire::reader(*payload);
+    const auto codec = block_reader.byte();
+    const auto original_size = codec ? block_reader.varint() : std::nullopt;
+    if (!original_size) {
+        _failed = true;
+        return false;
+    }
+
+    if (*original_size > _limits.max_frame_size) {
+        _overflow();
+        return false;
+    }
+
+    // Stored uncompressed when compressing didn't pay off
+    const auto block = payload->subspan(block_reader.position());
+    auto decompressed = std::optional<std::string>();
+    if (static_cast<ca::codec>(*codec) != ca::codec::none) {
+        decompressed = std::string(*original_size, '\0');
+        if (!ca::decompress(static_cast<ca::codec>(*codec), block, *decompressed)) {
+            _failed = true;
+            return false;
+        }
+    }
+    const auto messages = decompressed ? std::as_bytes(std::span(*decompressed)) : block;
+
+    // Nothing but sequenced messages, the block is complete so running out of data means it's corrupt
+    auto messages_reader = ca::wire::reader(messages);
+    while (messages_reader.position() < messages.size()) {
+        const auto type = messages_reader.byte();
+        const auto sequence = type == std::uint8_t(packet_type::sequenced) ? messages_reader.varint() : std::nullopt;
+        auto message = sequence ? _decode(messages_reader, true) : std::nullopt;
+        if (!message) {
+            _failed = true;
+            return false;
+        }
+        frame.history.emplace_back(*sequence, std::move(message->message));
+    }
+    return true;
+}
+
+std::optional<ca::pooled_string> ca::frame_decoder::_decompress(std::span<const std::byte> payload) {
+    auto reader = ca::wire::reader(payload);
+
+    const auto codec = reader.byte();
+    const auto original_size = codec ? reader.varint() : std::nullopt;
+    if (!original_size)
+        return std::nullopt;
+
+    // Nothing is allocated for it before this, a few compressed bytes can claim any size
+    if (*original_size > _limits.max_frame_size) {
+        _overflow();
+        return std::nullopt;
+    }
+
+    auto content = ca::pooled_string(static_cast<size_t>(*original_size));
+    const auto output = std::span(content.data(), content.size());
+    if (static_cast<ca::codec>(*codec) != ca::codec::zstd_dictionary) {
+        if (!ca::decompress(static_cast<ca::codec>(*codec), payload.subspan(reader.position()), output))
+            return std::nullopt;
+        return content;
+    }
+
+    const auto version = reader.varint();
+    if (!version)
+        return std::nullopt;
+
+    for (const auto &dictionary : _dictionaries) {
+        if (dictionary && dictionary->version() == *version) {
+            if (!dictionary->decompress(payload.subspan(reader.position()), output))
+                return std::nullopt;
+            return content;
+        }
+    }
+    return std::nullopt;
+}
+
+size_t ca::frame_decoder::_available() const noexcept {
+    return _buffer.size() - _offset;
+}
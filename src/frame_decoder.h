@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <frame_limits.h>
+#include <message.h>
+#include <packet.h>
+#include <presence.h>
+#include <wire.h>
+
+namespace ca {
+    /// Reassembles packets from a byte stream, the bytes can arrive split up at any point. Packets bigger than the
+    /// frame limit fail the stream as soon as their declared size arrives, so a peer can't make the buffer grow past
+    /// one packet of the limit's size. Packets sent as chunk packets are put back together before they're decoded,
+    /// the pieces count towards the same limit
+    class frame_decoder {
+    public:
+        struct frame {
+            ca::packet_type type;
+            ca::message message;       // Only valid for packet_type::message and room_message
+            size_t message_hash = 0;   // Only valid for packet_type::message_read
+            ca::room_id room = 0;      // Only valid for packet_type::subscribe, unsubscribe and room_message
+            std::uint8_t codecs = 0;   // Only valid for packet_type::hello
+            std::uint32_t version = 0; // Only valid for packet_type::hello
+            size_t max_frame_size = 0; // Only valid for packet_type::hello
+            std::uint64_t ping_time = 0; // Only valid for packet_type::ping and pong
+            std::uint64_t sequence = 0;  // Set for messages that were sequenced, and for packet_type::ack, resume,
+                                         // sync (the last one known) and history (the one to continue after)
+            std::uint64_t session = 0;      // Only valid for packet_type::resume
+            std::uint64_t peer_session = 0; // Only valid for packet_type::resume
+            std::shared_ptr<const ca::dictionary> dictionary = nullptr; // Only valid for packet_type::dictionary
+            // Only valid for packet_type::sync, history, presence and presence_summary, empty for the messages that
+            // weren't sent to a room
+            std::optional<ca::room_id> history_room = std::nullopt;
+            std::uint64_t since = 0;  // Only valid for packet_type::sync
+            std::uint32_t limit = 0;  // Only valid for packet_type::sync
+            bool more = false;        // Only valid for packet_type::history (and chunk, which next never returns)
+            // Only valid for packet_type::history and search_results, the messages and their sequence numbers
+            std::vector<std::pair<std::uint64_t, ca::message>> history = {};
+            std::uint64_t query_id = 0; // Only valid for packet_type::search and search_results
+            std::string query = {};     // Only valid for packet_type::search
+            // Only valid for packet_type::presence_summary, and presence (online 0, typing 1 if the sender is typing)
+            ca::presence presence = {};
+            std::uint64_t transfer = 0;     // Only valid for packet_type::file_offer, file_accept, file_data and file_done
+            std::uint64_t offset = 0;       // Only valid for packet_type::file_accept and file_data
+            std::uint64_t file_size = 0;    // Only valid for packet_type::file_offer
+            std::uint64_t content_hash = 0; // Only valid for packet_type::file_offer
+            std::string name = {};          // Only valid for packet_type::file_offer, sanitized to a plain file name
+            bool verified = false;          // Only valid for packet_type::file_done
+            // Only valid for packet_type::file_data, it points into the decoder's buffer and is only valid until the
+            // next #feed
+            std::span<const std::byte> data = {};
+        };
+
+        /// \param limits The biggest packet to accept, the same that's sent to the other side in our hello
+        /// \param budget Where the buffer's memory is reserved from, has to outlive the decoder. Null for no budget
+        explicit frame_decoder(ca::frame_limits limits = {}, ca::receive_budget *budget = nullptr);
+
+        /// Appends received bytes to the stream
+        /// \param data The bytes read from the socket
+        void feed(std::span<const std::byte> data);
+
+        /// Lets the decoder decompress messages that were compressed with a dictionary. The previous dictionary is
+        /// kept around as well, for messages that were sent before the other side switched over
+        /// \param dictionary The dictionary the other side was sent
+        void add_dictionary(std::shared_ptr<const ca::dictionary> dictionary);
+
+        /// Decodes the next complete packet in the stream
+        /// \return The packet, or an empty optional if a full packet hasn't arrived yet
+        [[nodiscard]] std::optional<frame> next();
+
+        /// If the stream contained a packet type we don't understand (or content that doesn't decompress),
+        /// nothing more can be decoded after that
+        /// \return true if the stream is corrupt
+        [[nodiscard]] bool failed() const noexcept;
+
+        /// The stream didn't start with a hello packet for our protocol version, this also makes it #failed
+        /// \return true if the other side speaks a different version of the protocol
+        [[nodiscard]] bool incompatible() const noexcept;
+
+        /// The other side sent a packet bigger than the frame limit, or more than the budget had left to buffer it,
+        /// this also makes it #failed
+        /// \return true if the other side went past the limits
+        [[nodiscard]] bool oversized() const noexcept;
+
+    private:
+        /// Internal function: Decodes a single packet
+        /// \param reader Reads from the start of the packet
+        /// \param sequenced If the packet is wrapped in a sequenced packet, then it has to be a message
+        /// \return The packet, or an empty optional if it hasn't fully arrived yet (or is corrupt, which sets _failed)
+        [[nodiscard]] std::optional<frame> _decode(ca::wire::reader &reader, bool sequenced = false);
+
+        /// Internal function: Reads a part of a packet whose size the other side declared, the size is checked against
+        /// the frame limit first
+        /// \return The bytes, or an empty optional if they haven't fully arrived yet (or are too big, which sets
+        /// _failed)
+        [[nodiscard]] std::optional<std::span<const std::byte>> _bytes(ca::wire::reader &reader, std::uint64_t size);
+
+        /// Internal function: Adds the piece of a chunk packet to the packet being put back together, after its type
+        /// byte
+        /// \return A chunk frame (more is false for the last piece), or an empty optional if the piece hasn't fully
+        /// arrived yet (or makes the packet too big, which sets _failed)
+        [[nodiscard]] std::optional<frame> _chunk(ca::wire::reader &reader);
+
+        /// Internal function: Decodes the packet the pieces of chunk packets were put back together into
+        /// \return The packet, or an empty optional if the pieces aren't exactly one packet (which sets _failed)
+        [[nodiscard]] std::optional<frame> _reassemble();
+
+        /// Internal function: Marks the stream as failed because the other side went past the limits
+        void _overflow() noexcept;
+
+        /// Internal function: Decodes the rest of a message packet, after its type byte
+        /// \param compressed If the type byte had the compressed flag set
+        [[nodiscard]] std::optional<frame> _message(ca::wire::reader &reader, bool compressed);
+
+        /// Internal function: Decodes the rest of a dictionary packet, after its type byte
+        [[nodiscard]] std::optional<frame> _dictionary(ca::wire::reader &reader);
+
+        /// Internal function: Decodes the rest of a file_offer packet, after its type byte
+        [[nodiscard]] std::optional<frame> _file_offer(ca::wire::reader &reader);
+
+        /// Internal function: Decodes the rest of a history packet, after its type byte
+        [[nodiscard]] std::optional<frame> _history(ca::wire::reader &reader);
+
+        /// Internal function: Decodes a block of sequenced messages (see packet::message_block) into frame::history
+        /// \return false if the block hasn't fully arrived yet (or is corrupt, which sets _failed)
+        [[nodiscard]] bool _message_block(ca::wire::reader &reader, frame &frame);
+
+        /// Internal function: Decompresses the content of a compressed message packet
+        /// \param payload The content as it was sent (codec, sizes and compressed data)
+        /// \return The message content (in the decoding thread's slab pool), or an empty optional if it can't be
+        /// decompressed (or would be bigger than the frame limit, which sets _oversized)
+        [[nodiscard]] std::optional<ca::pooled_string> _decompress(std::span<const std::byte> payload);
+
+        /// Internal function: How many bytes are buffered but not decoded yet
+        [[nodiscard]] size_t _available() const noexcept;
+
+        ca::frame_limits _limits;
+        ca::receive_budget::reservation _reservation; // Covers the capacity of the buffer
+
+        bool _failed = false;
+        bool _incompatible = false;
+        bool _oversized = false;
+        bool _handshake_done = false; // If the hello packet has been decoded
+
+        std::array<std::shared_ptr<const ca::dictionary>, 2> _dictionaries; // The newest one first
+
+        size_t _offset = 0; // Read position in the buffer, everything before it has been decoded
+        std::vector<std::byte> _buffer;
+
+        std::vector<std::byte> _chunks; // The pieces of a chunked packet so far
+        ca::receive_budget::reservation _chunk_reservation; // Covers the capacity of the pieces
+    };
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace ca {
+    /// How much memory the other side of a connection can make us use. No packet can be bigger than max_frame_size,
+    /// the lengths a packet declares are checked against it before any of it is buffered, and so are decompressed
+    /// sizes before decompressing. It's sent in the hello packet so the other side never sends anything bigger.
+    /// The memory budget is shared by the receive buffers of every connection, so many peers together can't go past
+    /// it either
+    struct frame_limits {
+        size_t max_frame_size = 4 * 1024 * 1024;
+        size_t memory_budget = 256 * 1024 * 1024;
+    };
+
+    /// Memory shared between receive buffers, they reserve what they grow to and give it back when they shrink
+    class receive_budget {
+    public:
+        /// Memory taken from a budget, given back when it's destroyed
+        class reservation {
+        public:
+            reservation() = default;
+
+            /// \param budget Where the memory comes from, it has to outlive the reservation. Null reserves without limit
+            explicit reservation(receive_budget *budget) noexcept : _budget(budget) {}
+
+            reservation(reservation &&other) noexcept
+                    : _budget(std::exchange(other._budget, nullptr)), _bytes(std::exchange(other._bytes, 0)) {}
+
+            reservation &operator=(reservation &&other) noexcept {
+                if (this != &other) {
+                    (void) resize(0);
+                    _budget = std::exchange(other._budget, nullptr);
+                    _bytes = std::exchange(other._bytes, 0);
+                }
+                return *this;
+            }
+
+            ~reservation() { (void) resize(0); }
+
+            /// Changes how much is reserved
+            /// \param bytes The new size of the reservation
+            /// \return false if the budget doesn't have enough left, the reservation stays as it was then
+            [[nodiscard]] bool resize(size_t bytes) noexcept {
+                if (_budget && bytes > _bytes && !_budget->_reserve(bytes - _bytes))
+                    return false;
+                if (_budget && bytes < _bytes)
+                    _budget->_used -= _bytes - bytes;
+                _bytes = bytes;
+                return true;
+            }
+
+        private:
+            receive_budget *_budget = nullptr;
+            size_t _bytes = 0;
+        };
+
+        /// \param limit How much all reservations together can have
+        explicit receive_budget(size_t limit) noexcept : _limit(limit) {}
+
+        receive_budget(const receive_budget &) = delete;
+        receive_budget &operator=(const receive_budget &) = delete;
+
+        /// \return How much is reserved at the moment
+        [[nodiscard]] size_t used() const noexcept { return _used; }
+
+        /// \return How much can be reserved
+        [[nodiscard]] size_t limit() const noexcept { return _limit; }
+
+    private:
+        /// Internal function: Takes memory from the budget, unless that would go past the limit
+        [[nodiscard]] bool _reserve(size_t bytes) noexcept {
+            auto used = _used.load();
+            do {
+                if (bytes > _limit - used)
+                    return false;
+            } while (!_used.compare_exchange_weak(used, used + bytes));
+            return true;
+        }
+
+        const size_t _limit;
+        std::atomic<size_t> _used = 0;
+    };
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <chrono>
+
+namespace ca {
+    /// How a connection is kept alive, and when the other side is considered dead. A network processor pings every
+    /// interval and whoever is on the other side answers with a pong, so a connection that has been quiet for longer
+    /// than the timeout has crashed or lost its network, even if the socket never reported it
+    struct heartbeat_settings {
+        std::chrono::milliseconds interval = std::chrono::seconds(5);
+        std::chrono::milliseconds timeout = std::chrono::seconds(15);
+    };
+}
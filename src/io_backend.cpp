@@ -0,0 +1,70 @@
+#include "io_backend.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <poll_backend.h>
+#include <ring_backend.h>
+
+#ifdef __linux__
+#include <epoll_backend.h>
+#include <uring_backend.h>
+#endif
+
+namespace {
+    /// \param type The preferred backend
+    /// \return The backend that watches the sockets, one the platform supports
+    std::unique_ptr<ca::io_backend> make_socket_backend(ca::io_backend_type type) {
+#ifdef __linux__
+        switch (type) {
+            case ca::io_backend_type::automatic:
+            case ca::io_backend_type::io_uring:
+                // Older kernels (or sandboxes that block io_uring) make this fail, epoll is always there
+                if (auto backend = ca::uring_backend::create(); backend)
+                    return backend;
+                [[fallthrough]];
+            case ca::io_backend_type::epoll:
+                if (auto backend = ca::epoll_backend::create(); backend)
+                    return backend;
+                break;
+            case ca::io_backend_type::poll:
+                break;
+        }
+#endif
+        return ca::poll_backend::create();
+    }
+}
+
+ca::io_backend_type ca::io_backend_type_from_string(const std::string &name) {
+    if (name == "epoll")
+        return ca::io_backend_type::epoll;
+    if (name == "io_uring" || name == "uring")
+        return ca::io_backend_type::io_uring;
+    if (name == "poll")
+        return ca::io_backend_type::poll;
+    return ca::io_backend_type::automatic;
+}
+
+ca::backpressure_policy ca::backpressure_policy_from_string(const std::string &name) {
+    if (name == "drop_oldest")
+        return ca::backpressure_policy::drop_oldest;
+    if (name == "disconnect")
+        return ca::backpressure_policy::disconnect;
+    return ca::backpressure_policy::block;
+}
+
+void ca::io_backend::_limit_unsent(int fd) noexcept {
+#ifdef TCP_NOTSENT_LOWAT
+    // Does nothing on a Unix domain socket, what it has buffered is already all the peer's to read
+    const auto bytes = int(max_unsent_bytes);
+    setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes));
+#else
+    (void) fd;
+#endif
+}
+
+std::unique_ptr<ca::io_backend> ca::make_io_backend(ca::io_backend_type type) {
+    // Shared memory connections go around whichever backend watches the sockets
+    return std::make_unique<ca::ring_backend>(make_socket_backend(type));
+}
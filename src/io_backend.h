@@ -0,0 +1,155 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <shared_bytes.h>
+#include <shared_file.h>
+
+namespace ca {
+    /// Something that happened on a socket watched by an io backend
+    struct io_event {
+        enum class type {
+            received, // Data has arrived, it's only valid for the duration of the handler
+            closed,   // The socket was closed by the other side, or failed
+            accepted  // A listener accepted a new (non-blocking) connection, fd is the new socket
+        };
+
+        type kind;
+        int fd;
+        std::span<const std::byte> data;
+    };
+
+    /// What happens when a socket's send queue is full, because the other side isn't reading fast enough
+    enum class backpressure_policy {
+        block,       // Nothing is dropped, whoever queues the data has to wait for it to drain (see io_backend::queued_bytes)
+        drop_oldest, // Chat messages and presence updates that haven't started being written are thrown away, lowest
+                     // priority and oldest first, packets the protocol depends on never are
+        disconnect   // The connection is closed
+    };
+
+    /// Which of a socket's send queues data goes into. A queue is only written from while the ones before it are empty,
+    /// within a queue everything goes out in the order it was queued. Big buffers in the normal and background queues
+    /// are written a piece at a time (see ca::write_queue), so control packets never wait for more than one piece
+    enum class send_priority : std::uint8_t {
+        control,   // Small packets the other side is waiting on: the handshake, heartbeats, acks and read receipts
+        normal,    // Chat messages and history, anything that has to stay in order with them
+        background, // Presence updates, only sent when nothing else is waiting
+        bulk        // Files (see io_backend::send_file), streamed whenever every other queue is empty
+    };
+
+    /// Upper bound on the data queued on a single socket
+    struct send_limit {
+        size_t max_bytes = 4 * 1024 * 1024;
+        ca::backpressure_policy policy = ca::backpressure_policy::block;
+    };
+
+    /// Waits on sockets and performs the reads / writes for them. Only ever used from a single thread,
+    /// with the exception of #wake
+    class io_backend {
+    public:
+        using event_handler = std::function<void(const ca::io_event &)>;
+
+        virtual ~io_backend() = default;
+
+        /// Start watching a non-blocking socket for incoming data
+        /// \param fd The socket handle
+        /// \return If the socket could be watched
+        virtual bool add(int fd) = 0;
+
+        /// Start accepting connections on a non-blocking listening socket, each one is reported as an accepted event.
+        /// Accepted sockets aren't watched until they're added
+        /// \param fd The listening socket handle
+        /// \return If the socket could be watched
+        virtual bool add_listener(int fd) = 0;
+
+        /// Stop watching a socket (or listener), anything still queued for it is discarded
+        /// \param fd The socket handle
+        virtual void remove(int fd) = 0;
+
+        /// Queue a packet to be written to the socket, packets of the same priority are written in the order they're
+        /// queued. Only a reference is kept, the same buffer can be queued on any number of sockets
+        /// \param fd The socket handle (must have been added)
+        /// \param bytes The packet to send
+        /// \param priority Which queue it goes into
+        virtual void send(int fd, ca::shared_bytes bytes, ca::send_priority priority = ca::send_priority::normal) = 0;
+
+        /// Same as the shared version, for data that only goes to a single socket
+        /// \param fd The socket handle (must have been added)
+        /// \param bytes The packet to send
+        /// \param priority Which queue it goes into
+        void send(int fd, std::vector<std::byte> bytes, ca::send_priority priority = ca::send_priority::normal) {
+            send(fd, ca::make_shared_bytes(std::move(bytes)), priority);
+        }
+
+        /// Queue a file to be streamed to the socket as file_data packets in the send_priority::bulk queue. It's read
+        /// straight from the page cache into the socket (sendfile) a packet at a time, so it takes up no memory while
+        /// it's queued and isn't counted in #queued_bytes. The socket has to be non-blocking, and SIGPIPE ignored
+        /// \param fd The socket handle (must have been added)
+        /// \param transfer The transfer id the packets are for
+        /// \param file The file to send, it's kept open until it's been sent or the socket is removed
+        /// \param offset Where in the file to start
+        virtual void send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                               size_t offset) = 0;
+
+        /// Waits until there is socket activity, a #wake or the timeout, and handles everything that happened
+        /// \param timeout The longest amount of time to wait for
+        /// \param handler Called for every event
+        virtual void wait(std::chrono::milliseconds timeout, const event_handler &handler) = 0;
+
+        /// Wakes up a #wait that is in progress, this is safe to call from any thread
+        virtual void wake() = 0;
+
+        /// How much data is queued on a socket but hasn't been written yet
+        /// \param fd The socket handle
+        /// \return The number of bytes, 0 for sockets that aren't watched
+        [[nodiscard]] virtual size_t queued_bytes(int fd) const = 0;
+
+        /// Bounds the send queue of every socket, it's checked whenever more data is queued
+        /// \param limit The maximum queue size, and what to do when a socket goes over it
+        virtual void set_send_limit(ca::send_limit limit) noexcept { _send_limit = limit; }
+
+        /// The backend name, used for displaying / logging
+        /// \return The name of the backend
+        [[nodiscard]] virtual const char *name() const noexcept = 0;
+
+    protected:
+        /// How much a TCP socket keeps in the kernel that hasn't been sent yet, anything more waits in our queues where
+        /// control packets can still get ahead of it
+        static constexpr auto max_unsent_bytes = 32 * 1024;
+
+        /// Internal function: Applies #max_unsent_bytes to a socket that's being added, sockets other than TCP ones
+        /// are left as they are
+        static void _limit_unsent(int fd) noexcept;
+
+        ca::send_limit _send_limit;
+    };
+
+    enum class io_backend_type {
+        automatic, // io_uring when the kernel supports it, otherwise epoll
+        epoll,
+        io_uring,
+        poll       // Portable fallback for when neither epoll nor io_uring exist
+    };
+
+    /// Parses a backend name ("auto", "epoll", "io_uring", "poll")
+    /// \param name The backend name
+    /// \return The backend type, unknown names result in automatic
+    [[nodiscard]] ca::io_backend_type io_backend_type_from_string(const std::string &name);
+
+    /// Parses a backpressure policy name ("block", "drop_oldest", "disconnect")
+    /// \param name The policy name
+    /// \return The policy, unknown names result in block
+    [[nodiscard]] ca::backpressure_policy backpressure_policy_from_string(const std::string &name);
+
+    /// Creates the requested backend, falling back to one that the platform supports if it isn't available
+    /// \param type The preferred backend
+    /// \return The created backend
+    [[nodiscard]] std::unique_ptr<ca::io_backend> make_io_backend(ca::io_backend_type type);
+}
@@ -1,13 +1,238 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
 #include <display.h>
 #include <network_processor.h>
+#include <relay_server.h>
+#include <trace.h>
+
+namespace {
+    volatile std::sig_atomic_t stop_requested = 0;
+
+    /// Runs the headless multi-user relay until the process is interrupted
+    /// Usage: ChatApplication --relay [port] [shards]
+    int run_relay(int argc, char **argv, ca::io_backend_type io_backend, ca::send_limit send_limit,
+                  ca::heartbeat_settings heartbeat, ca::frame_limits frames, ca::presence_settings presence) {
+        const auto port = static_cast<std::uint16_t>(argc > 2 ? std::atoi(argv[2]) : 50000);
+        const auto shards = argc > 3 ? static_cast<size_t>(std::atoi(argv[3])) : size_t(std::thread::hardware_concurrency());
+
+        // CA_HISTORY is the file the relay logs every message to, for clients to sync their history from
+        const auto history = std::getenv("CA_HISTORY");
+        const auto history_path = std::string(history ? history : "relay_history.log");
+
+        auto relay = ca::relay_server(shards, io_backend, send_limit, heartbeat, history_path, frames, presence);
+        if (!relay.history_persistent())
+            std::fprintf(stderr, "Can't use %s for the history, it's only kept in memory\n", history_path.c_str());
+
+        // CA_UNIX_SOCKET is the path of a Unix domain socket the relay listens on as well, for clients on this host.
+        // CA_SHM_SOCKET is the same, with the data going through shared memory rings next to the socket
+        const auto shm_path = std::getenv("CA_SHM_SOCKET");
+        const auto local_path = shm_path ? shm_path : std::getenv("CA_UNIX_SOCKET");
+        const auto local_address = local_path ? (shm_path ? "shm:" : "unix:") + std::string(local_path) : "";
+
+        const auto bound_port = relay.start(port, local_address);
+        if (bound_port == 0) {
+            std::fprintf(stderr, "Failed to listen on port %hu%s%s\n", port, local_path ? " or " : "",
+                         local_path ? local_path : "");
+            return 1;
+        }
+
+        std::printf("Relay listening on port %hu with %zu shards\n", bound_port, relay.shard_count());
+        if (local_path)
+            std::printf("Relay listening on %s\n", local_address.c_str());
+
+        std::signal(SIGINT, [](int) { stop_requested = 1; });
+        std::signal(SIGTERM, [](int) { stop_requested = 1; });
+
+        using namespace std::chrono_literals;
+        while (!stop_requested)
+            std::this_thread::sleep_for(100ms);
+
+        relay.stop();
+        ca::trace::dump();
+        return 0;
+    }
+
+    /// What a benchmark run got through
+    struct bench_result {
+        size_t received = 0;
+        double seconds = 0;
+        std::string backend;
+    };
+
+    /// Runs a server and a client in this process, connected locally so there's no network in between, and
+    /// measures how fast the client's messages get through the protocol to the server
+    /// \param address Where the server listens, "memory:<name>" or "unix:<path>"
+    /// \return What got through, nothing if it couldn't connect
+    std::optional<bench_result> bench(const std::string &address, size_t count, size_t size,
+                                      ca::io_backend_type io_backend, ca::send_limit send_limit,
+                                      ca::heartbeat_settings heartbeat, ca::frame_limits frames,
+                                      ca::presence_settings presence) {
+        auto server = ca::network_processor(io_backend, send_limit, heartbeat, frames, presence);
+        auto client = ca::network_processor(io_backend, send_limit, heartbeat, frames, presence);
+
+        server.set_mode(ca::client_mode::server);
+        server.listen_locally(address);
+        (void) server.create_server();
+        client.set_mode(ca::client_mode::client);
+
+        auto accepting = std::thread([&server]() { server.wait_on_connection(); });
+        client.connect(server.server_address(), 0);
+        accepting.join();
+        if (!client.error().empty() || !server.error().empty())
+            return std::nullopt;
+
+        const auto content = std::string(size, 'x');
+        const auto start = std::chrono::steady_clock::now();
+        auto sending = std::thread([&client, &content, count]() {
+            for (auto i = size_t(0); i < count; i++)
+                client.queue_message(ca::message(content));
+        });
+
+        using namespace std::chrono_literals;
+        auto received = size_t(0);
+        while (received < count && client.error().empty()) {
+            received += server.incoming_messages().size();
+            std::this_thread::sleep_for(1ms);
+        }
+        sending.join();
+
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return bench_result{.received = received, .seconds = seconds, .backend = server.io_backend_name()};
+    }
+
+    /// Benchmarks the protocol end to end in memory. With CA_IO_BACKEND unset (or auto) it's then run once over epoll
+    /// and once over io_uring so the two can be compared, over a Unix domain socket: in memory the data doesn't go
+    /// through the sockets the backends service
+    /// Usage: ChatApplication --bench [messages] [message size]
+    int run_bench(int argc, char **argv, ca::io_backend_type io_backend, ca::send_limit send_limit,
+                  ca::heartbeat_settings heartbeat, ca::frame_limits frames, ca::presence_settings presence) {
+        const auto count = argc > 2 ? static_cast<size_t>(std::atoll(argv[2])) : size_t(100000);
+        const auto size = argc > 3 ? static_cast<size_t>(std::atoll(argv[3])) : size_t(64);
+
+        auto runs = std::vector<std::pair<std::string, ca::io_backend_type>>{{"memory:bench", io_backend}};
+        if (io_backend == ca::io_backend_type::automatic) {
+            const auto path = std::filesystem::temp_directory_path() /
+                              ("ca-bench-" + std::to_string(::getpid()) + ".sock");
+            runs.emplace_back("unix:" + path.string(), ca::io_backend_type::epoll);
+            runs.emplace_back("unix:" + path.string(), ca::io_backend_type::io_uring);
+        }
+
+        auto results = std::vector<bench_result>();
+        for (const auto &[address, backend] : runs) {
+            const auto result = bench(address, count, size, backend, send_limit, heartbeat, frames, presence);
+            if (!result) {
+                std::fprintf(stderr, "Failed to connect to %s\n", address.c_str());
+                return 1;
+            }
+
+            std::printf("%zu of %zu messages of %zu bytes over %s with %s in %.3f s: %.0f messages/s, %.1f MiB/s\n",
+                        result->received, count, size, address.substr(0, address.find(':')).c_str(),
+                        result->backend.c_str(), result->seconds, double(result->received) / result->seconds,
+                        double(result->received * size) / result->seconds / (1024 * 1024));
+            results.push_back(*result);
+        }
+
+        // An io_uring the kernel doesn't allow falls back to epoll, then there's nothing to compare
+        if (results.size() == 3 && results[1].backend != results[2].backend)
+            std::printf("%s gets %.2fx the messages a second %s does\n", results[2].backend.c_str(),
+                        (double(results[2].received) / results[2].seconds) /
+                            (double(results[1].received) / results[1].seconds),
+                        results[1].backend.c_str());
+
+        ca::trace::dump();
+        const auto complete = std::all_of(results.begin(), results.end(), [count](const bench_result &result) {
+            return result.received == count;
+        });
+        return complete ? 0 : 1;
+    }
+}
+
+int main(int argc, char **argv) {
+    // Opt-in tracing, CA_TRACE is the path the Chrome trace_event JSON gets written to (on exit, or when F9 is pressed)
+    if (const auto trace_path = std::getenv("CA_TRACE"); trace_path)
+        ca::trace::enable(trace_path);
+    ca::trace::set_thread_name("ui");
 
-int main() {
     sockpp::socket_initializer initializer;
 
-    auto network_processor = ca::network_processor();
+    // CA_IO_BACKEND picks how sockets are serviced (auto, epoll, io_uring, poll), auto prefers io_uring
+    auto io_backend = ca::io_backend_type::automatic;
+    if (const auto backend_name = std::getenv("CA_IO_BACKEND"); backend_name)
+        io_backend = ca::io_backend_type_from_string(backend_name);
+
+    // CA_BACKPRESSURE is what happens to a peer that can't keep up (block, drop_oldest, disconnect),
+    // once more than CA_SEND_LIMIT bytes are queued for it
+    auto send_limit = ca::send_limit();
+    if (const auto policy = std::getenv("CA_BACKPRESSURE"); policy)
+        send_limit.policy = ca::backpressure_policy_from_string(policy);
+    if (const auto max_bytes = std::getenv("CA_SEND_LIMIT"); max_bytes)
+        send_limit.max_bytes = std::strtoull(max_bytes, nullptr, 10);
+
+    // CA_PEER_TIMEOUT is how many seconds the other side can go without answering before it's considered dead,
+    // it gets pinged a few times within that
+    auto heartbeat = ca::heartbeat_settings();
+    if (const auto timeout = std::getenv("CA_PEER_TIMEOUT"); timeout) {
+        heartbeat.timeout = std::chrono::seconds(std::max(std::atoi(timeout), 1));
+        heartbeat.interval = std::min(heartbeat.interval, heartbeat.timeout / 3);
+    }
+
+    // CA_MAX_FRAME is the biggest packet (in bytes) the other side can send, CA_RECEIVE_BUDGET how much everything
+    // received but not decoded yet can take up, over every connection
+    auto frames = ca::frame_limits();
+    if (const auto max_frame = std::getenv("CA_MAX_FRAME"); max_frame)
+        frames.max_frame_size = std::strtoull(max_frame, nullptr, 10);
+    if (const auto budget = std::getenv("CA_RECEIVE_BUDGET"); budget)
+        frames.memory_budget = std::strtoull(budget, nullptr, 10);
+
+    // CA_PRESENCE_INTERVAL is how often (in milliseconds) typing and presence updates can go out at most
+    auto presence = ca::presence_settings();
+    if (const auto interval = std::getenv("CA_PRESENCE_INTERVAL"); interval)
+        presence.interval = std::chrono::milliseconds(std::max(std::atoi(interval), 1));
+
+    // A file is streamed straight to the socket, a peer that's gone would otherwise kill the process with SIGPIPE
+    // instead of failing the write
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (argc > 1 && std::string_view(argv[1]) == "--relay")
+        return run_relay(argc, argv, io_backend, send_limit, heartbeat, frames, presence);
+    if (argc > 1 && std::string_view(argv[1]) == "--bench")
+        return run_bench(argc, argv, io_backend, send_limit, heartbeat, frames, presence);
+
+    // CA_DOWNLOADS is the directory files sent to us are saved in, CA_STORE where the content of every file sent
+    // either way is kept (up to CA_STORE_LIMIT bytes) so it never has to be sent again
+    const auto downloads = std::getenv("CA_DOWNLOADS");
+    auto store = ca::store_settings();
+    if (const auto directory = std::getenv("CA_STORE"); directory)
+        store.directory = directory;
+    if (const auto max_bytes = std::getenv("CA_STORE_LIMIT"); max_bytes)
+        store.max_bytes = std::strtoull(max_bytes, nullptr, 10);
+
+    auto network_processor = ca::network_processor(io_backend, send_limit, heartbeat, frames, presence,
+                                                   downloads ? downloads : "downloads", store);
+
+    // CA_UNIX_SOCKET makes the chat server listen on a Unix domain socket instead of a TCP port, clients on the same
+    // host connect to it as unix:<path>. CA_SHM_SOCKET does the same for shm:<path>
+    if (const auto local_path = std::getenv("CA_SHM_SOCKET"); local_path)
+        network_processor.listen_locally("shm:" + std::string(local_path));
+    else if (const auto unix_path = std::getenv("CA_UNIX_SOCKET"); unix_path)
+        network_processor.listen_locally("unix:" + std::string(unix_path));
 
     const auto display = ca::display();
     while (display.running())
         display.render(network_processor);
+
+    ca::trace::dump();
     return 0;
 }
@@ -0,0 +1,122 @@
+#include "memory_transport.h"
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <shm_ring.h>
+
+namespace {
+    /// A name something listens on
+    struct listener {
+        int fd;     // What #listen returned, the read end
+        int notify; // Gets a byte for every connection that's waiting
+        std::deque<int> pending; // The accepting sides of the connections that are waiting, oldest first
+    };
+
+    std::mutex listeners_mutex;
+    std::unordered_map<std::string, listener> listeners;
+
+    /// \param fd A listener's socket
+    /// \return Its entry, nullptr if it isn't one (listeners_mutex has to be held)
+    listener *find_listener(int fd) {
+        for (auto &[name, entry] : listeners)
+            if (entry.fd == fd)
+                return &entry;
+        return nullptr;
+    }
+}
+
+int ca::memory_transport::connect(const ca::endpoint &endpoint) {
+    const auto lock = std::lock_guard(listeners_mutex);
+    const auto it = listeners.find(endpoint.address);
+    if (it == listeners.end()) {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+
+    auto sockets = std::array<int, 2>();
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets.data()) != 0)
+        return -1;
+
+    const auto [connecting, accepting] = ca::shm_channel::create_pair();
+    const auto byte = std::byte(1);
+    if (!connecting || ::send(it->second.notify, &byte, 1, MSG_NOSIGNAL) != 1) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+
+    ca::shm_channel::attach(sockets[0], connecting);
+    ca::shm_channel::attach(sockets[1], accepting);
+    it->second.pending.push_back(sockets[1]);
+    return sockets[0];
+}
+
+int ca::memory_transport::listen(const ca::endpoint &endpoint) {
+    if (endpoint.address.empty())
+        return -1;
+
+    const auto lock = std::lock_guard(listeners_mutex);
+    if (listeners.contains(endpoint.address)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    auto sockets = std::array<int, 2>();
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets.data()) != 0)
+        return -1;
+
+    listeners[endpoint.address] = {.fd = sockets[0], .notify = sockets[1], .pending = {}};
+    return sockets[0];
+}
+
+int ca::memory_transport::accept(int listener) {
+    auto byte = std::byte();
+    auto read = ssize_t();
+    while ((read = ::read(listener, &byte, 1)) < 0 && errno == EINTR)
+        ;
+    return read == 1 ? take(listener) : -1;
+}
+
+void ca::memory_transport::unlisten(const ca::endpoint &endpoint) {
+    const auto lock = std::lock_guard(listeners_mutex);
+    const auto it = listeners.find(endpoint.address);
+    if (it == listeners.end())
+        return;
+
+    // The listener's own end has been closed already
+    close(it->second.notify);
+    for (const auto fd : it->second.pending) {
+        (void) ca::shm_channel::detach(fd);
+        close(fd);
+    }
+    listeners.erase(it);
+}
+
+const char *ca::memory_transport::name() const noexcept {
+    return "memory";
+}
+
+bool ca::memory_transport::listening(int fd) {
+    const auto lock = std::lock_guard(listeners_mutex);
+    return find_listener(fd) != nullptr;
+}
+
+int ca::memory_transport::take(int listener) {
+    const auto lock = std::lock_guard(listeners_mutex);
+    const auto entry = find_listener(listener);
+    if (!entry || entry->pending.empty())
+        return -1;
+
+    const auto fd = entry->pending.front();
+    entry->pending.pop_front();
+    return fd;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <transport.h>
+
+namespace ca {
+    /// Connections under a name instead of an address, between two sides in the same process. It's the quickest way
+    /// the protocol can be run end to end (--bench uses it): the data goes through a pair of rings in memory (see
+    /// ca::shm_channel), nothing goes near the network stack, the filesystem or a socket buffer.
+    /// A connection is still a socket pair, so the io backends can watch it, but only for wake ups and to tell when
+    /// the other side is gone (see ca::ring_backend). A listener is one as well, its other end gets a byte for every
+    /// connection that's waiting. Names are only known within the process, nothing else can connect to them
+    class memory_transport : public ca::transport {
+    public:
+        [[nodiscard]] int connect(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] int listen(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] int accept(int listener) override;
+
+        /// Forgets the name, and closes the connections nobody accepted
+        void unlisten(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] const char *name() const noexcept override;
+
+        /// \param fd A socket
+        /// \return If it's a listener from #listen, io backends watch it for incoming data instead of connections
+        [[nodiscard]] static bool listening(int fd);
+
+        /// Takes the oldest connection that's waiting on a listener, for each byte that came in on it
+        /// \param listener The listener from #listen
+        /// \return The accepting side's socket (blocking), -1 if there's none
+        [[nodiscard]] static int take(int listener);
+    };
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <charconv>
 #include <cstddef>
 #include <vector>
 #include <cstring>
@@ -7,10 +9,19 @@
 #include <chrono>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <unordered_map>
 
+#include <slab_pool.h>
+#include <wire.h>
+
 namespace ca {
+    /// Identifies a chat room on a relay server
+    using room_id = std::uint32_t;
+
+    /// A chat message, move only so nothing copies one by accident. The content can't change once it's created, so a
+    /// message that needs two owners (the chat history and the send queue) is #share'd, which only shares the content
     class message {
     public:
         enum class sender {
@@ -21,37 +32,36 @@ namespace ca {
 
         message() = default;
 
-        message(std::uint64_t sent, std::string content) : _sender(message::sender::other), _sent(sent),
-                                                           _content(std::move(content)) { _calc_hash(); }
-
-        explicit message(std::string content) : _seen(false), _sender(message::sender::self),
-                                                _sent(duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()),
-                                                _content(std::move(content)) { _calc_hash(); }
-
-        /// Serializes the message data into a vector of bytes
-        /// \return Serialized data as a byte vector
-        [[nodiscard]] std::vector<std::byte> as_stream() const noexcept {
-            auto stream = std::vector<std::byte>(
-                    sizeof(std::uint64_t) +
-                    sizeof(size_t) +
-                    _content.size() +
-                    1);
-
-            const auto size = _content.size();
+        message(std::uint64_t sent, ca::pooled_string content) : _sender(message::sender::other), _sent(sent),
+                                                                 _content(std::move(content)) { _calc_hash(); }
 
-            auto data = stream.data();
-            stream[0] = std::byte(0); // The 0 means that this is a new message packet
-            data++;
+        explicit message(std::string_view content) : _seen(false), _sender(message::sender::self),
+                                                     _sent(duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()),
+                                                     _content(content) { _calc_hash(); }
 
-            std::memcpy(data, &_sent, sizeof(std::uint64_t));
-            data += sizeof(std::uint64_t);
+        message(message &&) noexcept = default;
+        message &operator=(message &&) noexcept = default;
 
-            std::memcpy(data, &size, sizeof(size_t));
-            data += sizeof(size_t);
+        /// Another message with the same content, time and state, the content itself isn't copied
+        /// \return The new owner of the message
+        [[nodiscard]] message share() const noexcept { return *this; }
 
-            std::memcpy(data, _content.c_str(), _content.size());
+        /// Serializes the message data into a vector of bytes: the packet type, the time sent and the content size
+        /// as varints (see ca::wire::writer), and then the content
+        /// \return Serialized data as a byte vector
+        [[nodiscard]] std::vector<std::byte> as_stream() const noexcept {
+            auto stream = ca::wire::writer(1 + 2 * ca::wire::max_varint_size + _content.size());
+            write(stream);
+            return stream.take();
+        }
 
-            return stream;
+        /// Serializes the message the same as #as_stream, behind whatever the writer has already
+        /// \param stream The writer
+        void write(ca::wire::writer &stream) const {
+            stream.byte(0); // The 0 means that this is a new message packet
+            stream.timestamp(_sent);
+            stream.varint(_content.size());
+            stream.bytes(std::as_bytes(std::span(_content.data(), _content.size())));
         }
 
         void set_seen() noexcept { _seen = true; }
@@ -64,14 +74,20 @@ namespace ca {
         /// \return The time in seconds since epoch
         [[nodiscard]] std::uint64_t time_sent() const noexcept { return _sent; }
 
-        /// The message string content
+        /// The message string content, kept in the slab pool of the thread that created the message
         /// \return Message content
-        [[nodiscard]] const std::string &content() const noexcept { return _content; }
+        [[nodiscard]] const ca::pooled_string &content() const noexcept { return _content; }
 
         /// Gives you a unique identifier for the message by using it's hash
         /// \return The message unique hash
         [[nodiscard]] size_t hash() const noexcept { return _hash; }
 
+        /// The room the message was sent to, only set for messages received through a relay server
+        /// \return The room id, 0 if the message wasn't sent to a room
+        [[nodiscard]] ca::room_id room() const noexcept { return _room; }
+
+        void set_room(ca::room_id room) noexcept { _room = room; }
+
         [[nodiscard]] bool operator==(size_t hash) const noexcept {
             return _hash == hash;
         }
@@ -96,14 +112,19 @@ namespace ca {
         }
 
     private:
+        message(const message &) noexcept = default;
 
         /// Creates a hash from the message content and timestamp, allowing for unique-identifiers
-        void _calc_hash() {
-            const auto combined_string = _content + std::to_string(_sent);
+        void _calc_hash() noexcept {
+            // The content followed by the timestamp's digits, without putting them together in a new string
+            auto digits = std::array<char, 20>();
+            const auto digits_end = std::to_chars(digits.data(), digits.data() + digits.size(), _sent).ptr;
 
             // Calculating hash by hand - std::hash is nondeterministic
             _hash = size_t(37);
-            for (const auto letter : combined_string)
+            for (const auto letter : _content.view())
+                _hash = (_hash * 54059) ^ (letter * 76963);
+            for (const auto letter : std::string_view(digits.data(), digits_end))
                 _hash = (_hash * 54059) ^ (letter * 76963);
             _hash %= 86969; // Using all the prime numbers possible
         }
@@ -112,6 +133,7 @@ namespace ca {
         size_t _hash = ~0;
         ca::message::sender _sender = message::sender::unknown;
         std::uint64_t _sent = 0;
-        std::string _content;
+        ca::room_id _room = 0;
+        ca::pooled_string _content;
     };
 }
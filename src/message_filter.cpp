@@ -0,0 +1,173 @@
+#include "message_filter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CA_FILTER_X86 1
+#endif
+
+namespace {
+    /// Below this many bytes a scan is quicker than starting threads for it
+    constexpr auto parallel_threshold = size_t(4 * 1024 * 1024);
+
+    [[nodiscard]] constexpr char lower(char c) noexcept {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    /// If the needle is at a position whose first and last bytes already matched
+    [[nodiscard]] inline bool middle_matches(const char *position, std::string_view needle) noexcept {
+        return needle.size() < 3 || std::memcmp(position + 1, needle.data() + 1, needle.size() - 2) == 0;
+    }
+
+    /// Finds the first occurrence of the needle (at least 1 byte) without any vector instructions
+    /// \return The occurrence, or end if there is none
+    [[nodiscard]] const char *scan_scalar(const char *begin, const char *end, std::string_view needle) noexcept {
+        const auto haystack = std::string_view(begin, static_cast<size_t>(end - begin));
+        const auto found = haystack.find(needle);
+        return found == std::string_view::npos ? end : begin + found;
+    }
+
+#ifdef CA_FILTER_X86
+    /// 16 positions at a time, SSE2 is there on every x86-64 CPU
+    [[nodiscard]] const char *scan_sse2(const char *begin, const char *end, std::string_view needle) noexcept {
+        const auto first = _mm_set1_epi8(needle.front());
+        const auto last = _mm_set1_epi8(needle.back());
+
+        auto position = begin;
+        for (; static_cast<size_t>(end - position) >= needle.size() - 1 + 16; position += 16) {
+            const auto starts = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position));
+            const auto ends = _mm_loadu_si128(reinterpret_cast<const __m128i *>(position + needle.size() - 1));
+            auto mask = static_cast<std::uint32_t>(
+                    _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, last))));
+
+            for (; mask != 0; mask &= mask - 1) {
+                const auto candidate = position + __builtin_ctz(mask);
+                if (middle_matches(candidate, needle))
+                    return candidate;
+            }
+        }
+        return scan_scalar(position, end, needle);
+    }
+
+    /// 32 positions at a time
+    [[nodiscard]] __attribute__((target("avx2"))) const char *scan_avx2(const char *begin, const char *end,
+                                                                        std::string_view needle) noexcept {
+        const auto first = _mm256_set1_epi8(needle.front());
+        const auto last = _mm256_set1_epi8(needle.back());
+
+        auto position = begin;
+        for (; static_cast<size_t>(end - position) >= needle.size() - 1 + 32; position += 32) {
+            const auto starts = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position));
+            const auto ends = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(position + needle.size() - 1));
+            auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(starts, first), _mm256_cmpeq_epi8(ends, last))));
+
+            for (; mask != 0; mask &= mask - 1) {
+                const auto candidate = position + __builtin_ctz(mask);
+                if (middle_matches(candidate, needle))
+                    return candidate;
+            }
+        }
+        return scan_scalar(position, end, needle);
+    }
+#endif
+
+    /// The fastest scan the CPU supports, picked once
+    [[nodiscard]] const char *scan(const char *begin, const char *end, std::string_view needle) noexcept {
+#ifdef CA_FILTER_X86
+        static const auto avx2 = __builtin_cpu_supports("avx2") != 0;
+        return avx2 ? scan_avx2(begin, end, needle) : scan_sse2(begin, end, needle);
+#else
+        return scan_scalar(begin, end, needle);
+#endif
+    }
+}
+
+std::uint32_t ca::message_filter::add(std::string_view content) {
+    const auto id = static_cast<std::uint32_t>(_offsets.size() - 1);
+    std::transform(content.begin(), content.end(), std::back_inserter(_arena), lower);
+
+    // Needles can't contain a null byte, so a match never runs into the next message
+    _arena.push_back('\0');
+    _offsets.push_back(_arena.size());
+    return id;
+}
+
+size_t ca::message_filter::size() const noexcept {
+    return _offsets.size() - 1;
+}
+
+std::vector<std::uint32_t> ca::message_filter::find(std::string_view needle, std::uint32_t first) const {
+    auto matches = std::vector<std::uint32_t>();
+    const auto count = static_cast<std::uint32_t>(size());
+    if (first >= count || needle.find('\0') != std::string_view::npos)
+        return matches;
+
+    auto lowered = std::string();
+    std::transform(needle.begin(), needle.end(), std::back_inserter(lowered), lower);
+
+    const auto bytes = _offsets[count] - _offsets[first];
+    const auto threads = std::min<size_t>(std::thread::hardware_concurrency(), bytes / parallel_threshold + 1);
+    if (threads <= 1) {
+        _find(lowered, first, count, matches);
+        return matches;
+    }
+
+    // Split at message boundaries into ranges of about the same size, every thread collects its own matches
+    auto bounds = std::vector<std::uint32_t>{first};
+    for (auto i = size_t(1); i < threads; i++) {
+        const auto target = _offsets[first] + bytes * i / threads;
+        const auto bound = std::lower_bound(_offsets.begin() + first, _offsets.begin() + count, target);
+        bounds.push_back(std::max(bounds.back(), static_cast<std::uint32_t>(bound - _offsets.begin())));
+    }
+    bounds.push_back(count);
+
+    auto results = std::vector<std::vector<std::uint32_t>>(threads);
+    auto workers = std::vector<std::thread>();
+    for (auto i = size_t(1); i < threads; i++)
+        workers.emplace_back([&, i]() { _find(lowered, bounds[i], bounds[i + 1], results[i]); });
+    _find(lowered, bounds[0], bounds[1], results[0]);
+    for (auto &worker : workers)
+        worker.join();
+
+    for (const auto &result : results)
+        matches.insert(matches.end(), result.begin(), result.end());
+    return matches;
+}
+
+void ca::message_filter::_find(std::string_view needle, std::uint32_t first, std::uint32_t last,
+                               std::vector<std::uint32_t> &matches) const {
+    if (needle.empty()) {
+        for (auto id = first; id < last; id++)
+            matches.push_back(id);
+        return;
+    }
+
+    const auto begin = _arena.data();
+    const auto end = begin + _offsets[last];
+    auto position = begin + _offsets[first];
+    auto id = first;
+    while (position < end) {
+        const auto found = scan(position, end, needle);
+        if (found == end)
+            break;
+
+        // Matches are usually close together, so the message it's in is galloped to from the last one
+        const auto offset = static_cast<size_t>(found - begin);
+        auto step = std::uint32_t(1);
+        while (id + step < last && _offsets[id + step] <= offset)
+            step *= 2;
+        const auto next = std::upper_bound(_offsets.begin() + id + step / 2, _offsets.begin() + std::min(id + step, last) + 1,
+                                           offset);
+        id = static_cast<std::uint32_t>(next - _offsets.begin() - 1);
+        matches.push_back(id);
+
+        // The rest of that message doesn't matter anymore, carry on with the next one
+        position = begin + *next;
+        id++;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ca {
+    /// The content of every message kept in one contiguous buffer, for narrowing the message list down as the user
+    /// types. Finding a substring is a single vectorized scan over the buffer (AVX2 or SSE2 depending on the CPU,
+    /// plain C++ on anything else) that compares the first and last byte of the needle at 32 or 16 positions at once,
+    /// and only checks the rest where both match. Big buffers are split up and scanned on every core
+    class message_filter {
+    public:
+        /// Adds a message's content, messages get ids in the order they're added
+        /// \param content The content to filter on
+        /// \return The message's id, starting at 0
+        std::uint32_t add(std::string_view content);
+
+        /// \return The number of messages that have been added
+        [[nodiscard]] size_t size() const noexcept;
+
+        /// Finds the messages that contain a string, ignoring the case of ASCII letters
+        /// \param needle What to look for, empty matches every message
+        /// \param first Only messages with this id or higher, to only check the ones added since the last time
+        /// \return The ids of the matching messages, in order
+        [[nodiscard]] std::vector<std::uint32_t> find(std::string_view needle, std::uint32_t first = 0) const;
+
+    private:
+        /// Internal function: Finds the matching messages in a range of ids, on the calling thread
+        /// \param needle Lowercased already
+        void _find(std::string_view needle, std::uint32_t first, std::uint32_t last,
+                   std::vector<std::uint32_t> &matches) const;
+
+        std::string _arena;                // Lowercased contents, each one followed by a null byte
+        std::vector<size_t> _offsets = {0}; // Where each message starts in _arena, and where the next one will
+    };
+}
@@ -0,0 +1,286 @@
+#include "message_log.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <wire.h>
+
+namespace {
+    /// The start of every log file, bumped if the record layout ever changes
+    constexpr auto magic = std::array{std::byte('C'), std::byte('A'), std::byte('L'), std::byte('O'), std::byte('G'),
+                                      std::byte(0), std::byte(0), std::byte(1)};
+
+    /// How much of the file is read at once when loading it
+    constexpr auto load_chunk_size = size_t(1024 * 1024);
+}
+
+ca::message_log::message_log(const std::string &path) {
+    if (path.empty())
+        return;
+
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd >= 0 && !_load()) {
+        ::close(_fd);
+        _fd = -1;
+    }
+
+    // Whatever was indexed from a file that turned out to be unusable doesn't belong to the in memory log
+    if (_fd < 0) {
+        _channels.clear();
+        _sequences.clear();
+        _last_sequence = 0;
+        _end = 0;
+    }
+}
+
+ca::message_log::~message_log() {
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool ca::message_log::persistent() const noexcept {
+    return _fd >= 0;
+}
+
+void ca::message_log::append(std::uint64_t sequence, std::uint64_t origin, std::optional<ca::room_id> room,
+                             std::span<const std::byte> packet) {
+    const auto logged = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+
+    // [body size][sequence][origin][room + 1][time logged][packet], the size first so a cut off record can be detected
+    auto fields = ca::wire::writer(4 * ca::wire::max_varint_size);
+    fields.varint(sequence);
+    fields.varint(origin);
+    fields.varint(_channel(room));
+    fields.varint(logged);
+    const auto header = fields.take();
+
+    auto record = ca::wire::writer(ca::wire::max_varint_size + header.size() + packet.size());
+    record.varint(header.size() + packet.size());
+    record.bytes(header);
+    record.bytes(packet);
+    const auto bytes = record.take();
+
+    auto guard = std::lock_guard(_mutex);
+    const auto offset = _end + (bytes.size() - packet.size());
+
+    // Written through to the OS right away (not synced), a crash of the relay doesn't lose anything
+    if (_fd >= 0) {
+        if (::write(_fd, bytes.data(), bytes.size()) != static_cast<ssize_t>(bytes.size())) {
+            // Don't leave half a record behind, the next one would be unreadable
+            if (::ftruncate(_fd, static_cast<off_t>(_end)) != 0) {
+                ::close(_fd);
+                _fd = -1;
+            }
+            return;
+        }
+    } else
+        _memory.insert(_memory.end(), bytes.begin(), bytes.end());
+
+    _end += bytes.size();
+    _index(_channel(room), {.sequence = sequence, .origin = origin, .logged = logged, .offset = offset,
+                            .size = static_cast<std::uint32_t>(packet.size())});
+}
+
+std::uint64_t ca::message_log::last_sequence() const {
+    auto guard = std::lock_guard(_mutex);
+    return _last_sequence;
+}
+
+ca::message_log::page ca::message_log::read(std::optional<ca::room_id> room, std::uint64_t after,
+                                            std::uint64_t since, size_t limit) const {
+    auto result = page{.last_sequence = after};
+    auto locations = std::vector<std::pair<location, std::uint64_t>>();
+    {
+        auto guard = std::lock_guard(_mutex);
+        const auto channel = _channels.find(_channel(room));
+        if (channel == _channels.end())
+            return result;
+
+        // Both are binary searches, so a page costs the same no matter how long the room's history is
+        const auto &index = channel->second;
+        auto first = std::partition_point(index.begin(), index.end(), [after](const location &location) {
+            return location.sequence <= after;
+        });
+        if (since != 0)
+            first = std::max(first, std::partition_point(index.begin(), index.end(), [since](const location &location) {
+                return location.logged < since;
+            }));
+
+        const auto last = first + static_cast<std::ptrdiff_t>(std::min(limit, size_t(index.end() - first)));
+        result.more = last != index.end();
+        if (first != last)
+            result.last_sequence = (last - 1)->sequence;
+
+        for (auto it = first; it != last; ++it)
+            locations.emplace_back(*it, channel->first);
+    }
+
+    result.entries = _read(locations);
+
+    // Continue from what was read, the next page tries again
+    if (result.entries.size() != locations.size()) {
+        result.last_sequence = result.entries.empty() ? after : result.entries.back().sequence;
+        result.more = true;
+    }
+    return result;
+}
+
+ca::message_log::page ca::message_log::read_all(std::uint64_t after, size_t limit) const {
+    auto result = page{.last_sequence = after};
+    auto locations = std::vector<std::pair<location, std::uint64_t>>();
+    {
+        auto guard = std::lock_guard(_mutex);
+        auto first = std::partition_point(_sequences.begin(), _sequences.end(), [after](const auto &sequence) {
+            return sequence.first <= after;
+        });
+        const auto last = first + static_cast<std::ptrdiff_t>(std::min(limit, size_t(_sequences.end() - first)));
+        result.more = last != _sequences.end();
+
+        for (auto it = first; it != last; ++it) {
+            const auto &index = _channels.at(it->second);
+            const auto found = std::partition_point(index.begin(), index.end(), [&](const location &location) {
+                return location.sequence < it->first;
+            });
+            locations.emplace_back(*found, it->second);
+        }
+        if (!locations.empty())
+            result.last_sequence = locations.back().first.sequence;
+    }
+
+    result.entries = _read(locations);
+    if (result.entries.size() != locations.size()) {
+        result.last_sequence = result.entries.empty() ? after : result.entries.back().sequence;
+        result.more = true;
+    }
+    return result;
+}
+
+std::vector<ca::message_log::entry> ca::message_log::read(std::span<const std::uint64_t> sequences,
+                                                          const std::function<bool(std::optional<ca::room_id>)> &wanted,
+                                                          size_t limit) const {
+    auto locations = std::vector<std::pair<location, std::uint64_t>>();
+    {
+        auto guard = std::lock_guard(_mutex);
+        for (auto it = sequences.begin(); it != sequences.end() && locations.size() < limit; ++it) {
+            const auto sequence = *it;
+            const auto channel = std::partition_point(_sequences.begin(), _sequences.end(), [sequence](const auto &entry) {
+                return entry.first < sequence;
+            });
+            if (channel == _sequences.end() || channel->first != sequence || !wanted(_room(channel->second)))
+                continue;
+
+            const auto &index = _channels.at(channel->second);
+            const auto found = std::partition_point(index.begin(), index.end(), [sequence](const location &location) {
+                return location.sequence < sequence;
+            });
+            locations.emplace_back(*found, channel->second);
+        }
+    }
+    return _read(locations);
+}
+
+std::vector<ca::message_log::entry> ca::message_log::_read(
+        const std::vector<std::pair<location, std::uint64_t>> &locations) const {
+    auto entries = std::vector<entry>();
+    entries.reserve(locations.size());
+
+    if (_fd < 0) {
+        auto guard = std::lock_guard(_mutex);
+        for (const auto &[location, channel] : locations) {
+            const auto packet = std::span(_memory).subspan(location.offset, location.size);
+            entries.push_back({location.sequence, location.origin, std::vector(packet.begin(), packet.end()),
+                               _room(channel)});
+        }
+        return entries;
+    }
+
+    // Records never change once they're written, so they're read without holding up #append
+    for (const auto &[location, channel] : locations) {
+        auto packet = std::vector<std::byte>(location.size);
+        if (::pread(_fd, packet.data(), packet.size(), static_cast<off_t>(location.offset)) !=
+            static_cast<ssize_t>(packet.size()))
+            break;
+        entries.push_back({location.sequence, location.origin, std::move(packet), _room(channel)});
+    }
+    return entries;
+}
+
+bool ca::message_log::_load() {
+    const auto size = static_cast<std::uint64_t>(std::max<off_t>(::lseek(_fd, 0, SEEK_END), 0));
+    if (size == 0) {
+        _end = magic.size();
+        return ::write(_fd, magic.data(), magic.size()) == static_cast<ssize_t>(magic.size());
+    }
+
+    auto header = std::array<std::byte, magic.size()>();
+    if (size < magic.size() || ::pread(_fd, header.data(), header.size(), 0) != static_cast<ssize_t>(header.size()) ||
+        header != magic)
+        return false;
+
+    auto buffer = std::vector<std::byte>();
+    auto buffer_offset = std::uint64_t(magic.size()); // Where buffer[0] is in the file
+    auto position = size_t(0);                        // How much of the buffer has been indexed
+    auto read_offset = buffer_offset;
+
+    while (true) {
+        auto reader = ca::wire::reader(std::span(buffer).subspan(position));
+        const auto body_size = reader.varint();
+        const auto body = body_size ? reader.bytes(*body_size) : std::nullopt;
+
+        if (!body) {
+            if (reader.malformed() || read_offset >= size)
+                break;
+
+            // The record continues past what has been read so far
+            buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(position));
+            buffer_offset += position;
+            position = 0;
+
+            const auto chunk = std::min<std::uint64_t>(load_chunk_size, size - read_offset);
+            const auto previous_size = buffer.size();
+            buffer.resize(previous_size + chunk);
+            const auto read = ::pread(_fd, buffer.data() + previous_size, chunk, static_cast<off_t>(read_offset));
+            if (read <= 0)
+                break;
+            buffer.resize(previous_size + static_cast<size_t>(read));
+            read_offset += static_cast<std::uint64_t>(read);
+            continue;
+        }
+
+        auto fields = ca::wire::reader(*body);
+        const auto sequence = fields.varint();
+        const auto origin = sequence ? fields.varint() : std::nullopt;
+        const auto channel = origin ? fields.varint() : std::nullopt;
+        const auto logged = channel ? fields.varint() : std::nullopt;
+        if (!logged)
+            break;
+
+        const auto packet_offset = buffer_offset + position + (reader.position() - body->size()) + fields.position();
+        _index(*channel, {.sequence = *sequence, .origin = *origin, .logged = *logged, .offset = packet_offset,
+                          .size = static_cast<std::uint32_t>(body->size() - fields.position())});
+        position += reader.position();
+    }
+
+    // Anything after the last complete record was cut off mid-write, the next record goes where it started
+    _end = buffer_offset + position;
+    return _end == size || ::ftruncate(_fd, static_cast<off_t>(_end)) == 0;
+}
+
+void ca::message_log::_index(std::uint64_t channel, const location &location) {
+    _channels[channel].push_back(location);
+    _sequences.emplace_back(location.sequence, channel);
+    _last_sequence = std::max(_last_sequence, location.sequence);
+}
+
+std::uint64_t ca::message_log::_channel(std::optional<ca::room_id> room) noexcept {
+    return room ? std::uint64_t(*room) + 1 : 0;
+}
+
+std::optional<ca::room_id> ca::message_log::_room(std::uint64_t channel) noexcept {
+    return channel != 0 ? std::optional(static_cast<ca::room_id>(channel - 1)) : std::nullopt;
+}
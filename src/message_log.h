@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <message.h>
+
+namespace ca {
+    /// Append-only log of every chat message a relay server has relayed, so clients can sync what they missed even
+    /// after the relay restarted. Each record is the message packet (uncompressed) with its sequence number, the
+    /// session that sent it, the room and when it was logged. Only a small index (per room, ordered by sequence
+    /// number, and which room every sequence number is in) is kept in memory, a page of history reads just the
+    /// records it returns.
+    /// Appending and reading can happen from any thread
+    class message_log {
+    public:
+        /// A logged message
+        struct entry {
+            std::uint64_t sequence;
+            std::uint64_t origin;          // The session of the client that sent it
+            std::vector<std::byte> packet; // The uncompressed message or room_message packet
+            std::optional<ca::room_id> room = std::nullopt;
+        };
+
+        /// A range of a room's messages
+        struct page {
+            std::vector<entry> entries = {};
+            std::uint64_t last_sequence = 0; // The next page starts after this one
+            bool more = false;               // If there are more messages after the page
+        };
+
+        /// Opens the log and indexes what's in it, a record that was only partly written (the relay crashed while
+        /// writing it) is cut off
+        /// \param path The log file, it's created if it doesn't exist. Empty keeps the log in memory only
+        explicit message_log(const std::string &path = {});
+
+        ~message_log();
+
+        message_log(const message_log &) = delete;
+        message_log &operator=(const message_log &) = delete;
+
+        /// If the messages end up on disk, false if there was no path or the file couldn't be used
+        /// \return true if the log survives a restart
+        [[nodiscard]] bool persistent() const noexcept;
+
+        /// Adds a message to the end of the log, the sequence numbers have to go up
+        /// \param sequence The relay's number for the message
+        /// \param origin The session of the client that sent it
+        /// \param room The room it was sent to, if any
+        /// \param packet The uncompressed message or room_message packet
+        void append(std::uint64_t sequence, std::uint64_t origin, std::optional<ca::room_id> room,
+                    std::span<const std::byte> packet);
+
+        /// \return The sequence number of the newest message, 0 if the log is empty
+        [[nodiscard]] std::uint64_t last_sequence() const;
+
+        /// Reads the messages of a room that come after a sequence number
+        /// \param room The room, empty for the messages that weren't sent to a room
+        /// \param after Only messages with a higher sequence number
+        /// \param since Only messages logged at or after this time (seconds since epoch), 0 for all of them
+        /// \param limit How many messages to read at most
+        /// \return The messages, oldest first
+        [[nodiscard]] page read(std::optional<ca::room_id> room, std::uint64_t after, std::uint64_t since,
+                                size_t limit) const;
+
+        /// Reads the messages of every room that come after a sequence number
+        /// \param after Only messages with a higher sequence number
+        /// \param limit How many messages to read at most
+        /// \return The messages, oldest first
+        [[nodiscard]] page read_all(std::uint64_t after, size_t limit) const;
+
+        /// Reads messages by their sequence numbers
+        /// \param sequences The messages to read, in the order they're wanted
+        /// \param wanted Which rooms' messages to read (empty for the messages that weren't sent to a room), the
+        /// others are skipped. Called with the log locked
+        /// \param limit How many messages to read at most
+        /// \return The messages that are in the log and wanted, in the order they were asked for
+        [[nodiscard]] std::vector<entry> read(std::span<const std::uint64_t> sequences,
+                                              const std::function<bool(std::optional<ca::room_id>)> &wanted,
+                                              size_t limit) const;
+
+    private:
+        /// Where a message is in the log
+        struct location {
+            std::uint64_t sequence;
+            std::uint64_t origin;
+            std::uint64_t logged; // Seconds since epoch
+            std::uint64_t offset; // Of the packet, in the file or _memory
+            std::uint32_t size;   // Of the packet
+        };
+
+        /// Internal function: Reads the whole file, building the index
+        /// \return false if it isn't a message log
+        bool _load();
+
+        /// Internal function: Adds a record to the index
+        void _index(std::uint64_t channel, const location &location);
+
+        /// Internal function: Reads the packets of records, stopping at the first one that can't be read
+        /// \param locations The records and their channels, found while holding _mutex (which has to be released)
+        /// \return The records that could be read
+        [[nodiscard]] std::vector<entry> _read(const std::vector<std::pair<location, std::uint64_t>> &locations) const;
+
+        /// Internal function: Which index a room's messages are in, 0 for messages that weren't sent to a room
+        [[nodiscard]] static std::uint64_t _channel(std::optional<ca::room_id> room) noexcept;
+
+        /// Internal function: The room of an index
+        [[nodiscard]] static std::optional<ca::room_id> _room(std::uint64_t channel) noexcept;
+
+        mutable std::mutex _mutex;
+        int _fd = -1;
+        std::uint64_t _end = 0; // Size of the log, where the next record goes
+        std::uint64_t _last_sequence = 0;
+        std::unordered_map<std::uint64_t, std::vector<location>> _channels;
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> _sequences; // The channel of every sequence number, in order
+        std::vector<std::byte> _memory; // The records, when the log isn't persistent
+    };
+}
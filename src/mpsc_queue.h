@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+namespace ca {
+    /// Lock-free unbounded queue for many producer threads and a single consumer thread (Vyukov's intrusive MPSC queue).
+    /// Pushing is a single atomic exchange, popping never touches anything the producers write to apart from the link
+    template<typename T>
+    class mpsc_queue {
+    public:
+        mpsc_queue() : _head(new node()), _tail(_head.load()) {}
+
+        ~mpsc_queue() {
+            while (pop());
+            delete _tail;
+        }
+
+        mpsc_queue(const mpsc_queue &) = delete;
+
+        mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+        /// Adds a value to the queue, this is safe to call from any thread
+        /// \param value The value to add
+        void push(T value) {
+            auto added = new node{.next = nullptr, .value = std::move(value)};
+            const auto previous = _head.exchange(added, std::memory_order_acq_rel);
+            previous->next.store(added, std::memory_order_release);
+        }
+
+        /// Takes the oldest value out of the queue, only the consumer thread may call this.
+        /// A push that's still in progress might not be visible yet, the producer should wake the consumer afterwards
+        /// \return The value, or an empty optional if the queue is empty
+        std::optional<T> pop() {
+            const auto next = _tail->next.load(std::memory_order_acquire);
+            if (!next)
+                return std::nullopt;
+
+            // The next node becomes the new (empty) tail once its value has been taken
+            auto value = std::move(next->value);
+            delete _tail;
+            _tail = next;
+            return value;
+        }
+
+    private:
+        struct node {
+            std::atomic<node *> next = nullptr;
+            T value;
+        };
+
+        std::atomic<node *> _head; // Last pushed node, shared with every producer
+        node *_tail;               // Consumer side, its value has already been taken
+    };
+}
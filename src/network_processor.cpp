@@ -1,10 +1,41 @@
 #include "network_processor.h"
 
+#include <algorithm>
+#include <random>
+#include <utility>
+
+#include <packet.h>
+#include <trace.h>
+
+namespace {
+    /// The first reconnect is tried straight away, after that the delay doubles up to the maximum
+    constexpr auto first_reconnect_delay = std::chrono::milliseconds(250);
+    constexpr auto max_reconnect_delay = std::chrono::milliseconds(30000);
+
+    /// How long the disconnect packet gets to go out when shutting down, a peer that doesn't read is given up on
+    constexpr auto disconnect_flush_time = std::chrono::milliseconds(500);
+
+    /// How many messages a page of history has at most, one page is asked for at a time
+    constexpr auto history_page_size = std::uint32_t(200);
+
+    std::mt19937_64 &random_engine() {
+        thread_local auto engine = std::mt19937_64((std::uint64_t(std::random_device()()) << 32) | std::random_device()());
+        return engine;
+    }
+}
+
 ca::network_processor::~network_processor() {
     _processing = false;
     _running = false;
 
+    _outgoing_space.notify_all();
+    _backend->wake();
     _processing_thread.join();
+
+    if (_listener.is_open()) {
+        _listener.close();
+        _transport->unlisten(_endpoint);
+    }
 }
 
 void ca::network_processor::set_mode(ca::client_mode mode) {
@@ -15,128 +46,643 @@ ca::client_mode ca::network_processor::mode() const noexcept {
     return _mode.load();
 }
 
-void ca::network_processor::queue_message(const ca::message &message) {
-    auto guard = std::lock_guard(_outgoing_mutex);
-    _outgoing.push_back(message);
+void ca::network_processor::queue_message(ca::message &&message) {
+    {
+        auto lock = std::unique_lock(_outgoing_mutex);
+        _wait_for_space(lock);
+        // It's numbered once it's sent, until then it's counted with the widest sequence number
+        _outgoing_bytes += ca::packet::message_size(UINT64_MAX, std::nullopt, message);
+        _outgoing.push_back(std::move(message));
+    }
+    _backend->wake();
+}
+
+void ca::network_processor::queue_message(ca::message &&message, ca::room_id room) {
+    {
+        auto lock = std::unique_lock(_outgoing_mutex);
+        _wait_for_space(lock);
+        _outgoing_bytes += ca::packet::message_size(UINT64_MAX, room, message);
+        _outgoing_room_messages.emplace_back(room, std::move(message));
+    }
+    _backend->wake();
+}
+
+void ca::network_processor::subscribe(ca::room_id room) {
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        _outgoing_packets.push_back(ca::packet::subscribe(room));
+        if (std::find(_rooms.begin(), _rooms.end(), room) == _rooms.end())
+            _rooms.push_back(room);
+
+        // Catch up on what was said while we weren't in the room
+        _history_requests.emplace_back(room, 0);
+    }
+    _backend->wake();
+}
+
+void ca::network_processor::unsubscribe(ca::room_id room) {
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        _outgoing_packets.push_back(ca::packet::unsubscribe(room));
+        _rooms.erase(std::remove(_rooms.begin(), _rooms.end(), room), _rooms.end());
+    }
+    _backend->wake();
+}
+
+void ca::network_processor::request_history(std::optional<ca::room_id> room, std::uint64_t since) {
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        _history_requests.emplace_back(room, since);
+    }
+    _backend->wake();
+}
+
+void ca::network_processor::search(const std::string &query) {
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        _search = std::pair(++_search_id, query);
+    }
+    _backend->wake();
+}
+
+void ca::network_processor::typing(bool typing, std::optional<ca::room_id> room) {
+    auto changed = false;
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        changed = typing != _typing || room != _typing_room;
+        _typing = typing;
+        _typing_room = room;
+        if (typing)
+            _last_input = std::chrono::steady_clock::now();
+    }
+
+    // Every keystroke ends up here, only a change is worth waking the processing thread for
+    if (changed)
+        _backend->wake();
+}
+
+ca::presence ca::network_processor::presence(std::optional<ca::room_id> room) {
+    auto guard = std::lock_guard(_incoming_mutex);
+    const auto it = _presence.find(room);
+    return it == _presence.end() ? ca::presence() : it->second;
+}
+
+std::optional<std::vector<ca::message>> ca::network_processor::search_results() {
+    auto guard = std::lock_guard(_incoming_mutex);
+    return std::exchange(_search_results, std::nullopt);
+}
+
+void ca::network_processor::send_file(const std::string &path) {
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        _outgoing_files.push_back(path);
+    }
+    _backend->wake();
+}
+
+std::vector<ca::file_transfer> ca::network_processor::file_transfers() const {
+    return _files.progress();
 }
 
 std::vector<ca::message> ca::network_processor::incoming_messages() {
     auto guard = std::lock_guard(_incoming_mutex);
-    auto messages = _incoming;
-    _incoming.clear();
-    return messages;
+    return std::exchange(_incoming, {});
 }
 
 void ca::network_processor::_tick() {
-    if (_running) {
-        auto inc_guard = std::lock_guard(_incoming_mutex);
-        auto out_guard = std::lock_guard(_outgoing_mutex);
-        auto read_guard = std::lock_guard(_read_mutex);
-        auto inc_read_guard = std::lock_guard(_inc_read_mutex);
-
-        switch (_mode) {
-            case client: {
-                for (const auto &message : _outgoing) {
-                    const auto bytes = message.as_stream();
-                    _connector.write(bytes.data(), bytes.size());
-                }
-                _outgoing.clear();
+    const auto fd = _socket.handle();
+
+    // While reconnecting there's no socket, only the timers (and accepting the client again) need to run. A socket
+    // the backend can't take is an error the UI shows, there's nothing left to run until then
+    const auto connected = !_reconnecting;
+    if (connected && !_registered && !_register(fd)) {
+        _running = false;
+        _outgoing_space.notify_all();
+        return;
+    }
 
-                for (const auto hash : _read_messages) {
-                    auto data = std::array<std::byte, 1 + sizeof(size_t)>();
-                    data[0] = std::byte(1);
-                    std::memcpy(data.data() + 1, &hash, sizeof(size_t));
-                    _connector.write(data.data(), data.size());
-                }
-                _read_messages.clear();
-
-                while (true) {
-                    auto packet_type = std::byte();
-                    auto read = _connector.read(&packet_type, sizeof(std::byte));
-                    if (read <= 0) break; // We have no data coming in anymore, stop reading
-
-                    if (packet_type == std::byte(0)) {
-                        // Read new message
-                        auto time_sent = std::uint64_t();
-                        read = _connector.read(&time_sent, sizeof(std::uint64_t));
-
-                        auto char_count = size_t();
-                        _connector.read(&char_count, sizeof(size_t));
-
-                        auto content = std::string();
-                        content.resize(char_count);
-                        read = _connector.read(content.data(), char_count);
-                        if (read != char_count)
-                            std::terminate();
-
-                        _incoming.emplace_back(time_sent, std::move(content));
-                    } else if (packet_type == std::byte(1)) {
-                        // Message read
-                        auto message_hash = size_t();
-                        read = _connector.read(&message_hash, sizeof(size_t));
-                        _inc_read_messages.push_back(message_hash);
-                    } else if (packet_type == std::byte(2)) {
-                        _error = "Other user disconnected";
-                    }
-                }
+    {
+        const auto span = ca::trace::scope("write_outgoing", "net");
+
+        // Take everything queued up by the UI thread, so the locks aren't held while writing
+        auto outgoing = std::vector<ca::message>();
+        auto outgoing_room_messages = std::vector<std::pair<ca::room_id, ca::message>>();
+        auto outgoing_packets = std::vector<std::vector<std::byte>>();
+        auto history_requests = std::vector<std::pair<std::optional<ca::room_id>, std::uint64_t>>();
+        auto search = std::optional<std::pair<std::uint64_t, std::string>>();
+        auto outgoing_files = std::vector<std::string>();
+        {
+            auto guard = std::lock_guard(_outgoing_mutex);
+            std::swap(outgoing, _outgoing);
+            std::swap(outgoing_room_messages, _outgoing_room_messages);
+            std::swap(outgoing_packets, _outgoing_packets);
+            std::swap(history_requests, _history_requests);
+            std::swap(outgoing_files, _outgoing_files);
+            _outgoing_bytes = 0;
+
+            // A relay ignores searches from clients that haven't resumed, so it waits for that
+            if (_resumed)
+                std::swap(search, _search);
+        }
+
+        // Read receipts wait for the connection, they aren't numbered so they'd be lost otherwise
+        auto read_messages = std::vector<size_t>();
+        if (_resumed) {
+            auto guard = std::lock_guard(_read_mutex);
+            std::swap(read_messages, _read_messages);
+        }
+
+        // Messages are numbered and kept until they're acknowledged, they're only sent once the other side has told
+        // us what it already has
+        // Messages the other side can't take would make it close the connection, after every reconnect again
+        for (auto &message : outgoing) {
+            const auto size = ca::packet::message_size(_sent_sequence + 1, std::nullopt, message);
+            if (!_fits(size))
+                continue;
+            _unacked.push_back({++_sent_sequence, std::move(message), std::nullopt, size});
+            _unacked_bytes += size;
+            if (_resumed)
+                _send_message(fd, _unacked.back());
+        }
+
+        for (auto &[room, message] : outgoing_room_messages) {
+            const auto size = ca::packet::message_size(_sent_sequence + 1, room, message);
+            if (!_fits(size))
+                continue;
+            _unacked.push_back({++_sent_sequence, std::move(message), room, size});
+            _unacked_bytes += size;
+            if (_resumed)
+                _send_message(fd, _unacked.back());
+        }
+
+        // Subscriptions made while disconnected are covered by _rooms, which is sent again on registering
+        if (connected)
+            for (auto &packet : outgoing_packets)
+                _backend->send(fd, std::move(packet), ca::send_priority::control);
+
+        for (const auto hash : read_messages)
+            _backend->send(fd, ca::packet::message_read(hash), ca::send_priority::control);
+
+        if (_resumed)
+            _send_typing(fd);
+
+        // After the subscriptions, a relay only sends a room's history to its members
+        for (const auto &[room, since] : history_requests)
+            _start_sync(room, since);
+
+        if (search)
+            _backend->send(fd, ca::packet::search(search->first, search->second), ca::send_priority::control);
+
+        for (const auto &path : outgoing_files)
+            _files.send(path);
+
+        // Past the send limit drop_oldest gives up on the oldest messages, they won't be resent either
+        if (_send_limit.policy == backpressure_policy::drop_oldest) {
+            while (_unacked_bytes > _send_limit.max_bytes && !_unacked.empty()) {
+                _unacked_bytes -= _unacked.front().size;
+                _unacked.pop_front();
             }
-                break;
-            case server: {
-                for (const auto &message : _outgoing) {
-                    const auto bytes = message.as_stream();
-                    _socket.write(bytes.data(), bytes.size());
-                }
-                _outgoing.clear();
+        }
+    }
 
-                for (const auto hash : _read_messages) {
-                    auto data = std::array<std::byte, 1 + sizeof(size_t)>();
-                    data[0] = std::byte(1);
-                    std::memcpy(data.data() + 1, &hash, sizeof(size_t));
-                    _socket.write(data.data(), data.size());
-                }
-                _read_messages.clear();
-
-                while (true) {
-                    auto packet_type = std::byte();
-                    auto read = _socket.read(&packet_type, sizeof(std::byte));
-                    if (read <= 0) break; // We have no data coming in anymore, stop reading
-
-                    if (packet_type == std::byte(0)) {
-                        // Read new message
-                        auto time_sent = std::uint64_t();
-                        read = _socket.read(&time_sent, sizeof(std::uint64_t));
-
-                        auto char_count = size_t();
-                        _socket.read(&char_count, sizeof(size_t));
-
-                        auto content = std::string();
-                        content.resize(char_count);
-                        read = _socket.read(content.data(), char_count);
-                        if (read != char_count)
-                            std::terminate();
-
-                        _incoming.emplace_back(time_sent, std::move(content));
-                    } else if (packet_type == std::byte(1)) {
-                        // Message read
-                        auto message_hash = size_t();
-                        read = _socket.read(&message_hash, sizeof(size_t));
-                        _inc_read_messages.push_back(message_hash);
-                    } else if (packet_type == std::byte(2)) {
-                        _error = "Other user disconnected";
-                    }
+    // Files are hashed a slice per tick, so the connection keeps being serviced while a big one is
+    auto hashing = false;
+    {
+        const auto span = ca::trace::scope("file_transfers", "net");
+        hashing = _files.update(fd, _resumed, _peer_max_frame_size);
+    }
+
+    // Sleeps until data arrives, the UI thread wakes us up to send something, or the next timer is due
+    {
+        const auto span = ca::trace::scope("wait_io", "net");
+        using namespace std::chrono_literals;
+        const auto next_timer = _timers.next_timeout(std::chrono::steady_clock::now()).value_or(100ms);
+        const auto timeout = hashing ? 0ms : std::min(next_timer, 100ms);
+        _backend->wait(timeout, [this](const ca::io_event &event) { _handle_event(event); });
+    }
+
+    _timers.advance(std::chrono::steady_clock::now());
+
+    // Let a blocked queue_message know how far the socket has caught up. Unacknowledged messages count too,
+    // otherwise a dropped connection would let them pile up without limit
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        _backend_queued = std::max(_backend->queued_bytes(fd), _unacked_bytes);
+    }
+    _outgoing_space.notify_all();
+}
+
+bool ca::network_processor::_register(int fd) {
+    _registered = _backend->add(fd);
+    if (!_registered) {
+        _set_error("Failed to watch the connection");
+        return false;
+    }
+
+    // Let the other side know what we can decompress, until theirs arrives everything is sent uncompressed
+    _backend->send(fd, ca::packet::hello(ca::supported_codecs, _frame_limits.max_frame_size),
+                   ca::send_priority::control);
+
+    // Join our rooms again before resuming, so a relay knows which of the messages we missed are for us.
+    // Queued subscriptions are already part of _rooms
+    auto rooms = std::vector<ca::room_id>();
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        rooms = _rooms;
+        _outgoing_packets.clear();
+    }
+    for (const auto room : rooms)
+        _backend->send(fd, ca::packet::subscribe(room), ca::send_priority::control);
+
+    _backend->send(fd, ca::packet::resume(_session, _peer_session, _received_sequence), ca::send_priority::control);
+
+    // Ping straight away, so there's a round trip time to show right after connecting
+    _last_received = std::chrono::steady_clock::now();
+    _ping(fd);
+    _peer_timer = _timers.schedule(_heartbeat_settings.timeout, [this, fd]() { _check_peer(fd); });
+    return true;
+}
+
+void ca::network_processor::_send_message(int fd, const unacked_message &message) {
+    _backend->send(fd, ca::packet::sequenced(message.sequence, message.room, message.message, _codec,
+                                             _dictionary.get()));
+}
+
+void ca::network_processor::_resume(int fd, const ca::frame_decoder::frame &frame) {
+    // The other side only resent what we missed if it knew us from before, otherwise (the first time we connect, or
+    // a relay that restarted) everything we missed is synced from a relay's history
+    if (frame.session != _peer_session) {
+        auto rooms = std::vector<ca::room_id>();
+        {
+            auto guard = std::lock_guard(_outgoing_mutex);
+            rooms = _rooms;
+        }
+
+        _start_sync(std::nullopt, 0);
+        for (const auto room : rooms)
+            _start_sync(room, 0);
+    }
+
+    // A different session is someone new (or a restarted relay), it numbers its messages (and files) from scratch
+    if (frame.session != _peer_session) {
+        _peer_session = frame.session;
+        _received_sequence = 0;
+        _files.peer_changed();
+    }
+
+    // How far it got only refers to our messages if it knows us by this session, everything else is resent
+    if (frame.peer_session == _session)
+        _acknowledged(frame.sequence);
+
+    for (const auto &message : _unacked)
+        _send_message(fd, message);
+
+    // Whatever page was on its way got lost with the old connection
+    for (const auto &[room, sync] : _syncs)
+        _backend->send(fd, ca::packet::sync(room, sync.after, sync.since, history_page_size),
+                       ca::send_priority::control);
+
+    _resumed = true;
+    _reconnect_delay = first_reconnect_delay;
+}
+
+void ca::network_processor::_start_sync(std::optional<ca::room_id> room, std::uint64_t since) {
+    if (_syncs.contains(room))
+        return;
+
+    const auto after = since == 0 ? _known[room] : 0;
+    _syncs.emplace(room, history_sync{.after = after, .since = since, .live = {}});
+    if (_resumed)
+        _backend->send(_socket.handle(), ca::packet::sync(room, after, since, history_page_size),
+                       ca::send_priority::control);
+}
+
+void ca::network_processor::_history(int fd, ca::frame_decoder::frame &frame, std::vector<ca::message> &messages) {
+    const auto it = _syncs.find(frame.history_room);
+    if (it == _syncs.end())
+        return;
+
+    // Anything that arrived live while syncing is already there
+    auto &sync = it->second;
+    auto &known = _known[frame.history_room];
+    for (auto &[sequence, message] : frame.history) {
+        if (sequence <= sync.after || sync.live.contains(sequence))
+            continue;
+        known = std::max(known, sequence);
+        messages.push_back(std::move(message));
+    }
+
+    if (!frame.more) {
+        _syncs.erase(it);
+        return;
+    }
+
+    sync.after = std::max(sync.after, frame.sequence);
+    _backend->send(fd, ca::packet::sync(frame.history_room, sync.after, sync.since, history_page_size),
+                   ca::send_priority::control);
+}
+
+void ca::network_processor::_send_typing(int fd) {
+    auto typing = false;
+    auto room = std::optional<ca::room_id>();
+    auto last_input = std::chrono::steady_clock::time_point();
+    {
+        auto guard = std::lock_guard(_outgoing_mutex);
+        typing = _typing;
+        room = _typing_room;
+        last_input = _last_input;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    typing = typing && now - last_input < _presence_settings.idle;
+
+    // While typing it's repeated before the other side's idle time runs out, a relay forgets it otherwise
+    const auto since = now - _last_announced;
+    const auto changed = typing != _announced_typing || (typing && room != _announced_room);
+    if (since < _presence_settings.interval || (!changed && !(typing && since >= _presence_settings.idle / 2)))
+        return;
+
+    // Queued behind that much it would only arrive late, the next tick tries again with whatever is current by then
+    if (_backend->queued_bytes(fd) > _presence_settings.max_backlog)
+        return;
+
+    if (_announced_typing && room != _announced_room)
+        _backend->send(fd, ca::packet::presence(_announced_room, false), ca::send_priority::background);
+    _backend->send(fd, ca::packet::presence(room, typing), ca::send_priority::background);
+    _last_announced = now;
+
+    auto guard = std::lock_guard(_incoming_mutex);
+    _announced_typing = typing;
+    _announced_room = room;
+}
+
+void ca::network_processor::_presence_update(const ca::frame_decoder::frame &frame) {
+    auto guard = std::lock_guard(_incoming_mutex);
+
+    // The other side of a direct connection is the only one there is, a relay counts us as well. We're online in
+    // every room a summary is sent for, and typing in it if that's what we last told the relay
+    if (frame.type == packet_type::presence) {
+        _presence[frame.history_room] = {.online = 1, .typing = frame.presence.typing};
+        return;
+    }
+
+    const auto typing = _announced_typing && _announced_room == frame.history_room;
+    _presence[frame.history_room] = {.online = frame.presence.online - std::min<size_t>(frame.presence.online, 1),
+                                     .typing = frame.presence.typing - std::min<size_t>(frame.presence.typing, typing)};
+}
+
+bool ca::network_processor::_fits(size_t size) const noexcept {
+    return size <= _peer_max_frame_size;
+}
+
+void ca::network_processor::_acknowledged(std::uint64_t sequence) {
+    while (!_unacked.empty() && _unacked.front().sequence <= sequence) {
+        _unacked_bytes -= _unacked.front().size;
+        _unacked.pop_front();
+    }
+}
+
+void ca::network_processor::_connection_lost() {
+    const auto span = ca::trace::scope("connection_lost", "net");
+    _backend->remove(_socket.handle());
+    _timers.cancel(_ping_timer);
+    _timers.cancel(_peer_timer);
+
+    // Everything negotiated belongs to the old connection, the next one starts with a hello again
+    _registered = false;
+    _resumed = false;
+    _decoder = ca::frame_decoder(_frame_limits, &_receive_budget);
+    _codec = ca::codec::none;
+    _peer_max_frame_size = _frame_limits.max_frame_size;
+    _dictionary = nullptr;
+    _files.disconnected();
+    _reconnecting = true;
+    {
+        // Nobody is known to be online until the other side tells us again, and it has forgotten our typing
+        auto guard = std::lock_guard(_incoming_mutex);
+        _presence.clear();
+        _announced_typing = false;
+    }
+
+    _socket.close();
+    if (_mode == client) {
+        _reconnect_delay = first_reconnect_delay;
+        _reconnect();
+    } else {
+        // The client reconnects to us, the accepted socket shows up as an event
+        _backend->add_listener(_listener.handle());
+    }
+}
+
+void ca::network_processor::_reconnect() {
+    const auto span = ca::trace::scope("reconnect", "net");
+
+    const auto fd = _transport->connect(_endpoint);
+    if (fd < 0) {
+        // Somewhere between half and all of the delay, so clients that lost the same server don't all come back at once
+        auto jitter = std::uniform_int_distribution<std::chrono::milliseconds::rep>(_reconnect_delay.count() / 2,
+                                                                                   _reconnect_delay.count());
+        _timers.schedule(std::chrono::milliseconds(jitter(random_engine())), [this]() { _reconnect(); });
+        _reconnect_delay = std::min(_reconnect_delay * 2, max_reconnect_delay);
+        return;
+    }
+
+    _socket = sockpp::stream_socket(fd);
+    _socket.set_non_blocking(true);
+    _reconnecting = false;
+}
+
+void ca::network_processor::_ping(int fd) {
+    if (_closed)
+        return;
+
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    const auto time = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+    _backend->send(fd, ca::packet::ping(static_cast<std::uint64_t>(time)), ca::send_priority::control);
+    _ping_timer = _timers.schedule(_heartbeat_settings.interval, [this, fd]() { _ping(fd); });
+}
+
+void ca::network_processor::_check_peer(int fd) {
+    if (_closed)
+        return;
+
+    // A crashed peer or a dropped network doesn't close the socket, it just goes quiet.
+    // Received data only updates _last_received, the timer is pushed back here instead of on every packet
+    const auto quiet = std::chrono::steady_clock::now() - _last_received;
+    if (quiet >= _heartbeat_settings.timeout) {
+        _connection_lost();
+        return;
+    }
+
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(_heartbeat_settings.timeout - quiet);
+    _peer_timer = _timers.schedule(remaining, [this, fd]() { _check_peer(fd); });
+}
+
+void ca::network_processor::_wait_for_space(std::unique_lock<std::mutex> &lock) {
+    if (_send_limit.policy != backpressure_policy::block)
+        return;
+
+    // Not connected yet means nothing is being written, so there's nothing to wait for either
+    const auto span = ca::trace::scope("wait_send_space", "net");
+    _outgoing_space.wait(lock, [this]() {
+        return !_running || _closed || _outgoing_bytes + _backend_queued < _send_limit.max_bytes;
+    });
+}
+
+void ca::network_processor::_handle_event(const ca::io_event &event) {
+    if (event.kind == ca::io_event::type::accepted) {
+        // The client is back, it's registered like a new connection on the next tick
+        _backend->remove(_listener.handle());
+        _socket = sockpp::stream_socket(event.fd);
+        _reconnecting = false;
+        return;
+    }
+
+    // Unless the other side closed it on purpose (with a disconnect packet) the connection is only dropped
+    if (event.kind == ca::io_event::type::closed) {
+        if (!_closed)
+            _connection_lost();
+        return;
+    }
+
+    const auto span = ca::trace::scope("decode", "net");
+    _last_received = std::chrono::steady_clock::now();
+    _decoder.feed(event.data);
+
+    auto messages = std::vector<ca::message>();
+    auto read_messages = std::vector<size_t>();
+    auto acknowledge = false;
+    while (auto frame = _decoder.next()) {
+        switch (frame->type) {
+            case packet_type::message:
+            case packet_type::room_message:
+                if (frame->sequence != 0) {
+                    // Resent after a reconnect, but it had already arrived before the drop
+                    if (frame->sequence <= _received_sequence)
+                        break;
+                    _received_sequence = frame->sequence;
+                    acknowledge = true;
+
+                    // Newer than anything a sync of the room could still bring, but it might show up in a page
+                    const auto room = frame->type == packet_type::room_message ? std::optional(frame->room)
+                                                                               : std::nullopt;
+                    _known[room] = std::max(_known[room], frame->sequence);
+                    if (const auto sync = _syncs.find(room); sync != _syncs.end())
+                        sync->second.live.insert(frame->sequence);
                 }
+                messages.push_back(std::move(frame->message));
+                break;
+            case packet_type::message_read:
+                read_messages.push_back(frame->message_hash);
+                break;
+            case packet_type::disconnect:
+                _set_error("Other user disconnected");
+                _closed = true;
+                break;
+            case packet_type::subscribe:
+            case packet_type::unsubscribe:
+                break; // Only meaningful to a relay server
+            case packet_type::hello: {
+                _codec = ca::negotiate_codec(ca::supported_codecs, frame->codecs);
+
+                // Whatever was queued before it arrived is checked again, nothing has been sent yet
+                _peer_max_frame_size = frame->max_frame_size;
+                const auto too_big = std::remove_if(_unacked.begin(), _unacked.end(), [this](const auto &message) {
+                    return !_fits(message.size);
+                });
+                for (auto it = too_big; it != _unacked.end(); ++it)
+                    _unacked_bytes -= it->size;
+                _unacked.erase(too_big, _unacked.end());
+                break;
             }
+            case packet_type::dictionary:
+                // Everything after this packet can be compressed with it, in both directions
+                _dictionary = frame->dictionary;
+                _decoder.add_dictionary(frame->dictionary);
+                break;
+            case packet_type::ping:
+                _backend->send(event.fd, ca::packet::pong(frame->ping_time), ca::send_priority::control);
+                break;
+            case packet_type::pong: {
+                const auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                        _last_received.time_since_epoch()).count();
+                const auto round_trip_time = now - static_cast<std::int64_t>(frame->ping_time);
+                _round_trip_time = round_trip_time;
+                ca::trace::counter("rtt_us", round_trip_time);
+                break;
+            }
+            case packet_type::sequenced:
+            case packet_type::chunk:
+                break; // Unwrapped by the decoder
+            case packet_type::ack:
+                _acknowledged(frame->sequence);
+                break;
+            case packet_type::resume:
+                _resume(event.fd, *frame);
+                break;
+            case packet_type::sync:
+                // Only a relay keeps a log, anyone else has nothing more than what was sent already
+                _backend->send(event.fd, ca::packet::history(frame->history_room, frame->sequence, false, {},
+                                                             ca::codec::none));
                 break;
-            case unknown:
+            case packet_type::history:
+                _history(event.fd, *frame, messages);
+                break;
+            case packet_type::search:
+                // Same as syncing, there's no log to search without a relay
+                _backend->send(event.fd, ca::packet::search_results(frame->query_id, {}, ca::codec::none));
+                break;
+            case packet_type::search_results:
+                if (frame->query_id == _search_id) {
+                    auto results = std::vector<ca::message>();
+                    results.reserve(frame->history.size());
+                    for (auto &[sequence, message] : frame->history)
+                        results.push_back(std::move(message));
+
+                    auto guard = std::lock_guard(_incoming_mutex);
+                    _search_results = std::move(results);
+                }
+                break;
+            case packet_type::presence:
+            case packet_type::presence_summary:
+                _presence_update(*frame);
+                break;
+            case packet_type::file_offer:
+            case packet_type::file_accept:
+            case packet_type::file_data:
+            case packet_type::file_done:
+                _files.handle(event.fd, *frame);
                 break;
         }
     }
+
+    // One acknowledgement covers everything up to the last message
+    if (acknowledge)
+        _backend->send(event.fd, ca::packet::ack(_received_sequence), ca::send_priority::control);
+
+    // Reconnecting wouldn't help with either of these
+    if (_decoder.failed()) {
+        _set_error(_decoder.incompatible() ? "Other side uses an incompatible protocol version"
+                   : _decoder.oversized()    ? "Other side sent more than the frame limits allow"
+                                             : "Received a malformed packet");
+        _closed = true;
+    }
+
+    if (!messages.empty()) {
+        auto guard = std::lock_guard(_incoming_mutex);
+        _incoming.insert(_incoming.end(), std::make_move_iterator(messages.begin()),
+                         std::make_move_iterator(messages.end()));
+    }
+
+    if (!read_messages.empty()) {
+        auto guard = std::lock_guard(_inc_read_mutex);
+        _inc_read_messages.insert(_inc_read_messages.end(), read_messages.begin(), read_messages.end());
+    }
 }
 
 void ca::network_processor::start() {
-    _connector.set_non_blocking(true);
     _socket.set_non_blocking(true);
-    _acceptor.set_non_blocking(true);
+    _listener.set_non_blocking(true);
 
     _running = true;
 }
@@ -146,41 +692,61 @@ bool ca::network_processor::connected() const noexcept {
 }
 
 void ca::network_processor::connect(const std::string &address, std::uint16_t port) {
-    _connector = sockpp::tcp_connector();
+    _endpoint = ca::parse_endpoint(address, port);
+    _transport = ca::make_transport(_endpoint.type);
 
-    try {
-        _connector.connect({address, port});
-    } catch (...)
-    {
-        _error = "Failed to connect to server";
-    }
+    // A server that isn't up yet is retried the same way as one that went away, the timers only run once started
+    const auto fd = _transport->connect(_endpoint);
+    if (fd < 0) {
+        _reconnecting = true;
+        _timers.schedule(_reconnect_delay, [this]() { _reconnect(); });
+    } else
+        _socket = sockpp::stream_socket(fd);
 
     _connected = true;
     start();
 }
 
+void ca::network_processor::listen_locally(const std::string &address) {
+    _local_address = address;
+}
+
 std::uint16_t ca::network_processor::create_server() {
     _connected = true;
-    auto port = 50000;
 
-    _acceptor = sockpp::tcp_acceptor();
+    auto fd = -1;
+    if (!_local_address.empty()) {
+        _endpoint = ca::parse_endpoint(_local_address, 0);
+        _transport = ca::make_transport(_endpoint.type);
+        fd = _transport->listen(_endpoint);
+    } else {
+        _endpoint = {.type = ca::transport_type::tcp, .address = "0.0.0.0", .port = 50000};
+        _transport = ca::make_transport(_endpoint.type);
+        while ((fd = _transport->listen(_endpoint)) < 0 && _endpoint.port < UINT16_MAX)
+            _endpoint.port++;
+    }
 
-    while (!_acceptor.open(port++));
-    port--;
+    if (fd < 0)
+        _set_error("Failed to create server on " + ca::to_string(_endpoint));
+    else
+        _listener = sockpp::socket(fd);
 
     _waiting_on_connection = true;
 
-    _server_port = port;
+    _server_port = _endpoint.port;
 
-    return port;
+    return _server_port;
 }
 
 void ca::network_processor::wait_on_connection() {
-    auto peer = sockpp::inet_address();
-    auto socket = _acceptor.accept(&peer);
-
-    _socket = std::move(socket);
+    _socket = sockpp::stream_socket(_transport->accept(_listener.handle()));
     _waiting_on_connection = false;
+
+    // Accepting failed, the backend accepts the client instead once it's started
+    if (!_socket.is_open()) {
+        _reconnecting = true;
+        _backend->add_listener(_listener.handle());
+    }
     start();
 }
 
@@ -192,6 +758,10 @@ std::uint16_t ca::network_processor::server_port() const noexcept {
     return _server_port;
 }
 
+std::string ca::network_processor::server_address() const {
+    return ca::to_string(_endpoint);
+}
+
 std::vector<size_t> ca::network_processor::read_messages() {
     auto guard = std::lock_guard(_inc_read_mutex);
     auto read = _inc_read_messages;
@@ -199,35 +769,81 @@ std::vector<size_t> ca::network_processor::read_messages() {
 }
 
 void ca::network_processor::seen(size_t message_hash) {
-    auto guard = std::lock_guard(_read_mutex);
-    _read_messages.push_back(message_hash);
+    {
+        auto guard = std::lock_guard(_read_mutex);
+        _read_messages.push_back(message_hash);
+    }
+    _backend->wake();
 }
 
-ca::network_processor::network_processor() {
+ca::network_processor::network_processor(ca::io_backend_type backend, ca::send_limit limit,
+                                         ca::heartbeat_settings heartbeat,
+                                         ca::frame_limits frames,
+                                         ca::presence_settings presence,
+                                         std::string downloads,
+                                         ca::store_settings store) : _send_limit(limit),
+                                                                           _heartbeat_settings(heartbeat),
+                                                                           _frame_limits(frames),
+                                                                           _presence_settings(presence),
+                                                                           _receive_budget(frames.memory_budget),
+                                                                           _backend(ca::make_io_backend(backend)),
+                                                                           _files(*_backend, std::move(downloads),
+                                                                                  std::move(store)),
+                                                                           _decoder(frames, &_receive_budget),
+                                                                           _peer_max_frame_size(frames.max_frame_size),
+                                                                           _reconnect_delay(first_reconnect_delay),
+                                                                           _session(random_engine()() | 1) {
+    _backend->set_send_limit(limit);
+
     _processing_thread = std::thread([this](){
+        ca::trace::set_thread_name("network");
+
         while (_processing) {
             using namespace std::chrono_literals;
 
-            // Only poll for new messages once every 100ms
-            std::this_thread::sleep_for(100ms);
-
+            // There's nothing to wait on until a connection has been made
             if (_running)
                 _tick();
+            else
+                std::this_thread::sleep_for(100ms);
         }
 
-        switch (_mode) {
-            case client:
-                _connector.write("\2");
-                break;
-            case server:
-                _socket.write("\2");
-                break;
-            default:
-                break;
+        // Queued like any other packet, so it can't land in the middle of one that's partly sent, then given a
+        // moment to go out before the socket is closed
+        if (_mode != unknown && _socket.is_open()) {
+            const auto fd = _socket.handle();
+            _backend->send(fd, ca::packet::disconnect(), ca::send_priority::control);
+
+            const auto deadline = std::chrono::steady_clock::now() + disconnect_flush_time;
+            while (_backend->queued_bytes(fd) > 0 && std::chrono::steady_clock::now() < deadline)
+                _backend->wait(std::chrono::milliseconds(10), [](const ca::io_event &) {});
+            _backend->remove(fd);
+            _socket.close();
         }
     });
 }
 
 std::string ca::network_processor::error() {
+    auto guard = std::lock_guard(_error_mutex);
     return _error;
 }
+
+void ca::network_processor::_set_error(std::string error) {
+    auto guard = std::lock_guard(_error_mutex);
+    _error = std::move(error);
+}
+
+std::optional<std::chrono::microseconds> ca::network_processor::round_trip_time() const noexcept {
+    const auto round_trip_time = _round_trip_time.load();
+    if (round_trip_time < 0)
+        return std::nullopt;
+    return std::chrono::microseconds(round_trip_time);
+}
+
+bool ca::network_processor::reconnecting() const noexcept {
+    return _reconnecting;
+}
+
+const char *ca::network_processor::io_backend_name() const noexcept {
+    return _backend->name();
+}
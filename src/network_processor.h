@@ -1,20 +1,42 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <client_mode.h>
+#include <file_transfer.h>
+#include <frame_decoder.h>
+#include <frame_limits.h>
+#include <heartbeat.h>
+#include <io_backend.h>
 #include <message.h>
+#include <presence.h>
+#include <timer_wheel.h>
+#include <transport.h>
 
-#include <sockpp/tcp_acceptor.h>
-#include <sockpp/tcp_connector.h>
+#include <sockpp/stream_socket.h>
 
 namespace ca {
     class network_processor {
     public:
-        network_processor();
+        /// \param backend Which io backend the processing thread uses to wait on / read from / write to the socket
+        /// \param limit How much can be queued for the other side, and what happens when it isn't keeping up.
+        /// With backpressure_policy::block, #queue_message waits until there is room again
+        /// \param heartbeat How often the other side is pinged, and how long it can stay quiet before it's considered dead
+        /// \param frames The biggest packet the other side can send us, and how much it can make us buffer
+        /// \param presence How often typing updates go out at most, and when the user has stopped typing
+        /// \param downloads The directory received files are saved in
+        /// \param store Where the content of sent and received files is kept, so it's never sent twice
+        explicit network_processor(ca::io_backend_type backend = ca::io_backend_type::automatic, ca::send_limit limit = {},
+                                   ca::heartbeat_settings heartbeat = {}, ca::frame_limits frames = {},
+                                   ca::presence_settings presence = {}, std::string downloads = "downloads",
+                                   ca::store_settings store = {});
 
         ~network_processor();
 
@@ -25,9 +47,12 @@ namespace ca {
         /// \param mode Either server, or client. Unknown will result in undefined behaviour
         void set_mode(ca::client_mode mode);
 
-        /// Connect the processor to the specified server (Only legal if the mode is client)
-        /// \param address The server address (localhost: 127.0.0.1)
-        /// \param port The server port (Typically 50000, displayed on the server information screen)
+        /// Connect the processor to the specified server (Only legal if the mode is client), a server that can't be
+        /// reached yet is retried like a connection that dropped
+        /// \param address The server address (localhost: 127.0.0.1), or "unix:<path>" for a server on the same host
+        /// listening on a Unix domain socket ("memory:<name>" for one in the same process)
+        /// \param port The server port (Typically 50000, displayed on the server information screen), unused for a Unix
+        /// domain socket
         void connect(const std::string &address, std::uint16_t port);
 
         /// Waits for a connection to be established from a client (Only legal if the mode is server)
@@ -41,14 +66,24 @@ namespace ca {
         /// \return Waiting for a connection
         [[nodiscard]] bool waiting_on_connection() const noexcept;
 
+        /// Makes #create_server listen for a peer on the same host instead of on a TCP port (without going through
+        /// the TCP/IP stack then)
+        /// \param address Where to listen, the way #connect takes it: "unix:<path>" for a Unix domain socket (it's
+        /// removed again when the processor is destroyed) or "memory:<name>" for a peer in the same process
+        void listen_locally(const std::string &address);
+
         /// This creates a server (Only legal if the mode is server)
-        /// \return The port that the server was created on
+        /// \return The port that the server was created on, 0 when listening locally (or if it couldn't listen there)
         [[nodiscard]] std::uint16_t create_server();
 
         /// Only legal if the mode is server
         /// \return The current port the server is bound to
         [[nodiscard]] std::uint16_t server_port() const noexcept;
 
+        /// Only legal if the mode is server
+        /// \return Where the server can be reached, the way #connect takes it
+        [[nodiscard]] std::string server_address() const;
+
         /// Is the processor connected to another one
         /// \return true if there is a connection, false if not
         [[nodiscard]] bool connected() const noexcept;
@@ -57,9 +92,66 @@ namespace ca {
         /// \return either client, server, unknown
         [[nodiscard]] ca::client_mode mode() const noexcept;
 
-        /// Queue a new message to be sent to the connected processor
-        /// \param message The message to be sent
-        void queue_message(const ca::message& message);
+        /// Queue a new message to be sent to the connected processor. Messages bigger than the other side's frame
+        /// limit are dropped, it would only close the connection over them
+        /// \param message The message to be sent, ca::message::share it to keep it around as well
+        void queue_message(ca::message &&message);
+
+        /// Queue a new message to be sent to everyone in a room (Only works when connected to a relay server)
+        /// \param message The message to be sent, ca::message::share it to keep it around as well
+        /// \param room The room to send it to
+        void queue_message(ca::message &&message, ca::room_id room);
+
+        /// Join a room on the relay server, its messages show up in #incoming_messages
+        /// \param room The room to join
+        void subscribe(ca::room_id room);
+
+        /// Leave a room on the relay server
+        /// \param room The room to leave
+        void unsubscribe(ca::room_id room);
+
+        /// Asks a relay server for the messages of a room we haven't seen yet, they show up in #incoming_messages (in
+        /// the order they were sent, older than what has arrived so far). Only the missing range is sent, a page at a
+        /// time, the next page is asked for once the last one has arrived. Joining a room and connecting sync by
+        /// themselves, this is only needed to go further back
+        /// \param room The room, empty for the messages that weren't sent to a room
+        /// \param since Only messages that reached the relay at or after this time (seconds since epoch), 0 for
+        /// everything after the last message we've seen
+        void request_history(std::optional<ca::room_id> room, std::uint64_t since = 0);
+
+        /// Searches a relay server's history for the messages containing every word of a query, the newest ones in the
+        /// rooms we're in come back through #search_results. Searching again before they have arrived replaces the
+        /// search, a search made while reconnecting is sent once the connection is back
+        /// \param query The words to look for, case doesn't matter
+        void search(const std::string &query);
+
+        /// Lets the other side know if we're typing, meant to be called whenever the user edits the message. Updates
+        /// are coalesced to at most one per presence interval, only the latest state is sent and it's dropped while
+        /// the connection is backed up. Once the user hasn't typed for the idle time we're not typing anymore
+        /// \param typing false once the message has been sent or cleared
+        /// \param room The room the message is for, empty outside of rooms
+        void typing(bool typing, std::optional<ca::room_id> room = std::nullopt);
+
+        /// Who else is in a room, as the relay (or the other side of a direct connection) last told us
+        /// \param room The room, empty for everyone connected
+        /// \return How many others are online and typing, nobody until the first update arrives
+        [[nodiscard]] ca::presence presence(std::optional<ca::room_id> room = std::nullopt);
+
+        /// The results of the last #search, only returned once
+        /// \return The matching messages (newest first), empty until they've arrived. A peer that isn't a relay has
+        /// nothing to search and always answers with no messages
+        [[nodiscard]] std::optional<std::vector<ca::message>> search_results();
+
+        /// Sends a file to the other side (Only works over a direct connection, a relay server doesn't pass files on).
+        /// It's hashed first, then streamed from disk without being read into memory, and continues where it left off
+        /// after a reconnect. Content the other side has kept from before isn't sent at all. What arrives from the
+        /// other side is saved in the downloads directory
+        /// \param path The file to send, a transfer that fails straight away if it can't be opened
+        void send_file(const std::string &path);
+
+        /// Every file sent and received so far, and how far along it is
+        /// \return The transfers, in the order they were started
+        [[nodiscard]] std::vector<ca::file_transfer> file_transfers() const;
 
         /// Get the messages that have been processed by the network processor
         /// \return The messages to process
@@ -73,14 +165,117 @@ namespace ca {
         /// \return Returns the current error, if none returns empty string
         [[nodiscard]] std::string error();
 
+        /// The round trip time to the other side, measured with the heartbeats. It's also recorded as the "rtt_us"
+        /// trace counter
+        /// \return The round trip time of the last answered ping, empty if none has been answered yet
+        [[nodiscard]] std::optional<std::chrono::microseconds> round_trip_time() const noexcept;
+
+        /// If the connection dropped and is being re-established, as a client by reconnecting to the server (backing
+        /// off while it stays unreachable), as a server by waiting for the client to come back. Messages queued in the
+        /// meantime are sent once it's back, and nothing sent before the drop is lost or shown twice
+        /// \return true while there is no connection
+        [[nodiscard]] bool reconnecting() const noexcept;
+
+        /// The io backend that ended up being used, this can differ from the requested one if it isn't supported
+        /// \return The backend name
+        [[nodiscard]] const char *io_backend_name() const noexcept;
+
     private:
+        /// A message that's been numbered and sent (or is waiting for the connection), kept until the other side
+        /// acknowledges it so it can be sent again after a reconnect
+        struct unacked_message {
+            std::uint64_t sequence;
+            ca::message message;
+            std::optional<ca::room_id> room;
+            size_t size; // What it takes up on the wire, see packet::message_size
+        };
+
+        /// A history sync that is still paging through a room
+        struct history_sync {
+            std::uint64_t after;                  // The next page starts after this sequence number
+            std::uint64_t since;
+            std::unordered_set<std::uint64_t> live; // Arrived while syncing, skipped when they show up in a page
+        };
+
         /// Internal function: The main processing loop that is executed on another thread
         void _tick();
 
+        /// Internal function: Handles data / disconnects reported by the io backend
+        void _handle_event(const ca::io_event &event);
+
+        /// Internal function: Pings the other side, and schedules the next ping
+        /// \param fd The socket connected to the other side
+        void _ping(int fd);
+
+        /// Internal function: Closes the connection if the other side has gone quiet for too long, otherwise checks
+        /// again once it could have
+        /// \param fd The socket connected to the other side
+        void _check_peer(int fd);
+
+        /// Internal function: Sends everything a new connection starts with, our hello, the rooms we're in and how far
+        /// we've got, so the other side can resend what we've missed
+        /// \param fd The socket connected to the other side
+        /// \return false if the socket can't be watched
+        bool _register(int fd);
+
+        /// Internal function: Sends a numbered message, compressed the way the current connection negotiated
+        /// \param fd The socket connected to the other side
+        /// \param message The message to send
+        void _send_message(int fd, const unacked_message &message);
+
+        /// Internal function: Handles the other side's resume packet, resending whatever it hasn't received
+        /// \param fd The socket connected to the other side
+        /// \param frame The resume packet
+        void _resume(int fd, const ca::frame_decoder::frame &frame);
+
+        /// Internal function: Starts syncing a room's history, unless it already is
+        /// \param room The room, empty for the messages that weren't sent to a room
+        /// \param since The oldest messages to get, 0 for everything after the last one we've seen
+        void _start_sync(std::optional<ca::room_id> room, std::uint64_t since);
+
+        /// Internal function: Handles a page of history, asking for the next one if there is more
+        /// \param fd The socket connected to the other side
+        /// \param frame The history packet
+        /// \param messages Where the messages we haven't seen go
+        void _history(int fd, ca::frame_decoder::frame &frame, std::vector<ca::message> &messages);
+
+        /// Internal function: Sends whether we're typing, if it changed (or has to be repeated) and the last update was
+        /// at least an interval ago
+        /// \param fd The socket connected to the other side
+        void _send_typing(int fd);
+
+        /// Internal function: Keeps what the other side told us about a room, without counting ourselves
+        /// \param frame The presence or presence_summary packet
+        void _presence_update(const ca::frame_decoder::frame &frame);
+
+        /// Internal function: If a message fits in the other side's frame limit
+        /// \param size The message's size as counted in unacked_message::size
+        [[nodiscard]] bool _fits(size_t size) const noexcept;
+
+        /// Internal function: Forgets about the messages the other side has received
+        /// \param sequence The last message it has received
+        void _acknowledged(std::uint64_t sequence);
+
+        /// Internal function: The connection dropped without the other side closing it, starts getting it back
+        void _connection_lost();
+
+        /// Internal function: Tries to connect to the server again, and schedules the next try (further out every time)
+        /// if it's still unreachable
+        void _reconnect();
+
+        /// Internal function: Sets the error the UI thread shows
+        /// \param error The error
+        void _set_error(std::string error);
+
+        /// Internal function: With backpressure_policy::block, waits until the send queue has room again
+        /// \param lock Holds _outgoing_mutex
+        void _wait_for_space(std::unique_lock<std::mutex> &lock);
+
         bool _connected = false;
         bool _waiting_on_connection = false;
 
-        std::string _error;
+        std::mutex _error_mutex;
+        std::string _error; // Set from both threads, under _error_mutex
 
         std::uint16_t _server_port = 0;
 
@@ -88,12 +283,36 @@ namespace ca {
         std::atomic<ca::client_mode> _mode = ca::client_mode::unknown; // Default to client
         std::atomic<bool> _processing = true;
         std::atomic<bool> _running = false;
+        std::atomic<bool> _closed = false; // The connection is gone, nothing queued is going to be sent anymore
+        std::atomic<bool> _reconnecting = false; // The connection dropped, messages are kept until it's back
 
         std::mutex _incoming_mutex;
         std::vector<ca::message> _incoming;
+        std::optional<std::vector<ca::message>> _search_results;
+        std::unordered_map<std::optional<ca::room_id>, ca::presence> _presence; // Everyone else, per room
 
         std::mutex _outgoing_mutex;
         std::vector<ca::message> _outgoing;
+        std::vector<std::pair<ca::room_id, ca::message>> _outgoing_room_messages;
+        std::vector<std::vector<std::byte>> _outgoing_packets; // Already serialized (subscriptions)
+        std::vector<ca::room_id> _rooms;         // Every room we're in, joined again after reconnecting
+        std::vector<std::pair<std::optional<ca::room_id>, std::uint64_t>> _history_requests; // Room and since
+        std::optional<std::pair<std::uint64_t, std::string>> _search; // Query id and query, waiting to be sent
+        std::vector<std::string> _outgoing_files; // Paths, waiting to be handed to _files
+        std::atomic<std::uint64_t> _search_id = 0; // The newest search, results of older ones are ignored
+        bool _typing = false;                    // What the user is doing, as of their last input
+        std::optional<ca::room_id> _typing_room;
+        std::chrono::steady_clock::time_point _last_input;
+        std::condition_variable _outgoing_space; // Signalled after every tick, when data may have been written
+        size_t _outgoing_bytes = 0;              // Serialized size of the queued messages
+        size_t _backend_queued = 0;              // What the io backend still has to write, as of the last tick
+        ca::send_limit _send_limit;
+
+        ca::heartbeat_settings _heartbeat_settings;
+        ca::frame_limits _frame_limits;
+        ca::presence_settings _presence_settings;
+        ca::receive_budget _receive_budget; // Only the one connection's receive buffer reserves from it
+        std::atomic<std::int64_t> _round_trip_time = -1; // Microseconds, -1 until the first pong arrives
 
         std::mutex _read_mutex;
         std::vector<size_t> _read_messages;
@@ -101,9 +320,42 @@ namespace ca {
         std::mutex _inc_read_mutex;
         std::vector<size_t> _inc_read_messages;
 
-        sockpp::tcp_connector  _connector;
-        sockpp::tcp_acceptor _acceptor;
-        sockpp::tcp_socket _socket;
+        ca::endpoint _endpoint; // The server we connected to (for reconnecting), or the one we are
+        std::unique_ptr<ca::transport> _transport;
+        std::string _local_address; // See #listen_locally
+
+        sockpp::stream_socket _socket; // Connected to the other side, whichever side connected
+        sockpp::socket _listener;      // As a server, accepts the client (again after it lost the connection)
+
+        // Only used by the processing thread (apart from io_backend::wake)
+        std::unique_ptr<ca::io_backend> _backend;
+        ca::file_transfers _files; // Sends through _backend
+        ca::frame_decoder _decoder;
+        bool _registered = false; // If the socket has been added to the backend
+        ca::codec _codec = ca::codec::none; // Picked once the other side's hello arrives
+        size_t _peer_max_frame_size;        // Ours until the other side's hello arrives
+        std::shared_ptr<const ca::dictionary> _dictionary; // Sent to us by a relay server, for small messages
+        std::chrono::steady_clock::time_point _last_received; // When anything last arrived from the other side
+        ca::timer_wheel _timers;
+        ca::timer_wheel::timer_id _ping_timer = ca::timer_wheel::no_timer;
+        ca::timer_wheel::timer_id _peer_timer = ca::timer_wheel::no_timer;
+        std::chrono::milliseconds _reconnect_delay; // Doubles with every failed attempt, up to a limit
+        bool _announced_typing = false;             // What the other side was last told, written under _incoming_mutex
+        std::optional<ca::room_id> _announced_room;
+        std::chrono::steady_clock::time_point _last_announced;
+
+        // Resuming after a reconnect, messages in both directions are numbered per session
+        std::uint64_t _session;               // Random, tells the other side it's still us after a reconnect
+        std::uint64_t _peer_session = 0;      // The other side's, from its resume packet
+        std::uint64_t _sent_sequence = 0;     // The number of the last message we sent
+        std::uint64_t _received_sequence = 0; // The number of the last message we received from _peer_session
+        bool _resumed = false;                // The other side's resume has arrived, messages can be sent again
+        std::deque<unacked_message> _unacked; // Sent (or waiting to be), not acknowledged yet
+        size_t _unacked_bytes = 0;
+
+        // Syncing history from a relay, rooms are empty for the messages that weren't sent to a room
+        std::unordered_map<std::optional<ca::room_id>, std::uint64_t> _known; // Newest sequence number seen per room
+        std::unordered_map<std::optional<ca::room_id>, history_sync> _syncs;  // The rooms still paging
 
         std::thread _processing_thread;
     };
@@ -0,0 +1,527 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <compression.h>
+#include <message.h>
+#include <presence.h>
+#include <wire.h>
+
+namespace ca {
+    /// The first byte of every packet sent over the wire, all numbers after it are varints (see ca::wire::writer)
+    enum class packet_type : std::uint8_t {
+        message = 0,      // A new chat message, see ca::message::as_stream
+        message_read = 1, // The other side has read one of our messages, the message hash
+        disconnect = 2,   // The other side is closing the connection
+        subscribe = 3,    // Start receiving the messages sent to a room, the room id
+        unsubscribe = 4,  // Stop receiving the messages sent to a room, the room id
+        room_message = 5, // A chat message sent to a room, the room id followed by a message packet
+        hello = 6,        // Always the first packet on a connection, the protocol version, the codecs
+                          // (ca::codec_bit mask) the sender can decompress and the biggest packet it accepts
+        dictionary = 7,   // A relay's dictionary for small messages, the version, size and content
+        ping = 8,         // A heartbeat, the sender's clock (opaque to the receiver) which is echoed back
+        pong = 9,         // The answer to a ping, the clock value from the ping
+        sequenced = 10,   // A chat message numbered by whoever sent it, the sequence number followed by a message or
+                          // room_message packet. Every chat message is sent like this, so it can be resent after a
+                          // reconnect and skipped if it already arrived
+        ack = 11,         // Every sequenced message up to this sequence number has arrived
+        resume = 12,      // Sent after the hello on every connection, our session, the other side's session as we
+                          // know it and the last sequence number we got from that session
+        sync = 13,        // Asks a relay for the messages we've missed: the room + 1 (0 for messages that weren't
+                          // sent to a room), the last sequence number we know of, the oldest time we want
+                          // and how many messages at most
+        history = 14,     // A page of messages answering a sync: the room + 1, the sequence number to ask for the next
+                          // page after, if there is more, the size and then the sequenced message packets
+                          // (compressed as a single block: the codec, the uncompressed size and the data)
+        search = 15,      // Searches a relay's history: the query id, the size and the query text
+        search_results = 16, // The messages matching a search, newest first: the query id, and then a block of
+                             // sequenced message packets like a history page
+        presence = 17,       // If the sender is typing: the room + 1 (0 outside of rooms), then 1 if it is and 0 if not.
+                             // Never sequenced or resent, see ca::presence_settings
+        presence_summary = 18, // Who is in a room, from a relay at most once per interval: the room + 1, how many are
+                               // online and how many of them are typing (see ca::presence)
+        chunk = 19,            // A piece of a packet too big to send in one go (see packet::max_chunk_size): 1 if more
+                               // pieces follow and 0 for the last one, the size and the piece. Other packets can go
+                               // between the pieces, but never the pieces of another chunked packet
+        file_offer = 20,  // A file the sender wants to send: the transfer id, the size, the content hash (see
+                          // ca::content_hash), the size of the name and the name. Sent again on every connection
+                          // until the transfer is done
+        file_accept = 21, // How much of a file the receiver already has: the transfer id and the offset. Answers
+                          // every offer, the file is sent from there on, and is repeated as the file arrives
+        file_data = 22,   // A part of a file: the transfer id, the offset, the size and the data. Never chunked,
+                          // see packet::max_file_data_size
+        file_done = 23    // The whole file has arrived: the transfer id, then 1 if its content hash matched and 0 if
+                          // it didn't
+    };
+
+    /// Set on the type byte of a message packet whose content is compressed. The content is then the codec (1 byte),
+    /// the uncompressed size, the dictionary version (only for zstd_dictionary) and the compressed data
+    constexpr auto compressed_flag = std::uint8_t(0x80);
+
+    namespace packet {
+        /// Packets bigger than this are sent as chunk packets of at most this much, see ca::write_queue
+        constexpr auto max_chunk_size = size_t(16 * 1024);
+
+        /// The most the fields of a chunk packet take up in front of its piece
+        constexpr auto max_chunk_header_size = 2 + ca::wire::max_varint_size;
+
+        /// Writes everything of a chunk packet that goes in front of the piece, without allocating, the piece itself
+        /// is sent straight from the packet it's cut from
+        /// \param header Where the fields go
+        /// \param more If more pieces of the packet follow this one
+        /// \param size The size of the piece
+        /// \return How many bytes of the header were used
+        inline size_t chunk_header(std::span<std::byte, max_chunk_header_size> header, bool more,
+                                   size_t size) noexcept {
+            auto used = size_t(0);
+            header[used++] = std::byte(packet_type::chunk);
+            header[used++] = std::byte(more ? 1 : 0);
+            for (; size >= 0x80; size >>= 7)
+                header[used++] = std::byte(std::uint8_t(size) | 0x80);
+            header[used++] = std::byte(size);
+            return used;
+        }
+
+        /// Files are sent in file_data packets of at most this much, each one is a whole packet so other packets can go
+        /// between any two of them
+        constexpr auto max_file_data_size = size_t(64 * 1024);
+
+        /// The most the fields of a file_data packet take up in front of its data
+        constexpr auto max_file_data_header_size = 1 + 3 * ca::wire::max_varint_size;
+
+        /// Writes everything of a file_data packet that goes in front of the data, the data itself is sent straight
+        /// from the file
+        /// \param header Where the fields go
+        /// \param transfer The transfer id from the offer
+        /// \param offset Where in the file the data starts
+        /// \param size How much data follows
+        /// \return How many bytes of the header were used
+        inline size_t file_data_header(std::span<std::byte, max_file_data_header_size> header, std::uint64_t transfer,
+                                       std::uint64_t offset, size_t size) noexcept {
+            auto used = size_t(0);
+            header[used++] = std::byte(packet_type::file_data);
+            for (auto value : {transfer, offset, std::uint64_t(size)}) {
+                for (; value >= 0x80; value >>= 7)
+                    header[used++] = std::byte(std::uint8_t(value) | 0x80);
+                header[used++] = std::byte(value);
+            }
+            return used;
+        }
+
+        /// If a packet can be thrown away unsent when the other side isn't keeping up (see
+        /// backpressure_policy::drop_oldest). Only chat messages and presence can, everything else carries protocol
+        /// state the other side depends on (a lost hello, resume, dictionary or history page breaks the connection)
+        /// \param bytes The serialized packet
+        /// \return If it's a chat message or a presence update
+        [[nodiscard]] inline bool droppable(std::span<const std::byte> bytes) noexcept {
+            if (bytes.empty())
+                return false;
+
+            switch (packet_type(std::to_integer<std::uint8_t>(bytes.front()) & ~compressed_flag)) {
+                case packet_type::message:
+                case packet_type::room_message:
+                case packet_type::sequenced:
+                case packet_type::presence:
+                case packet_type::presence_summary:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        /// Serializes a notification that a message has been read
+        /// \param message_hash The hash of the message that's been read
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> message_read(size_t message_hash) {
+            auto stream = ca::wire::writer(1 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::message_read));
+            stream.varint(message_hash);
+            return stream.take();
+        }
+
+        /// Serializes a notification that we're closing the connection
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> disconnect() {
+            return {std::byte(packet_type::disconnect)};
+        }
+
+        /// Serializes the packet announcing what we support, sent first thing on every connection
+        /// \param codecs The codecs we can decompress
+        /// \param max_frame_size The biggest packet we accept, see ca::frame_limits
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> hello(std::uint8_t codecs, size_t max_frame_size) {
+            auto stream = ca::wire::writer(1 + 3 * ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::hello));
+            stream.varint(ca::wire::protocol_version);
+            stream.varint(codecs);
+            stream.varint(max_frame_size);
+            return stream.take();
+        }
+
+        /// Serializes a message, compressing the content if it's big enough for that to pay off
+        /// \param stream Where the packet is written, behind whatever it has already
+        /// \param message The message to send
+        /// \param codec The codec negotiated with the other side for big messages, none never compresses them
+        /// \param dictionary The dictionary for small messages, nullptr if the other side doesn't have one
+        inline void message(ca::wire::writer &stream, const ca::message &message, ca::codec codec,
+                            const ca::dictionary *dictionary = nullptr) {
+            const auto &content = message.content();
+            const auto content_bytes = std::as_bytes(std::span(content.data(), content.size()));
+
+            // Big messages compress fine on their own, small ones only do with a dictionary
+            auto compressed = std::vector<std::byte>();
+            if (content.size() >= ca::compression_threshold && codec != ca::codec::none)
+                compressed = ca::compress(codec, content_bytes);
+            else if (content.size() < ca::compression_threshold && content.size() >= ca::dictionary_threshold &&
+                     dictionary) {
+                codec = ca::codec::zstd_dictionary;
+                compressed = dictionary->compress(content_bytes);
+            }
+
+            const auto info_size = 1 + ca::wire::varint_size(content.size()) +
+                                   (codec == ca::codec::zstd_dictionary ? ca::wire::varint_size(dictionary->version()) : 0);
+            if (compressed.empty() || compressed.size() + info_size >= content.size()) {
+                message.write(stream);
+                return;
+            }
+
+            const auto size = compressed.size() + info_size;
+            stream.byte(std::uint8_t(packet_type::message) | compressed_flag);
+            stream.timestamp(message.time_sent());
+            stream.varint(size);
+
+            stream.byte(std::uint8_t(codec));
+            stream.varint(content.size());
+            if (codec == ca::codec::zstd_dictionary)
+                stream.varint(dictionary->version());
+
+            stream.bytes(compressed);
+        }
+
+        /// Serializes a message on its own, see the overload writing to a ca::wire::writer
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> message(const ca::message &message, ca::codec codec,
+                                                            const ca::dictionary *dictionary = nullptr) {
+            auto stream = ca::wire::writer(1 + 2 * ca::wire::max_varint_size + message.content().size());
+            packet::message(stream, message, codec, dictionary);
+            return stream.take();
+        }
+
+        /// Serializes a dictionary for the other side to compress small messages with
+        /// \param dictionary The trained dictionary
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> dictionary(const ca::dictionary &dictionary) {
+            const auto &content = dictionary.content();
+
+            auto stream = ca::wire::writer(1 + 2 * ca::wire::max_varint_size + content.size());
+            stream.byte(std::uint8_t(packet_type::dictionary));
+            stream.varint(dictionary.version());
+            stream.varint(content.size());
+            stream.bytes(content);
+            return stream.take();
+        }
+
+        /// Serializes a heartbeat, the other side answers it with a #pong
+        /// \param time Our clock (in microseconds), used to measure the round trip time once it comes back
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> ping(std::uint64_t time) {
+            auto stream = ca::wire::writer(1 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::ping));
+            stream.varint(time);
+            return stream.take();
+        }
+
+        /// Serializes the answer to a heartbeat
+        /// \param time The clock value from the ping, unchanged
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> pong(std::uint64_t time) {
+            auto stream = ca::wire::writer(1 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::pong));
+            stream.varint(time);
+            return stream.take();
+        }
+
+        /// Serializes a chat message as a sequenced packet before its sequence number is known, the number is filled
+        /// in by #number. The message (in a room_message packet if it's sent to a room) is written once, straight
+        /// behind the room left for the number
+        /// \param width How many bytes to leave for the sequence number, see ca::wire::varint_size
+        /// \param room The room the message is sent to, empty if it isn't
+        /// \param message The message to send
+        /// \param codec The codec negotiated with the other side for big messages
+        /// \param dictionary The dictionary for small messages, nullptr if the other side doesn't have one
+        /// \return Serialized packet as a byte vector, numbered 0
+        [[nodiscard]] inline std::vector<std::byte> unnumbered(size_t width, std::optional<ca::room_id> room,
+                                                               const ca::message &message, ca::codec codec,
+                                                               const ca::dictionary *dictionary = nullptr) {
+            auto stream = ca::wire::writer(3 + 3 * ca::wire::max_varint_size + message.content().size());
+            stream.byte(std::uint8_t(packet_type::sequenced));
+            stream.varint(0, width);
+            if (room) {
+                stream.byte(std::uint8_t(packet_type::room_message));
+                stream.varint(*room);
+            }
+            packet::message(stream, message, codec, dictionary);
+            return stream.take();
+        }
+
+        /// \param packet A packet from #unnumbered
+        /// \return How many bytes it has for the sequence number, the message follows them
+        [[nodiscard]] inline size_t sequence_width(std::span<const std::byte> packet) noexcept {
+            auto width = size_t(1);
+            while (width < ca::wire::max_varint_size && width < packet.size() &&
+                   (std::to_integer<std::uint8_t>(packet[width]) & 0x80))
+                width++;
+            return width;
+        }
+
+        /// Fills in the sequence number of a packet from #unnumbered
+        /// \param packet The packet
+        /// \param sequence The sequence number, they go up by at least one for every message sent
+        /// \return false if the number doesn't fit in the room left for it
+        [[nodiscard]] inline bool number(std::span<std::byte> packet, std::uint64_t sequence) noexcept {
+            return packet.size() > 1 && ca::wire::padded_varint(packet.subspan(1, sequence_width(packet)), sequence);
+        }
+
+        /// How big a chat message is as a sequenced packet (see #sequenced) when it isn't compressed, compression only
+        /// ever makes it smaller
+        /// \param sequence The sequence number
+        /// \param room The room the message is sent to, empty if it isn't
+        /// \param message The message
+        /// \return The size in bytes
+        [[nodiscard]] inline size_t message_size(std::uint64_t sequence, std::optional<ca::room_id> room,
+                                                 const ca::message &message) noexcept {
+            const auto content = message.content().size();
+            const auto header = 1 + ca::wire::varint_size(sequence) +
+                                (room ? 1 + ca::wire::varint_size(*room) : 0) + 1 +
+                                ca::wire::varint_size(ca::wire::zigzag_timestamp(message.time_sent())) +
+                                ca::wire::varint_size(content);
+            return header + content;
+        }
+
+        /// Serializes a chat message as a sequenced packet, see #unnumbered
+        /// \param sequence The sequence number
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> sequenced(std::uint64_t sequence, std::optional<ca::room_id> room,
+                                                              const ca::message &message, ca::codec codec,
+                                                              const ca::dictionary *dictionary = nullptr) {
+            auto packet = unnumbered(ca::wire::varint_size(sequence), room, message, codec, dictionary);
+            (void) number(packet, sequence);
+            return packet;
+        }
+
+        /// Serializes an acknowledgement of the sequenced messages that have arrived
+        /// \param sequence The highest sequence number received
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> ack(std::uint64_t sequence) {
+            auto stream = ca::wire::writer(1 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::ack));
+            stream.varint(sequence);
+            return stream.take();
+        }
+
+        /// Serializes where we left off, so the other side only resends what we missed
+        /// \param session Identifies us, it stays the same when we reconnect
+        /// \param peer_session The other side's session the sequence number belongs to, 0 if we don't know it
+        /// \param sequence The last sequence number we got from the other side's session
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> resume(std::uint64_t session, std::uint64_t peer_session,
+                                                           std::uint64_t sequence) {
+            auto stream = ca::wire::writer(1 + 3 * ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::resume));
+            stream.varint(session);
+            stream.varint(peer_session);
+            stream.varint(sequence);
+            return stream.take();
+        }
+
+        /// Serializes a request for the messages we've missed, the answer is a #history page
+        /// \param room The room, empty for the messages that weren't sent to a room
+        /// \param after The last sequence number we know of in the room, 0 if we haven't seen any
+        /// \param since Only messages that reached the relay at or after this time (seconds since epoch), 0 for all
+        /// \param limit How many messages the page can have at most
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> sync(std::optional<ca::room_id> room, std::uint64_t after,
+                                                         std::uint64_t since, std::uint32_t limit) {
+            auto stream = ca::wire::writer(1 + 4 * ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::sync));
+            stream.varint(room ? std::uint64_t(*room) + 1 : 0);
+            stream.varint(after);
+            stream.varint(since);
+            stream.varint(limit);
+            return stream.take();
+        }
+
+        /// Writes sequenced message packets as a single block, compressed together so even short ones shrink: the size,
+        /// the codec (none if compressing didn't pay off), the uncompressed size and the data
+        /// \param stream Where the block goes
+        /// \param messages The sequenced message packets, one after the other
+        /// \param codec What to compress them with, none leaves them as they are
+        inline void message_block(ca::wire::writer &stream, std::span<const std::byte> messages, ca::codec codec) {
+            auto compressed = codec != ca::codec::none ? ca::compress(codec, messages) : std::vector<std::byte>();
+            if (compressed.empty() || compressed.size() >= messages.size())
+                codec = ca::codec::none;
+
+            const auto block = codec == ca::codec::none ? messages : std::span<const std::byte>(compressed);
+            stream.varint(1 + ca::wire::varint_size(messages.size()) + block.size());
+            stream.byte(std::uint8_t(codec));
+            stream.varint(messages.size());
+            stream.bytes(block);
+        }
+
+        /// Serializes a page of history
+        /// \param room The room the page is for, empty for the messages that weren't sent to a room
+        /// \param last_sequence The sequence number the next page starts after
+        /// \param more If there are more messages after this page
+        /// \param messages The sequenced message packets, one after the other
+        /// \param codec What to compress them with, none leaves them as they are
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> history(std::optional<ca::room_id> room, std::uint64_t last_sequence,
+                                                            bool more, std::span<const std::byte> messages,
+                                                            ca::codec codec) {
+            auto stream = ca::wire::writer(2 + 5 * ca::wire::max_varint_size + messages.size());
+            stream.byte(std::uint8_t(packet_type::history));
+            stream.varint(room ? std::uint64_t(*room) + 1 : 0);
+            stream.varint(last_sequence);
+            stream.byte(more ? 1 : 0);
+            message_block(stream, messages, codec);
+            return stream.take();
+        }
+
+        /// Serializes a search of a relay's history, the answer is a #search_results packet
+        /// \param query_id Identifies the search, the results carry the same id
+        /// \param query The words to look for, a message has to contain all of them
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> search(std::uint64_t query_id, std::string_view query) {
+            auto stream = ca::wire::writer(1 + 2 * ca::wire::max_varint_size + query.size());
+            stream.byte(std::uint8_t(packet_type::search));
+            stream.varint(query_id);
+            stream.varint(query.size());
+            stream.bytes(std::as_bytes(std::span(query)));
+            return stream.take();
+        }
+
+        /// Serializes the messages matching a search
+        /// \param query_id The id of the search
+        /// \param messages The sequenced message packets, newest first
+        /// \param codec What to compress them with, none leaves them as they are
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> search_results(std::uint64_t query_id,
+                                                                   std::span<const std::byte> messages,
+                                                                   ca::codec codec) {
+            auto stream = ca::wire::writer(1 + 4 * ca::wire::max_varint_size + messages.size());
+            stream.byte(std::uint8_t(packet_type::search_results));
+            stream.varint(query_id);
+            message_block(stream, messages, codec);
+            return stream.take();
+        }
+
+        /// Serializes whether we're typing
+        /// \param room The room we're typing in, empty outside of rooms
+        /// \param typing If we are
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> presence(std::optional<ca::room_id> room, bool typing) {
+            auto stream = ca::wire::writer(2 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::presence));
+            stream.varint(room ? std::uint64_t(*room) + 1 : 0);
+            stream.byte(typing ? 1 : 0);
+            return stream.take();
+        }
+
+        /// Serializes who is in a room, a relay sends the same packet to every member
+        /// \param room The room, empty outside of rooms
+        /// \param presence Who is online in it and typing
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> presence_summary(std::optional<ca::room_id> room,
+                                                                     const ca::presence &presence) {
+            auto stream = ca::wire::writer(1 + 3 * ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::presence_summary));
+            stream.varint(room ? std::uint64_t(*room) + 1 : 0);
+            stream.varint(presence.online);
+            stream.varint(presence.typing);
+            return stream.take();
+        }
+
+        /// Serializes an offer to send a file
+        /// \param transfer Identifies the transfer, it stays the same across reconnects
+        /// \param size The size of the file
+        /// \param content_hash The XXH64 of the whole file, the receiver checks what arrived against it
+        /// \param name The file name, without any directories
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> file_offer(std::uint64_t transfer, std::uint64_t size,
+                                                               std::uint64_t content_hash, std::string_view name) {
+            auto stream = ca::wire::writer(1 + 4 * ca::wire::max_varint_size + name.size());
+            stream.byte(std::uint8_t(packet_type::file_offer));
+            stream.varint(transfer);
+            stream.varint(size);
+            stream.varint(content_hash);
+            stream.varint(name.size());
+            stream.bytes(std::as_bytes(std::span(name)));
+            return stream.take();
+        }
+
+        /// Serializes how much of a file we have, asking for the rest
+        /// \param transfer The transfer id from the offer
+        /// \param offset How much of the file has arrived, it's sent from there on
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> file_accept(std::uint64_t transfer, std::uint64_t offset) {
+            auto stream = ca::wire::writer(1 + 2 * ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::file_accept));
+            stream.varint(transfer);
+            stream.varint(offset);
+            return stream.take();
+        }
+
+        /// Serializes the end of a file transfer
+        /// \param transfer The transfer id from the offer
+        /// \param verified If what arrived matches the content hash from the offer
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> file_done(std::uint64_t transfer, bool verified) {
+            auto stream = ca::wire::writer(2 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::file_done));
+            stream.varint(transfer);
+            stream.byte(verified ? 1 : 0);
+            return stream.take();
+        }
+
+        /// Serializes a request to join a room
+        /// \param room The room to receive messages from
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> subscribe(ca::room_id room) {
+            auto stream = ca::wire::writer(1 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::subscribe));
+            stream.varint(room);
+            return stream.take();
+        }
+
+        /// Serializes a request to leave a room
+        /// \param room The room to stop receiving messages from
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> unsubscribe(ca::room_id room) {
+            auto stream = ca::wire::writer(1 + ca::wire::max_varint_size);
+            stream.byte(std::uint8_t(packet_type::unsubscribe));
+            stream.varint(room);
+            return stream.take();
+        }
+
+        /// Serializes a message sent to a room, the message itself is encoded the same as #message
+        /// \param room The room the message is sent to
+        /// \param message The message to send
+        /// \param codec The codec negotiated with the other side
+        /// \param dictionary The dictionary for small messages, nullptr if the other side doesn't have one
+        /// \return Serialized packet as a byte vector
+        [[nodiscard]] inline std::vector<std::byte> room_message(ca::room_id room, const ca::message &message,
+                                                                 ca::codec codec = ca::codec::none,
+                                                                 const ca::dictionary *dictionary = nullptr) {
+            auto stream = ca::wire::writer(2 + 3 * ca::wire::max_varint_size + message.content().size());
+            stream.byte(std::uint8_t(packet_type::room_message));
+            stream.varint(room);
+            packet::message(stream, message, codec, dictionary);
+            return stream.take();
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#include "poll_backend.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+std::unique_ptr<ca::poll_backend> ca::poll_backend::create() {
+    auto backend = std::unique_ptr<ca::poll_backend>(new ca::poll_backend());
+
+    if (pipe(backend->_wake_pipe.data()) != 0)
+        return nullptr;
+
+    for (const auto fd : backend->_wake_pipe)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return backend;
+}
+
+ca::poll_backend::~poll_backend() {
+    for (const auto fd : _wake_pipe)
+        if (fd >= 0) close(fd);
+}
+
+bool ca::poll_backend::add(int fd) {
+    _limit_unsent(fd);
+    _connections[fd] = connection();
+    return true;
+}
+
+bool ca::poll_backend::add_listener(int fd) {
+    _listeners.insert(fd);
+    return true;
+}
+
+void ca::poll_backend::remove(int fd) {
+    _connections.erase(fd);
+    _listeners.erase(fd);
+}
+
+void ca::poll_backend::send(int fd, ca::shared_bytes bytes, ca::send_priority priority) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+
+    auto &connection = it->second;
+    if (connection.failed)
+        return;
+
+    connection.outgoing.push(std::move(bytes), priority);
+    if (connection.outgoing.flush(fd) == write_queue::flush_result::failed || !connection.outgoing.enforce(_send_limit))
+        connection.failed = true;
+}
+
+void ca::poll_backend::send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                                 size_t offset) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end() || it->second.failed)
+        return;
+
+    auto &connection = it->second;
+    connection.outgoing.push_file(transfer, std::move(file), offset);
+    if (connection.outgoing.flush(fd) == write_queue::flush_result::failed)
+        connection.failed = true;
+}
+
+size_t ca::poll_backend::queued_bytes(int fd) const {
+    const auto it = _connections.find(fd);
+    return it == _connections.end() ? 0 : it->second.outgoing.queued_bytes();
+}
+
+void ca::poll_backend::wait(std::chrono::milliseconds timeout, const event_handler &handler) {
+    auto fds = std::vector<pollfd>();
+    fds.push_back({.fd = _wake_pipe[0], .events = POLLIN, .revents = 0});
+
+    for (const auto fd : _listeners)
+        fds.push_back({.fd = fd, .events = POLLIN, .revents = 0});
+
+    auto failed = std::vector<int>();
+    for (const auto &[fd, connection] : _connections) {
+        if (connection.failed)
+            failed.push_back(fd);
+        else
+            fds.push_back({.fd = fd, .events = short(POLLIN | (connection.outgoing.empty() ? 0 : POLLOUT)), .revents = 0});
+    }
+
+    for (const auto fd : failed) {
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+    }
+
+    if (poll(fds.data(), fds.size(), static_cast<int>(timeout.count())) <= 0)
+        return;
+
+    if (fds[0].revents & POLLIN) {
+        auto drain = std::array<char, 64>();
+        while (::read(_wake_pipe[0], drain.data(), drain.size()) > 0);
+    }
+
+    for (auto i = size_t(1); i < fds.size(); i++) {
+        const auto fd = fds[i].fd;
+
+        if (_listeners.contains(fd)) {
+            while (fds[i].revents & POLLIN && _listeners.contains(fd)) {
+                const auto socket = ::accept(fd, nullptr, nullptr);
+                if (socket < 0)
+                    break;
+
+                fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+                handler({.kind = io_event::type::accepted, .fd = socket, .data = {}});
+            }
+            continue;
+        }
+
+        const auto it = _connections.find(fd);
+        if (it == _connections.end())
+            continue;
+
+        if (fds[i].revents & POLLOUT && it->second.outgoing.flush(fd) == write_queue::flush_result::failed)
+            it->second.failed = true;
+
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        while (_connections.contains(fd)) {
+            auto read = ssize_t();
+            {
+                const auto span = ca::trace::scope("socket_read", "net");
+                read = ::recv(fd, _read_buffer.data(), _read_buffer.size(), MSG_DONTWAIT);
+            }
+
+            if (read > 0) {
+                handler({.kind = io_event::type::received, .fd = fd,
+                         .data = std::span(_read_buffer.data(), static_cast<size_t>(read))});
+                continue;
+            }
+
+            if (read < 0 && errno == EINTR)
+                continue;
+            if (read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            remove(fd);
+            handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+        }
+    }
+}
+
+void ca::poll_backend::wake() {
+    [[maybe_unused]] const auto written = ::write(_wake_pipe[1], "", 1);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <set>
+
+#include <io_backend.h>
+#include <write_queue.h>
+
+namespace ca {
+    /// Portable backend built on poll(), used on platforms without epoll / io_uring
+    class poll_backend : public io_backend {
+    public:
+        /// Creates the wake up pipe
+        /// \return The backend, or nullptr if the pipe couldn't be created
+        [[nodiscard]] static std::unique_ptr<ca::poll_backend> create();
+
+        ~poll_backend() override;
+
+        bool add(int fd) override;
+
+        bool add_listener(int fd) override;
+
+        void remove(int fd) override;
+
+        using io_backend::send;
+
+        void send(int fd, ca::shared_bytes bytes, ca::send_priority priority = ca::send_priority::normal) override;
+
+        void send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                       size_t offset) override;
+
+        void wait(std::chrono::milliseconds timeout, const event_handler &handler) override;
+
+        void wake() override;
+
+        [[nodiscard]] size_t queued_bytes(int fd) const override;
+
+        [[nodiscard]] const char *name() const noexcept override { return "poll"; }
+
+    private:
+        poll_backend() = default;
+
+        struct connection {
+            ca::write_queue outgoing;
+            bool failed = false;
+        };
+
+        std::array<int, 2> _wake_pipe = {-1, -1};
+
+        std::map<int, connection> _connections;
+        std::set<int> _listeners;
+
+        std::vector<std::byte> _read_buffer = std::vector<std::byte>(64 * 1024);
+    };
+}
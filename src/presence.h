@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace ca {
+    /// How typing and presence updates are kept from competing with chat messages. Whatever changes within an interval
+    /// is coalesced into a single update (per user going to the other side, per room going out from a relay), and
+    /// an update that would have to queue behind more than the backlog isn't sent at all, the next one carries the
+    /// latest state anyway
+    struct presence_settings {
+        std::chrono::milliseconds interval = std::chrono::milliseconds(500);
+        std::chrono::milliseconds idle = std::chrono::seconds(3); // Not typing anymore after this long without input
+        size_t max_backlog = 16 * 1024;
+    };
+
+    /// Who is in a room, as a relay (or the other side of a direct connection) sees it
+    struct presence {
+        size_t online = 0; // Connected and in the room, or connected at all outside of rooms
+        size_t typing = 0; // How many of them are typing
+    };
+}
@@ -0,0 +1,882 @@
+#include "relay_server.h"
+
+#include <algorithm>
+#include <random>
+
+#include <unistd.h>
+
+#include <packet.h>
+#include <tcp_transport.h>
+#include <trace.h>
+
+namespace {
+    /// What the relay compresses with, clients that negotiated anything else get the uncompressed packets
+    constexpr auto relay_codec = ca::codec::zstd;
+
+    /// The dictionary is retrained once this many new messages have come in, but no more often than the interval
+    constexpr auto samples_per_training = size_t(1000);
+    constexpr auto training_interval = std::chrono::seconds(10);
+
+    /// How many of the most recent messages are trained on
+    constexpr auto max_samples = size_t(4096);
+
+    /// Chat messages don't have much variety, a small dictionary already covers most of it
+    constexpr auto dictionary_size = size_t(16 * 1024);
+
+    /// How many of the most recent chat messages a reconnecting client can get back
+    constexpr auto history_size = size_t(10000);
+
+    /// The most messages a single page of history can have, whatever the client asks for
+    constexpr auto max_history_page = std::uint32_t(1000);
+
+    /// The most messages a search returns, the newest ones
+    constexpr auto max_search_results = size_t(100);
+
+    /// How many of the newest messages a search looks through first, it goes back twice as far every time until it
+    /// has found enough
+    constexpr auto search_window = std::uint64_t(4096);
+
+    /// Room for the fields of a history or search results packet around its block of messages
+    constexpr auto block_overhead = size_t(64);
+
+    /// How many logged messages are read at once when adding them to the search index
+    constexpr auto index_batch_size = size_t(1000);
+
+    /// How long the relay remembers a client's session after it disconnected, a client that takes longer to come
+    /// back may get messages it already sent relayed twice
+    constexpr auto session_retention = std::chrono::minutes(10);
+}
+
+ca::relay_server::relay_server(size_t shard_count, ca::io_backend_type backend, ca::send_limit limit,
+                               ca::heartbeat_settings heartbeat, const std::string &history_path,
+                               ca::frame_limits frames, ca::presence_settings presence)
+        : _backend_type(backend), _send_limit(limit), _heartbeat(heartbeat), _frames(frames),
+          _receive_budget(frames.memory_budget), _presence_settings(presence),
+          _shard_count(std::max(shard_count, size_t(1))),
+          _session((std::uint64_t(std::random_device()()) << 32 | std::random_device()()) | 1), _log(history_path) {
+    // Sequence numbers carry on where the log left off, so what clients know stays valid across restarts
+    _sequence = _log.last_sequence();
+    _logged = _sequence.load();
+
+    if (_log.persistent()) {
+        _index_path = history_path + ".index";
+        _index.load(_index_path);
+    }
+
+    // An index that's ahead of the log belongs to a log that has since been replaced
+    if (_index.last_document() > _sequence)
+        _index.clear();
+    _index_log();
+
+    if (_send_limit.policy == backpressure_policy::block)
+        _send_limit.policy = backpressure_policy::disconnect;
+}
+
+ca::relay_server::~relay_server() {
+    stop();
+}
+
+std::uint16_t ca::relay_server::start(std::uint16_t port, const std::string &local_address) {
+    // Same as create_server, if the port is taken try the next one
+    auto bound = false;
+    for (auto attempt = 0; attempt < 100 && !bound; attempt++)
+        if (!(bound = _listen(port)))
+            port++;
+
+    if (!bound || (!local_address.empty() && !_listen_locally(local_address))) {
+        _shards.clear();
+        return 0;
+    }
+
+    _running = true;
+    for (auto &shard : _shards)
+        shard->thread = std::thread([this, &shard = *shard]() { _run(shard); });
+    _trainer = std::thread([this]() { _train(); });
+    _logging = true;
+    _log_writer = std::thread([this]() { _write_log(); });
+
+    return port;
+}
+
+void ca::relay_server::stop() {
+    if (!_running.exchange(false))
+        return;
+
+    for (auto &shard : _shards)
+        shard->backend->wake();
+
+    for (auto &shard : _shards)
+        shard->thread.join();
+    _trainer.join();
+
+    // Nothing is published anymore, the writer still logs what's queued before it stops
+    _logging = false;
+    _unlogged_pushes++;
+    _unlogged_pushes.notify_one();
+    _log_writer.join();
+
+    _shards.clear();
+    _connection_count = 0;
+
+    if (!_local_endpoint.address.empty())
+        ca::make_transport(_local_endpoint.type)->unlisten(_local_endpoint);
+
+    // Only saved here, after a crash whatever was logged since the last save is indexed again on startup
+    if (!_index_path.empty())
+        _index.save(_index_path);
+}
+
+size_t ca::relay_server::connection_count() const noexcept {
+    return _connection_count;
+}
+
+size_t ca::relay_server::shard_count() const noexcept {
+    return _shard_count;
+}
+
+bool ca::relay_server::history_persistent() const noexcept {
+    return _log.persistent();
+}
+
+bool ca::relay_server::_listen(std::uint16_t port) {
+    _shards.clear();
+
+    auto transport = ca::tcp_transport();
+    for (auto i = size_t(0); i < _shard_count; i++) {
+        const auto fd = transport.listen_shared({.type = ca::transport_type::tcp, .address = {}, .port = port});
+        if (fd < 0) {
+            _shards.clear();
+            return false;
+        }
+
+        auto &shard = _shards.emplace_back(std::make_unique<ca::relay_server::shard>());
+        shard->listener = sockpp::socket(fd);
+        shard->listener.set_non_blocking(true);
+        shard->backend = ca::make_io_backend(_backend_type);
+        shard->backend->set_send_limit(_send_limit);
+        shard->backend->add_listener(fd);
+    }
+    return true;
+}
+
+bool ca::relay_server::_listen_locally(const std::string &address) {
+    _local_endpoint = ca::parse_endpoint(address, 0);
+    const auto fd = ca::make_transport(_local_endpoint.type)->listen(_local_endpoint);
+    if (fd < 0) {
+        _local_endpoint = {};
+        return false;
+    }
+
+    auto &shard = *_shards.front();
+    shard.local_listener = sockpp::socket(fd);
+    shard.local_listener.set_non_blocking(true);
+    shard.backend->add_listener(fd);
+    return true;
+}
+
+void ca::relay_server::_run(shard &shard) {
+    ca::trace::set_thread_name("relay_shard");
+    shard.timers.schedule(_presence_settings.interval, [this, &shard]() { _send_presence(shard); });
+
+    while (_running) {
+        if (_dictionary_version != _shard_dictionary_version(shard))
+            _adopt_dictionary(shard);
+
+        {
+            const auto span = ca::trace::scope("drain_inbox", "relay");
+            while (auto relayed = shard.inbox.pop()) {
+                if (relayed->room)
+                    _send_to_room(shard, -1, *relayed->room, *relayed);
+                else
+                    _send_to_all(shard, -1, *relayed);
+            }
+        }
+
+        // Still wakes up every now and then without any timers, to pick up new dictionaries
+        using namespace std::chrono_literals;
+        const auto next_timer = shard.timers.next_timeout(std::chrono::steady_clock::now()).value_or(100ms);
+        shard.backend->wait(std::min(next_timer, 100ms),
+                            [this, &shard](const ca::io_event &event) { _handle_event(shard, event); });
+
+        shard.timers.advance(std::chrono::steady_clock::now());
+    }
+
+    // The backend has to let go of the sockets before they're closed
+    for (const auto &[fd, connection] : shard.connections)
+        shard.backend->remove(fd);
+    shard.backend->remove(shard.listener.handle());
+    if (shard.local_listener.is_open())
+        shard.backend->remove(shard.local_listener.handle());
+    shard.connections.clear();
+}
+
+void ca::relay_server::_handle_event(shard &shard, const ca::io_event &event) {
+    switch (event.kind) {
+        case io_event::type::accepted: {
+            if (!shard.backend->add(event.fd)) {
+                close(event.fd);
+                return;
+            }
+
+            auto &connection = shard.connections.emplace(event.fd, ca::relay_server::connection{
+                    .socket = sockpp::stream_socket(event.fd), .decoder = ca::frame_decoder(_frames, &_receive_budget),
+                    .max_frame_size = _frames.max_frame_size}).first->second;
+            if (shard.dictionary)
+                connection.decoder.add_dictionary(shard.dictionary);
+
+            connection.timeout = shard.timers.schedule(_heartbeat.timeout, [this, &shard, fd = event.fd]() {
+                _check_alive(shard, fd);
+            });
+
+            shard.backend->send(event.fd, ca::packet::hello(ca::codec_bit(relay_codec) |
+                                                            ca::codec_bit(ca::codec::zstd_dictionary),
+                                                            _frames.max_frame_size),
+                               ca::send_priority::control);
+            _connection_count++;
+            return;
+        }
+        case io_event::type::closed:
+            _close(shard, event.fd);
+            return;
+        case io_event::type::received:
+            break;
+    }
+
+    const auto it = shard.connections.find(event.fd);
+    if (it == shard.connections.end())
+        return;
+
+    const auto span = ca::trace::scope("decode", "relay");
+    it->second.last_received = std::chrono::steady_clock::now();
+    auto &decoder = it->second.decoder;
+    decoder.feed(event.data);
+
+    auto acknowledge = std::optional<std::uint64_t>();
+    while (auto frame = decoder.next()) {
+        switch (frame->type) {
+            case packet_type::message:
+            case packet_type::room_message: {
+                // Resent after a reconnect, but it had already arrived before the drop
+                const auto session = it->second.session;
+                if (frame->sequence != 0 && session != 0) {
+                    auto guard = std::lock_guard(_sessions_mutex);
+                    auto &state = _sessions[session];
+                    if (frame->sequence <= state.received)
+                        break;
+                    state.received = frame->sequence;
+                    acknowledge = frame->sequence;
+                }
+
+                const auto room = frame->type == packet_type::room_message ? std::optional(frame->room) : std::nullopt;
+                const auto size = frame->message.content().size();
+                if (size >= ca::dictionary_threshold && size < ca::compression_threshold)
+                    _samples.push(frame->message.content());
+
+                _publish(shard, session, frame->message, room);
+                break;
+            }
+            case packet_type::message_read: {
+                const auto packet = ca::make_shared_bytes(ca::packet::message_read(frame->message_hash));
+                _relay(shard, event.fd, {.plain = packet, .compressed = packet}, std::nullopt,
+                       ca::send_priority::control);
+                break;
+            }
+            case packet_type::hello:
+                it->second.codec = ca::negotiate_codec(ca::codec_bit(relay_codec), frame->codecs);
+                it->second.dictionary = frame->codecs & ca::codec_bit(ca::codec::zstd_dictionary);
+                it->second.max_frame_size = frame->max_frame_size;
+                if (it->second.dictionary && shard.dictionary)
+                    shard.backend->send(event.fd, ca::packet::dictionary(*shard.dictionary));
+                break;
+            case packet_type::dictionary:
+                break; // Dictionaries only go from the relay to the clients
+            case packet_type::ping:
+                shard.backend->send(event.fd, ca::packet::pong(frame->ping_time), ca::send_priority::control);
+                break;
+            case packet_type::pong:
+                break; // The relay doesn't ping, the clients do
+            case packet_type::subscribe:
+                // The shard's members are told about the room again, so the new one hears about it too
+                if (shard.rooms.subscribe(frame->room, event.fd)) {
+                    _count_online(frame->room, true);
+                    shard.presence_sent.erase(frame->room);
+                }
+                break;
+            case packet_type::unsubscribe:
+                if (shard.rooms.unsubscribe(frame->room, event.fd))
+                    _count_online(frame->room, false);
+                break;
+            case packet_type::disconnect:
+                // Don't relay this, the other clients are still talking to each other
+                _close(shard, event.fd);
+                return;
+            case packet_type::sequenced:
+            case packet_type::chunk:
+                break; // Unwrapped by the decoder
+            case packet_type::ack:
+                break; // Whatever a client missed is replayed from the history, not from what it acknowledged
+            case packet_type::file_offer:
+            case packet_type::file_accept:
+            case packet_type::file_data:
+            case packet_type::file_done:
+                break; // Files only go over direct connections, an offer made to a relay is never accepted
+            case packet_type::resume:
+                _resume(shard, event.fd, *frame);
+                break;
+            case packet_type::sync:
+                _sync(shard, event.fd, *frame);
+                break;
+            case packet_type::history:
+                break; // History only goes from the relay to the clients
+            case packet_type::search:
+                _search(shard, event.fd, *frame);
+                break;
+            case packet_type::search_results:
+                break; // Results only go from the relay to the clients
+            case packet_type::presence:
+                _typing(shard, event.fd, *frame);
+                break;
+            case packet_type::presence_summary:
+                break; // Summaries only go from the relay to the clients
+        }
+    }
+
+    // One acknowledgement covers everything up to the last message
+    if (acknowledge)
+        shard.backend->send(event.fd, ca::packet::ack(*acknowledge), ca::send_priority::control);
+
+    if (decoder.failed())
+        _close(shard, event.fd);
+}
+
+void ca::relay_server::_check_alive(shard &shard, int fd) {
+    const auto it = shard.connections.find(fd);
+    if (it == shard.connections.end())
+        return;
+
+    // Every client pings at least once per interval, anyone quiet for longer than the timeout is gone.
+    // Received data only updates last_received, the timer is pushed back here instead of on every packet
+    auto &connection = it->second;
+    const auto quiet = std::chrono::steady_clock::now() - connection.last_received;
+    if (quiet >= _heartbeat.timeout) {
+        _close(shard, fd);
+        return;
+    }
+
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(_heartbeat.timeout - quiet);
+    connection.timeout = shard.timers.schedule(remaining, [this, &shard, fd]() { _check_alive(shard, fd); });
+}
+
+void ca::relay_server::_close(shard &shard, int fd) {
+    if (const auto it = shard.connections.find(fd); it != shard.connections.end()) {
+        shard.timers.cancel(it->second.timeout);
+
+        // The session is kept around for a while, in case the client comes back
+        if (const auto session = it->second.session; it->second.resumed) {
+            {
+                auto guard = std::lock_guard(_sessions_mutex);
+                auto &state = _sessions[session];
+                state.connections--;
+                state.disconnected = std::chrono::steady_clock::now();
+            }
+            shard.timers.schedule(session_retention, [this, session]() { _expire_session(session); });
+            _count_online(std::nullopt, false);
+        }
+    }
+
+    shard.backend->remove(fd);
+    for (const auto room : shard.rooms.unsubscribe_all(fd))
+        _count_online(room, false);
+    if (shard.connections.erase(fd) > 0)
+        _connection_count--;
+}
+
+void ca::relay_server::_resume(shard &shard, int fd, const ca::frame_decoder::frame &frame) {
+    const auto it = shard.connections.find(fd);
+    if (it == shard.connections.end() || it->second.resumed)
+        return;
+
+    const auto span = ca::trace::scope("resume", "relay");
+    auto &connection = it->second;
+    connection.session = frame.session;
+
+    auto received = std::uint64_t(0);
+    {
+        auto guard = std::lock_guard(_sessions_mutex);
+        auto &state = _sessions[frame.session];
+        state.connections++;
+        received = state.received;
+    }
+    shard.backend->send(fd, ca::packet::resume(_session, frame.session, received), ca::send_priority::control);
+
+    // Holding the lock means nothing can be published in between, every message after the replayed ones is still
+    // on its way through the inbox
+    auto guard = std::lock_guard(_history_mutex);
+    if (frame.peer_session == _session) {
+        const auto dictionary_version = _shard_dictionary_version(shard);
+        const auto first = std::partition_point(_history.begin(), _history.end(), [&](const relayed_packet &packet) {
+            return packet.sequence <= frame.sequence;
+        });
+
+        for (auto entry = first; entry != _history.end(); ++entry) {
+            if (entry->origin == connection.session || (entry->room && !shard.rooms.subscribed(*entry->room, fd)) ||
+                entry->packet.plain->size() > connection.max_frame_size)
+                continue;
+            shard.backend->send(fd, entry->packet.for_client(connection, dictionary_version));
+        }
+    }
+
+    connection.replayed = _sequence;
+    connection.resumed = true;
+    _count_online(std::nullopt, true);
+
+    // Nothing was sent to it before now, the rooms it joined before resuming included
+    shard.presence_sent.clear();
+}
+
+void ca::relay_server::_sync(shard &shard, int fd, const ca::frame_decoder::frame &frame) {
+    const auto it = shard.connections.find(fd);
+    if (it == shard.connections.end() || !it->second.resumed)
+        return;
+
+    // A room's history is only for its members, anyone else gets an empty page
+    const auto span = ca::trace::scope("sync", "relay");
+    const auto &connection = it->second;
+    const auto limit = std::clamp(frame.limit, 1u, max_history_page);
+    auto page = ca::message_log::page{.last_sequence = frame.sequence};
+    if (!frame.history_room || shard.rooms.subscribed(*frame.history_room, fd)) {
+        const auto logged = _logged.load();
+        page = _log.read(frame.history_room, frame.sequence, frame.since, limit);
+        if (!page.more && logged < connection.replayed)
+            _read_unlogged(page, frame.history_room, logged, connection.replayed, limit);
+    }
+
+    // The client has its own messages already. The page has to fit in the client's frame limit uncompressed, what
+    // doesn't fit is left for the next page, a message that can't fit in any page is skipped
+    const auto max_block = connection.max_frame_size - std::min(connection.max_frame_size, block_overhead);
+    auto messages = ca::wire::writer();
+    auto size = size_t(0);
+    auto position = frame.sequence; // The last entry that was sent or skipped
+    for (const auto &entry : page.entries) {
+        const auto entry_size = 1 + ca::wire::varint_size(entry.sequence) + entry.packet.size();
+        if (entry.origin != connection.session && entry_size <= max_block) {
+            if (size + entry_size > max_block) {
+                page.last_sequence = position;
+                page.more = true;
+                break;
+            }
+
+            messages.byte(std::uint8_t(packet_type::sequenced));
+            messages.varint(entry.sequence);
+            messages.bytes(entry.packet);
+            size += entry_size;
+        }
+        position = entry.sequence;
+    }
+
+    const auto codec = connection.codec == relay_codec ? relay_codec : ca::codec::none;
+    shard.backend->send(fd, ca::packet::history(frame.history_room, page.last_sequence, page.more, messages.take(), codec));
+}
+
+void ca::relay_server::_read_unlogged(ca::message_log::page &page, std::optional<ca::room_id> room,
+                                      std::uint64_t logged, std::uint64_t replayed, size_t limit) {
+    // Nothing newer than the replay reaches the client live, so none of it can be left out. The log is written in
+    // order, so everything after what it had is still in the history, unless the writer fell that far behind
+    auto guard = std::lock_guard(_history_mutex);
+    if (_history.empty() || _history.front().sequence > logged + 1) {
+        page.more = true;
+        return;
+    }
+
+    const auto first = std::partition_point(_history.begin(), _history.end(), [&](const relayed_packet &packet) {
+        return packet.sequence <= std::max(page.last_sequence, logged);
+    });
+    for (auto entry = first; entry != _history.end() && entry->sequence <= replayed; ++entry) {
+        if (entry->room != room)
+            continue;
+        if (page.entries.size() == limit) {
+            page.more = true;
+            return;
+        }
+
+        const auto &packet = *entry->packet.plain;
+        const auto message = std::span(packet).subspan(1 + ca::packet::sequence_width(packet));
+        page.entries.push_back({.sequence = entry->sequence, .origin = entry->origin,
+                                .packet = {message.begin(), message.end()}, .room = room});
+        page.last_sequence = entry->sequence;
+    }
+}
+
+void ca::relay_server::_search(shard &shard, int fd, const ca::frame_decoder::frame &frame) {
+    const auto it = shard.connections.find(fd);
+    if (it == shard.connections.end() || !it->second.resumed)
+        return;
+
+    // Same as syncing, a room's messages are only found by its members
+    const auto span = ca::trace::scope("search", "relay");
+    const auto wanted = [&](std::optional<ca::room_id> room) { return !room || shard.rooms.subscribed(*room, fd); };
+
+    // Only the newest results are sent, so a query of common words doesn't have to walk the whole index
+    auto entries = std::vector<ca::message_log::entry>();
+    auto upper = _index.last_document();
+    for (auto window = search_window; upper != 0 && entries.size() < max_search_results; window *= 2) {
+        const auto lower = upper > window ? upper - window : 0;
+        auto documents = _index.search(frame.query, lower);
+        documents.erase(std::upper_bound(documents.begin(), documents.end(), upper), documents.end());
+        std::reverse(documents.begin(), documents.end());
+
+        auto found = _log.read(documents, wanted, max_search_results - entries.size());
+        entries.insert(entries.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+        upper = lower;
+    }
+
+    // Results that would take the packet past the client's frame limit are left out
+    const auto max_block = it->second.max_frame_size - std::min(it->second.max_frame_size, block_overhead);
+    auto messages = ca::wire::writer();
+    auto size = size_t(0);
+    for (const auto &entry : entries) {
+        const auto entry_size = 1 + ca::wire::varint_size(entry.sequence) + entry.packet.size();
+        if (size + entry_size > max_block)
+            continue;
+
+        messages.byte(std::uint8_t(packet_type::sequenced));
+        messages.varint(entry.sequence);
+        messages.bytes(entry.packet);
+        size += entry_size;
+    }
+
+    const auto codec = it->second.codec == relay_codec ? relay_codec : ca::codec::none;
+    shard.backend->send(fd, ca::packet::search_results(frame.query_id, messages.take(), codec));
+}
+
+void ca::relay_server::_typing(shard &shard, int fd, const ca::frame_decoder::frame &frame) {
+    const auto it = shard.connections.find(fd);
+    if (it == shard.connections.end() || !it->second.resumed ||
+        (frame.history_room && !shard.rooms.subscribed(*frame.history_room, fd)))
+        return;
+
+    // Clients repeat it while they're typing, one that has gone quiet (or away) stops counting after the idle time
+    auto guard = std::lock_guard(_presence_mutex);
+    auto &typing = _presence[frame.history_room].typing;
+    if (frame.presence.typing != 0)
+        typing[it->second.session] = std::chrono::steady_clock::now() + _presence_settings.idle;
+    else
+        typing.erase(it->second.session);
+}
+
+void ca::relay_server::_count_online(std::optional<ca::room_id> room, bool joined) {
+    auto guard = std::lock_guard(_presence_mutex);
+    auto &presence = _presence[room];
+    if (joined)
+        presence.online++;
+    else if (presence.online > 0)
+        presence.online--;
+}
+
+void ca::relay_server::_send_presence(shard &shard) {
+    shard.timers.schedule(_presence_settings.interval, [this, &shard]() { _send_presence(shard); });
+
+    const auto span = ca::trace::scope("send_presence", "relay");
+    auto changed = std::vector<std::pair<std::optional<ca::room_id>, ca::presence>>();
+    {
+        auto guard = std::lock_guard(_presence_mutex);
+        const auto now = std::chrono::steady_clock::now();
+        for (auto it = _presence.begin(); it != _presence.end();) {
+            auto &[room, presence] = *it;
+            std::erase_if(presence.typing, [now](const auto &typist) { return typist.second <= now; });
+            if (presence.online == 0 && presence.typing.empty()) {
+                it = _presence.erase(it);
+                continue;
+            }
+
+            const auto current = ca::presence{.online = presence.online, .typing = presence.typing.size()};
+            const auto sent = shard.presence_sent.find(room);
+            if (sent == shard.presence_sent.end() || sent->second.online != current.online ||
+                sent->second.typing != current.typing)
+                changed.emplace_back(room, current);
+            ++it;
+        }
+
+        // Nobody is left in these rooms, on any shard
+        std::erase_if(shard.presence_sent, [this](const auto &sent) { return !_presence.contains(sent.first); });
+    }
+
+    // One packet per room no matter how many are typing in it, every member gets the same buffer. A client that's
+    // behind on its messages doesn't get it, the room is sent again next time instead
+    for (const auto &[room, presence] : changed) {
+        const auto packet = ca::make_shared_bytes(ca::packet::presence_summary(room, presence));
+        auto delivered = true;
+        const auto send = [&](int fd, const connection &client) {
+            if (!client.resumed)
+                return;
+            if (shard.backend->queued_bytes(fd) > _presence_settings.max_backlog)
+                delivered = false;
+            else
+                shard.backend->send(fd, packet, ca::send_priority::background);
+        };
+
+        if (!room) {
+            for (const auto &[fd, client] : shard.connections)
+                send(fd, client);
+        } else if (const auto subscribers = shard.rooms.subscribers(*room)) {
+            for (const auto fd : *subscribers)
+                if (const auto it = shard.connections.find(fd); it != shard.connections.end())
+                    send(fd, it->second);
+        }
+
+        if (delivered)
+            shard.presence_sent[room] = presence;
+    }
+}
+
+void ca::relay_server::_write_log() {
+    ca::trace::set_thread_name("relay_log_writer");
+
+    while (true) {
+        const auto pushes = _unlogged_pushes.load();
+        const auto logging = _logging.load();
+
+        while (auto entry = _unlogged.pop()) {
+            const auto span = ca::trace::scope("log_message", "relay");
+            const auto &packet = *entry->packet;
+            _log.append(entry->sequence, entry->origin, entry->room,
+                        std::span(packet).subspan(1 + ca::packet::sequence_width(packet)));
+            _index.add(entry->sequence, entry->content.view());
+            _logged = entry->sequence;
+        }
+
+        // Every push happened before logging was cleared, so they've all been popped by now
+        if (!logging)
+            return;
+        _unlogged_pushes.wait(pushes);
+    }
+}
+
+void ca::relay_server::_index_log() {
+    // The log only has plain message packets, a decoder reads them once it's past the handshake. They were accepted
+    // under whatever frame limit the relay had at the time, so it's only held to the limit on decompressing
+    auto decoder = ca::frame_decoder({.max_frame_size = ca::max_decompressed_size});
+    decoder.feed(ca::packet::hello(0, 0));
+    (void) decoder.next();
+
+    auto after = _index.last_document();
+    while (true) {
+        const auto page = _log.read_all(after, index_batch_size);
+        for (const auto &entry : page.entries) {
+            decoder.feed(entry.packet);
+            if (const auto frame = decoder.next())
+                _index.add(entry.sequence, frame->message.content());
+        }
+
+        if (!page.more || page.last_sequence == after || decoder.failed())
+            break;
+        after = page.last_sequence;
+    }
+}
+
+void ca::relay_server::_expire_session(std::uint64_t session) {
+    auto guard = std::lock_guard(_sessions_mutex);
+    const auto it = _sessions.find(session);
+    if (it != _sessions.end() && it->second.connections == 0 &&
+        std::chrono::steady_clock::now() - it->second.disconnected >= session_retention)
+        _sessions.erase(it);
+}
+
+const ca::shared_bytes &ca::relay_server::encoded_packet::for_client(const connection &client,
+                                                                     std::uint32_t dictionary_version) const noexcept {
+    // The client can only have the dictionary its own shard sent it, a packet from another shard can be a version off
+    if (with_dictionary && client.dictionary && this->dictionary_version == dictionary_version)
+        return with_dictionary;
+    return client.codec == relay_codec ? compressed : plain;
+}
+
+void ca::relay_server::_train() {
+    ca::trace::set_thread_name("relay_trainer");
+
+    auto samples = std::deque<ca::pooled_string>(); // Shared with the messages, not copies
+    auto new_samples = size_t(0);
+    auto last_training = std::chrono::steady_clock::now() - training_interval;
+
+    while (_running) {
+        while (auto sample = _samples.pop()) {
+            samples.push_back(std::move(*sample));
+            new_samples++;
+            if (samples.size() > max_samples)
+                samples.pop_front();
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (new_samples >= samples_per_training && now - last_training >= training_interval) {
+            new_samples = 0;
+            last_training = now;
+
+            auto dictionary = std::shared_ptr<const ca::dictionary>();
+            {
+                const auto span = ca::trace::scope("train_dictionary", "relay");
+                dictionary = ca::train_dictionary(_dictionary_version + 1, {samples.begin(), samples.end()},
+                                                  dictionary_size);
+            }
+
+            if (dictionary) {
+                {
+                    auto guard = std::lock_guard(_dictionary_mutex);
+                    _dictionary = std::move(dictionary);
+                    _dictionary_version = _dictionary->version();
+                }
+
+                for (auto &shard : _shards)
+                    shard->backend->wake();
+            }
+        }
+
+        using namespace std::chrono_literals;
+        std::this_thread::sleep_for(100ms);
+    }
+}
+
+void ca::relay_server::_adopt_dictionary(shard &shard) {
+    {
+        auto guard = std::lock_guard(_dictionary_mutex);
+        shard.dictionary = _dictionary;
+    }
+
+    // Queued behind everything already sent, so the clients have it before the first message that uses it
+    const auto packet = ca::make_shared_bytes(ca::packet::dictionary(*shard.dictionary));
+    for (auto &[fd, connection] : shard.connections) {
+        connection.decoder.add_dictionary(shard.dictionary);
+        if (connection.dictionary)
+            shard.backend->send(fd, packet);
+    }
+}
+
+ca::relay_server::unnumbered_packet ca::relay_server::_encode(const ca::message &message,
+                                                              std::optional<ca::room_id> room,
+                                                              const std::shared_ptr<const ca::dictionary> &dictionary,
+                                                              size_t width) {
+    const auto span = ca::trace::scope("encode", "relay");
+
+    const auto serialize = [&](ca::codec codec, const ca::dictionary *dictionary) {
+        return ca::packet::unnumbered(width, room, message, codec, dictionary);
+    };
+
+    auto packet = unnumbered_packet();
+    packet.plain = serialize(ca::codec::none, nullptr);
+
+    // Compression only ever makes the packet smaller, the same size means it was sent uncompressed
+    if (message.content().size() >= ca::compression_threshold) {
+        auto compressed = serialize(relay_codec, nullptr);
+        if (compressed.size() < packet.plain.size())
+            packet.compressed = std::move(compressed);
+    } else if (dictionary) {
+        auto compressed = serialize(ca::codec::none, dictionary.get());
+        if (compressed.size() < packet.plain.size()) {
+            packet.with_dictionary = std::move(compressed);
+            packet.dictionary_version = dictionary->version();
+        }
+    }
+    return packet;
+}
+
+bool ca::relay_server::unnumbered_packet::number(std::uint64_t sequence) noexcept {
+    return ca::packet::number(plain, sequence) && (compressed.empty() || ca::packet::number(compressed, sequence)) &&
+           (with_dictionary.empty() || ca::packet::number(with_dictionary, sequence));
+}
+
+std::span<const std::byte> ca::relay_server::unnumbered_packet::message() const noexcept {
+    return std::span(plain).subspan(1 + ca::packet::sequence_width(plain));
+}
+
+ca::relay_server::encoded_packet ca::relay_server::unnumbered_packet::share() && {
+    auto packet = encoded_packet{.plain = ca::make_shared_bytes(std::move(plain)), .compressed = nullptr,
+                                 .with_dictionary = nullptr, .dictionary_version = dictionary_version};
+    packet.compressed = compressed.empty() ? packet.plain : ca::make_shared_bytes(std::move(compressed));
+    if (!with_dictionary.empty())
+        packet.with_dictionary = ca::make_shared_bytes(std::move(with_dictionary));
+    return packet;
+}
+
+std::uint32_t ca::relay_server::_shard_dictionary_version(const shard &shard) noexcept {
+    return shard.dictionary ? shard.dictionary->version() : 0;
+}
+
+void ca::relay_server::_relay(shard &origin, int source, const encoded_packet &packet,
+                              std::optional<ca::room_id> room, ca::send_priority priority) {
+    const auto relayed = relayed_packet{.packet = packet, .room = room, .priority = priority};
+    if (room)
+        _send_to_room(origin, source, *room, relayed);
+    else
+        _send_to_all(origin, source, relayed);
+
+    for (auto &shard : _shards) {
+        if (shard.get() == &origin)
+            continue;
+
+        shard->inbox.push(relayed);
+        shard->backend->wake();
+    }
+}
+
+void ca::relay_server::_publish(shard &origin, std::uint64_t session, const ca::message &message,
+                                std::optional<ca::room_id> room) {
+    // Serialized with room for the number it's about to get. Only numbering it and handing it to the inboxes (and
+    // the log writer) in that order has to happen under the lock, the disk is left to the log writer
+    auto encoded = _encode(message, room, origin.dictionary, ca::wire::varint_size(_sequence + 1));
+
+    auto guard = std::unique_lock(_history_mutex);
+    const auto sequence = ++_sequence;
+    if (!encoded.number(sequence)) {
+        // Another shard took the numbers past a varint size in the meantime, once every 128 times as many messages
+        encoded = _encode(message, room, origin.dictionary, ca::wire::varint_size(sequence));
+        (void) encoded.number(sequence);
+    }
+
+    auto relayed = relayed_packet{.packet = std::move(encoded).share(), .room = room, .sequence = sequence,
+                                  .origin = session};
+    _unlogged.push({.sequence = sequence, .origin = session, .room = room, .packet = relayed.packet.plain,
+                    .content = message.content()});
+
+    // Pushed while holding the lock, so every inbox gets the messages in the order they're numbered
+    for (auto &shard : _shards)
+        shard->inbox.push(relayed);
+
+    _history.push_back(std::move(relayed));
+    if (_history.size() > history_size)
+        _history.pop_front();
+    guard.unlock();
+
+    for (auto &shard : _shards)
+        if (shard.get() != &origin)
+            shard->backend->wake();
+    _unlogged_pushes++;
+    _unlogged_pushes.notify_one();
+}
+
+bool ca::relay_server::_wants(const connection &client, int fd, int except, const relayed_packet &packet) noexcept {
+    // The sender has its own message already, and a resuming client already got everything up to where it was replayed
+    // A client never gets a packet bigger than its frame limit either, it would only disconnect over it
+    return client.resumed && fd != except && (packet.origin == 0 || client.session != packet.origin) &&
+           (packet.sequence == 0 || packet.sequence > client.replayed) &&
+           packet.packet.plain->size() <= client.max_frame_size;
+}
+
+void ca::relay_server::_send_to_all(shard &shard, int except, const relayed_packet &packet) {
+    for (const auto &[fd, connection] : shard.connections)
+        if (_wants(connection, fd, except, packet))
+            shard.backend->send(fd, packet.packet.for_client(connection, _shard_dictionary_version(shard)),
+                                packet.priority);
+}
+
+void ca::relay_server::_send_to_room(shard &shard, int except, ca::room_id room, const relayed_packet &packet) {
+    // Holding on to the snapshot keeps the array alive even if a subscriber leaves while we're sending
+    const auto subscribers = shard.rooms.subscribers(room);
+    if (!subscribers)
+        return;
+
+    const auto span = ca::trace::scope("room_fanout", "relay");
+    const auto dictionary_version = _shard_dictionary_version(shard);
+    for (const auto fd : *subscribers) {
+        const auto it = shard.connections.find(fd);
+        if (it != shard.connections.end() && _wants(it->second, fd, except, packet))
+            shard.backend->send(fd, packet.packet.for_client(it->second, dictionary_version), packet.priority);
+    }
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <frame_decoder.h>
+#include <frame_limits.h>
+#include <heartbeat.h>
+#include <io_backend.h>
+#include <message_log.h>
+#include <mpsc_queue.h>
+#include <presence.h>
+#include <room_index.h>
+#include <search_index.h>
+#include <timer_wheel.h>
+#include <transport.h>
+
+#include <sockpp/stream_socket.h>
+
+namespace ca {
+    /// Headless multi-user server, everything a client sends is relayed to every other connected client,
+    /// or only to the clients subscribed to the room when it's sent to a room.
+    /// There's one reactor thread per shard, each with its own SO_REUSEPORT listener and its own connections,
+    /// so the kernel spreads new connections over the shards and no connection state is shared between threads.
+    /// Packets that need to reach another shard's clients are handed over through that shard's lock-free inbox.
+    /// A background thread trains a zstd dictionary on the small messages going through the relay, which is sent
+    /// out to the clients so both sides can compress short messages with it.
+    /// Chat messages are numbered in the order the relay received them and the most recent ones are kept, so a
+    /// client that reconnects gets whatever it missed in the meantime. Every message also goes into a persistent
+    /// log, which clients sync a room's history from page by page, and into a full-text index clients can search.
+    /// Both are written by a thread of their own, so no shard ever waits on the disk.
+    /// Typing updates aren't relayed one by one, every shard tells its clients who is online and typing in their
+    /// rooms once per presence interval, and only for the rooms where that changed.
+    /// Clients on the same host can also connect over a Unix domain socket (or in memory), those are accepted by the
+    /// first shard
+    class relay_server {
+    public:
+        /// \param shard_count Number of reactor threads, typically one per core
+        /// \param backend Which io backend every reactor uses
+        /// \param limit How much can be queued for a single client. A reactor can't wait on one slow client without
+        /// stalling every other one, so backpressure_policy::block disconnects the client instead
+        /// \param heartbeat Clients ping the relay, one that hasn't sent anything for longer than the timeout is
+        /// disconnected
+        /// \param history_path The file the message log is kept in, empty keeps the history in memory only. The
+        /// search index is saved beside it (with .index appended) when the relay stops
+        /// \param frames The biggest packet a client can send, and how much all clients together can make the relay
+        /// buffer. A client that goes past either is disconnected
+        /// \param presence How often clients are told who is online and typing, and how long someone who stopped
+        /// sending typing updates is still counted as typing
+        relay_server(size_t shard_count, ca::io_backend_type backend, ca::send_limit limit = {},
+                     ca::heartbeat_settings heartbeat = {}, const std::string &history_path = {},
+                     ca::frame_limits frames = {}, ca::presence_settings presence = {});
+
+        ~relay_server();
+
+        /// Binds a listener per shard and starts the reactor threads
+        /// \param port The port to listen on, goes up by one until a free port is found (same as the chat server)
+        /// \param local_address Where to listen for clients on the same host as well, "unix:<path>" (the socket is
+        /// removed again when the relay stops) or "memory:<name>", empty for TCP only
+        /// \return The port being listened on, 0 if the listeners couldn't be created
+        [[nodiscard]] std::uint16_t start(std::uint16_t port, const std::string &local_address = {});
+
+        /// Stops the reactor threads and closes every connection
+        void stop();
+
+        /// \return The number of clients connected over all shards
+        [[nodiscard]] size_t connection_count() const noexcept;
+
+        /// \return The number of reactor threads
+        [[nodiscard]] size_t shard_count() const noexcept;
+
+        /// \return If the history survives a restart, false if it's only kept in memory
+        [[nodiscard]] bool history_persistent() const noexcept;
+
+    private:
+        struct connection {
+            sockpp::stream_socket socket;
+            ca::frame_decoder decoder;
+            ca::codec codec = ca::codec::none; // Negotiated from the client's hello
+            bool dictionary = false;           // The client can decompress with the relay's dictionaries
+            size_t max_frame_size = 0;         // The biggest packet the client accepts, ours until its hello arrives
+            std::chrono::steady_clock::time_point last_received = std::chrono::steady_clock::now();
+            ca::timer_wheel::timer_id timeout = ca::timer_wheel::no_timer; // Checks if the client has gone quiet
+            std::uint64_t session = 0; // The client's, from its resume packet
+            bool resumed = false;      // Nothing is sent to the client before its resume packet
+            std::uint64_t replayed = 0; // Messages up to this one were sent when resuming
+        };
+
+        /// A packet serialized once for every client: uncompressed, compressed with the relay's codec and, for small
+        /// messages, compressed with the dictionary of the shard that encoded it
+        struct encoded_packet {
+            ca::shared_bytes plain;
+            ca::shared_bytes compressed;      // The same buffer as plain when compressing didn't pay off
+            ca::shared_bytes with_dictionary = nullptr;
+            std::uint32_t dictionary_version = 0;
+
+            /// \param client The client it's sent to
+            /// \param dictionary_version The version of the dictionary the client's shard has sent out
+            /// \return The smallest version the client can read
+            [[nodiscard]] const ca::shared_bytes &for_client(const connection &client,
+                                                             std::uint32_t dictionary_version) const noexcept;
+        };
+
+        /// A chat message serialized for every kind of client as sequenced packets, before the relay has numbered it
+        struct unnumbered_packet {
+            std::vector<std::byte> plain;
+            std::vector<std::byte> compressed;      // Empty when compressing didn't pay off
+            std::vector<std::byte> with_dictionary; // Empty without a dictionary, or when it didn't pay off
+            std::uint32_t dictionary_version = 0;
+
+            /// Fills in the sequence number of every version, see packet::number
+            /// \return false if it doesn't fit in the room left for it
+            [[nodiscard]] bool number(std::uint64_t sequence) noexcept;
+
+            /// \return The message in the plain version, without the sequenced packet around it
+            [[nodiscard]] std::span<const std::byte> message() const noexcept;
+
+            /// \return The versions, moved into buffers every shard can share
+            [[nodiscard]] encoded_packet share() &&;
+        };
+
+        /// A packet handed over from another shard
+        struct relayed_packet {
+            encoded_packet packet;           // The same buffers every shard sends
+            std::optional<ca::room_id> room; // Empty if it goes to every client
+            std::uint64_t sequence = 0;      // The relay's number for chat messages, 0 for anything else
+            std::uint64_t origin = 0;        // The session of the client that sent it, it doesn't get it back
+            ca::send_priority priority = ca::send_priority::normal; // Read receipts go ahead of chat messages
+        };
+
+        /// What the relay remembers about a client between connections
+        struct session_state {
+            std::uint64_t received = 0; // The last message number the client sent us
+            size_t connections = 0;
+            std::chrono::steady_clock::time_point disconnected; // When the last connection closed
+        };
+
+        /// A chat message on its way to the log and the search index
+        struct log_entry {
+            std::uint64_t sequence;
+            std::uint64_t origin;            // The session of the client that sent it
+            std::optional<ca::room_id> room;
+            ca::shared_bytes packet;         // The sequenced packet (plain), what's logged is the message inside it
+            ca::pooled_string content;       // Shared with the message, not a copy
+        };
+
+        /// Who is in a room and who is typing in it, over every shard. Outside of rooms it's every resumed client
+        struct room_presence {
+            size_t online = 0;
+            std::unordered_map<std::uint64_t, std::chrono::steady_clock::time_point> typing; // Sessions, until when
+        };
+
+        struct shard {
+            std::unique_ptr<ca::io_backend> backend;
+            sockpp::socket listener;       // Shares its port with the other shards' listeners
+            sockpp::socket local_listener; // For clients on the same host, only on the first shard
+            std::unordered_map<int, connection> connections;
+            ca::room_index rooms; // Only the subscriptions of this shard's connections
+            std::shared_ptr<const ca::dictionary> dictionary; // What this shard's clients have been sent
+            ca::mpsc_queue<relayed_packet> inbox; // Packets relayed from other shards
+            ca::timer_wheel timers; // Per-connection timeouts
+            std::unordered_map<std::optional<ca::room_id>, ca::presence> presence_sent; // What its clients were told
+            std::thread thread;
+        };
+
+        /// Internal function: Creates the listeners for every shard on the same port
+        /// \return If every listener could be bound
+        bool _listen(std::uint16_t port);
+
+        /// Internal function: Creates the listener for clients on the same host on the first shard
+        /// \param address Where to listen, see #start
+        /// \return If it could be created
+        bool _listen_locally(const std::string &address);
+
+        /// Internal function: The reactor loop for a single shard
+        void _run(shard &shard);
+
+        /// Internal function: Writes the messages the shards publish to the log and the search index, in the order
+        /// they were numbered, until the relay stops
+        void _write_log();
+
+        /// Internal function: Handles new connections, data and disconnects on a shard
+        void _handle_event(shard &shard, const ca::io_event &event);
+
+        /// Internal function: Closes a client connection
+        void _close(shard &shard, int fd);
+
+        /// Internal function: Handles a client's resume packet, telling it how far we got and sending it everything it
+        /// missed since it was last connected
+        void _resume(shard &shard, int fd, const ca::frame_decoder::frame &frame);
+
+        /// Internal function: Answers a client's sync request with a page of history from the log
+        void _sync(shard &shard, int fd, const ca::frame_decoder::frame &frame);
+
+        /// Internal function: Adds the messages a resumed client was replayed up to but the log writer hasn't
+        /// written yet to the end of a page, from the history
+        /// \param page The page read from the log, it had no more messages
+        /// \param room The room being synced
+        /// \param logged The last message the log had when the page was read
+        /// \param replayed The last message the client was replayed
+        /// \param limit How many messages the page can have
+        void _read_unlogged(ca::message_log::page &page, std::optional<ca::room_id> room, std::uint64_t logged,
+                            std::uint64_t replayed, size_t limit);
+
+        /// Internal function: Answers a client's search with the newest matching messages it's allowed to see
+        void _search(shard &shard, int fd, const ca::frame_decoder::frame &frame);
+
+        /// Internal function: Handles a client's typing update, it only counts for rooms the client is in
+        void _typing(shard &shard, int fd, const ca::frame_decoder::frame &frame);
+
+        /// Internal function: Counts a client joining or leaving a room (or connecting at all, outside of rooms)
+        void _count_online(std::optional<ca::room_id> room, bool joined);
+
+        /// Internal function: Tells a shard's clients who is in their rooms, for the rooms where that changed since they
+        /// were last told. Runs from the shard's timers, once per presence interval
+        void _send_presence(shard &shard);
+
+        /// Internal function: Adds whatever the log has that the search index doesn't to the index, the messages
+        /// logged since the index was last saved
+        void _index_log();
+
+        /// Internal function: Forgets a session once its client has been gone for longer than the retention time
+        void _expire_session(std::uint64_t session);
+
+        /// Internal function: Closes a client connection if it has gone quiet for longer than the heartbeat timeout,
+        /// otherwise checks again once it could have. Runs from the shard's timers
+        void _check_alive(shard &shard, int fd);
+
+        /// Internal function: Trains a new dictionary from the collected messages every now and then, runs on its own thread
+        void _train();
+
+        /// Internal function: Switches a shard over to the newest dictionary, and sends it to the shard's clients
+        void _adopt_dictionary(shard &shard);
+
+        /// Internal function: Serializes a chat message for every codec the relay sends with, each version is written
+        /// once as a sequenced packet with room left for its number
+        /// \param message The message to serialize
+        /// \param room The room it was sent to, if any
+        /// \param dictionary The dictionary of the shard doing the encoding, if it has one
+        /// \param width How many bytes to leave for the sequence number
+        [[nodiscard]] static unnumbered_packet _encode(const ca::message &message, std::optional<ca::room_id> room,
+                                                       const std::shared_ptr<const ca::dictionary> &dictionary,
+                                                       size_t width);
+
+        /// Internal function: The version of the dictionary a shard has sent out
+        [[nodiscard]] static std::uint32_t _shard_dictionary_version(const shard &shard) noexcept;
+
+        /// Internal function: Sends a packet to every client on every shard, apart from the one that sent it.
+        /// The packet is serialized once, every client's send queue only gets a reference to it
+        /// \param room If set, only the clients subscribed to the room get the packet
+        /// \param priority Which of the clients' send queues it goes into
+        void _relay(shard &origin, int source, const encoded_packet &packet, std::optional<ca::room_id> room,
+                    ca::send_priority priority);
+
+        /// Internal function: Numbers a chat message, adds it to the history and sends it to every other client.
+        /// Every shard (the sender's included) gets it through its inbox, so every client sees the same order
+        /// \param session The session of the client that sent it
+        /// \param room If set, only the clients subscribed to the room get the message
+        void _publish(shard &origin, std::uint64_t session, const ca::message &message, std::optional<ca::room_id> room);
+
+        /// Internal function: Sends a packet to every client on a single shard
+        static void _send_to_all(shard &shard, int except, const relayed_packet &packet);
+
+        /// Internal function: Sends a packet to every client on a single shard that is subscribed to the room
+        static void _send_to_room(shard &shard, int except, ca::room_id room, const relayed_packet &packet);
+
+        /// Internal function: If a packet should go to a client, apart from the room it's for
+        [[nodiscard]] static bool _wants(const connection &client, int fd, int except, const relayed_packet &packet) noexcept;
+
+        ca::io_backend_type _backend_type;
+        ca::send_limit _send_limit;
+        ca::heartbeat_settings _heartbeat;
+        ca::frame_limits _frames;
+        ca::receive_budget _receive_budget; // Shared by the decoders of every connection on every shard
+        ca::presence_settings _presence_settings;
+        size_t _shard_count;
+
+        std::atomic<bool> _running = false;
+        std::atomic<size_t> _connection_count = 0;
+
+        std::vector<std::unique_ptr<shard>> _shards;
+        ca::endpoint _local_endpoint; // Where the listener for clients on the same host is, if there is one
+
+        ca::mpsc_queue<ca::pooled_string> _samples; // Small messages the shards have relayed, for training dictionaries
+        std::thread _trainer;
+
+        std::mutex _dictionary_mutex;
+        std::shared_ptr<const ca::dictionary> _dictionary;    // The newest dictionary
+        std::atomic<std::uint32_t> _dictionary_version = 0;   // Its version, so shards can check without locking
+
+        std::uint64_t _session; // Random, tells clients when they've reconnected to a restarted relay
+
+        std::mutex _history_mutex;
+        std::atomic<std::uint64_t> _sequence = 0; // The number of the last chat message, carries on from the log.
+                                                  // Only changes under _history_mutex
+        std::deque<relayed_packet> _history;  // The most recent chat messages, for resuming clients
+        ca::message_log _log;                 // Every chat message, for syncing history
+        ca::search_index _index;              // The content of every chat message in the log
+        std::string _index_path;              // Where the index is saved, empty if the log isn't persistent
+
+        ca::mpsc_queue<log_entry> _unlogged;            // Pushed in the order the messages are numbered
+        std::atomic<std::uint32_t> _unlogged_pushes = 0; // Waited on by the log writer
+        std::atomic<std::uint64_t> _logged = 0;         // The last message the log writer has written
+        std::atomic<bool> _logging = false;             // Cleared once nothing can publish anymore
+        std::thread _log_writer;
+
+        std::mutex _sessions_mutex;
+        std::unordered_map<std::uint64_t, session_state> _sessions;
+
+        std::mutex _presence_mutex;
+        std::unordered_map<std::optional<ca::room_id>, room_presence> _presence;
+    };
+}
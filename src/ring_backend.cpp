@@ -0,0 +1,310 @@
+#include "ring_backend.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory_transport.h>
+#include <shm_transport.h>
+
+namespace {
+    /// Wakes up the other side of a ring, it's blocked on the socket. If the socket's full there are wake ups it
+    /// hasn't read yet, another one isn't needed
+    /// \param fd The socket the ring was set up next to
+    void ring_doorbell(int fd) noexcept {
+        const auto byte = std::byte(1);
+        [[maybe_unused]] const auto sent = ::send(fd, &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    /// Lets the other hardware thread run while spinning
+    void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+}
+
+bool ca::ring_backend::add(int fd) {
+    if (!_inner->add(fd))
+        return false;
+
+    if (auto channel = ca::shm_channel::detach(fd); channel) {
+        auto &added = _connections[fd] = std::make_shared<connection>();
+        added->channel = std::move(channel);
+    }
+    return true;
+}
+
+bool ca::ring_backend::add_listener(int fd) {
+    if (!ca::memory_transport::listening(fd))
+        return _inner->add_listener(fd);
+
+    if (!_inner->add(fd))
+        return false;
+    _memory_listeners.insert(fd);
+    return true;
+}
+
+void ca::ring_backend::remove(int fd) {
+    if (const auto it = _connections.find(fd); it != _connections.end()) {
+        it->second->removed = true;
+        _connections.erase(it);
+    }
+    _memory_listeners.erase(fd);
+    _inner->remove(fd);
+}
+
+void ca::ring_backend::send(int fd, ca::shared_bytes bytes, ca::send_priority priority) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end()) {
+        _inner->send(fd, std::move(bytes), priority);
+        return;
+    }
+
+    auto &connection = *it->second;
+    if (connection.failed)
+        return;
+
+    connection.outgoing.push(std::move(bytes), priority);
+    _flush(fd, connection);
+
+    // Same as a slow socket reader, it's reported as closed on the next wait
+    if (!connection.outgoing.enforce(_send_limit))
+        connection.failed = true;
+}
+
+void ca::ring_backend::send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                                 size_t offset) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end()) {
+        _inner->send_file(fd, transfer, std::move(file), offset);
+        return;
+    }
+
+    auto &connection = *it->second;
+    if (connection.failed)
+        return;
+
+    connection.outgoing.push_file(transfer, std::move(file), offset);
+    _flush(fd, connection);
+}
+
+void ca::ring_backend::wait(std::chrono::milliseconds timeout, const event_handler &handler) {
+    const auto handle = [this, &handler](const ca::io_event &event) { _handle(event, handler); };
+    if (_connections.empty()) {
+        _streaming = false;
+        _inner->wait(timeout, handle);
+        return;
+    }
+
+    _woken.store(false, std::memory_order_relaxed);
+
+    // Rings that failed while sending are reported here, so every close goes through the handler
+    auto failed = std::vector<int>();
+    for (const auto &[fd, connection] : _connections)
+        if (connection->failed)
+            failed.push_back(fd);
+
+    for (const auto fd : failed) {
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+    }
+
+    // While data is streaming in, the next of it is usually less than a syscall away. With a single hardware thread
+    // the other side can't write while this one spins
+    static const auto can_spin = std::thread::hardware_concurrency() > 1;
+    auto received = _service(handler);
+    if (!received && _streaming && can_spin && timeout.count() > 0 && _spin())
+        received = _service(handler);
+
+    // Blocking needs every ring to know, so the other side rings its socket when it writes to it
+    auto blocking = received ? std::chrono::milliseconds(0) : timeout;
+    for (const auto &[fd, connection] : _connections)
+        if (!connection->channel->incoming().sleep())
+            blocking = std::chrono::milliseconds(0);
+
+    _inner->wait(blocking, handle);
+
+    for (const auto &[fd, connection] : _connections)
+        connection->channel->incoming().awake();
+
+    _streaming = _service(handler) || received;
+}
+
+void ca::ring_backend::wake() {
+    _woken.store(true, std::memory_order_release);
+    _inner->wake();
+}
+
+size_t ca::ring_backend::queued_bytes(int fd) const {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return _inner->queued_bytes(fd);
+
+    const auto &connection = *it->second;
+    return connection.outgoing.queued_bytes() + (connection.writing ? connection.writing->unwritten() : 0);
+}
+
+void ca::ring_backend::set_send_limit(ca::send_limit limit) noexcept {
+    io_backend::set_send_limit(limit);
+    _inner->set_send_limit(limit);
+}
+
+void ca::ring_backend::_handle(const ca::io_event &event, const event_handler &handler) {
+    // A connection on a shared memory listener hands over its rings before it's anything else
+    if (event.kind == io_event::type::accepted) {
+        if (ca::shm_transport::accepted(event.fd))
+            handler(event);
+        else
+            ::close(event.fd);
+        return;
+    }
+
+    if (_memory_listeners.contains(event.fd)) {
+        if (event.kind == io_event::type::received)
+            _accept(event.fd, event.data.size(), handler);
+        else
+            _memory_listeners.erase(event.fd); // Closed by the transport, the inner backend has forgotten it already
+        return;
+    }
+
+    const auto it = _connections.find(event.fd);
+    if (it == _connections.end()) {
+        handler(event);
+        return;
+    }
+
+    // The data is in the ring, what's on the socket only woke the wait up. The ring is read after the wait
+    if (event.kind == io_event::type::received)
+        return;
+
+    // Whatever the other side wrote before it closed is still in the ring
+    const auto connection = it->second;
+    _receive(event.fd, connection, handler);
+    if (connection->removed)
+        return;
+
+    connection->removed = true;
+    _connections.erase(event.fd);
+    handler(event);
+}
+
+void ca::ring_backend::_accept(int listener, size_t announced, const event_handler &handler) {
+    for (auto i = size_t(0); i < announced && _memory_listeners.contains(listener); i++) {
+        const auto fd = ca::memory_transport::take(listener);
+        if (fd < 0)
+            continue;
+
+        // Accepted sockets are non-blocking, like the ones accept4 hands the other backends
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        handler({.kind = io_event::type::accepted, .fd = fd, .data = {}});
+    }
+}
+
+bool ca::ring_backend::_receive(int fd, const std::shared_ptr<connection> &connection,
+                                const event_handler &handler) {
+    auto &ring = connection->channel->incoming();
+
+    // At most a ring's worth, a side that keeps writing can't keep the other connections waiting
+    auto received = size_t(0);
+    while (received < ca::shm_channel::ring_size && !connection->removed) {
+        const auto data = ring.readable();
+        if (data.empty())
+            break;
+
+        {
+            const auto span = ca::trace::scope("ring_read", "net");
+            handler({.kind = io_event::type::received, .fd = fd, .data = data});
+        }
+        ring.consume(data.size());
+        received += data.size();
+    }
+
+    // Once the handler removed it the socket may have been closed, and the fd reused
+    if (received > 0 && !connection->removed && ring.wake_writer())
+        ring_doorbell(fd);
+    return received > 0;
+}
+
+void ca::ring_backend::_flush(int fd, connection &connection) {
+    auto &ring = connection.channel->outgoing();
+    auto committed = false;
+
+    while (!connection.failed && (connection.writing || (connection.writing = connection.outgoing.take()))) {
+        auto &piece = *connection.writing;
+        while (piece.written < piece.size()) {
+            const auto space = ring.writable();
+            if (space.empty())
+                break;
+
+            auto copied = size_t(0);
+            auto vectors = std::array<iovec, 2>();
+            if (piece.remaining(vectors) > 0) {
+                copied = std::min(space.size(), vectors[0].iov_len);
+                std::memcpy(space.data(), vectors[0].iov_base, copied);
+            } else {
+                // A file's data, after its header, is read straight into the ring
+                const auto position = piece.offset + (piece.written - piece.header_size);
+                const auto read = ::pread(piece.file->fd(), space.data(), std::min(space.size(), piece.end - position),
+                                          static_cast<off_t>(position));
+                if (read < 0 && errno == EINTR)
+                    continue;
+                if (read <= 0) {
+                    connection.failed = true; // The file got shorter since it was opened, or can't be read
+                    break;
+                }
+                copied = static_cast<size_t>(read);
+            }
+
+            ring.commit(copied);
+            piece.advance(copied);
+            committed = true;
+        }
+
+        if (piece.written == piece.size())
+            connection.writing.reset();
+        else if (connection.failed || ring.wait_for_space())
+            break; // The other side rings once it's made room
+    }
+
+    if (committed && ring.wake_reader())
+        ring_doorbell(fd);
+}
+
+bool ca::ring_backend::_service(const event_handler &handler) {
+    // The handler can add and remove connections, and send on any of them
+    auto connections = std::vector<std::pair<int, std::shared_ptr<connection>>>(_connections.begin(),
+                                                                                _connections.end());
+    auto received = false;
+    for (const auto &[fd, connection] : connections) {
+        if (connection->removed)
+            continue;
+        received = _receive(fd, connection, handler) || received;
+        if (!connection->removed)
+            _flush(fd, *connection);
+    }
+    return received;
+}
+
+bool ca::ring_backend::_spin() const {
+    const auto until = std::chrono::steady_clock::now() + spin_time;
+    for (auto i = 0u;; i++) {
+        for (const auto &[fd, connection] : _connections)
+            if (!connection->channel->incoming().readable().empty())
+                return true;
+
+        if (_woken.load(std::memory_order_acquire))
+            return false;
+        if (i % 64 == 0 && std::chrono::steady_clock::now() >= until)
+            return false;
+        cpu_relax();
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <io_backend.h>
+#include <shm_ring.h>
+#include <write_queue.h>
+
+namespace ca {
+    /// Goes around another backend, for sockets that have a ca::shm_channel set up next to them the data goes through
+    /// the channel's rings instead of the socket. The socket is still watched by the other backend: it's what tells
+    /// when the other side is gone, and a byte on it is what wakes up a side that's blocked waiting on its ring. Both
+    /// sides only ring when the other one said it's blocked, a busy connection doesn't make any syscalls.
+    /// Listeners of the memory transport are socket pairs rather than listening sockets, their connections are taken
+    /// from the transport as they're announced (see ca::memory_transport)
+    class ring_backend : public io_backend {
+    public:
+        /// \param inner The backend that watches the sockets (and moves the data of the ones that aren't rings)
+        explicit ring_backend(std::unique_ptr<ca::io_backend> inner) noexcept : _inner(std::move(inner)) {}
+
+        bool add(int fd) override;
+
+        bool add_listener(int fd) override;
+
+        void remove(int fd) override;
+
+        using io_backend::send;
+
+        void send(int fd, ca::shared_bytes bytes, ca::send_priority priority = ca::send_priority::normal) override;
+
+        void send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                       size_t offset) override;
+
+        void wait(std::chrono::milliseconds timeout, const event_handler &handler) override;
+
+        void wake() override;
+
+        [[nodiscard]] size_t queued_bytes(int fd) const override;
+
+        void set_send_limit(ca::send_limit limit) noexcept override;
+
+        [[nodiscard]] const char *name() const noexcept override { return _inner->name(); }
+
+    private:
+        /// How long a wait keeps checking the rings before it blocks, while data has been coming in through them
+        static constexpr auto spin_time = std::chrono::microseconds(50);
+
+        struct connection {
+            std::shared_ptr<ca::shm_channel> channel;
+            ca::write_queue outgoing;
+            std::optional<ca::write_queue::piece> writing; // Partly copied into the ring
+            bool failed = false;
+            bool removed = false; // The handler may remove it while it's being read from
+        };
+
+        /// Internal function: Passes on what the inner backend reported, the doorbell bytes on ring sockets aren't
+        /// data and a ring that's closed is read to the end first
+        void _handle(const ca::io_event &event, const event_handler &handler);
+
+        /// Internal function: Reports the connections a memory transport listener announced as accepted
+        /// \param listener The listener
+        /// \param announced How many bytes came in on it, one for each connection
+        void _accept(int listener, size_t announced, const event_handler &handler);
+
+        /// Internal function: Hands what's in a connection's incoming ring to the handler
+        /// \return If there was anything
+        bool _receive(int fd, const std::shared_ptr<connection> &connection, const event_handler &handler);
+
+        /// Internal function: Copies the queued data into a connection's outgoing ring, as much as fits
+        void _flush(int fd, connection &connection);
+
+        /// Internal function: Reads and writes every ring
+        /// \return If anything was received
+        bool _service(const event_handler &handler);
+
+        /// Internal function: Checks the rings for a moment, until something comes in or a #wake
+        /// \return If something came in
+        bool _spin() const;
+
+        std::unique_ptr<ca::io_backend> _inner;
+
+        std::unordered_map<int, std::shared_ptr<connection>> _connections;
+        std::unordered_set<int> _memory_listeners;
+
+        std::atomic<bool> _woken = false;
+        bool _streaming = false; // Data came in through a ring on the last wait, the next one spins before blocking
+    };
+}
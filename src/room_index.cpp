@@ -0,0 +1,73 @@
+#include "room_index.h"
+
+#include <algorithm>
+#include <iterator>
+
+bool ca::room_index::subscribe(ca::room_id room, int fd) {
+    auto &rooms = _memberships[fd];
+    if (std::find(rooms.begin(), rooms.end(), room) != rooms.end())
+        return false;
+    rooms.push_back(room);
+
+    auto &subscribers = _rooms[room];
+    auto updated = subscribers ? std::vector<int>(*subscribers) : std::vector<int>();
+    updated.push_back(fd);
+    subscribers = std::make_shared<const std::vector<int>>(std::move(updated));
+    return true;
+}
+
+bool ca::room_index::unsubscribe(ca::room_id room, int fd) {
+    const auto membership = _memberships.find(fd);
+    if (membership == _memberships.end())
+        return false;
+
+    auto &rooms = membership->second;
+    const auto it = std::find(rooms.begin(), rooms.end(), room);
+    if (it == rooms.end())
+        return false;
+
+    *it = rooms.back();
+    rooms.pop_back();
+    if (rooms.empty())
+        _memberships.erase(membership);
+
+    const auto subscribers = _rooms.find(room);
+    if (subscribers->second->size() == 1) {
+        _rooms.erase(subscribers);
+        return true;
+    }
+
+    auto updated = std::vector<int>();
+    updated.reserve(subscribers->second->size() - 1);
+    std::copy_if(subscribers->second->begin(), subscribers->second->end(), std::back_inserter(updated),
+                 [fd](int subscriber) { return subscriber != fd; });
+    subscribers->second = std::make_shared<const std::vector<int>>(std::move(updated));
+    return true;
+}
+
+std::vector<ca::room_id> ca::room_index::unsubscribe_all(int fd) {
+    const auto membership = _memberships.find(fd);
+    if (membership == _memberships.end())
+        return {};
+
+    // Copied, as unsubscribing modifies the membership list
+    const auto rooms = membership->second;
+    for (const auto room : rooms)
+        unsubscribe(room, fd);
+    return rooms;
+}
+
+ca::room_index::subscriber_list ca::room_index::subscribers(ca::room_id room) const {
+    const auto it = _rooms.find(room);
+    return it == _rooms.end() ? nullptr : it->second;
+}
+
+bool ca::room_index::subscribed(ca::room_id room, int fd) const {
+    const auto membership = _memberships.find(fd);
+    return membership != _memberships.end() &&
+           std::find(membership->second.begin(), membership->second.end(), room) != membership->second.end();
+}
+
+size_t ca::room_index::room_count() const noexcept {
+    return _rooms.size();
+}
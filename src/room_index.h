@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <message.h>
+
+namespace ca {
+    /// Which connections are subscribed to which rooms, built for fanout rather than for changes.
+    /// Every room's subscribers are kept in one contiguous array that is never modified in place, subscribing or
+    /// unsubscribing copies it and swaps the new array in. A broadcast holds on to the array it started with,
+    /// so connections can come and go (even from inside the broadcast) without invalidating it
+    class room_index {
+    public:
+        using subscriber_list = std::shared_ptr<const std::vector<int>>;
+
+        /// Adds a connection to a room, creating the room if needed
+        /// \param room The room to join
+        /// \param fd The connection socket handle
+        /// \return false if it was already in the room
+        bool subscribe(ca::room_id room, int fd);
+
+        /// Removes a connection from a room, the room is dropped once it's empty
+        /// \param room The room to leave
+        /// \param fd The connection socket handle
+        /// \return false if it wasn't in the room
+        bool unsubscribe(ca::room_id room, int fd);
+
+        /// Removes a connection from every room it's in, used when it disconnects
+        /// \param fd The connection socket handle
+        /// \return The rooms it was in
+        std::vector<ca::room_id> unsubscribe_all(int fd);
+
+        /// A snapshot of the room's subscribers, later changes to the room don't affect it
+        /// \param room The room to look up
+        /// \return The subscribers, nullptr if nobody is in the room
+        [[nodiscard]] subscriber_list subscribers(ca::room_id room) const;
+
+        /// \param room The room to look up
+        /// \param fd The connection socket handle
+        /// \return true if the connection is subscribed to the room
+        [[nodiscard]] bool subscribed(ca::room_id room, int fd) const;
+
+        /// \return The number of rooms with at least one subscriber
+        [[nodiscard]] size_t room_count() const noexcept;
+
+    private:
+        std::unordered_map<ca::room_id, subscriber_list> _rooms;
+        std::unordered_map<int, std::vector<ca::room_id>> _memberships; // The rooms every connection is in
+    };
+}
@@ -0,0 +1,293 @@
+#include "search_index.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <span>
+
+#include <wire.h>
+
+namespace {
+    /// The start of every index file, bumped if the layout ever changes
+    constexpr auto magic = std::array{std::byte('C'), std::byte('A'), std::byte('I'), std::byte('D'), std::byte('X'),
+                                      std::byte(0), std::byte(0), std::byte(1)};
+
+    /// Longer terms are cut off, they're almost never something anyone searches for
+    constexpr auto max_term_size = size_t(64);
+
+    /// Closes a std::FILE when it goes out of scope
+    struct file_closer {
+        void operator()(std::FILE *file) const noexcept { std::fclose(file); }
+    };
+    using file_handle = std::unique_ptr<std::FILE, file_closer>;
+}
+
+void ca::search_index::add(std::uint64_t document, std::string_view text) {
+    // Tokenized before locking, searches only wait for the postings to be appended
+    const auto terms = tokenize(text);
+
+    auto guard = std::unique_lock(_mutex);
+    if (document <= _last_document && _last_document != 0)
+        return;
+
+    for (const auto &term : terms)
+        _append(_terms[term], document);
+    _last_document = document;
+}
+
+std::vector<std::uint64_t> ca::search_index::search(std::string_view query, std::uint64_t after) const {
+    auto terms = tokenize(query);
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    if (terms.empty())
+        return {};
+
+    auto guard = std::shared_lock(_mutex);
+    auto lists = std::vector<const postings *>();
+    for (const auto &term : terms) {
+        const auto it = _terms.find(term);
+        if (it == _terms.end())
+            return {};
+        lists.push_back(&it->second);
+    }
+
+    // The rarest term leads, every other list only gets decoded around its documents
+    std::sort(lists.begin(), lists.end(), [](const postings *a, const postings *b) { return a->count < b->count; });
+    auto cursors = std::vector<cursor>();
+    cursors.reserve(lists.size());
+    for (const auto *list : lists)
+        cursors.emplace_back(*list);
+
+    auto results = std::vector<std::uint64_t>();
+    auto &lead = cursors.front();
+    lead.seek(after + 1);
+    while (!lead.done()) {
+        const auto candidate = lead.document();
+        auto matched = true;
+        for (auto it = cursors.begin() + 1; it != cursors.end(); ++it) {
+            it->seek(candidate);
+            if (it->done())
+                return results;
+
+            if (it->document() != candidate) {
+                lead.seek(it->document());
+                matched = false;
+                break;
+            }
+        }
+
+        if (matched) {
+            results.push_back(candidate);
+            lead.next();
+        }
+    }
+    return results;
+}
+
+void ca::search_index::clear() {
+    auto guard = std::unique_lock(_mutex);
+    _terms.clear();
+    _last_document = 0;
+}
+
+std::uint64_t ca::search_index::last_document() const {
+    auto guard = std::shared_lock(_mutex);
+    return _last_document;
+}
+
+size_t ca::search_index::term_count() const {
+    auto guard = std::shared_lock(_mutex);
+    return _terms.size();
+}
+
+bool ca::search_index::save(const std::string &path) const {
+    const auto temporary = path + ".tmp";
+    auto file = file_handle(std::fopen(temporary.c_str(), "wb"));
+    if (!file)
+        return false;
+
+    auto written = std::fwrite(magic.data(), 1, magic.size(), file.get()) == magic.size();
+    {
+        auto guard = std::shared_lock(_mutex);
+
+        // [last document][term count], then [term size][term][count][last document][data size][data] per term
+        auto header = ca::wire::writer(2 * ca::wire::max_varint_size);
+        header.varint(_last_document);
+        header.varint(_terms.size());
+        const auto header_bytes = header.take();
+        written = written && std::fwrite(header_bytes.data(), 1, header_bytes.size(), file.get()) == header_bytes.size();
+
+        for (auto it = _terms.begin(); written && it != _terms.end(); ++it) {
+            const auto &[term, postings] = *it;
+            auto record = ca::wire::writer(4 * ca::wire::max_varint_size + term.size() + postings.data.size());
+            record.varint(term.size());
+            record.bytes(std::as_bytes(std::span(term)));
+            record.varint(postings.count);
+            record.varint(postings.last);
+            record.varint(postings.data.size());
+            record.bytes(postings.data);
+            const auto bytes = record.take();
+            written = std::fwrite(bytes.data(), 1, bytes.size(), file.get()) == bytes.size();
+        }
+    }
+
+    written = std::fflush(file.get()) == 0 && written;
+    file.reset();
+    if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ca::search_index::load(const std::string &path) {
+    auto terms = std::unordered_map<std::string, postings>();
+    auto last_document = std::uint64_t(0);
+
+    auto loaded = [&]() {
+        auto file = file_handle(std::fopen(path.c_str(), "rb"));
+        if (!file)
+            return false;
+
+        auto contents = std::vector<std::byte>();
+        auto chunk = std::array<std::byte, 64 * 1024>();
+        for (auto read = size_t(0); (read = std::fread(chunk.data(), 1, chunk.size(), file.get())) > 0;)
+            contents.insert(contents.end(), chunk.begin(), chunk.begin() + static_cast<std::ptrdiff_t>(read));
+
+        if (contents.size() < magic.size() || !std::equal(magic.begin(), magic.end(), contents.begin()))
+            return false;
+
+        auto reader = ca::wire::reader(std::span(contents).subspan(magic.size()));
+        const auto last = reader.varint();
+        const auto count = last ? reader.varint() : std::nullopt;
+        if (!count)
+            return false;
+        last_document = *last;
+
+        for (auto i = std::uint64_t(0); i < *count; i++) {
+            const auto term_size = reader.varint();
+            const auto term = term_size ? reader.bytes(*term_size) : std::nullopt;
+            const auto postings_count = term ? reader.varint() : std::nullopt;
+            const auto postings_last = postings_count ? reader.varint() : std::nullopt;
+            const auto data_size = postings_last ? reader.varint() : std::nullopt;
+            const auto data = data_size ? reader.bytes(*data_size) : std::nullopt;
+            if (!data)
+                return false;
+
+            // The skip entries aren't saved, they're rebuilt by walking the postings once
+            auto rebuilt = postings();
+            auto data_reader = ca::wire::reader(*data);
+            while (data_reader.position() < data->size()) {
+                const auto delta = data_reader.varint();
+                if (!delta)
+                    return false;
+                _append(rebuilt, rebuilt.last + *delta);
+            }
+            if (rebuilt.count != *postings_count || rebuilt.last != *postings_last)
+                return false;
+
+            terms.emplace(std::string(reinterpret_cast<const char *>(term->data()), term->size()), std::move(rebuilt));
+        }
+        return true;
+    }();
+
+    auto guard = std::unique_lock(_mutex);
+    _terms = loaded ? std::move(terms) : decltype(terms)();
+    _last_document = loaded ? last_document : 0;
+    return loaded;
+}
+
+std::vector<std::string> ca::search_index::tokenize(std::string_view text) {
+    auto terms = std::vector<std::string>();
+    auto term = std::string();
+
+    for (auto i = size_t(0); i <= text.size(); i++) {
+        const auto c = i < text.size() ? static_cast<unsigned char>(text[i]) : 0;
+        const auto letter = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80;
+        if (c >= 'A' && c <= 'Z') {
+            term.push_back(static_cast<char>(c - 'A' + 'a'));
+            continue;
+        }
+        if (letter) {
+            term.push_back(static_cast<char>(c));
+            continue;
+        }
+
+        if (!term.empty()) {
+            // Cut off between UTF-8 characters, continuation bytes start with 0b10
+            if (term.size() > max_term_size) {
+                auto size = max_term_size;
+                while (size > 0 && (static_cast<unsigned char>(term[size]) & 0xC0) == 0x80)
+                    size--;
+                term.resize(size);
+            }
+            terms.push_back(std::move(term));
+            term.clear();
+        }
+    }
+    return terms;
+}
+
+void ca::search_index::_append(postings &postings, std::uint64_t document) {
+    // A term that shows up more than once in a document is only posted once
+    if (postings.count != 0 && postings.last == document)
+        return;
+
+    const auto delta = document - postings.last;
+    auto varint = ca::wire::writer(ca::wire::max_varint_size);
+    varint.varint(delta);
+    const auto bytes = varint.take();
+    postings.data.insert(postings.data.end(), bytes.begin(), bytes.end());
+
+    postings.last = document;
+    postings.count++;
+    if (postings.count % skip_interval == 0)
+        postings.skips.push_back({.document = document, .offset = static_cast<std::uint32_t>(postings.data.size()),
+                                  .index = postings.count});
+}
+
+ca::search_index::cursor::cursor(const postings &postings) noexcept : _postings(&postings) {
+    next();
+}
+
+bool ca::search_index::cursor::done() const noexcept {
+    return _done;
+}
+
+std::uint64_t ca::search_index::cursor::document() const noexcept {
+    return _document;
+}
+
+void ca::search_index::cursor::next() noexcept {
+    if (_index == _postings->count) {
+        _done = true;
+        return;
+    }
+
+    auto reader = ca::wire::reader(std::span(_postings->data).subspan(_offset));
+    _document += reader.varint().value_or(0);
+    _offset += reader.position();
+    _index++;
+}
+
+void ca::search_index::cursor::seek(std::uint64_t target) noexcept {
+    if (_done || _document >= target)
+        return;
+
+    // The last skip entry before the target, if it's ahead of where the cursor is decoding continues from there
+    const auto &skips = _postings->skips;
+    const auto after = std::partition_point(skips.begin(), skips.end(), [target](const skip &skip) {
+        return skip.document < target;
+    });
+    if (after != skips.begin() && std::prev(after)->index > _index) {
+        const auto &skip = *std::prev(after);
+        _document = skip.document;
+        _offset = skip.offset;
+        _index = skip.index;
+    }
+
+    while (!_done && _document < target)
+        next();
+}
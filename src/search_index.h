@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ca {
+    /// Inverted index over message content, for full-text search. Every term has a postings list of the documents it
+    /// appears in (the relay's sequence numbers), delta encoded as varints so a posting mostly takes a byte or two, with
+    /// a skip entry every skip_interval postings. A query walks the postings of all its terms at once, the rarest term
+    /// leads and the others skip ahead to its documents, so common words barely cost anything next to a rare one.
+    /// Documents are added in increasing order as they arrive, searching can happen from any thread
+    class search_index {
+    public:
+        /// Indexes a document
+        /// \param document Identifies it, has to be higher than every document added before
+        /// \param text What can be searched for
+        void add(std::uint64_t document, std::string_view text);
+
+        /// Finds the documents containing every term of a query
+        /// \param query The words to look for, split up the same way documents are
+        /// \param after Only documents after this one, the postings before it are skipped over rather than decoded
+        /// \return The documents, oldest first. Empty if the query has no terms
+        [[nodiscard]] std::vector<std::uint64_t> search(std::string_view query, std::uint64_t after = 0) const;
+
+        /// Removes every document
+        void clear();
+
+        /// \return The newest document that has been added, 0 if none has
+        [[nodiscard]] std::uint64_t last_document() const;
+
+        /// \return The number of distinct terms
+        [[nodiscard]] size_t term_count() const;
+
+        /// Writes the index to a file, through a temporary file so a crash leaves the previous one intact
+        /// \param path The file to write
+        /// \return false if it couldn't be written
+        bool save(const std::string &path) const;
+
+        /// Replaces the index with one written by #save
+        /// \param path The file to read
+        /// \return false if it doesn't exist or isn't an index, the index is left empty then
+        bool load(const std::string &path);
+
+        /// Splits text into the terms that are indexed: runs of letters and digits, lowercased. Bytes of multibyte
+        /// UTF-8 characters count as letters, so words in other scripts are found too (matching them exactly)
+        /// \param text The text to split
+        /// \return The terms, in the order they appear (including duplicates)
+        [[nodiscard]] static std::vector<std::string> tokenize(std::string_view text);
+
+    private:
+        /// How many postings there are between skip entries
+        static constexpr auto skip_interval = size_t(128);
+
+        /// Where decoding can start from in the middle of a postings list
+        struct skip {
+            std::uint64_t document; // The document of the posting just before offset
+            std::uint32_t offset;   // Into postings::data
+            std::uint32_t index;    // How many postings come before offset
+        };
+
+        struct postings {
+            std::vector<std::byte> data; // Differences between consecutive documents, the first one is from 0
+            std::vector<skip> skips;
+            std::uint64_t last = 0;      // The newest document
+            std::uint32_t count = 0;
+        };
+
+        /// Walks a postings list in order
+        class cursor {
+        public:
+            explicit cursor(const postings &postings) noexcept;
+
+            /// \return true if every posting has been walked past
+            [[nodiscard]] bool done() const noexcept;
+
+            /// \return The document of the current posting, only valid if not #done
+            [[nodiscard]] std::uint64_t document() const noexcept;
+
+            /// Moves to the next posting
+            void next() noexcept;
+
+            /// Moves to the first posting at or after a document, using the skip entries to jump over the ones before it
+            /// \param target The document
+            void seek(std::uint64_t target) noexcept;
+
+        private:
+            const postings *_postings;
+            size_t _offset = 0;   // Of the next posting to decode
+            size_t _index = 0;    // How many postings have been decoded
+            std::uint64_t _document = 0;
+            bool _done = false;
+        };
+
+        /// Internal function: Appends a document to a term's postings
+        static void _append(postings &postings, std::uint64_t document);
+
+        mutable std::shared_mutex _mutex;
+        std::unordered_map<std::string, postings> _terms;
+        std::uint64_t _last_document = 0;
+    };
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace ca {
+    /// An immutable, reference counted packet. A packet going to many sockets is serialized once,
+    /// and every send queue it's in only holds a reference to it
+    using shared_bytes = std::shared_ptr<const std::vector<std::byte>>;
+
+    /// Moves serialized bytes into a shared buffer
+    /// \param bytes The serialized packet
+    /// \return The shared buffer
+    [[nodiscard]] inline ca::shared_bytes make_shared_bytes(std::vector<std::byte> bytes) {
+        return std::make_shared<const std::vector<std::byte>>(std::move(bytes));
+    }
+}
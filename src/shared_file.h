@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ca {
+    /// A file opened for reading, shared between whoever still needs it (a file transfer and the send queues it's
+    /// being streamed from) and closed with the last of them. The size is taken once when it's opened, a file that
+    /// shrinks afterwards fails the transfer rather than sending something else
+    class shared_file {
+    public:
+        /// \param path The file to open
+        /// \return The file, or nullptr if it can't be opened (or isn't a regular file)
+        [[nodiscard]] static std::shared_ptr<const ca::shared_file> open(const std::string &path) {
+            const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return nullptr;
+
+            struct stat status = {};
+            if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+                close(fd);
+                return nullptr;
+            }
+            return std::shared_ptr<const ca::shared_file>(new ca::shared_file(fd, static_cast<size_t>(status.st_size)));
+        }
+
+        shared_file(const shared_file &) = delete;
+        shared_file &operator=(const shared_file &) = delete;
+
+        ~shared_file() { close(_fd); }
+
+        [[nodiscard]] int fd() const noexcept { return _fd; }
+        [[nodiscard]] size_t size() const noexcept { return _size; }
+
+    private:
+        shared_file(int fd, size_t size) noexcept : _fd(fd), _size(size) {}
+
+        const int _fd;
+        const size_t _size;
+    };
+}
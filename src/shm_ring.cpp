@@ -0,0 +1,177 @@
+#include <shm_ring.h>
+
+#include <algorithm>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    /// Where the control blocks end and the buffers start
+    constexpr auto buffers_offset = size_t(4096);
+
+    /// Both control blocks and both buffers
+    constexpr auto mapping_size = buffers_offset + 2 * ca::shm_channel::ring_size;
+
+    static_assert(2 * sizeof(ca::shm_ring::control) <= buffers_offset);
+    static_assert((ca::shm_channel::ring_size & (ca::shm_channel::ring_size - 1)) == 0);
+
+    /// A channel that's been attached, and which socket it was: the fd could be closed and reused before the
+    /// channel's picked up
+    struct attached {
+        std::shared_ptr<ca::shm_channel> channel;
+        dev_t device;
+        ino_t inode;
+    };
+
+    std::mutex attached_mutex;
+    std::unordered_map<int, attached> attached_channels;
+
+    /// \param fd A socket
+    /// \return What it is, nullopt if it couldn't be looked at
+    std::optional<struct stat> identify(int fd) {
+        struct stat status {};
+        if (::fstat(fd, &status) != 0)
+            return std::nullopt;
+        return status;
+    }
+}
+
+struct ca::shm_channel::mapping {
+    void *address;
+
+    explicit mapping(void *address) noexcept : address(address) {}
+    mapping(const mapping &) = delete;
+    mapping &operator=(const mapping &) = delete;
+    ~mapping() { ::munmap(address, mapping_size); }
+
+    [[nodiscard]] ca::shm_ring ring(int index) const noexcept {
+        const auto base = static_cast<std::byte *>(address);
+        return {reinterpret_cast<ca::shm_ring::control *>(base) + index,
+                base + buffers_offset + index * ca::shm_channel::ring_size, ca::shm_channel::ring_size};
+    }
+};
+
+std::span<std::byte> ca::shm_ring::writable() const noexcept {
+    const auto tail = _control->tail.load(std::memory_order_relaxed);
+    const auto used = tail - _control->head.load(std::memory_order_acquire);
+    const auto position = tail & (_size - 1);
+    return {_data + position, std::min(_size - used, _size - position)};
+}
+
+void ca::shm_ring::commit(size_t bytes) noexcept {
+    // Sequentially consistent against #sleep: either the reader sees the bytes, or the writer sees it's asleep
+    _control->tail.fetch_add(bytes, std::memory_order_seq_cst);
+}
+
+std::span<const std::byte> ca::shm_ring::readable() const noexcept {
+    const auto head = _control->head.load(std::memory_order_relaxed);
+    const auto written = _control->tail.load(std::memory_order_acquire) - head;
+    const auto position = head & (_size - 1);
+    return {_data + position, std::min<size_t>(written, _size - position)};
+}
+
+void ca::shm_ring::consume(size_t bytes) noexcept {
+    // Sequentially consistent against #wait_for_space, like #commit is against #sleep
+    _control->head.fetch_add(bytes, std::memory_order_seq_cst);
+}
+
+bool ca::shm_ring::sleep() noexcept {
+    _control->reader_asleep.store(1, std::memory_order_seq_cst);
+    if (_control->tail.load(std::memory_order_seq_cst) == _control->head.load(std::memory_order_relaxed))
+        return true;
+    awake();
+    return false;
+}
+
+void ca::shm_ring::awake() noexcept {
+    _control->reader_asleep.store(0, std::memory_order_relaxed);
+}
+
+bool ca::shm_ring::wake_reader() noexcept {
+    return _control->reader_asleep.load(std::memory_order_seq_cst) != 0
+        && _control->reader_asleep.exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+bool ca::shm_ring::wait_for_space() noexcept {
+    _control->writer_waiting.store(1, std::memory_order_seq_cst);
+    const auto used = _control->tail.load(std::memory_order_relaxed) - _control->head.load(std::memory_order_seq_cst);
+    if (used == _size)
+        return true;
+    _control->writer_waiting.store(0, std::memory_order_relaxed);
+    return false;
+}
+
+bool ca::shm_ring::wake_writer() noexcept {
+    return _control->writer_waiting.load(std::memory_order_seq_cst) != 0
+        && _control->writer_waiting.exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+ca::shm_channel::shm_channel(std::shared_ptr<mapping> mapping, int side) noexcept
+    : _mapping(std::move(mapping)), _incoming(_mapping->ring(1 - side)), _outgoing(_mapping->ring(side)) {}
+
+std::shared_ptr<ca::shm_channel> ca::shm_channel::create(int &fd) {
+#ifdef __linux__
+    fd = ::memfd_create("ca-channel", MFD_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    // A fresh memfd reads as zeroes, which is what both control blocks start out as
+    const auto accepting = ::ftruncate(fd, mapping_size) == 0 ? open(fd) : nullptr;
+    if (!accepting) {
+        ::close(fd);
+        fd = -1;
+        return nullptr;
+    }
+    return std::shared_ptr<ca::shm_channel>(new shm_channel(accepting->_mapping, 0));
+#else
+    fd = -1;
+    return nullptr;
+#endif
+}
+
+std::shared_ptr<ca::shm_channel> ca::shm_channel::open(int fd) {
+    const auto status = identify(fd);
+    if (!status || !S_ISREG(status->st_mode) || size_t(status->st_size) != mapping_size)
+        return nullptr;
+    const auto address = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
+        return nullptr;
+    return std::shared_ptr<ca::shm_channel>(new shm_channel(std::make_shared<mapping>(address), 1));
+}
+
+std::pair<std::shared_ptr<ca::shm_channel>, std::shared_ptr<ca::shm_channel>> ca::shm_channel::create_pair() {
+    const auto address = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED)
+        return {};
+    const auto shared = std::make_shared<mapping>(address);
+    return {std::shared_ptr<ca::shm_channel>(new shm_channel(shared, 0)),
+            std::shared_ptr<ca::shm_channel>(new shm_channel(shared, 1))};
+}
+
+void ca::shm_channel::attach(int fd, std::shared_ptr<ca::shm_channel> channel) {
+    const auto status = identify(fd);
+    if (!status)
+        return;
+    const auto lock = std::lock_guard(attached_mutex);
+    attached_channels[fd] = {std::move(channel), status->st_dev, status->st_ino};
+}
+
+std::shared_ptr<ca::shm_channel> ca::shm_channel::detach(int fd) {
+    auto entry = attached();
+    {
+        const auto lock = std::lock_guard(attached_mutex);
+        const auto it = attached_channels.find(fd);
+        if (it == attached_channels.end())
+            return nullptr;
+        entry = std::move(it->second);
+        attached_channels.erase(it);
+    }
+    const auto status = identify(fd);
+    if (!status || status->st_dev != entry.device || status->st_ino != entry.inode)
+        return nullptr;
+    return std::move(entry.channel);
+}
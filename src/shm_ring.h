@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+
+namespace ca {
+    /// A single producer single consumer byte ring in memory both sides have mapped, the writer and the reader can
+    /// be in different processes. Neither side makes a syscall to move data, only to wake the other side up: the
+    /// reader says when it's about to block and the writer only rings then, the same handshake a futex based ring
+    /// uses (see ca::ring_backend for what rings)
+    class shm_ring {
+    public:
+        /// Shared between both sides, the indices only ever grow and are wrapped when they're used
+        struct control {
+            alignas(64) std::atomic<std::uint64_t> head;     // Read up to here, only the reader moves it
+            alignas(64) std::atomic<std::uint64_t> tail;     // Written up to here, only the writer moves it
+            alignas(64) std::atomic<std::uint32_t> reader_asleep;  // The writer has to wake the reader up
+            std::atomic<std::uint32_t> writer_waiting;              // The reader has to tell the writer there's room
+        };
+        static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "The indices are shared between processes");
+
+        shm_ring() = default;
+
+        /// \param control Where the indices are
+        /// \param data The ring's buffer
+        /// \param size The buffer's size, a power of two
+        shm_ring(control *control, std::byte *data, size_t size) noexcept : _control(control), _data(data),
+                                                                            _size(size) {}
+
+        /// Writer: the free space up to where the buffer wraps around, the rest of it comes after a #commit
+        [[nodiscard]] std::span<std::byte> writable() const noexcept;
+
+        /// Writer: hands bytes written into #writable to the reader
+        /// \param bytes How many
+        void commit(size_t bytes) noexcept;
+
+        /// Reader: what's been written up to where the buffer wraps around, the rest of it comes after a #consume
+        [[nodiscard]] std::span<const std::byte> readable() const noexcept;
+
+        /// Reader: gives bytes that have been read from #readable back to the writer
+        /// \param bytes How many
+        void consume(size_t bytes) noexcept;
+
+        /// Reader: about to block until it's woken up
+        /// \return false if there's something to read already, it shouldn't block then
+        [[nodiscard]] bool sleep() noexcept;
+
+        /// Reader: done blocking, the writer doesn't have to wake it up anymore
+        void awake() noexcept;
+
+        /// Writer: after a #commit
+        /// \return If the reader is blocked and has to be woken up, only true once per #sleep
+        [[nodiscard]] bool wake_reader() noexcept;
+
+        /// Writer: out of room, the reader should say once it's made some
+        /// \return false if there's room again already
+        [[nodiscard]] bool wait_for_space() noexcept;
+
+        /// Reader: after a #consume
+        /// \return If the writer is waiting for room and has to be told, only true once per #wait_for_space
+        [[nodiscard]] bool wake_writer() noexcept;
+
+    private:
+        control *_control = nullptr;
+        std::byte *_data = nullptr;
+        size_t _size = 0;
+    };
+
+    /// One side of a connection whose data goes through a pair of rings, one for each direction. The rings are in a
+    /// memfd another process maps as well, or in anonymous memory for both sides within the process. A channel is
+    /// set up next to a socket, which is what the io backends watch and what tells the sides apart
+    class shm_channel {
+    public:
+        /// How much each direction holds
+        static constexpr size_t ring_size = size_t(1) << 20;
+
+        /// Maps the rings of a new connection in a memfd, for another process to map with #open
+        /// \param fd Set to the memfd, it's up to the caller to close it once it's been handed over
+        /// \return The connecting side, nullptr if the rings couldn't be mapped
+        [[nodiscard]] static std::shared_ptr<ca::shm_channel> create(int &fd);
+
+        /// Maps the rings another process created
+        /// \param fd The memfd from #create
+        /// \return The accepting side, nullptr if it isn't a channel's memfd
+        [[nodiscard]] static std::shared_ptr<ca::shm_channel> open(int fd);
+
+        /// Maps the rings of a new connection within the process
+        /// \return Both sides, nullptr if the rings couldn't be mapped
+        [[nodiscard]] static std::pair<std::shared_ptr<ca::shm_channel>, std::shared_ptr<ca::shm_channel>>
+        create_pair();
+
+        /// Hands a channel over to the io backend its socket gets added to
+        /// \param fd The socket it was set up next to
+        /// \param channel The channel
+        static void attach(int fd, std::shared_ptr<ca::shm_channel> channel);
+
+        /// \param fd A socket
+        /// \return The channel set up next to the socket, nullptr if there isn't one. It isn't attached anymore after
+        [[nodiscard]] static std::shared_ptr<ca::shm_channel> detach(int fd);
+
+        [[nodiscard]] ca::shm_ring &incoming() noexcept { return _incoming; }
+        [[nodiscard]] ca::shm_ring &outgoing() noexcept { return _outgoing; }
+
+    private:
+        struct mapping;
+
+        /// \param mapping Both rings
+        /// \param side 0 for the side that connected, 1 for the one that accepted
+        shm_channel(std::shared_ptr<mapping> mapping, int side) noexcept;
+
+        std::shared_ptr<mapping> _mapping;
+        ca::shm_ring _incoming;
+        ca::shm_ring _outgoing;
+    };
+}
@@ -0,0 +1,145 @@
+#include "shm_transport.h"
+
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <shm_ring.h>
+
+namespace {
+    /// The paths shared memory listeners are bound to, an accepted socket's own address is its listener's
+    std::mutex listening_mutex;
+    std::set<std::string> listening_paths;
+
+    /// \param fd A connected socket
+    /// \return The path of the listener it was accepted on, empty if it doesn't have one
+    std::string local_path(int fd) {
+        auto address = sockaddr_un();
+        auto size = socklen_t(sizeof(address));
+        if (::getsockname(fd, reinterpret_cast<sockaddr *>(&address), &size) != 0 || address.sun_family != AF_UNIX ||
+            size <= offsetof(sockaddr_un, sun_path) || address.sun_path[0] == '\0')
+            return {};
+        return std::string(address.sun_path, strnlen(address.sun_path, size - offsetof(sockaddr_un, sun_path)));
+    }
+}
+
+int ca::shm_transport::connect(const ca::endpoint &endpoint) {
+    const auto fd = unix_transport::connect(endpoint);
+    if (fd < 0)
+        return -1;
+
+    auto memfd = -1;
+    const auto channel = ca::shm_channel::create(memfd);
+    if (!channel) {
+        close(fd);
+        return -1;
+    }
+
+    // One byte of data to carry the memfd, the other side maps it as well
+    auto byte = std::byte(0);
+    auto vector = iovec{.iov_base = &byte, .iov_len = 1};
+    auto control = std::array<char, CMSG_SPACE(sizeof(int))>();
+    auto message = msghdr();
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+    const auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &memfd, sizeof(int));
+
+    const auto sent = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+    close(memfd);
+    if (sent != 1) {
+        close(fd);
+        return -1;
+    }
+
+    ca::shm_channel::attach(fd, channel);
+    return fd;
+}
+
+int ca::shm_transport::listen(const ca::endpoint &endpoint) {
+    const auto fd = unix_transport::listen(endpoint);
+    if (fd >= 0) {
+        const auto lock = std::lock_guard(listening_mutex);
+        listening_paths.insert(endpoint.address);
+    }
+    return fd;
+}
+
+int ca::shm_transport::accept(int listener) {
+    const auto fd = transport::accept(listener);
+    if (fd >= 0 && !_receive_rings(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void ca::shm_transport::unlisten(const ca::endpoint &endpoint) {
+    {
+        const auto lock = std::lock_guard(listening_mutex);
+        listening_paths.erase(endpoint.address);
+    }
+    unix_transport::unlisten(endpoint);
+}
+
+const char *ca::shm_transport::name() const noexcept {
+    return "shm";
+}
+
+bool ca::shm_transport::accepted(int fd) {
+    {
+        const auto lock = std::lock_guard(listening_mutex);
+        if (listening_paths.empty() || !listening_paths.contains(local_path(fd)))
+            return true;
+    }
+    return _receive_rings(fd);
+}
+
+bool ca::shm_transport::_receive_rings(int fd) {
+    auto ready = pollfd{.fd = fd, .events = POLLIN, .revents = 0};
+    if (::poll(&ready, 1, handshake_timeout_ms) != 1)
+        return false;
+
+    auto byte = std::byte();
+    auto vector = iovec{.iov_base = &byte, .iov_len = 1};
+    auto control = std::array<char, CMSG_SPACE(sizeof(int))>();
+    auto message = msghdr();
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data();
+    message.msg_controllen = control.size();
+
+#ifdef MSG_CMSG_CLOEXEC
+    const auto flags = MSG_DONTWAIT | MSG_CMSG_CLOEXEC;
+#else
+    const auto flags = MSG_DONTWAIT;
+#endif
+    if (::recvmsg(fd, &message, flags) != 1)
+        return false;
+
+    const auto header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int)))
+        return false;
+
+    auto memfd = -1;
+    std::memcpy(&memfd, CMSG_DATA(header), sizeof(int));
+    const auto channel = ca::shm_channel::open(memfd);
+    close(memfd);
+    if (!channel)
+        return false;
+
+    ca::shm_channel::attach(fd, channel);
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <unix_transport.h>
+
+namespace ca {
+    /// A Unix domain socket with a pair of shared memory rings next to it (see ca::shm_channel), for peers on the
+    /// same host that want the data to go without syscalls. The connecting side maps the rings in a memfd and hands
+    /// it over through the socket, from then on the socket only carries wake ups and tells when the other side is
+    /// gone. The io backends move the data through the rings (see ca::ring_backend). Linux only, it needs memfd
+    class shm_transport : public ca::unix_transport {
+    public:
+        [[nodiscard]] int connect(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] int listen(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] int accept(int listener) override;
+
+        void unlisten(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] const char *name() const noexcept override;
+
+        /// Picks up the rings of a connection an io backend accepted, if it came in on a shared memory listener
+        /// \param fd The accepted socket
+        /// \return false if it came in on one but didn't hand over any rings, it should be closed then
+        [[nodiscard]] static bool accepted(int fd);
+
+    private:
+        /// How long the accepting side waits for the rings, the connecting side sends them straight away
+        static constexpr auto handshake_timeout_ms = 100;
+
+        /// Internal function: Receives the memfd from the connecting side, and attaches its rings to the socket
+        /// \param fd The accepted socket
+        /// \return If it got the rings
+        [[nodiscard]] static bool _receive_rings(int fd);
+    };
+}
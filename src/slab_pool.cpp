@@ -0,0 +1,117 @@
+#include "slab_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+
+namespace {
+    /// Slabs are at least this big, and hold at least a few blocks of the biggest sizes
+    constexpr auto slab_size = size_t(16 * 1024);
+    constexpr auto min_blocks_per_slab = size_t(8);
+}
+
+thread_local ca::slab_pool::owner ca::slab_pool::_owner;
+
+void *ca::slab_pool::allocate(size_t size) {
+    const auto total = size + sizeof(block_header);
+    if (total > max_block_size) {
+        const auto block = static_cast<block_header *>(::operator new(total));
+        block->pool = nullptr;
+        return block + 1;
+    }
+
+    const auto size_class = static_cast<std::uint32_t>(
+            std::bit_width(std::max(total, min_block_size) - 1) - std::bit_width(min_block_size - 1));
+    auto &pool = _local();
+    const auto block = pool._take(size_class);
+    pool._references.fetch_add(1, std::memory_order_relaxed);
+    return block + 1;
+}
+
+void ca::slab_pool::release(void *data) noexcept {
+    if (!data)
+        return;
+
+    const auto block = static_cast<block_header *>(data) - 1;
+    const auto pool = block->pool;
+    if (!pool) {
+        ::operator delete(block);
+        return;
+    }
+
+    const auto next = reinterpret_cast<block_header **>(block + 1);
+    if (pool == _owner.pool) {
+        *next = pool->_free[block->size_class];
+        pool->_free[block->size_class] = block;
+    } else {
+        auto head = pool->_remote.load(std::memory_order_relaxed);
+        do {
+            *next = head;
+        } while (!pool->_remote.compare_exchange_weak(head, block, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+    }
+    pool->_unreference();
+}
+
+ca::slab_pool::owner::~owner() {
+    if (pool)
+        std::exchange(pool, nullptr)->_unreference();
+}
+
+ca::slab_pool &ca::slab_pool::_local() {
+    if (!_owner.pool)
+        _owner.pool = new slab_pool();
+    return *_owner.pool;
+}
+
+ca::slab_pool::block_header *ca::slab_pool::_take(std::uint32_t size_class) {
+    const auto next = [](block_header *block) { return reinterpret_cast<block_header **>(block + 1); };
+
+    // What other threads have released is only picked up once it's needed, it can be of any size
+    if (!_free[size_class]) {
+        for (auto block = _remote.exchange(nullptr, std::memory_order_acquire); block;) {
+            const auto following = *next(block);
+            *next(block) = _free[block->size_class];
+            _free[block->size_class] = block;
+            block = following;
+        }
+    }
+
+    if (!_free[size_class]) {
+        const auto block_size = min_block_size << size_class;
+        const auto size = std::max(slab_size, block_size * min_blocks_per_slab);
+        const auto slab = _slabs.emplace_back(std::make_unique_for_overwrite<std::byte[]>(size)).get();
+
+        for (auto offset = size; offset >= block_size; offset -= block_size) {
+            const auto block = reinterpret_cast<block_header *>(slab + offset - block_size);
+            block->pool = this;
+            block->size_class = size_class;
+            *next(block) = _free[size_class];
+            _free[size_class] = block;
+        }
+    }
+
+    const auto block = _free[size_class];
+    _free[size_class] = *next(block);
+    return block;
+}
+
+void ca::slab_pool::_unreference() noexcept {
+    if (_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+ca::pooled_string::pooled_string(std::string_view text) : pooled_string(text.size()) {
+    if (!text.empty())
+        std::memcpy(_data, text.data(), text.size());
+}
+
+ca::pooled_string::pooled_string(size_t size) : _size(size) {
+    if (size == 0)
+        return;
+
+    const auto block = ::new(slab_pool::allocate(sizeof(header) + size + 1)) header{1};
+    _data = reinterpret_cast<char *>(block + 1);
+    _data[size] = '\0';
+}
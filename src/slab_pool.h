@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ca {
+    /// Fixed size blocks carved out of bigger slabs, with a pool per thread so allocating never takes a lock.
+    /// Sizes are rounded up to a power of two from 64 bytes to 64 KiB, anything bigger comes from the heap.
+    /// A block can be released on any thread, one released by another thread goes back to its pool through a
+    /// lock-free stack the owner empties the next time it runs out of blocks. Slabs are kept for reuse until the
+    /// thread has exited and every block of its pool has been released
+    class slab_pool {
+    public:
+        /// The smallest and biggest blocks, including the header in front of every block
+        static constexpr auto min_block_size = size_t(64);
+        static constexpr auto max_block_size = size_t(64 * 1024);
+
+        slab_pool(const slab_pool &) = delete;
+        slab_pool &operator=(const slab_pool &) = delete;
+
+        /// Allocates from the calling thread's pool
+        /// \param size How many bytes are needed
+        /// \return The memory, aligned for anything new would allocate
+        [[nodiscard]] static void *allocate(size_t size);
+
+        /// Gives memory back to the pool it came from, on any thread
+        /// \param data Memory returned by #allocate
+        static void release(void *data) noexcept;
+
+    private:
+        /// In front of every block, a free block keeps the link to the next free one right after it
+        struct alignas(std::max_align_t) block_header {
+            slab_pool *pool; // Null for blocks that came from the heap
+            std::uint32_t size_class;
+        };
+
+        /// Lets go of the thread's pool when the thread exits
+        struct owner {
+            slab_pool *pool = nullptr;
+            ~owner();
+        };
+
+        static constexpr auto class_count = size_t(11); // 64 bytes up to 64 KiB
+
+        slab_pool() = default;
+
+        /// Internal function: The calling thread's pool, created on first use
+        [[nodiscard]] static slab_pool &_local();
+
+        /// Internal function: Takes a free block of a size class, carving a new slab if there is none
+        [[nodiscard]] block_header *_take(std::uint32_t size_class);
+
+        /// Internal function: One block or the owner thread less, the last one deletes the pool
+        void _unreference() noexcept;
+
+        std::array<block_header *, class_count> _free = {}; // Only touched by the owner thread
+        std::atomic<block_header *> _remote = nullptr;      // Released by other threads
+        std::atomic<size_t> _references = 1;                // Every block in use, and the owner thread
+        std::vector<std::unique_ptr<std::byte[]>> _slabs;
+
+        static thread_local owner _owner;
+    };
+
+    /// Text kept in a block of the calling thread's slab_pool, so short lived strings like received messages don't
+    /// go through the heap allocator. Always null terminated. Copies share the same text, the block counts its
+    /// references and goes back to the pool with the last one, so the text can't be changed once it's shared
+    class pooled_string {
+    public:
+        pooled_string() noexcept = default;
+
+        /// \param text Copied into the pool
+        explicit pooled_string(std::string_view text);
+
+        /// Text of a size to be filled in through #data, for writing into directly (like decompressing)
+        /// \param size The number of characters
+        explicit pooled_string(size_t size);
+
+        pooled_string(const pooled_string &other) noexcept : _data(other._data), _size(other._size) { _reference(); }
+
+        pooled_string(pooled_string &&other) noexcept
+                : _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)) {}
+
+        pooled_string &operator=(const pooled_string &other) noexcept {
+            if (this != &other) {
+                other._reference();
+                _unreference();
+                _data = other._data;
+                _size = other._size;
+            }
+            return *this;
+        }
+
+        pooled_string &operator=(pooled_string &&other) noexcept {
+            if (this != &other) {
+                _unreference();
+                _data = std::exchange(other._data, nullptr);
+                _size = std::exchange(other._size, 0);
+            }
+            return *this;
+        }
+
+        ~pooled_string() { _unreference(); }
+
+        /// Only for filling in text created with a size, before it's shared
+        [[nodiscard]] char *data() noexcept { return _data; }
+        [[nodiscard]] const char *data() const noexcept { return _data; }
+        [[nodiscard]] size_t size() const noexcept { return _size; }
+        [[nodiscard]] bool empty() const noexcept { return _size == 0; }
+        [[nodiscard]] const char *c_str() const noexcept { return _data ? _data : ""; }
+        [[nodiscard]] std::string_view view() const noexcept { return {c_str(), _size}; }
+
+        operator std::string_view() const noexcept { return view(); }
+
+        [[nodiscard]] friend bool operator==(const pooled_string &string, std::string_view text) noexcept {
+            return string.view() == text;
+        }
+
+    private:
+        /// In front of the text in its block
+        struct header {
+            std::atomic<size_t> references;
+        };
+
+        [[nodiscard]] header *_header() const noexcept { return reinterpret_cast<header *>(_data) - 1; }
+
+        void _reference() const noexcept {
+            if (_data)
+                _header()->references.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void _unreference() noexcept {
+            if (_data && _header()->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                _header()->~header();
+                slab_pool::release(_header());
+            }
+        }
+
+        char *_data = nullptr;
+        size_t _size = 0;
+    };
+}
@@ -0,0 +1,66 @@
+#include "tcp_transport.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int ca::tcp_transport::connect(const ca::endpoint &endpoint) {
+    // Host names are looked up, IPv4 only like the listener
+    auto hints = addrinfo();
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    auto *addresses = static_cast<addrinfo *>(nullptr);
+    const auto port = std::to_string(endpoint.port);
+    if (getaddrinfo(endpoint.address.c_str(), port.c_str(), &hints, &addresses) != 0)
+        return -1;
+
+    auto fd = -1;
+    for (auto *address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+int ca::tcp_transport::listen(const ca::endpoint &endpoint) {
+    return _listen(endpoint, false);
+}
+
+int ca::tcp_transport::listen_shared(const ca::endpoint &endpoint) {
+    return _listen(endpoint, true);
+}
+
+int ca::tcp_transport::_listen(const ca::endpoint &endpoint, bool shared) {
+    const auto fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    const auto enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (shared)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+
+    auto address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(endpoint.port);
+
+    if (bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void ca::tcp_transport::unlisten(const ca::endpoint &) {}
+
+const char *ca::tcp_transport::name() const noexcept {
+    return "tcp";
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <transport.h>
+
+namespace ca {
+    /// TCP over IPv4, what two hosts use to reach each other
+    class tcp_transport : public ca::transport {
+    public:
+        [[nodiscard]] int connect(const ca::endpoint &endpoint) override;
+        [[nodiscard]] int listen(const ca::endpoint &endpoint) override;
+
+        /// Starts listening on a port other listeners can be bound to as well (SO_REUSEPORT), the kernel then load
+        /// balances incoming connections between them
+        /// \param endpoint Where to listen
+        /// \return The listening socket (blocking), -1 if it's taken by a listener that isn't shared
+        [[nodiscard]] int listen_shared(const ca::endpoint &endpoint);
+
+        void unlisten(const ca::endpoint &endpoint) override;
+        [[nodiscard]] const char *name() const noexcept override;
+
+    private:
+        /// Internal function: Binds a listener to the endpoint's port on every interface
+        [[nodiscard]] static int _listen(const ca::endpoint &endpoint, bool shared);
+    };
+}
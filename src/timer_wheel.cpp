@@ -0,0 +1,202 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <limits>
+
+ca::timer_wheel::timer_wheel(std::chrono::steady_clock::time_point now) : _start(now) {
+    _slots.fill(none);
+}
+
+ca::timer_wheel::timer_id ca::timer_wheel::schedule(std::chrono::milliseconds delay, std::function<void()> callback) {
+    auto index = _free;
+    if (index != none)
+        _free = _timers[index].next;
+    else {
+        index = static_cast<std::uint32_t>(_timers.size());
+        _timers.emplace_back();
+    }
+
+    // A timer is never due on the current tick, that one has already fired
+    auto &timer = _timers[index];
+    timer.callback = std::move(callback);
+    timer.deadline = _current + static_cast<std::uint64_t>(std::max(delay.count(), std::chrono::milliseconds::rep(1)));
+    _link(index);
+    _scheduled++;
+
+    return (timer_id(timer.generation) << 32) | index;
+}
+
+bool ca::timer_wheel::cancel(timer_id id) noexcept {
+    const auto index = static_cast<std::uint32_t>(id);
+    if (id == no_timer || index >= _timers.size())
+        return false;
+
+    auto &timer = _timers[index];
+    if (timer.generation != static_cast<std::uint32_t>(id >> 32) || timer.slot == none)
+        return false;
+
+    _unlink(index);
+    timer.callback = nullptr;
+    timer.generation++;
+    timer.next = _free;
+    _free = index;
+    _scheduled--;
+    return true;
+}
+
+void ca::timer_wheel::advance(std::chrono::steady_clock::time_point now) {
+    const auto target = _tick_of(now);
+
+    // Nothing can fire, so there's no need to go through every tick in between
+    if (_scheduled == 0) {
+        _current = std::max(_current, target);
+        return;
+    }
+
+    while (_current < target) {
+        // Skip the ticks where nothing is due and nothing has to move down a wheel
+        _current = std::min(_next_due() - 1, target);
+        if (_current < target)
+            _step();
+    }
+}
+
+std::optional<std::chrono::milliseconds> ca::timer_wheel::next_timeout(std::chrono::steady_clock::time_point now) const {
+    if (_scheduled == 0)
+        return std::nullopt;
+
+    const auto next = _next_due();
+    const auto elapsed = _tick_of(now);
+    return std::chrono::milliseconds(next > elapsed ? next - elapsed : 0);
+}
+
+size_t ca::timer_wheel::size() const noexcept {
+    return _scheduled;
+}
+
+void ca::timer_wheel::_link(std::uint32_t index) noexcept {
+    auto &timer = _timers[index];
+
+    // The first wheel that can tell the deadline apart from the current tick, the slot of a coarser wheel is only
+    // reached once every finer wheel has gone round
+    const auto delta = timer.deadline > _current ? timer.deadline - _current : 0;
+    auto wheel = size_t(0);
+    while (wheel < wheel_count - 1 && delta >= (std::uint64_t(1) << ((wheel + 1) * slot_bits)))
+        wheel++;
+
+    // Further out than the last wheel covers, it's moved down again once that wheel gets to it
+    const auto slot = wheel * slot_count + _position(std::min(timer.deadline, _current + (std::uint64_t(1) << 32) - 1), wheel);
+
+    timer.slot = static_cast<std::uint32_t>(slot);
+    timer.previous = none;
+    timer.next = _slots[slot];
+    if (timer.next != none)
+        _timers[timer.next].previous = index;
+    _slots[slot] = index;
+
+    const auto position = slot & slot_mask;
+    _occupied[wheel][position / 64] |= std::uint64_t(1) << (position % 64);
+}
+
+void ca::timer_wheel::_unlink(std::uint32_t index) noexcept {
+    auto &timer = _timers[index];
+    const auto slot = timer.slot;
+
+    if (timer.previous != none)
+        _timers[timer.previous].next = timer.next;
+    else
+        _slots[slot] = timer.next;
+
+    if (timer.next != none)
+        _timers[timer.next].previous = timer.previous;
+
+    if (_slots[slot] == none) {
+        const auto position = slot & slot_mask;
+        _occupied[slot / slot_count][position / 64] &= ~(std::uint64_t(1) << (position % 64));
+    }
+
+    timer.slot = none;
+    timer.previous = none;
+    timer.next = none;
+}
+
+void ca::timer_wheel::_cascade(size_t wheel) noexcept {
+    const auto slot = wheel * slot_count + _position(_current, wheel);
+    while (_slots[slot] != none) {
+        const auto index = _slots[slot];
+        _unlink(index);
+        _link(index);
+    }
+}
+
+void ca::timer_wheel::_step() {
+    _current++;
+
+    // Once a wheel goes round, the next slot of the coarser wheel is moved down. Coarser wheels first, so their
+    // timers end up in the finer slots that are moved down right after
+    auto wheels = size_t(1);
+    while (wheels < wheel_count && _position(_current, wheels - 1) == 0)
+        wheels++;
+    for (auto wheel = wheels - 1; wheel >= 1; wheel--)
+        _cascade(wheel);
+
+    const auto slot = _position(_current, 0);
+    while (_slots[slot] != none) {
+        const auto index = _slots[slot];
+        _unlink(index);
+
+        // Freed before it's called, so the callback can schedule a new timer in its place
+        auto &timer = _timers[index];
+        auto callback = std::move(timer.callback);
+        timer.callback = nullptr;
+        timer.generation++;
+        timer.next = _free;
+        _free = index;
+        _scheduled--;
+
+        callback();
+    }
+}
+
+std::uint64_t ca::timer_wheel::_next_due() const noexcept {
+    // The first wheel holds exact deadlines, a slot on a coarser wheel is due once the finer wheels have gone
+    // round far enough to reach it
+    auto next = std::numeric_limits<std::uint64_t>::max();
+    for (auto wheel = size_t(0); wheel < wheel_count; wheel++) {
+        const auto distance = _next_occupied(wheel);
+        if (!distance)
+            continue;
+
+        const auto shift = wheel * slot_bits;
+        next = std::min(next, ((_current >> shift) + *distance) << shift);
+    }
+    return next;
+}
+
+std::optional<size_t> ca::timer_wheel::_next_occupied(size_t wheel) const noexcept {
+    const auto current = _position(_current, wheel);
+    for (auto distance = size_t(1); distance <= slot_count; distance++) {
+        const auto position = (current + distance) & slot_mask;
+        const auto word = _occupied[wheel][position / 64];
+
+        // Skip the rest of an empty word
+        if (word == 0) {
+            distance += 63 - position % 64;
+            continue;
+        }
+
+        if (word & (std::uint64_t(1) << (position % 64)))
+            return distance;
+    }
+    return std::nullopt;
+}
+
+size_t ca::timer_wheel::_position(std::uint64_t tick, size_t wheel) noexcept {
+    return static_cast<size_t>(tick >> (wheel * slot_bits)) & slot_mask;
+}
+
+std::uint64_t ca::timer_wheel::_tick_of(std::chrono::steady_clock::time_point time) const noexcept {
+    if (time <= _start)
+        return 0;
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(time - _start).count());
+}
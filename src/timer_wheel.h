@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace ca {
+    /// Hierarchical timing wheel for the timeouts of a single event loop thread, with millisecond ticks.
+    /// There are 4 wheels of 256 slots, the first covers the next 256 ms one tick per slot, every wheel after that
+    /// covers 256 times more with coarser slots. Timers sit in an intrusive list in the slot of their deadline, and
+    /// are moved down a wheel once the finer wheel reaches them, so scheduling and cancelling are O(1) and advancing
+    /// only touches the slots that are due, no matter how many timers there are
+    class timer_wheel {
+    public:
+        /// Identifies a scheduled timer, ids of timers that have fired or been cancelled are never reused
+        using timer_id = std::uint64_t;
+
+        /// Never refers to a timer, cancelling it does nothing
+        static constexpr auto no_timer = timer_id(0);
+
+        /// \param now The time the wheel starts at
+        explicit timer_wheel(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+        /// Schedules a callback, it's called from #advance once the delay has passed. Delays are rounded up to the next
+        /// millisecond, anything longer than the wheels cover (49 days) fires once they've gone round
+        /// \param delay How long from the last #advance until the timer is due
+        /// \param callback What to do when it's due, it can schedule and cancel timers itself
+        /// \return The id to cancel the timer with
+        timer_id schedule(std::chrono::milliseconds delay, std::function<void()> callback);
+
+        /// Stops a timer from firing
+        /// \param id The timer, it's fine if it has already fired or been cancelled
+        /// \return true if the timer was still scheduled
+        bool cancel(timer_id id) noexcept;
+
+        /// Moves the wheel forward, firing every timer that's due by now (in order of their deadline)
+        /// \param now The current time
+        void advance(std::chrono::steady_clock::time_point now);
+
+        /// How long an event loop can sleep before it has to #advance again. The deeper wheels are only accurate
+        /// to their slot size, so this can be earlier than the next timer but never later
+        /// \param now The current time
+        /// \return The time until the next timer (or the next slot to move down), empty if nothing is scheduled
+        [[nodiscard]] std::optional<std::chrono::milliseconds> next_timeout(std::chrono::steady_clock::time_point now) const;
+
+        /// \return The number of scheduled timers
+        [[nodiscard]] size_t size() const noexcept;
+
+    private:
+        static constexpr auto wheel_count = size_t(4);
+        static constexpr auto slot_bits = size_t(8);
+        static constexpr auto slot_count = size_t(1) << slot_bits;
+        static constexpr auto slot_mask = slot_count - 1;
+        static constexpr auto none = std::uint32_t(-1);
+
+        struct timer {
+            std::function<void()> callback;
+            std::uint64_t deadline = 0;   // In ticks
+            std::uint32_t generation = 1; // Bumped whenever the timer is freed, so stale ids don't match
+            std::uint32_t previous = none;
+            std::uint32_t next = none;    // Also links the free list
+            std::uint32_t slot = none;    // Index into _slots, none when the timer isn't scheduled
+        };
+
+        /// Internal function: Puts a timer in the slot for its deadline
+        void _link(std::uint32_t index) noexcept;
+
+        /// Internal function: Takes a timer out of its slot
+        void _unlink(std::uint32_t index) noexcept;
+
+        /// Internal function: Moves the timers in a slot of a coarser wheel to the finer wheels
+        void _cascade(size_t wheel) noexcept;
+
+        /// Internal function: Moves the wheel forward by a single tick and fires everything that's due
+        void _step();
+
+        /// Internal function: The first tick after the current one where a timer is due, or a slot has to be moved down
+        [[nodiscard]] std::uint64_t _next_due() const noexcept;
+
+        /// Internal function: How many slots from the current one the next occupied slot of a wheel is
+        /// \return The distance (1 to slot_count), empty if the wheel is empty
+        [[nodiscard]] std::optional<size_t> _next_occupied(size_t wheel) const noexcept;
+
+        /// Internal function: The wheel position of a tick
+        [[nodiscard]] static size_t _position(std::uint64_t tick, size_t wheel) noexcept;
+
+        /// Internal function: Converts a time to a tick
+        [[nodiscard]] std::uint64_t _tick_of(std::chrono::steady_clock::time_point time) const noexcept;
+
+        std::chrono::steady_clock::time_point _start;
+        std::uint64_t _current = 0; // Every tick up to and including this one has been fired
+        size_t _scheduled = 0;
+
+        std::vector<timer> _timers;
+        std::uint32_t _free = none; // Head of the list of unused entries in _timers
+
+        std::array<std::uint32_t, wheel_count * slot_count> _slots;
+        std::array<std::array<std::uint64_t, slot_count / 64>, wheel_count> _occupied = {}; // A bit per non-empty slot
+    };
+}
@@ -0,0 +1,164 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    struct event {
+        const char *name;
+        const char *category;  // nullptr for counters
+        std::int64_t start;    // Nanoseconds since tracing was enabled
+        std::int64_t duration; // Nanoseconds, or the value for counters
+    };
+
+    /// Every thread gets its own buffer, only the owning thread ever writes into it so recording needs no locks.
+    /// The buffer is append-only, so a dump can safely read everything below the published count
+    struct thread_buffer {
+        static constexpr size_t capacity = 1 << 18;
+
+        std::uint32_t id = 0;
+        std::atomic<const char *> name = nullptr;
+        std::unique_ptr<event[]> events = std::make_unique<event[]>(capacity);
+        std::atomic<size_t> count = 0;
+        std::atomic<size_t> dropped = 0;
+    };
+
+    std::atomic<bool> trace_enabled = false;
+    std::chrono::steady_clock::time_point epoch;
+    std::string trace_path;
+
+    // Only touched when a thread records its first span, or when dumping
+    std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+    thread_local thread_buffer *local_buffer = nullptr;
+
+    thread_buffer &this_thread_buffer() {
+        if (!local_buffer) {
+            auto guard = std::lock_guard(buffers_mutex);
+            auto &buffer = buffers.emplace_back(std::make_unique<thread_buffer>());
+            buffer->id = static_cast<std::uint32_t>(buffers.size());
+            local_buffer = buffer.get();
+        }
+        return *local_buffer;
+    }
+
+    /// Adds an event to the calling thread's buffer
+    void append(const event &event) noexcept {
+        auto &buffer = this_thread_buffer();
+
+        const auto index = buffer.count.load(std::memory_order_relaxed);
+        if (index >= thread_buffer::capacity) {
+            buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        buffer.events[index] = event;
+
+        // Publish the event, a dump on another thread will only read up to this count
+        buffer.count.store(index + 1, std::memory_order_release);
+    }
+
+    /// Span names are string literals from the codebase, but escape them anyways so the JSON is always valid
+    void write_escaped(std::FILE *file, const char *string) {
+        for (; *string; string++) {
+            if (*string == '"' || *string == '\\')
+                std::fputc('\\', file);
+            std::fputc(*string, file);
+        }
+    }
+}
+
+void ca::trace::enable(std::string output_path) {
+    trace_path = std::move(output_path);
+    epoch = std::chrono::steady_clock::now();
+    trace_enabled = true;
+}
+
+bool ca::trace::enabled() noexcept {
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+void ca::trace::set_thread_name(const char *name) noexcept {
+    if (enabled())
+        this_thread_buffer().name = name;
+}
+
+void ca::trace::record(const char *name, const char *category,
+                       std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end) noexcept {
+    append(event{
+            .name = name,
+            .category = category,
+            .start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count(),
+            .duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()});
+}
+
+void ca::trace::counter(const char *name, std::int64_t value) noexcept {
+    if (!enabled())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    append(event{
+            .name = name,
+            .category = nullptr,
+            .start = std::chrono::duration_cast<std::chrono::nanoseconds>(now - epoch).count(),
+            .duration = value});
+}
+
+bool ca::trace::dump() {
+    if (!enabled())
+        return false;
+
+    auto file = std::fopen(trace_path.c_str(), "w");
+    if (!file)
+        return false;
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    auto first = true;
+    const auto separator = [&]() {
+        if (!first) std::fputs(",\n", file);
+        first = false;
+    };
+
+    auto guard = std::lock_guard(buffers_mutex);
+    for (const auto &buffer : buffers) {
+        if (const auto name = buffer->name.load(); name) {
+            separator();
+            std::fprintf(file, R"({"name":"thread_name","ph":"M","pid":1,"tid":%u,"args":{"name":")", buffer->id);
+            write_escaped(file, name);
+            std::fputs("\"}}", file);
+        }
+
+        const auto count = buffer->count.load(std::memory_order_acquire);
+        for (auto i = size_t(0); i < count; i++) {
+            const auto &event = buffer->events[i];
+            separator();
+            if (!event.category) {
+                std::fputs("{\"name\":\"", file);
+                write_escaped(file, event.name);
+                std::fprintf(file, R"(","ph":"C","pid":1,"tid":%u,"ts":%.3f,"args":{"value":%lld}})", buffer->id,
+                             static_cast<double>(event.start) / 1000.0, static_cast<long long>(event.duration));
+                continue;
+            }
+
+            std::fputs("{\"name\":\"", file);
+            write_escaped(file, event.name);
+            std::fputs("\",\"cat\":\"", file);
+            write_escaped(file, event.category);
+            std::fprintf(file, R"(","ph":"X","pid":1,"tid":%u,"ts":%.3f,"dur":%.3f})", buffer->id,
+                         static_cast<double>(event.start) / 1000.0, static_cast<double>(event.duration) / 1000.0);
+        }
+
+        if (const auto dropped = buffer->dropped.load(); dropped > 0) {
+            separator();
+            std::fprintf(file, R"({"name":"dropped_spans","ph":"C","pid":1,"tid":%u,"ts":0,"args":{"count":%zu}})",
+                         buffer->id, dropped);
+        }
+    }
+
+    std::fputs("\n]}\n", file);
+    return std::fclose(file) == 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ca::trace {
+    /// Turns on span recording, nothing is recorded until this is called. Call once at startup before other threads run
+    /// \param output_path Where the Chrome trace_event JSON is written to when dumped
+    void enable(std::string output_path);
+
+    /// Is span recording currently turned on
+    /// \return true if spans are being recorded
+    [[nodiscard]] bool enabled() noexcept;
+
+    /// Names the calling thread, this is what the thread shows up as in Perfetto / chrome://tracing
+    /// \param name The thread name, must outlive the program (string literal)
+    void set_thread_name(const char *name) noexcept;
+
+    /// Records a completed span into the calling thread's buffer
+    /// \param name The span name, must outlive the program (string literal)
+    /// \param category The span category, must outlive the program (string literal)
+    /// \param start The time the span started
+    /// \param end The time the span finished
+    void record(const char *name, const char *category,
+                std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end) noexcept;
+
+    /// Records the current value of a counter (round trip time, queue sizes), it shows up as a graph next to the
+    /// spans. Does nothing if tracing isn't enabled
+    /// \param name The counter name, must outlive the program (string literal)
+    /// \param value The current value
+    void counter(const char *name, std::int64_t value) noexcept;
+
+    /// Writes every span recorded so far (from all threads) as Chrome trace_event JSON
+    /// \return true if the file was written
+    bool dump();
+
+    /// Records a span covering its own lifetime, does nothing if tracing isn't enabled
+    class scope {
+    public:
+        scope(const char *name, const char *category) noexcept: _name(name), _category(category),
+                                                                _active(enabled()) {
+            if (_active)
+                _start = std::chrono::steady_clock::now();
+        }
+
+        ~scope() {
+            if (_active)
+                record(_name, _category, _start, std::chrono::steady_clock::now());
+        }
+
+        scope(const scope &) = delete;
+
+        scope &operator=(const scope &) = delete;
+
+    private:
+        const char *_name;
+        const char *_category;
+        bool _active;
+        std::chrono::steady_clock::time_point _start;
+    };
+}
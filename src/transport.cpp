@@ -0,0 +1,58 @@
+#include "transport.h"
+
+#include <string_view>
+
+#include <sys/socket.h>
+
+#include <memory_transport.h>
+#include <shm_transport.h>
+#include <tcp_transport.h>
+#include <unix_transport.h>
+
+namespace {
+    constexpr auto unix_prefix = std::string_view("unix:");
+    constexpr auto memory_prefix = std::string_view("memory:");
+    constexpr auto shm_prefix = std::string_view("shm:");
+}
+
+int ca::transport::accept(int listener) {
+    return ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+}
+
+ca::endpoint ca::parse_endpoint(const std::string &address, std::uint16_t port) {
+    if (address.starts_with(unix_prefix))
+        return {.type = ca::transport_type::unix_socket, .address = address.substr(unix_prefix.size()), .port = 0};
+    if (address.starts_with(memory_prefix))
+        return {.type = ca::transport_type::memory, .address = address.substr(memory_prefix.size()), .port = 0};
+    if (address.starts_with(shm_prefix))
+        return {.type = ca::transport_type::shared_memory, .address = address.substr(shm_prefix.size()), .port = 0};
+    return {.type = ca::transport_type::tcp, .address = address, .port = port};
+}
+
+std::string ca::to_string(const ca::endpoint &endpoint) {
+    switch (endpoint.type) {
+        case transport_type::unix_socket:
+            return std::string(unix_prefix) + endpoint.address;
+        case transport_type::memory:
+            return std::string(memory_prefix) + endpoint.address;
+        case transport_type::shared_memory:
+            return std::string(shm_prefix) + endpoint.address;
+        case transport_type::tcp:
+            break;
+    }
+    return endpoint.address + ":" + std::to_string(endpoint.port);
+}
+
+std::unique_ptr<ca::transport> ca::make_transport(ca::transport_type type) {
+    switch (type) {
+        case transport_type::unix_socket:
+            return std::make_unique<ca::unix_transport>();
+        case transport_type::memory:
+            return std::make_unique<ca::memory_transport>();
+        case transport_type::shared_memory:
+            return std::make_unique<ca::shm_transport>();
+        case transport_type::tcp:
+            break;
+    }
+    return std::make_unique<ca::tcp_transport>();
+}
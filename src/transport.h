@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace ca {
+    enum class transport_type {
+        tcp,          // Over the network (or the loopback interface)
+        unix_socket,  // Peers on the same host only, skips the TCP/IP stack altogether
+        memory,       // A name the process listens on, for benchmarks. Rings in memory, only within the process
+        shared_memory // Peers on the same host, the data goes through rings in shared memory next to a Unix socket
+    };
+
+    /// Where a transport listens, or connects to
+    struct endpoint {
+        ca::transport_type type = ca::transport_type::tcp;
+        std::string address;    // The host for TCP, the socket's path for a Unix domain socket (or shared memory),
+                                // a name in memory
+        std::uint16_t port = 0; // TCP only
+    };
+
+    /// Opens the sockets of one kind of endpoint. Every transport ends up with stream sockets, the io backends
+    /// service them all the same way from there (a shared memory one's data goes around the socket, see
+    /// ca::ring_backend), and above them the protocol doesn't know which transport it runs over. A new kind of
+    /// endpoint only needs a transport (and a prefix in #parse_endpoint)
+    class transport {
+    public:
+        virtual ~transport() = default;
+
+        /// Connects to an endpoint something is listening on, blocking until it's connected
+        /// \param endpoint Where to connect to
+        /// \return The connected socket (blocking), -1 if it couldn't connect
+        [[nodiscard]] virtual int connect(const ca::endpoint &endpoint) = 0;
+
+        /// Starts listening on an endpoint
+        /// \param endpoint Where to listen
+        /// \return The listening socket (blocking), -1 if it's taken or can't be listened on
+        [[nodiscard]] virtual int listen(const ca::endpoint &endpoint) = 0;
+
+        /// Accepts a connection on a listener from #listen, blocking until there is one
+        /// \param listener The listening socket
+        /// \return The connected socket (blocking), -1 if it couldn't accept one
+        [[nodiscard]] virtual int accept(int listener);
+
+        /// Cleans up after #listen once the listener has been closed
+        /// \param endpoint Where it was listening
+        virtual void unlisten(const ca::endpoint &endpoint) = 0;
+
+        /// \return The transport's name, for showing to the user
+        [[nodiscard]] virtual const char *name() const noexcept = 0;
+    };
+
+    /// Parses a server address as the user types it, "unix:<path>" is a Unix domain socket, "shm:<path>" one with
+    /// shared memory rings next to it, "memory:<name>" a name the process listens on and anything else a host
+    /// \param address The address
+    /// \param port The port, only used for TCP
+    /// \return The endpoint
+    [[nodiscard]] ca::endpoint parse_endpoint(const std::string &address, std::uint16_t port);
+
+    /// \param endpoint The endpoint
+    /// \return The endpoint the way #parse_endpoint reads it, with the port appended for TCP
+    [[nodiscard]] std::string to_string(const ca::endpoint &endpoint);
+
+    /// Creates the transport for a type of endpoint
+    /// \param type The endpoint type
+    /// \return The created transport
+    [[nodiscard]] std::unique_ptr<ca::transport> make_transport(ca::transport_type type);
+}
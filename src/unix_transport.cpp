@@ -0,0 +1,68 @@
+#include "unix_transport.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+int ca::unix_transport::connect(const ca::endpoint &endpoint) {
+    const auto address = _address(endpoint);
+    if (!address)
+        return -1;
+
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr *>(&address->address), address->size) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ca::unix_transport::listen(const ca::endpoint &endpoint) {
+    const auto address = _address(endpoint);
+    if (!address)
+        return -1;
+
+    const auto fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    auto bound = bind(fd, reinterpret_cast<const sockaddr *>(&address->address), address->size) == 0;
+
+    // Nobody answers on a socket file that's in the way, it's stale. Anything that isn't a socket is left alone
+    struct stat status = {};
+    if (!bound && errno == EADDRINUSE && lstat(endpoint.address.c_str(), &status) == 0 &&
+        S_ISSOCK(status.st_mode)) {
+        const auto probe = connect(endpoint);
+        if (probe >= 0)
+            close(probe);
+        else if (errno == ECONNREFUSED && unlink(endpoint.address.c_str()) == 0)
+            bound = bind(fd, reinterpret_cast<const sockaddr *>(&address->address), address->size) == 0;
+    }
+
+    if (!bound || ::listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void ca::unix_transport::unlisten(const ca::endpoint &endpoint) {
+    unlink(endpoint.address.c_str());
+}
+
+const char *ca::unix_transport::name() const noexcept {
+    return "unix";
+}
+
+std::optional<ca::unix_transport::socket_address> ca::unix_transport::_address(const ca::endpoint &endpoint) const {
+    const auto &path = endpoint.address;
+    auto address = socket_address{.address = sockaddr_un(), .size = sizeof(sockaddr_un)};
+    if (path.empty() || path.size() >= sizeof(address.address.sun_path))
+        return std::nullopt;
+
+    address.address.sun_family = AF_UNIX;
+    std::memcpy(address.address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
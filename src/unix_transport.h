@@ -0,0 +1,38 @@
+#pragma once
+
+#include <optional>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <transport.h>
+
+namespace ca {
+    /// Unix domain sockets, for peers on the same host (a bot or a bridge running next to the chat). The data is
+    /// copied straight from one socket's buffer to the other's, there are no checksums, acknowledgements or
+    /// congestion control in between like there are over loopback TCP
+    class unix_transport : public ca::transport {
+    public:
+        [[nodiscard]] int connect(const ca::endpoint &endpoint) override;
+
+        /// A socket file left behind by a listener that's gone (one that crashed) is replaced, one that's still
+        /// being listened on isn't
+        [[nodiscard]] int listen(const ca::endpoint &endpoint) override;
+
+        /// Removes the socket file
+        void unlisten(const ca::endpoint &endpoint) override;
+
+        [[nodiscard]] const char *name() const noexcept override;
+
+    protected:
+        struct socket_address {
+            sockaddr_un address;
+            socklen_t size;
+        };
+
+        /// Internal function: The socket address of an endpoint
+        /// \param endpoint The endpoint
+        /// \return The address, nullopt if the endpoint can't have one (the path is too long)
+        [[nodiscard]] std::optional<socket_address> _address(const ca::endpoint &endpoint) const;
+    };
+}
@@ -0,0 +1,655 @@
+#include "uring_backend.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include <linux/time_types.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+
+namespace {
+    int io_uring_setup(unsigned entries, io_uring_params *params) {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t arg_size) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size));
+    }
+
+    int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned arg_count) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, arg_count));
+    }
+
+    // The rings are shared with the kernel, so the head / tail indices need acquire / release ordering
+    unsigned load_acquire(unsigned *value) {
+        return std::atomic_ref(*value).load(std::memory_order_acquire);
+    }
+
+    void store_release(unsigned *value, unsigned new_value) {
+        std::atomic_ref(*value).store(new_value, std::memory_order_release);
+    }
+
+    /// Multishot receive and buffer rings both need at least Linux 6.0
+    bool kernel_supported() {
+        auto name = utsname();
+        if (uname(&name) != 0)
+            return false;
+
+        auto major = 0;
+        if (std::sscanf(name.release, "%d", &major) != 1)
+            return false;
+        return major >= 6;
+    }
+}
+
+std::unique_ptr<ca::uring_backend> ca::uring_backend::create() {
+    if (!kernel_supported())
+        return nullptr;
+
+    // Sandboxes can allow io_uring_setup but filter what the ring is allowed to do, so make sure receiving
+    // actually works before trusting it
+    auto backend = std::unique_ptr<ca::uring_backend>(new ca::uring_backend());
+    if (!backend->_setup() || !backend->_probe())
+        return nullptr;
+    return backend;
+}
+
+bool ca::uring_backend::_setup() {
+
+    auto params = io_uring_params();
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = completion_entries;
+
+    _ring_fd = io_uring_setup(ring_entries, &params);
+    if (_ring_fd < 0)
+        return false;
+
+    constexpr auto required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required_features) != required_features)
+        return false;
+
+    // With IORING_FEAT_SINGLE_MMAP both rings live in the same mapping
+    _sq_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                             params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd,
+                    IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        _sq_ring = nullptr;
+        return false;
+    }
+
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd,
+                     IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    _sqes = static_cast<io_uring_sqe *>(sqes);
+
+    const auto sq = static_cast<std::byte *>(_sq_ring);
+    _sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    _sq_entries = params.sq_entries;
+    _sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    _cq_head = reinterpret_cast<unsigned *>(sq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned *>(sq + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned *>(sq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe *>(sq + params.cq_off.cqes);
+
+    // The buffer ring has to be page aligned, so it gets its own mapping
+    _buffer_ring_size = buffer_count * sizeof(io_uring_buf);
+    auto ring = mmap(nullptr, _buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    _buffer_ring = static_cast<io_uring_buf_ring *>(ring);
+
+    auto registration = io_uring_buf_reg();
+    registration.ring_addr = reinterpret_cast<std::uint64_t>(_buffer_ring);
+    registration.ring_entries = buffer_count;
+    registration.bgid = buffer_group;
+    if (io_uring_register(_ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0)
+        return false;
+
+    _buffers = std::make_unique<std::byte[]>(buffer_count * buffer_size);
+    for (auto i = std::uint16_t(0); i < buffer_count; i++)
+        _recycle(i);
+
+    _wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (_wake_fd < 0)
+        return false;
+    _arm_wake();
+
+    return true;
+}
+
+bool ca::uring_backend::_probe() {
+    auto pair = std::array<int, 2>();
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair.data()) != 0)
+        return false;
+
+    add(pair[0]);
+    [[maybe_unused]] const auto written = ::write(pair[1], "", 1);
+
+    auto received = false;
+    for (auto attempt = 0; attempt < 10 && !received && _connections.contains(pair[0]); attempt++)
+        wait(std::chrono::milliseconds(10), [&](const ca::io_event &event) {
+            received |= event.kind == io_event::type::received;
+        });
+
+    remove(pair[0]);
+    close(pair[0]);
+    close(pair[1]);
+    return received;
+}
+
+ca::uring_backend::~uring_backend() {
+    // Removing waits until the kernel is done with each connection's buffers
+    auto fds = std::vector<int>();
+    for (const auto &[fd, connection] : _connections)
+        fds.push_back(fd);
+    for (const auto fd : fds)
+        remove(fd);
+
+    if (_ring_fd >= 0) close(_ring_fd);
+    if (_wake_fd >= 0) close(_wake_fd);
+    if (_buffer_ring) munmap(_buffer_ring, _buffer_ring_size);
+    if (_sqes) munmap(_sqes, _sqes_size);
+    if (_sq_ring) munmap(_sq_ring, _sq_ring_size);
+}
+
+bool ca::uring_backend::add(int fd) {
+    if (_broken)
+        return false;
+
+    _limit_unsent(fd);
+    _connections[fd] = connection();
+    _arm_receive(fd);
+    return true;
+}
+
+bool ca::uring_backend::add_listener(int fd) {
+    if (_broken)
+        return false;
+
+    _connections[fd] = connection();
+    _arm_accept(fd);
+    return true;
+}
+
+void ca::uring_backend::remove(int fd) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+
+    auto &connection = it->second;
+    connection.removed = true;
+    connection.queued.clear();
+    connection.retry.clear();
+    connection.held.reset();
+
+    // Some of its completions could have been put aside already
+    std::erase_if(_deferred, [&](const completion &cqe) { return _settle(fd, connection, cqe); });
+
+    const auto pending = [&connection]() {
+        return connection.receiving || !connection.in_flight.empty() || connection.polling;
+    };
+    if (pending() && !_broken) {
+        auto sqe = _next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = _user_data(operation::cancel, fd);
+    }
+
+    // The kernel can still be reading from the send buffers or writing into receive buffers, wait for it to let
+    // go of them. Completions for other sockets are kept for the next #wait. A broken ring doesn't complete
+    // anything anymore, there's nothing to wait for then
+    while (pending() && _enter(1, std::chrono::milliseconds(100)))
+        while (const auto cqe = _pop_completion())
+            if (!_settle(fd, connection, *cqe))
+                _deferred.push_back(*cqe);
+
+    _connections.erase(it);
+}
+
+bool ca::uring_backend::_settle(int fd, connection &connection, const completion &cqe) {
+    const auto op = static_cast<operation>(cqe.user_data >> 32);
+    const auto cqe_fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+    if (cqe_fd != fd || op == operation::cancel || op == operation::wake)
+        return false;
+
+    if (op == operation::receive || op == operation::accept) {
+        if (op == operation::receive && cqe.flags & IORING_CQE_F_BUFFER)
+            _recycle(static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        if (op == operation::accept && cqe.res >= 0)
+            close(cqe.res); // Accepted while the listener was being removed, nobody is going to use it
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            connection.receiving = false;
+    } else if (op == operation::send && !connection.in_flight.empty())
+        connection.in_flight.pop_front();
+    else if (op == operation::writable)
+        connection.polling = false;
+    return true;
+}
+
+void ca::uring_backend::send(int fd, ca::shared_bytes bytes, ca::send_priority priority) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end() || it->second.removed || it->second.failed || bytes->empty())
+        return;
+
+    auto &connection = it->second;
+    connection.queued_bytes += bytes->size();
+    connection.queued.push(std::move(bytes), priority);
+    _submit_sends(fd, connection);
+    _enforce_send_limit(connection);
+}
+
+void ca::uring_backend::send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                                  size_t offset) {
+    const auto it = _connections.find(fd);
+    if (it == _connections.end() || it->second.removed || it->second.failed)
+        return;
+
+    it->second.queued.push_file(transfer, std::move(file), offset);
+    _submit_sends(fd, it->second);
+}
+
+size_t ca::uring_backend::queued_bytes(int fd) const {
+    const auto it = _connections.find(fd);
+    return it == _connections.end() ? 0 : it->second.queued_bytes;
+}
+
+void ca::uring_backend::wait(std::chrono::milliseconds timeout, const event_handler &handler) {
+    auto failed = std::vector<int>();
+    for (const auto &[fd, connection] : _connections)
+        if (connection.failed)
+            failed.push_back(fd);
+
+    for (const auto fd : failed) {
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+    }
+
+    // Nothing completes on a broken ring, only the timeout is left to wait for
+    if (_broken) {
+        std::this_thread::sleep_for(timeout);
+        return;
+    }
+
+    // Completions put aside earlier are already here, so don't block if there are any
+    if (!_enter(_deferred.empty() ? 1 : 0, timeout))
+        return;
+
+    // Taken off one at a time, a handler removing a socket looks through the rest for that socket's completions
+    while (!_deferred.empty()) {
+        const auto cqe = _deferred.front();
+        _deferred.pop_front();
+        _dispatch(cqe, handler);
+    }
+
+    while (const auto cqe = _pop_completion())
+        _dispatch(*cqe, handler);
+}
+
+void ca::uring_backend::wake() {
+    const auto value = std::uint64_t(1);
+    [[maybe_unused]] const auto written = ::write(_wake_fd, &value, sizeof(value));
+}
+
+io_uring_sqe *ca::uring_backend::_next_sqe() {
+    // The kernel might not take anything until a completion frees up room, so after the first try wait for one
+    for (auto wait_for = 0u; _free_sqes() == 0; wait_for = 1)
+        if (!_enter(wait_for, std::chrono::milliseconds(1)))
+            break;
+
+    // Whatever was never submitted is thrown away, its connections have been failed
+    if (_broken)
+        store_release(_sq_tail, load_acquire(_sq_head));
+
+    const auto tail = *_sq_tail;
+    const auto index = tail & _sq_mask;
+    _sq_array[index] = index;
+
+    auto sqe = &_sqes[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+
+    // The kernel only looks at the queue during io_uring_enter, so the entry can be filled in after publishing it
+    store_release(_sq_tail, tail + 1);
+    return sqe;
+}
+
+size_t ca::uring_backend::_free_sqes() const noexcept {
+    return _sq_entries - (*_sq_tail - load_acquire(_sq_head));
+}
+
+bool ca::uring_backend::_enter(unsigned wait_for, std::chrono::milliseconds timeout) {
+    if (_broken)
+        return false;
+
+    const auto to_submit = *_sq_tail - load_acquire(_sq_head);
+    if (to_submit == 0 && wait_for == 0)
+        return true;
+
+    auto ts = __kernel_timespec();
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+
+    auto arg = io_uring_getevents_arg();
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+
+    while (true) {
+        const auto flags = IORING_ENTER_EXT_ARG | (wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (io_uring_enter(_ring_fd, *_sq_tail - load_acquire(_sq_head), wait_for, flags, &arg, sizeof(arg)) >= 0 ||
+            errno == ETIME || errno == EINTR)
+            return true;
+        if (errno != EAGAIN && errno != EBUSY) {
+            _break();
+            return false;
+        }
+
+        // The completion queue is full (or the kernel is short on memory), reaping it makes room. The reaped
+        // completions are what was waited for, so the next try doesn't wait
+        auto reaped = false;
+        while (const auto cqe = _pop_completion()) {
+            _deferred.push_back(*cqe);
+            reaped = true;
+        }
+        if (!reaped)
+            return true;
+        wait_for = 0;
+    }
+}
+
+void ca::uring_backend::_break() {
+    if (_broken)
+        return;
+
+    _broken = true;
+    for (auto &[fd, connection] : _connections)
+        connection.failed = true;
+}
+
+std::optional<ca::uring_backend::completion> ca::uring_backend::_pop_completion() {
+    const auto head = *_cq_head;
+    if (head == load_acquire(_cq_tail))
+        return std::nullopt;
+
+    // Copy the entry out and hand the slot back straight away, handlers are allowed to reap completions too
+    const auto &cqe = _cqes[head & _cq_mask];
+    const auto entry = completion{.user_data = cqe.user_data, .res = cqe.res, .flags = cqe.flags};
+    store_release(_cq_head, head + 1);
+    return entry;
+}
+
+void ca::uring_backend::_dispatch(const completion &cqe, const event_handler &handler) {
+    switch (static_cast<operation>(cqe.user_data >> 32)) {
+        case operation::receive:
+            _handle_receive(cqe, handler);
+            break;
+        case operation::send:
+            _handle_send(cqe, handler);
+            break;
+        case operation::accept:
+            _handle_accept(cqe, handler);
+            break;
+        case operation::writable:
+            _handle_writable(cqe);
+            break;
+        case operation::wake:
+            _arm_wake();
+            break;
+        case operation::cancel:
+            break;
+    }
+}
+
+void ca::uring_backend::_arm_receive(int fd) {
+    auto sqe = _next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffer_group;
+    sqe->user_data = _user_data(operation::receive, fd);
+
+    _connections[fd].receiving = true;
+}
+
+void ca::uring_backend::_arm_accept(int fd) {
+    auto sqe = _next_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = _user_data(operation::accept, fd);
+
+    _connections[fd].receiving = true;
+}
+
+void ca::uring_backend::_submit_sends(int fd, connection &connection) {
+    // Only one chain per socket at a time, otherwise two chains could be sent out interleaved
+    if (!connection.in_flight.empty() || connection.polling ||
+        (connection.retry.empty() && !connection.held && connection.queued.empty()))
+        return;
+
+    // A chain has to be handed to the kernel in a single submission, or it gets split into independent chains.
+    // It's kept short in bytes as well, a control packet queued while it's in flight has to wait for all of it
+    constexpr auto max_chain = size_t(32);
+    constexpr auto max_chain_bytes = size_t(64 * 1024);
+    if (_free_sqes() < max_chain && !_enter(0, {}))
+        return;
+
+    auto previous = static_cast<io_uring_sqe *>(nullptr);
+    auto chain_bytes = size_t(0);
+    for (auto i = size_t(0); i < max_chain && chain_bytes < max_chain_bytes;) {
+        auto piece = std::optional<ca::write_queue::piece>();
+        if (!connection.retry.empty()) {
+            piece = std::move(connection.retry.front());
+            connection.retry.pop_front();
+        } else if (connection.held)
+            piece = std::exchange(connection.held, std::nullopt);
+        else if (!(piece = connection.queued.take()))
+            break;
+
+        // A file piece goes out once the chain before it has completed
+        if (piece->file) {
+            if (previous) {
+                connection.held = std::move(piece);
+                break;
+            }
+            if (!_write_file(fd, connection, *piece))
+                return;
+            continue;
+        }
+
+        // Deque elements don't move, so the kernel can read the message header from where it is
+        auto &send = connection.in_flight.emplace_back(pending_send{.piece = std::move(*piece)});
+        send.message.msg_iov = send.vectors.data();
+        send.message.msg_iovlen = send.piece.remaining(send.vectors);
+        chain_bytes += send.piece.size() - send.piece.written;
+
+        if (previous)
+            previous->flags |= IOSQE_IO_LINK;
+
+        auto sqe = _next_sqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<std::uint64_t>(&send.message);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = _user_data(operation::send, fd);
+        previous = sqe;
+        i++;
+    }
+}
+
+bool ca::uring_backend::_write_file(int fd, connection &connection, ca::write_queue::piece &piece) {
+    while (piece.written < piece.size()) {
+        auto written = ssize_t();
+        {
+            const auto span = ca::trace::scope("socket_write", "net");
+            written = piece.write(fd);
+        }
+
+        if (written >= 0 || errno == EINTR)
+            continue;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            connection.failed = true;
+            return false;
+        }
+
+        connection.held = std::move(piece);
+        connection.polling = true;
+
+        auto sqe = _next_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLOUT;
+        sqe->user_data = _user_data(operation::writable, fd);
+        return false;
+    }
+    return true;
+}
+
+void ca::uring_backend::_enforce_send_limit(connection &connection) {
+    if (connection.queued_bytes <= _send_limit.max_bytes)
+        return;
+
+    switch (_send_limit.policy) {
+        case backpressure_policy::block:
+            return;
+        case backpressure_policy::drop_oldest: {
+            // Only what the kernel hasn't seen yet can go, what's in flight or waiting to be retried has to be finished
+            const auto before = connection.queued.queued_bytes();
+            const auto taken = connection.queued_bytes - before;
+            connection.queued.drop_oldest(_send_limit.max_bytes > taken ? _send_limit.max_bytes - taken : 0);
+            connection.queued_bytes -= before - connection.queued.queued_bytes();
+            return;
+        }
+        case backpressure_policy::disconnect:
+            connection.failed = true;
+            return;
+    }
+}
+
+void ca::uring_backend::_arm_wake() {
+    auto sqe = _next_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = _wake_fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&_wake_value);
+    sqe->len = sizeof(_wake_value);
+    sqe->user_data = _user_data(operation::wake, 0);
+}
+
+void ca::uring_backend::_recycle(std::uint16_t buffer_id) {
+    // Not using _buffer_ring->bufs, in C++ the kernel's flexible array macro puts it 8 bytes past the ring start
+    auto &entry = reinterpret_cast<io_uring_buf *>(_buffer_ring)[_buffer_ring_tail & (buffer_count - 1)];
+    entry.addr = reinterpret_cast<std::uint64_t>(_buffers.get() + size_t(buffer_id) * buffer_size);
+    entry.len = buffer_size;
+    entry.bid = buffer_id;
+
+    _buffer_ring_tail++;
+    std::atomic_ref(_buffer_ring->tail).store(_buffer_ring_tail, std::memory_order_release);
+}
+
+void ca::uring_backend::_handle_receive(const completion &cqe, const event_handler &handler) {
+    const auto fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+
+    if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        const auto buffer_id = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        handler({.kind = io_event::type::received, .fd = fd,
+                 .data = std::span(_buffers.get() + size_t(buffer_id) * buffer_size, static_cast<size_t>(cqe.res))});
+        _recycle(buffer_id);
+    }
+
+    // The multishot receive is still armed, nothing else to do
+    if (cqe.flags & IORING_CQE_F_MORE)
+        return;
+
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+    it->second.receiving = false;
+
+    // Running out of buffers stops the multishot receive, but they've been recycled now so it can be re-armed
+    if (cqe.res == -ENOBUFS || cqe.res > 0)
+        _arm_receive(fd);
+    else {
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+    }
+}
+
+void ca::uring_backend::_handle_send(const completion &cqe, const event_handler &handler) {
+    const auto fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+
+    auto &connection = it->second;
+    auto sent = std::move(connection.in_flight.front());
+    connection.in_flight.pop_front();
+
+    if (cqe.res > 0)
+        connection.queued_bytes -= sent.piece.advance(static_cast<size_t>(cqe.res));
+
+    // A short send breaks the chain and the rest of it gets cancelled, keep what wasn't sent to go out again in order.
+    // Any other error is the connection failing, and so is sending nothing at all, which would only repeat forever
+    const auto unsent = sent.piece.written < sent.piece.size();
+    if ((cqe.res < 0 && cqe.res != -ECANCELED) || (cqe.res == 0 && unsent)) {
+        remove(fd);
+        handler({.kind = io_event::type::closed, .fd = fd, .data = {}});
+        return;
+    }
+
+    if (unsent)
+        connection.retry.push_back(std::move(sent.piece));
+
+    if (!connection.in_flight.empty())
+        return;
+    _submit_sends(fd, connection);
+}
+
+void ca::uring_backend::_handle_writable(const completion &cqe) {
+    const auto fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+    const auto it = _connections.find(fd);
+    if (it == _connections.end())
+        return;
+
+    // An error shows up when writing again
+    it->second.polling = false;
+    _submit_sends(fd, it->second);
+}
+
+void ca::uring_backend::_handle_accept(const completion &cqe, const event_handler &handler) {
+    const auto fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+
+    if (cqe.res >= 0)
+        handler({.kind = io_event::type::accepted, .fd = cqe.res, .data = {}});
+
+    if (cqe.flags & IORING_CQE_F_MORE)
+        return;
+
+    // Errors like running out of file descriptors end the multishot accept, keep accepting regardless (the same
+    // as a level triggered epoll listener would)
+    if (const auto it = _connections.find(fd); it != _connections.end() && !it->second.removed) {
+        it->second.receiving = false;
+        _arm_accept(fd);
+    }
+}
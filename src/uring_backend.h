@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <io_backend.h>
+#include <write_queue.h>
+
+namespace ca {
+    /// Completion based backend on top of io_uring (talking to the kernel directly, no liburing).
+    /// Every socket has a multishot receive armed that picks buffers out of a registered buffer ring,
+    /// and queued sends are taken off a ca::write_queue a piece at a time and submitted as a linked chain so they
+    /// can't be reordered. io_uring has no sendfile (splicing would need a pipe per socket), so the pieces of a file are
+    /// written straight away once nothing is in flight, with a poll armed for when the socket is full
+    class uring_backend : public io_backend {
+    public:
+        /// Sets up the ring, this requires Linux 6.0 or newer (multishot receive, buffer rings)
+        /// \return The backend, or nullptr if the kernel doesn't support everything that's needed
+        [[nodiscard]] static std::unique_ptr<ca::uring_backend> create();
+
+        ~uring_backend() override;
+
+        bool add(int fd) override;
+
+        bool add_listener(int fd) override;
+
+        void remove(int fd) override;
+
+        using io_backend::send;
+
+        void send(int fd, ca::shared_bytes bytes, ca::send_priority priority = ca::send_priority::normal) override;
+
+        void send_file(int fd, std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file,
+                       size_t offset) override;
+
+        void wait(std::chrono::milliseconds timeout, const event_handler &handler) override;
+
+        void wake() override;
+
+        [[nodiscard]] size_t queued_bytes(int fd) const override;
+
+        [[nodiscard]] const char *name() const noexcept override { return "io_uring"; }
+
+    private:
+        uring_backend() = default;
+
+        enum class operation : std::uint32_t {
+            receive = 1,
+            send = 2,
+            wake = 3,
+            cancel = 4,
+            accept = 5,
+            writable = 6
+        };
+
+        /// A copy of a completion queue entry, io_uring_cqe can't be stored directly (flexible array member)
+        struct completion {
+            std::uint64_t user_data;
+            std::int32_t res;
+            std::uint32_t flags;
+        };
+
+        /// A piece handed to the kernel, with the message header it reads the piece through
+        struct pending_send {
+            ca::write_queue::piece piece;
+            msghdr message = {};
+            std::array<iovec, 2> vectors = {};
+        };
+
+        struct connection {
+            ca::write_queue queued;             // Waiting for the current send chain to finish
+            std::deque<pending_send> in_flight; // Kept alive until their completion arrives, the kernel reads from them
+            std::deque<ca::write_queue::piece> retry; // What a broken chain didn't manage to send, goes out first
+            std::optional<ca::write_queue::piece> held; // A file piece taken off the queue, next after the retries
+            bool receiving = false; // The multishot receive (or accept for listeners) is armed
+            bool polling = false;   // Waiting for the socket to become writable, to write the held file piece
+            size_t queued_bytes = 0; // Everything that hasn't been confirmed as sent
+            bool removed = false;
+            bool failed = false;     // Went over the send limit (or writing a file failed), reported as closed on the
+                                     // next wait
+        };
+
+        static constexpr unsigned ring_entries = 256;
+        static constexpr unsigned completion_entries = 4096;
+        static constexpr unsigned buffer_count = 256;        // Must be a power of two
+        static constexpr unsigned buffer_size = 16 * 1024;
+        static constexpr std::uint16_t buffer_group = 0;
+
+        /// Internal function: Maps the rings and registers the receive buffers
+        bool _setup();
+
+        /// Internal function: Checks that receiving into the buffer ring actually works
+        bool _probe();
+
+        /// Internal function: Gets a free submission entry, submitting the queue first if it's full (and reaping
+        /// completions until the kernel takes it)
+        io_uring_sqe *_next_sqe();
+
+        /// Internal function: How many submission entries can be taken before the queue has to be submitted
+        [[nodiscard]] size_t _free_sqes() const noexcept;
+
+        /// Internal function: Hands everything in the submission queue to the kernel, optionally waiting for completions.
+        /// Completions are reaped into _deferred when the kernel needs room for them before taking more
+        /// \return false if the ring failed, it's broken for good then (see #_break)
+        bool _enter(unsigned wait_for, std::chrono::milliseconds timeout);
+
+        /// Internal function: Gives up on the ring after it failed, every connection is reported closed on the next
+        /// wait and nothing is submitted anymore
+        void _break();
+
+        /// Internal function: Accounts for a completion of a socket that's being removed
+        /// \return false if it's for something else, it still has to be dispatched then
+        bool _settle(int fd, connection &connection, const completion &cqe);
+
+        /// Internal function: Takes the next completion off the completion queue
+        [[nodiscard]] std::optional<completion> _pop_completion();
+
+        /// Internal function: Handles a single completion
+        void _dispatch(const completion &cqe, const event_handler &handler);
+
+        /// Internal function: Arms the multishot receive for a socket
+        void _arm_receive(int fd);
+
+        /// Internal function: Arms the multishot accept for a listener
+        void _arm_accept(int fd);
+
+        /// Internal function: Submits the queued data for a socket as a linked chain of sends
+        void _submit_sends(int fd, connection &connection);
+
+        /// Internal function: Writes a piece of a file without going through the ring, or holds on to it and polls for
+        /// the socket to become writable if it's full
+        /// \return If it was written completely
+        bool _write_file(int fd, connection &connection, ca::write_queue::piece &piece);
+
+        /// Internal function: Applies the send limit after data has been queued on a socket
+        void _enforce_send_limit(connection &connection);
+
+        /// Internal function: Arms a read on the eventfd so #wake can interrupt a wait
+        void _arm_wake();
+
+        /// Internal function: Gives a receive buffer back to the kernel
+        void _recycle(std::uint16_t buffer_id);
+
+        void _handle_receive(const completion &cqe, const event_handler &handler);
+
+        void _handle_send(const completion &cqe, const event_handler &handler);
+
+        void _handle_accept(const completion &cqe, const event_handler &handler);
+
+        void _handle_writable(const completion &cqe);
+
+        [[nodiscard]] static std::uint64_t _user_data(operation op, int fd) noexcept {
+            return (std::uint64_t(op) << 32) | std::uint32_t(fd);
+        }
+
+        int _ring_fd = -1;
+
+        void *_sq_ring = nullptr; // Also holds the completion queue
+        size_t _sq_ring_size = 0;
+        io_uring_sqe *_sqes = nullptr;
+        size_t _sqes_size = 0;
+
+        unsigned *_sq_head = nullptr;
+        unsigned *_sq_tail = nullptr;
+        unsigned _sq_mask = 0;
+        unsigned _sq_entries = 0;
+        unsigned *_sq_array = nullptr;
+
+        unsigned *_cq_head = nullptr;
+        unsigned *_cq_tail = nullptr;
+        unsigned _cq_mask = 0;
+        io_uring_cqe *_cqes = nullptr;
+
+        std::deque<completion> _deferred; // Completions reaped outside #wait that still need to be dispatched
+        bool _broken = false;             // io_uring_enter failed with something other than running out of room
+
+        io_uring_buf_ring *_buffer_ring = nullptr;
+        size_t _buffer_ring_size = 0;
+        std::uint16_t _buffer_ring_tail = 0;
+        std::unique_ptr<std::byte[]> _buffers;
+
+        int _wake_fd = -1;
+        std::uint64_t _wake_value = 0;
+
+        std::unordered_map<int, connection> _connections;
+    };
+}
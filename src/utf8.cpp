@@ -0,0 +1,250 @@
+#include "utf8.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CA_UTF8_X86 1
+#endif
+
+namespace {
+    /// U+FFFD encoded as UTF-8
+    constexpr auto replacement_character = std::string_view("\xEF\xBF\xBD");
+
+    /// Checks the character at the start of data
+    /// \param skip Set to how many bytes the character (or the longest start of one that can't be finished) has,
+    /// always at least 1
+    /// \return The length of the character, 0 if it's invalid or a null byte
+    [[nodiscard]] size_t character(const unsigned char *data, size_t size, size_t &skip) noexcept {
+        const auto lead = data[0];
+        skip = 1;
+        if (lead < 0x80)
+            return lead != 0 ? 1 : 0;
+
+        // The second byte has a narrower range after some leads, that rules out overlong encodings, surrogates
+        // (U+D800 to U+DFFF) and anything past U+10FFFF
+        auto length = size_t(0);
+        auto low = std::uint8_t(0x80);
+        auto high = std::uint8_t(0xBF);
+        if (lead >= 0xC2 && lead <= 0xDF)
+            length = 2;
+        else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            low = lead == 0xE0 ? 0xA0 : low;
+            high = lead == 0xED ? 0x9F : high;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            low = lead == 0xF0 ? 0x90 : low;
+            high = lead == 0xF4 ? 0x8F : high;
+        } else
+            return 0;
+
+        for (auto i = size_t(1); i < length; i++) {
+            if (i >= size || data[i] < (i == 1 ? low : 0x80) || data[i] > (i == 1 ? high : 0xBF))
+                return 0;
+            skip = i + 1;
+        }
+        return length;
+    }
+
+    /// How many bytes from the start are ASCII (and not null), 16 at a time where it can
+    [[nodiscard]] size_t ascii_prefix(const unsigned char *data, size_t size) noexcept {
+        auto i = size_t(0);
+#ifdef CA_UTF8_X86
+        for (; i + 16 <= size; i += 16) {
+            const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            if (_mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, _mm_setzero_si128()))) != 0)
+                break;
+        }
+#endif
+        while (i < size && data[i] != 0 && data[i] < 0x80)
+            i++;
+        return i;
+    }
+
+    [[nodiscard]] bool valid_scalar(const unsigned char *data, size_t size) noexcept {
+        auto i = size_t(0);
+        while ((i += ascii_prefix(data + i, size - i)) < size) {
+            auto skip = size_t(0);
+            if (character(data + i, size - i, skip) == 0)
+                return false;
+            i += skip;
+        }
+        return true;
+    }
+
+#ifdef CA_UTF8_X86
+    // Error bits of the lookup tables, every one stands for a pair of bytes that can't follow each other. A pair is
+    // invalid if its bit is set in the entries of the first byte's high nibble, its low nibble and the second
+    // byte's high nibble
+    constexpr auto too_short = std::uint8_t(1 << 0);  // 11______ 0_______ or 11______ 11______
+    constexpr auto too_long = std::uint8_t(1 << 1);   // 0_______ 10______
+    constexpr auto overlong_3 = std::uint8_t(1 << 2); // 11100000 100_____
+    constexpr auto too_large = std::uint8_t(1 << 3);  // 11110100 1001____ and above
+    constexpr auto surrogate = std::uint8_t(1 << 4);  // 11101101 101_____
+    constexpr auto overlong_2 = std::uint8_t(1 << 5); // 1100000_ 10______
+    constexpr auto too_large_1000 = std::uint8_t(1 << 6); // 11110101 1000____ and above
+    constexpr auto overlong_4 = std::uint8_t(1 << 6);     // 11110000 1000____
+    constexpr auto two_continuations = std::uint8_t(1 << 7); // 10______ 10______
+    constexpr auto carry = std::uint8_t(too_short | too_long | two_continuations);
+
+    constexpr auto first_high_table = std::array<std::uint8_t, 16>{
+            too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+            two_continuations, two_continuations, two_continuations, two_continuations,
+            too_short | overlong_2,
+            too_short,
+            too_short | overlong_3 | surrogate,
+            too_short | too_large | too_large_1000 | overlong_4};
+
+    constexpr auto first_low_table = std::array<std::uint8_t, 16>{
+            carry | overlong_3 | overlong_2 | overlong_4,
+            carry | overlong_2,
+            carry,
+            carry,
+            carry | too_large,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000 | surrogate,
+            carry | too_large | too_large_1000,
+            carry | too_large | too_large_1000};
+
+    constexpr auto second_high_table = std::array<std::uint8_t, 16>{
+            too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+            too_long | overlong_2 | two_continuations | overlong_3 | too_large_1000 | overlong_4,
+            too_long | overlong_2 | two_continuations | overlong_3 | too_large,
+            too_long | overlong_2 | two_continuations | surrogate | too_large,
+            too_long | overlong_2 | two_continuations | surrogate | too_large,
+            too_short, too_short, too_short, too_short};
+
+    /// Validates 32 bytes at a time, carrying what's needed to check characters that span two blocks
+    class avx2_validator {
+    public:
+        __attribute__((target("avx2"))) avx2_validator() noexcept
+                : _error(_mm256_setzero_si256()), _previous(_mm256_setzero_si256()),
+                  _previous_incomplete(_mm256_setzero_si256()) {}
+
+        __attribute__((target("avx2"))) void check(__m256i input) noexcept {
+            // Null bytes aren't wanted either, they're ASCII so they need a check of their own
+            _error = _mm256_or_si256(_error, _mm256_cmpeq_epi8(input, _mm256_setzero_si256()));
+
+            if (_mm256_movemask_epi8(input) == 0) {
+                // Only ASCII, which can't finish a character the last block started
+                _error = _mm256_or_si256(_error, _previous_incomplete);
+                _previous_incomplete = _mm256_setzero_si256();
+            } else {
+                const auto previous1 = _previous_bytes<1>(input);
+                const auto special_cases = _special_cases(input, previous1);
+
+                // The bytes 2 or 3 after a 3 or 4 byte lead have to be continuations, and only those
+                const auto third = _mm256_subs_epu8(_previous_bytes<2>(input), _mm256_set1_epi8(0xE0 - 0x80));
+                const auto fourth = _mm256_subs_epu8(_previous_bytes<3>(input), _mm256_set1_epi8(0xF0 - 0x80));
+                const auto must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                                            _mm256_set1_epi8(static_cast<char>(0x80)));
+                _error = _mm256_or_si256(_error, _mm256_xor_si256(must_continue, special_cases));
+
+                // A lead in the last 3 bytes that needs more bytes than there are left
+                const auto max_value = _mm256_setr_epi8(
+                        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xF0 - 1),
+                        static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+                _previous_incomplete = _mm256_subs_epu8(input, max_value);
+            }
+            _previous = input;
+        }
+
+        /// \return If everything checked so far is valid, and doesn't end in the middle of a character
+        [[nodiscard]] __attribute__((target("avx2"))) bool valid() const noexcept {
+            const auto error = _mm256_or_si256(_error, _previous_incomplete);
+            return _mm256_testz_si256(error, error) != 0;
+        }
+
+    private:
+        /// Internal function: The input shifted by N bytes, the bytes from the end of the previous block moving in
+        template<int N>
+        [[nodiscard]] __attribute__((target("avx2"))) __m256i _previous_bytes(__m256i input) const noexcept {
+            return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(_previous, input, 0x21), 16 - N);
+        }
+
+        /// Internal function: Looks up every byte's nibble in a table of 16 entries
+        [[nodiscard]] __attribute__((target("avx2"))) static __m256i _lookup(const std::array<std::uint8_t, 16> &table,
+                                                                             __m256i nibbles) noexcept {
+            const auto entries = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table.data()));
+            return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(entries), nibbles);
+        }
+
+        /// Internal function: The errors of every pair of consecutive bytes
+        [[nodiscard]] __attribute__((target("avx2"))) static __m256i _special_cases(__m256i input,
+                                                                                    __m256i previous1) noexcept {
+            const auto nibble = _mm256_set1_epi8(0x0F);
+            const auto first_high = _lookup(first_high_table, _mm256_and_si256(_mm256_srli_epi16(previous1, 4), nibble));
+            const auto first_low = _lookup(first_low_table, _mm256_and_si256(previous1, nibble));
+            const auto second_high = _lookup(second_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+            return _mm256_and_si256(_mm256_and_si256(first_high, first_low), second_high);
+        }
+
+        __m256i _error;
+        __m256i _previous;
+        __m256i _previous_incomplete;
+    };
+
+    [[nodiscard]] __attribute__((target("avx2"))) bool valid_avx2(const unsigned char *data, size_t size) noexcept {
+        auto validator = avx2_validator();
+        auto i = size_t(0);
+        for (; i + 32 <= size; i += 32)
+            validator.check(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+
+        // The last block is padded with spaces, those are valid and can't finish a character either
+        if (i < size) {
+            auto block = std::array<unsigned char, 32>();
+            block.fill(' ');
+            std::memcpy(block.data(), data + i, size - i);
+            validator.check(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block.data())));
+        }
+        return validator.valid();
+    }
+#endif
+}
+
+bool ca::utf8::valid(std::string_view text) noexcept {
+    const auto data = reinterpret_cast<const unsigned char *>(text.data());
+#ifdef CA_UTF8_X86
+    static const auto avx2 = __builtin_cpu_supports("avx2") != 0;
+    if (avx2)
+        return valid_avx2(data, text.size());
+#endif
+    return valid_scalar(data, text.size());
+}
+
+bool ca::utf8::sanitize(std::string &text) {
+    if (valid(text))
+        return false;
+
+    const auto data = reinterpret_cast<const unsigned char *>(text.data());
+    auto repaired = std::string();
+    repaired.reserve(text.size() + replacement_character.size());
+
+    for (auto i = size_t(0); i < text.size();) {
+        const auto ascii = ascii_prefix(data + i, text.size() - i);
+        repaired.append(text, i, ascii);
+        if ((i += ascii) == text.size())
+            break;
+
+        auto skip = size_t(0);
+        if (character(data + i, text.size() - i, skip) != 0)
+            repaired.append(text, i, skip);
+        else
+            repaired.append(replacement_character);
+        i += skip;
+    }
+
+    text = std::move(repaired);
+    return true;
+}
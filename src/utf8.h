@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace ca::utf8 {
+    /// Checks that text is valid UTF-8 (no overlong encodings, surrogates or code points past U+10FFFF) without
+    /// null bytes, which would cut it short wherever it ends up as a C string. With AVX2 this runs 32 bytes at a time
+    /// using the lookup tables of Keiser and Lemire's validator, otherwise runs of ASCII are skipped 16 bytes at a time
+    /// and everything else is checked a character at a time
+    /// \param text The text to check
+    /// \return true if it's valid
+    [[nodiscard]] bool valid(std::string_view text) noexcept;
+
+    /// Makes text valid, every invalid sequence (the longest start of a character that can't be finished, or a
+    /// single byte) and null byte is replaced with U+FFFD, the replacement character. Valid text is left as it is
+    /// \param text The text to repair
+    /// \return true if anything had to be replaced
+    bool sanitize(std::string &text);
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace ca::wire {
+    /// Version of the wire format, both sides announce it in their hello packet and have to agree on it
+    constexpr auto protocol_version = std::uint32_t(9);
+
+    /// Timestamps are sent relative to this (2024-01-01 UTC), which keeps them at 4 bytes as a varint for years
+    constexpr auto epoch = std::int64_t(1704067200);
+
+    /// A 64 bit value never takes more than this many bytes as a varint
+    constexpr auto max_varint_size = size_t(10);
+
+    /// \return How many bytes a value takes up as a varint
+    [[nodiscard]] constexpr size_t varint_size(std::uint64_t value) noexcept {
+        auto size = size_t(1);
+        for (; value >= 0x80; value >>= 7)
+            size++;
+        return size;
+    }
+
+    /// \param seconds A timestamp, seconds since the unix epoch
+    /// \return The varint it's written as: relative to #epoch, zigzag encoded so a clock set before the epoch doesn't
+    /// turn into a 10 byte number
+    [[nodiscard]] constexpr std::uint64_t zigzag_timestamp(std::uint64_t seconds) noexcept {
+        const auto relative = static_cast<std::int64_t>(seconds) - epoch;
+        return (static_cast<std::uint64_t>(relative) << 1) ^ static_cast<std::uint64_t>(relative >> 63);
+    }
+
+    /// Writes a varint padded with continuation bytes that add nothing to exactly the size of the space it goes in.
+    /// Readers take it like any other varint, so a number can be filled in after what follows it has been written
+    /// \param space Where it goes, at most max_varint_size bytes
+    /// \param value The number
+    /// \return false if the number needs more space than that
+    [[nodiscard]] inline bool padded_varint(std::span<std::byte> space, std::uint64_t value) noexcept {
+        if (space.empty() || space.size() > max_varint_size || varint_size(value) > space.size())
+            return false;
+
+        for (auto i = size_t(0); i + 1 < space.size(); i++, value >>= 7)
+            space[i] = std::byte(std::uint8_t(value & 0x7F) | 0x80);
+        space.back() = std::byte(value);
+        return true;
+    }
+
+    /// Builds a packet, numbers are written as little endian base 128 varints (7 bits per byte, the top bit is set
+    /// on every byte but the last) so small numbers stay small and the format is the same on every platform
+    class writer {
+    public:
+        /// \param capacity How many bytes to reserve up front
+        explicit writer(size_t capacity = 0) { _data.reserve(capacity); }
+
+        void byte(std::uint8_t value) { _data.push_back(std::byte(value)); }
+
+        void varint(std::uint64_t value) {
+            for (; value >= 0x80; value >>= 7)
+                _data.push_back(std::byte(std::uint8_t(value) | 0x80));
+            _data.push_back(std::byte(value));
+        }
+
+        /// Writes a timestamp (seconds since the unix epoch) relative to ca::wire::epoch
+        void timestamp(std::uint64_t seconds) {
+            varint(zigzag_timestamp(seconds));
+        }
+
+        /// Writes a varint padded to a fixed size, see ca::wire::padded_varint
+        /// \param value The number
+        /// \param width How many bytes it takes up, at least varint_size(value)
+        void varint(std::uint64_t value, size_t width) {
+            const auto start = _data.size();
+            _data.resize(start + width);
+            (void) padded_varint(std::span(_data).subspan(start), value);
+        }
+
+        void bytes(std::span<const std::byte> data) { _data.insert(_data.end(), data.begin(), data.end()); }
+
+        /// \return The packet, the writer is empty afterwards
+        [[nodiscard]] std::vector<std::byte> take() noexcept { return std::move(_data); }
+
+    private:
+        std::vector<std::byte> _data;
+    };
+
+    /// Reads a packet written by ca::wire::writer from a buffer that might not hold all of it yet.
+    /// Every read returns an empty optional when there isn't enough data, check #malformed to tell that apart
+    /// from data that can never be read
+    class reader {
+    public:
+        explicit reader(std::span<const std::byte> data) : _data(data) {}
+
+        [[nodiscard]] std::optional<std::uint8_t> byte() {
+            if (_position >= _data.size())
+                return std::nullopt;
+            return std::uint8_t(_data[_position++]);
+        }
+
+        [[nodiscard]] std::optional<std::uint64_t> varint() {
+            auto value = std::uint64_t(0);
+            for (auto i = size_t(0); i < max_varint_size; i++) {
+                if (_position + i >= _data.size())
+                    return std::nullopt;
+
+                const auto byte = std::uint8_t(_data[_position + i]);
+                value |= std::uint64_t(byte & 0x7F) << (7 * i);
+                if (!(byte & 0x80)) {
+                    _position += i + 1;
+                    return value;
+                }
+            }
+
+            _malformed = true;
+            return std::nullopt;
+        }
+
+        /// Reads a timestamp written by ca::wire::writer::timestamp
+        /// \return Seconds since the unix epoch
+        [[nodiscard]] std::optional<std::uint64_t> timestamp() {
+            const auto value = varint();
+            if (!value)
+                return std::nullopt;
+
+            const auto relative = static_cast<std::int64_t>(*value >> 1) ^ -static_cast<std::int64_t>(*value & 1);
+            return static_cast<std::uint64_t>(relative + epoch);
+        }
+
+        /// \param count How many bytes to read
+        /// \return The bytes, only valid as long as the buffer the reader was created with
+        [[nodiscard]] std::optional<std::span<const std::byte>> bytes(size_t count) {
+            if (_data.size() - _position < count)
+                return std::nullopt;
+
+            const auto bytes = _data.subspan(_position, count);
+            _position += count;
+            return bytes;
+        }
+
+        /// \return How many bytes have been read
+        [[nodiscard]] size_t position() const noexcept { return _position; }
+
+        /// \return true if a varint was longer than any valid one can be
+        [[nodiscard]] bool malformed() const noexcept { return _malformed; }
+
+    private:
+        std::span<const std::byte> _data;
+        size_t _position = 0;
+        bool _malformed = false;
+    };
+}
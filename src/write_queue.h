@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include <io_backend.h>
+#include <packet.h>
+#include <shared_bytes.h>
+#include <shared_file.h>
+#include <trace.h>
+
+namespace ca {
+    /// Bytes waiting to be written to a non-blocking socket, in a queue per ca::send_priority. Buffers bigger than
+    /// packet::max_chunk_size (other than control ones, which have to be small) are cut into chunk packets as they're
+    /// written, and control packets can go between any two pieces. Only one buffer is being cut up at a time, the
+    /// other side can't tell the pieces of two of them apart. Files in the bulk queue are cut into file_data packets
+    /// the same way, those are whole packets so anything can go between them
+    class write_queue {
+    public:
+        enum class flush_result {
+            done,    // Everything has been written
+            blocked, // The kernel send buffer is full, try again once the socket is writable
+            failed   // The socket is broken
+        };
+
+        /// The most a piece's header can take up, for either kind of packet
+        static constexpr auto max_header_size = std::max(packet::max_chunk_header_size,
+                                                         packet::max_file_data_header_size);
+
+        /// What gets written in one go: a whole buffer, the header of a chunk packet and a piece of a buffer, or the
+        /// header of a file_data packet and a part of a file. The buffer can be shared with other sockets, so only the
+        /// offsets move, it's never modified
+        struct piece {
+            ca::shared_bytes bytes;                      // Either a buffer
+            std::shared_ptr<const ca::shared_file> file = nullptr; // or a file
+            size_t offset = 0; // The part of the buffer (or file) that's sent
+            size_t end = 0;
+            std::array<std::byte, max_header_size> header = {};
+            size_t header_size = 0;
+            size_t written = 0; // How much of the header and the part of the buffer has been written
+
+            [[nodiscard]] size_t size() const noexcept { return header_size + end - offset; }
+
+            /// \return How much of the part of the buffer hasn't been written, files don't count
+            [[nodiscard]] size_t unwritten() const noexcept {
+                return file ? 0 : end - offset - (written > header_size ? written - header_size : 0);
+            }
+
+            /// Points vectors at what hasn't been written yet, only the header for a file (the rest isn't in memory)
+            /// \param vectors Filled in from the start
+            /// \return How many of them are used
+            size_t remaining(std::array<iovec, 2> &vectors) const noexcept {
+                auto count = size_t(0);
+                if (written < header_size)
+                    vectors[count++] = {const_cast<std::byte *>(header.data()) + written, header_size - written};
+
+                const auto skipped = written > header_size ? written - header_size : 0;
+                if (!file)
+                    vectors[count++] = {const_cast<std::byte *>(bytes->data()) + offset + skipped,
+                                        end - offset - skipped};
+                return count;
+            }
+
+            /// Marks bytes as written
+            /// \param bytes How many more have been written
+            /// \return How many of them were from the buffer rather than the header (or a file)
+            size_t advance(size_t bytes) noexcept {
+                const auto before = std::max(written, header_size);
+                written += bytes;
+                return file ? 0 : std::max(written, header_size) - before;
+            }
+
+            /// Writes as much of what's left as the kernel takes without blocking, and marks it as written. A file's
+            /// data goes from the page cache straight into the socket
+            /// \param fd The socket
+            /// \return How many bytes were written, or -1 (with errno set) if none could be
+            ssize_t write(int fd) noexcept {
+                auto vectors = std::array<iovec, 2>();
+                auto message = msghdr();
+                message.msg_iov = vectors.data();
+                message.msg_iovlen = remaining(vectors);
+
+                auto total = ssize_t(0);
+                if (message.msg_iovlen > 0) {
+                    // A file's header is held back until its data is there to go in the same segment
+                    const auto sent = ::sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT | (file ? MSG_MORE : 0));
+                    if (sent <= 0)
+                        return sent;
+
+                    advance(static_cast<size_t>(sent));
+                    if (!file || written < header_size)
+                        return sent;
+                    total = sent;
+                }
+
+                const auto sent = _send_file(fd);
+                if (sent == 0)
+                    errno = EIO; // The file got shorter since it was opened
+                if (sent <= 0)
+                    return total > 0 ? total : -1;
+
+                advance(static_cast<size_t>(sent));
+                return total + sent;
+            }
+
+        private:
+            /// Internal function: Sends the part of the file that hasn't been written yet, after the header
+            /// \return What the syscall returned, 0 if the file ended early
+            ssize_t _send_file(int fd) const noexcept {
+                const auto position = offset + (written - header_size);
+#ifdef __linux__
+                auto file_offset = static_cast<off_t>(position);
+                return ::sendfile(fd, file->fd(), &file_offset, end - position);
+#else
+                // Through a buffer where there's no sendfile with the same semantics
+                auto buffer = std::array<std::byte, 16 * 1024>();
+                const auto read = ::pread(file->fd(), buffer.data(), std::min(buffer.size(), end - position),
+                                          static_cast<off_t>(position));
+                if (read <= 0)
+                    return read;
+                return ::send(fd, buffer.data(), static_cast<size_t>(read), MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+            }
+        };
+
+        /// \param bytes A whole packet
+        /// \param priority Which queue it goes into
+        void push(ca::shared_bytes bytes, ca::send_priority priority = ca::send_priority::normal) {
+            if (bytes->empty())
+                return;
+
+            const auto chunked = priority != ca::send_priority::control && bytes->size() > packet::max_chunk_size;
+            const auto droppable = priority != ca::send_priority::control && packet::droppable(*bytes);
+            _queued_bytes += bytes->size();
+            _queues[size_t(priority)].push_back({.bytes = std::move(bytes), .file = nullptr, .offset = 0,
+                                                 .chunked = chunked, .droppable = droppable});
+        }
+
+        /// \param transfer The transfer id the file_data packets are for
+        /// \param file The file, it's cut into file_data packets as it's written
+        /// \param offset Where in the file to start
+        void push_file(std::uint64_t transfer, std::shared_ptr<const ca::shared_file> file, size_t offset) {
+            if (offset >= file->size())
+                return;
+            _queues[size_t(ca::send_priority::bulk)].push_back({.bytes = nullptr, .file = std::move(file),
+                                                                .transfer = transfer, .offset = offset});
+        }
+
+        [[nodiscard]] bool empty() const noexcept {
+            return !_writing &&
+                   std::all_of(_queues.begin(), _queues.end(), [](const auto &queue) { return queue.empty(); });
+        }
+
+        /// \return How many bytes of the queued buffers haven't been written yet, not counting chunk headers (or files)
+        [[nodiscard]] size_t queued_bytes() const noexcept {
+            return _queued_bytes + (_writing ? _writing->unwritten() : 0);
+        }
+
+        /// Throws away whole chat messages and presence updates (see packet::droppable), lowest priority first and
+        /// oldest first within a priority, until no more than max_bytes are queued. Control packets and everything
+        /// else the other side's protocol state depends on always stay queued, so do packets that have been
+        /// partially written (dropping the rest of one would corrupt the stream) and files (they don't take up any
+        /// memory)
+        /// \param max_bytes How much can stay queued
+        void drop_oldest(size_t max_bytes) {
+            for (auto priority = size_t(ca::send_priority::bulk); priority-- > size_t(ca::send_priority::normal);) {
+                auto &queue = _queues[priority];
+                auto position = _chunking == priority ? size_t(1) : size_t(0);
+                while (queued_bytes() > max_bytes && position < queue.size()) {
+                    if (!queue[position].droppable) {
+                        position++;
+                        continue;
+                    }
+                    _queued_bytes -= queue[position].bytes->size();
+                    queue.erase(queue.begin() + static_cast<std::ptrdiff_t>(position));
+                }
+            }
+        }
+
+        /// Applies the send limit, should be called after queueing more data
+        /// \param limit The maximum queue size, and what to do when it's over it
+        /// \return false if the connection should be closed (backpressure_policy::disconnect)
+        [[nodiscard]] bool enforce(const ca::send_limit &limit) {
+            if (queued_bytes() <= limit.max_bytes)
+                return true;
+
+            switch (limit.policy) {
+                case backpressure_policy::block:
+                    return true; // Up to whoever is queueing the data to stop
+                case backpressure_policy::drop_oldest:
+                    drop_oldest(limit.max_bytes);
+                    return true;
+                case backpressure_policy::disconnect:
+                    clear();
+                    return false;
+            }
+            return true;
+        }
+
+        void clear() noexcept {
+            for (auto &queue : _queues)
+                queue.clear();
+            _chunking.reset();
+            _writing.reset();
+            _queued_bytes = 0;
+        }
+
+        /// Takes the next piece off the queues, for backends that write asynchronously and keep the piece alive until
+        /// it's been written. It isn't counted in #queued_bytes anymore
+        /// \return The piece, or an empty optional if nothing is queued
+        [[nodiscard]] std::optional<piece> take() {
+            // Control packets go first, then the rest of a buffer that's been cut up, and only then the next buffer
+            auto priority = std::optional<size_t>();
+            if (!_queues[size_t(ca::send_priority::control)].empty())
+                priority = size_t(ca::send_priority::control);
+            else if (_chunking)
+                priority = _chunking;
+            else
+                for (auto i = size_t(0); i < _queues.size() && !priority; i++)
+                    if (!_queues[i].empty())
+                        priority = i;
+
+            if (!priority)
+                return std::nullopt;
+
+            auto &queue = _queues[*priority];
+            auto &front = queue.front();
+            const auto size = front.file ? front.file->size() : front.bytes->size();
+
+            auto next = piece{.bytes = front.bytes, .file = front.file, .offset = front.offset, .end = size};
+            const auto header = std::span(next.header);
+            if (front.file) {
+                next.end = std::min(size, front.offset + packet::max_file_data_size);
+                next.header_size = packet::file_data_header(header.first<packet::max_file_data_header_size>(),
+                                                            front.transfer, next.offset, next.end - next.offset);
+            } else if (front.chunked) {
+                next.end = std::min(size, front.offset + packet::max_chunk_size);
+                next.header_size = packet::chunk_header(header.first<packet::max_chunk_header_size>(),
+                                                        next.end < size, next.end - next.offset);
+            }
+
+            if (!front.file)
+                _queued_bytes -= next.end - next.offset;
+            front.offset = next.end;
+
+            // The rest of a file can wait behind anything else, every file_data packet stands on its own
+            if (front.offset < size) {
+                if (!front.file)
+                    _chunking = priority;
+            } else {
+                queue.pop_front();
+                if (_chunking == priority)
+                    _chunking.reset();
+            }
+            return next;
+        }
+
+        /// Writes as much as the kernel will take without blocking
+        /// \param fd The socket to write to
+        /// \return If everything was written, if the socket would block, or if it failed
+        flush_result flush(int fd) {
+            while (_writing || (_writing = take())) {
+                auto written = ssize_t();
+                {
+                    const auto span = ca::trace::scope("socket_write", "net");
+                    written = _writing->write(fd);
+                }
+
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return flush_result::blocked;
+                    return flush_result::failed;
+                }
+
+                if (_writing->written == _writing->size())
+                    _writing.reset();
+            }
+            return flush_result::done;
+        }
+
+    private:
+        /// A buffer in one of the queues
+        struct entry {
+            ca::shared_bytes bytes;                      // Either a buffer
+            std::shared_ptr<const ca::shared_file> file; // or a file (only in the bulk queue)
+            std::uint64_t transfer = 0;                  // The transfer id of a file
+            size_t offset = 0; // How much of it has been taken off as pieces
+            bool chunked = false;
+            bool droppable = false; // See #drop_oldest
+        };
+
+        std::array<std::deque<entry>, 4> _queues; // Indexed by ca::send_priority
+        std::optional<size_t> _chunking;          // The queue whose front buffer has been partly taken off
+        std::optional<piece> _writing;            // Partly written by #flush
+        size_t _queued_bytes = 0;                 // Everything that hasn't been taken off as pieces, over all queues
+    };
+}